@@ -0,0 +1,421 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "apply.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <yajl/yajl_tree.h>
+
+#include "downtime.h"
+#include "monotonic.h"
+#include "reboot.h"
+#include "run.h"
+#include "wifi.h"
+#include "xsrf.h"
+
+/* the pending file is renamed to this while its changes are being applied */
+#define APPLY_CLAIMED_FILE "/tmp/sui-apply.applying"
+#define APPLY_PATH_LENGTH 64
+
+#define UBUS_PATH "/bin/ubus"
+#define WIFI_PATH "/sbin/wifi"
+#define DNSMASQ_INIT_PATH "/etc/init.d/dnsmasq"
+#define FW3_PATH "/sbin/fw3"
+#define DNSMASQ_COMM "dnsmasq"
+
+#define NETWORK_TIMEOUT_MS 30000
+#define WIFI_TIMEOUT_MS 30000
+#define DNSMASQ_TIMEOUT_MS 10000
+#define FIREWALL_TIMEOUT_MS 15000
+/* time for the deferred response to leave before the LAN address moves */
+#define DEFERRED_DELAY_SECONDS 2
+
+struct apply_rule {
+	const char* prefix;
+	/* if not NULL, the last part of the path has to be this as well */
+	const char* option;
+	unsigned int actions;
+};
+
+/* the first rule whose prefix matches a whole part of the path wins */
+static const struct apply_rule rules[] = {
+	{"network.lan", NULL, APPLY_NETWORK | APPLY_DNSMASQ_RELOAD | APPLY_MOVES_LAN},
+	{"network.wan.dns", NULL, APPLY_NETWORK | APPLY_DNSMASQ_FLUSH},
+	{"network", NULL, APPLY_NETWORK},
+	{"wireless", "ssid", APPLY_WIFI_CREDENTIALS},
+	{"wireless", "key", APPLY_WIFI_CREDENTIALS},
+	{"wireless", NULL, APPLY_WIFI},
+	{"dhcp", NULL, APPLY_DNSMASQ_RELOAD},
+	{"firewall", NULL, APPLY_FIREWALL},
+	/* bookkeeping for this interface only */
+	{"sui", NULL, 0},
+	{NULL, NULL, APPLY_REBOOT}
+};
+
+void apply_record(const char* path)
+{
+	FILE* pending;
+
+	if ((pending = fopen(APPLY_PENDING_FILE, "a")) == NULL) {
+		syslog(LOG_WARNING, "Unable to record change to %s; it will need a reboot", path);
+		return;
+	}
+	fprintf(pending, "%s\n", path);
+	fclose(pending);
+}
+
+unsigned int apply_plan_path(const char* path)
+{
+	const char* option = strrchr(path, '.');
+	size_t i;
+
+	option = (option == NULL) ? path : option + 1;
+	for (i = 0; rules[i].prefix != NULL; i++) {
+		size_t length = strlen(rules[i].prefix);
+		if (strncmp(path, rules[i].prefix, length) == 0 && (path[length] == '.' || path[length] == '\0')
+				&& (rules[i].option == NULL || strcmp(option, rules[i].option) == 0)) {
+			break;
+		}
+	}
+	return rules[i].actions;
+}
+
+static unsigned int plan_file(const char* file_path)
+{
+	char line[BUFSIZ];
+	unsigned int actions = 0;
+	FILE* file;
+
+	if ((file = fopen(file_path, "r")) == NULL) {
+		return 0;
+	}
+	while (fgets(line, BUFSIZ, file) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		if (line[0] != '\0') {
+			actions |= apply_plan_path(line);
+		}
+	}
+	fclose(file);
+	return actions;
+}
+
+unsigned int apply_plan()
+{
+	return plan_file(APPLY_CLAIMED_FILE) | plan_file(APPLY_PENDING_FILE);
+}
+
+/* moves the pending changes onto the end of the claimed ones, which an apply that failed may have left */
+static bool take_pending()
+{
+	char taken_path[APPLY_PATH_LENGTH];
+	char line[BUFSIZ];
+	FILE* taken;
+	FILE* claimed;
+	bool ok = true;
+
+	/* once renamed, nothing apply_record writes can end up in it */
+	snprintf(taken_path, APPLY_PATH_LENGTH, APPLY_CLAIMED_FILE ".%d", (int)getpid());
+	if (rename(APPLY_PENDING_FILE, taken_path) != 0) {
+		if (errno == ENOENT) {
+			return true;
+		}
+		syslog(LOG_ERR, "Unable to claim pending changes: %s", strerror(errno));
+		return false;
+	}
+	if ((taken = fopen(taken_path, "r")) == NULL) {
+		syslog(LOG_ERR, "Unable to read claimed changes: %s", strerror(errno));
+		unlink(taken_path);
+		return false;
+	}
+	if ((claimed = fopen(APPLY_CLAIMED_FILE, "a")) == NULL) {
+		syslog(LOG_ERR, "Unable to keep claimed changes: %s", strerror(errno));
+		fclose(taken);
+		unlink(taken_path);
+		return false;
+	}
+	while (fgets(line, BUFSIZ, taken) != NULL) {
+		ok = fputs(line, claimed) != EOF && ok;
+	}
+	fclose(taken);
+	ok = fclose(claimed) == 0 && ok;
+	unlink(taken_path);
+	if (!ok) {
+		syslog(LOG_ERR, "Unable to keep claimed changes");
+	}
+	return ok;
+}
+
+/* changes recorded from here on are left for the next apply */
+static unsigned int claim()
+{
+	unsigned int actions = 0;
+
+	if (!take_pending()) {
+		actions |= APPLY_REBOOT;
+	}
+	/* planned from what was claimed, so that whatever the plan covers is exactly what finish forgets */
+	return actions | plan_file(APPLY_CLAIMED_FILE);
+}
+
+static bool run_step(struct apply_result* result, const char* name, const char* const argv[], long timeout_ms)
+{
+	struct run_options options;
+	struct run_result outcome;
+	struct apply_step* step = &(result->steps[result->step_count++]);
+
+	memset(&options, 0x00, sizeof(struct run_options));
+	options.timeout_ms = timeout_ms;
+	step->name = name;
+	step->ok = run(argv, &options, &outcome);
+	step->elapsed_ms = outcome.elapsed_ms;
+	if (!step->ok) {
+		syslog(LOG_ERR, "Unable to %s (status %d, signal %d%s)", name,
+				outcome.status, outcome.signal, outcome.timed_out ? ", timed out" : "");
+	}
+	return step->ok;
+}
+
+/* SIGHUP makes dnsmasq drop its cache and reread its upstream servers */
+static bool flush_dnsmasq(struct apply_result* result)
+{
+	struct apply_step* step = &(result->steps[result->step_count++]);
+	struct dirent* entry;
+	DIR* proc;
+
+	step->name = "flush_dns_cache";
+	step->ok = false;
+	step->elapsed_ms = 0;
+	if ((proc = opendir("/proc")) == NULL) {
+		syslog(LOG_ERR, "Unable to open /proc: %s", strerror(errno));
+		return false;
+	}
+	while ((entry = readdir(proc)) != NULL) {
+		char comm_path[BUFSIZ];
+		char comm[BUFSIZ];
+		FILE* comm_file;
+		if (!isdigit((unsigned char)entry->d_name[0])) {
+			continue;
+		}
+		snprintf(comm_path, BUFSIZ, "/proc/%s/comm", entry->d_name);
+		if ((comm_file = fopen(comm_path, "r")) == NULL) {
+			continue;
+		}
+		if (fgets(comm, BUFSIZ, comm_file) != NULL) {
+			comm[strcspn(comm, "\n")] = '\0';
+			if (strcmp(comm, DNSMASQ_COMM) == 0 && kill((pid_t)atol(entry->d_name), SIGHUP) == 0) {
+				step->ok = true;
+			}
+		}
+		fclose(comm_file);
+	}
+	closedir(proc);
+
+	if (!step->ok) {
+		syslog(LOG_ERR, "Unable to find dnsmasq to flush its cache");
+	}
+	return step->ok;
+}
+
+static bool update_wifi(struct apply_result* result)
+{
+	struct apply_step* step = &(result->steps[result->step_count++]);
+	long started = monotonic_ms();
+
+	step->name = "update_wifi";
+	step->ok = wifi_apply_live();
+	step->elapsed_ms = monotonic_ms() - started;
+	return step->ok;
+}
+
+/* runs the steps for actions in dependency order, stopping at the first failure */
+static void run_steps(unsigned int actions, struct apply_result* result)
+{
+	const char* network_argv[] = {UBUS_PATH, "call", "network", "reload", NULL};
+	const char* wifi_argv[] = {WIFI_PATH, "reload", NULL};
+	const char* dnsmasq_argv[] = {DNSMASQ_INIT_PATH, "reload", NULL};
+	/* fw3 reloads every rule, there being no way to reload just one */
+	const char* firewall_argv[] = {FW3_PATH, "reload", NULL};
+	bool ok = true;
+
+	if (ok && (actions & APPLY_NETWORK) != 0) {
+		ok = run_step(result, "reload_network", network_argv, NETWORK_TIMEOUT_MS);
+	}
+	/* a radio that did not take its new credentials is reloaded with the rest */
+	if (ok && ((actions & APPLY_WIFI) != 0
+			|| ((actions & APPLY_WIFI_CREDENTIALS) != 0 && !update_wifi(result)))) {
+		ok = run_step(result, "reload_wifi", wifi_argv, WIFI_TIMEOUT_MS);
+	}
+	if (ok && (actions & APPLY_DNSMASQ_RELOAD) != 0) {
+		ok = run_step(result, "reload_dnsmasq", dnsmasq_argv, DNSMASQ_TIMEOUT_MS);
+	} else if (ok && (actions & APPLY_DNSMASQ_FLUSH) != 0) {
+		ok = flush_dnsmasq(result);
+	}
+	if (ok && (actions & APPLY_FIREWALL) != 0) {
+		ok = run_step(result, "reload_firewall", firewall_argv, FIREWALL_TIMEOUT_MS);
+	}
+
+	result->reboot_needed = !ok;
+}
+
+/* returns false only if a reboot was needed and could not be started */
+static bool finish(const struct apply_result* result)
+{
+	size_t i;
+
+	for (i = 0; i < result->step_count; i++) {
+		syslog(result->steps[i].ok ? LOG_INFO : LOG_ERR, "Apply step %s %s in %ld ms",
+				result->steps[i].name, result->steps[i].ok ? "succeeded" : "failed", result->steps[i].elapsed_ms);
+	}
+	if (result->reboot_needed && !reboot_start()) {
+		syslog(LOG_ERR, "Unable to reboot to apply changes");
+		return false;
+	}
+	/* a reboot picks up everything that was claimed */
+	unlink(APPLY_CLAIMED_FILE);
+	return true;
+}
+
+bool apply_pending(struct apply_result* result)
+{
+	memset(result, 0x00, sizeof(struct apply_result));
+	result->actions = claim();
+	if ((result->actions & APPLY_REBOOT) != 0) {
+		result->reboot_needed = true;
+	} else {
+		run_steps(result->actions, result);
+	}
+	return finish(result);
+}
+
+/*
+ * Applies in a grandchild of its own, for changes that would cut the browser
+ * off before it heard back. The grandchild never returns and never touches
+ * stdio, which still belongs to the parent; init reaps it.
+ */
+static bool apply_deferred(unsigned int actions)
+{
+	int child_status = 0;
+	pid_t pid;
+
+	fflush(stdout);
+	if ((pid = fork()) == -1) {
+		syslog(LOG_ERR, "Unable to fork to apply changes: %s", strerror(errno));
+		return false;
+	} else if (pid == 0) {
+		struct apply_result result;
+		int null_fd;
+		if ((pid = fork()) != 0) {
+			_exit((pid == -1) ? EXIT_FAILURE : EXIT_SUCCESS);
+		}
+		setsid();
+		if ((null_fd = open("/dev/null", O_RDWR)) != -1) {
+			dup2(null_fd, STDIN_FILENO);
+			dup2(null_fd, STDOUT_FILENO);
+			dup2(null_fd, STDERR_FILENO);
+			if (null_fd > STDERR_FILENO) {
+				close(null_fd);
+			}
+		}
+		sleep(DEFERRED_DELAY_SECONDS);
+		memset(&result, 0x00, sizeof(struct apply_result));
+		result.actions = actions;
+		run_steps(actions, &result);
+		finish(&result);
+		_exit(result.reboot_needed ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	while (waitpid(pid, &child_status, 0) == -1 && errno == EINTR) {
+	}
+	if (!WIFEXITED(child_status) || WEXITSTATUS(child_status) != EXIT_SUCCESS) {
+		syslog(LOG_ERR, "Unable to fork to apply changes");
+		return false;
+	}
+	return true;
+}
+
+void post_apply(yajl_val top, struct xsrft* token)
+{
+	struct apply_result result;
+	bool ok;
+	size_t i;
+
+	/* the same check a reboot would make, so that applying is no less safe */
+	reboot_avoid_wan_subnet();
+
+	if ((apply_plan() & (APPLY_MOVES_LAN | APPLY_REBOOT)) == APPLY_MOVES_LAN) {
+		unsigned int actions = claim();
+		if ((actions & APPLY_REBOOT) == 0) {
+			if (!apply_deferred(actions)) {
+				printf("Status: 500 Internal Server Error\n");
+				printf("Content-type: application/json\n\n");
+				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to apply changes.\"]}", token->val);
+				return;
+			}
+			printf("Status: 202 Accepted\n");
+			printf("Content-type: application/json\n\n");
+			printf("{\"xsrf\":\"%s\",\"deferred\":true,\"steps\":[],\"rebooting\":false}", token->val);
+			fflush(stdout);
+			return;
+		}
+		/* something else turned up in the meantime, so it is a reboot after all */
+		memset(&result, 0x00, sizeof(struct apply_result));
+		result.actions = actions;
+		result.reboot_needed = true;
+		ok = finish(&result);
+	} else {
+		ok = apply_pending(&result);
+	}
+	if (!ok) {
+		printf("Status: 500 Internal Server Error\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"xsrf\":\"%s\",\"rebooting\":false,\"errors\":[\"Unable to reboot system.\"]}", token->val);
+		return;
+	}
+
+	printf("Status: 200 OK\n");
+	printf("Content-type: application/json\n\n");
+	printf("{\"xsrf\":\"%s\",\"deferred\":false,\"steps\":[", token->val);
+	for (i = 0; i < result.step_count; i++) {
+		printf("%s{\"name\":\"%s\",\"ok\":%s,\"elapsed_ms\":%ld}", (i == 0) ? "" : ",",
+				result.steps[i].name, result.steps[i].ok ? "true" : "false", result.steps[i].elapsed_ms);
+	}
+	if (result.reboot_needed) {
+		/* the same estimate ?reboot gives, so the page knows how long to wait */
+		printf("],\"rebooting\":true,\"estimate_ms\":%ld}", downtime_estimate_ms());
+	} else {
+		printf("],\"rebooting\":false}");
+	}
+}
@@ -0,0 +1,83 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_APPLY_H
+#define WIOMW_SUI_APPLY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <yajl/yajl_tree.h>
+
+#include "xsrf.h"
+
+/* UCI paths that have changed since the last apply, one per line */
+#define APPLY_PENDING_FILE "/tmp/sui-apply.pending"
+#define APPLY_MAX_STEPS 8
+
+enum apply_action {
+	APPLY_NETWORK = 1 << 0,
+	APPLY_WIFI = 1 << 1,
+	/* an SSID or PSK, which hostapd can take without the radio restarting */
+	APPLY_WIFI_CREDENTIALS = 1 << 2,
+	APPLY_DNSMASQ_RELOAD = 1 << 3,
+	/* new upstream nameservers only need dnsmasq to forget what it cached */
+	APPLY_DNSMASQ_FLUSH = 1 << 4,
+	APPLY_FIREWALL = 1 << 5,
+	/* something changed that no step knows how to apply */
+	APPLY_REBOOT = 1 << 6,
+	/* the router's own address moves, so the answer has to go out first */
+	APPLY_MOVES_LAN = 1 << 7
+};
+
+struct apply_step {
+	const char* name;
+	bool ok;
+	long elapsed_ms;
+};
+
+struct apply_result {
+	unsigned int actions;
+	struct apply_step steps[APPLY_MAX_STEPS];
+	size_t step_count;
+	bool reboot_needed;
+};
+
+/* called by uci_txn for every path it really changed */
+void apply_record(const char* path);
+
+/* the actions a change to path calls for */
+unsigned int apply_plan_path(const char* path);
+
+/* reads APPLY_PENDING_FILE without consuming it */
+unsigned int apply_plan();
+
+/*
+ * Claims the pending changes and runs the steps they call for, stopping at
+ * the first one that fails. If a step failed or a change has no step of its
+ * own, reboot_needed is set and a reboot started; false means it could not
+ * be.
+ */
+bool apply_pending(struct apply_result* result);
+
+void post_apply(yajl_val top, struct xsrft* token);
+
+#endif
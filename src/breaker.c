@@ -0,0 +1,256 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "breaker.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "monotonic.h"
+
+#define BREAKER_MAGIC 0x42524B31
+
+struct breaker_slot {
+	char name[BREAKER_NAME_LENGTH];
+	uint32_t state;
+	uint32_t failures;
+	uint32_t trips;
+	uint32_t cooldown_ms;
+	/* CLOCK_MONOTONIC, which every process shares and which starts over with the file at boot */
+	int64_t last_failure_ms;
+	int64_t opened_ms;
+	int64_t probe_ms;
+};
+
+struct breaker_table {
+	uint32_t magic;
+	struct breaker_slot slots[BREAKER_SLOTS];
+};
+
+/* kept mapped for the life of the process so FastCGI only pays for it once */
+static struct breaker_table* table = NULL;
+static int table_fd = -1;
+
+/* returns the locked table, or NULL if there is none to be had */
+static struct breaker_table* lock_table()
+{
+	struct stat table_stat;
+	void* mapped;
+
+	if (table == NULL) {
+		if (table_fd == -1 && (table_fd = open(BREAKER_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1) {
+			return NULL;
+		}
+		if (flock(table_fd, LOCK_EX) == -1) {
+			return NULL;
+		}
+		/* whoever comes first sizes the file, and a zero magic then marks it as blank */
+		if (fstat(table_fd, &table_stat) == -1
+				|| (table_stat.st_size < (off_t)sizeof(struct breaker_table)
+					&& ftruncate(table_fd, sizeof(struct breaker_table)) == -1)
+				|| (mapped = mmap(NULL, sizeof(struct breaker_table), PROT_READ | PROT_WRITE, MAP_SHARED, table_fd, 0)) == MAP_FAILED) {
+			flock(table_fd, LOCK_UN);
+			return NULL;
+		}
+		table = (struct breaker_table*)mapped;
+		if (table->magic != BREAKER_MAGIC) {
+			memset(table, 0x00, sizeof(struct breaker_table));
+			table->magic = BREAKER_MAGIC;
+		}
+		return table;
+	}
+
+	return (flock(table_fd, LOCK_EX) == 0) ? table : NULL;
+}
+
+static void unlock_table()
+{
+	flock(table_fd, LOCK_UN);
+}
+
+/* finds the slot for endpoint, claiming a free one if it has none yet */
+static struct breaker_slot* find_slot(struct breaker_table* locked, const char* endpoint)
+{
+	struct breaker_slot* empty = NULL;
+	size_t i;
+
+	for (i = 0; i < BREAKER_SLOTS; i++) {
+		if (locked->slots[i].name[0] == '\0') {
+			if (empty == NULL) {
+				empty = &(locked->slots[i]);
+			}
+		} else if (strncmp(locked->slots[i].name, endpoint, BREAKER_NAME_LENGTH - 1) == 0) {
+			return &(locked->slots[i]);
+		}
+	}
+
+	if (empty != NULL) {
+		memset(empty, 0x00, sizeof(struct breaker_slot));
+		strncpy(empty->name, endpoint, BREAKER_NAME_LENGTH - 1);
+		empty->cooldown_ms = BREAKER_COOLDOWN_MS;
+	}
+	return empty;
+}
+
+static void open_breaker(struct breaker_slot* slot, long long now)
+{
+	slot->state = BREAKER_OPEN;
+	slot->opened_ms = now;
+	slot->trips++;
+	syslog(LOG_WARNING, "Calls to %s failed %u times in a row, failing fast for %u seconds",
+			slot->name, slot->failures, slot->cooldown_ms / 1000);
+}
+
+bool breaker_allow(const char* endpoint, long* retry_after_ms)
+{
+	struct breaker_table* locked;
+	struct breaker_slot* slot;
+	long long now = monotonic_ms();
+	bool allowed = true;
+
+	*retry_after_ms = 0;
+	if ((locked = lock_table()) == NULL) {
+		return true;
+	}
+	if ((slot = find_slot(locked, endpoint)) == NULL) {
+		/* more endpoints than slots; the ones left over just go unprotected */
+		unlock_table();
+		return true;
+	}
+
+	switch (slot->state) {
+	case BREAKER_OPEN:
+		if (now - slot->opened_ms < slot->cooldown_ms) {
+			*retry_after_ms = slot->cooldown_ms - (now - slot->opened_ms);
+			allowed = false;
+		} else {
+			slot->state = BREAKER_HALF_OPEN;
+			slot->probe_ms = now;
+		}
+		break;
+	case BREAKER_HALF_OPEN:
+		if (now - slot->probe_ms < BREAKER_PROBE_LEASE_MS) {
+			*retry_after_ms = BREAKER_PROBE_RETRY_MS;
+			allowed = false;
+		} else {
+			/* the last probe never reported back, so this caller takes over */
+			slot->probe_ms = now;
+		}
+		break;
+	default:
+		break;
+	}
+
+	unlock_table();
+	return allowed;
+}
+
+void breaker_record(const char* endpoint, bool ok)
+{
+	struct breaker_table* locked;
+	struct breaker_slot* slot;
+	long long now = monotonic_ms();
+
+	if ((locked = lock_table()) == NULL) {
+		return;
+	}
+	if ((slot = find_slot(locked, endpoint)) == NULL) {
+		unlock_table();
+		return;
+	}
+
+	if (ok) {
+		if (slot->state != BREAKER_CLOSED) {
+			syslog(LOG_NOTICE, "Calls to %s are answered again", slot->name);
+		}
+		slot->state = BREAKER_CLOSED;
+		slot->failures = 0;
+		slot->cooldown_ms = BREAKER_COOLDOWN_MS;
+	} else {
+		slot->failures++;
+		slot->last_failure_ms = now;
+		if (slot->state == BREAKER_HALF_OPEN) {
+			slot->cooldown_ms = (slot->cooldown_ms * 2 < BREAKER_MAX_COOLDOWN_MS) ? slot->cooldown_ms * 2 : BREAKER_MAX_COOLDOWN_MS;
+			open_breaker(slot, now);
+		} else if (slot->state == BREAKER_CLOSED && slot->failures >= BREAKER_THRESHOLD) {
+			open_breaker(slot, now);
+		}
+		/* a straggler that failed while the breaker was already open changes nothing else */
+	}
+
+	unlock_table();
+}
+
+void breaker_print()
+{
+	struct breaker_table* locked;
+	long long now = monotonic_ms();
+	bool first = true;
+	size_t i;
+
+	printf("[");
+	if ((locked = lock_table()) == NULL) {
+		printf("]");
+		return;
+	}
+	for (i = 0; i < BREAKER_SLOTS; i++) {
+		const struct breaker_slot* slot = &(locked->slots[i]);
+		long long retry_after = 0;
+		if (slot->name[0] == '\0') {
+			continue;
+		}
+		if (slot->state == BREAKER_OPEN && now - slot->opened_ms < slot->cooldown_ms) {
+			retry_after = slot->cooldown_ms - (now - slot->opened_ms);
+		}
+		printf("%s{\"endpoint\":\"%s\",\"state\":\"%s\",\"failures\":%u,\"trips\":%u,\"retry_after_ms\":%lld",
+				first ? "" : ",", slot->name, breaker_state_name(slot->state), slot->failures, slot->trips, retry_after);
+		if (slot->last_failure_ms != 0) {
+			printf(",\"last_failure_ms_ago\":%lld", now - slot->last_failure_ms);
+		}
+		printf("}");
+		first = false;
+	}
+	unlock_table();
+	printf("]");
+}
+
+const char* breaker_state_name(enum breaker_state state)
+{
+	switch (state) {
+	case BREAKER_OPEN:
+		return "open";
+	case BREAKER_HALF_OPEN:
+		return "half-open";
+	default:
+		return "closed";
+	}
+}
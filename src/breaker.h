@@ -0,0 +1,74 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_BREAKER_H
+#define WIOMW_SUI_BREAKER_H
+
+#include <stdbool.h>
+
+/* mapped by every process, so all of them see the same breakers; the tests map their own */
+#ifndef BREAKER_PATH
+#define BREAKER_PATH "/tmp/sui-breaker"
+#endif
+#define BREAKER_SLOTS 8
+#define BREAKER_NAME_LENGTH 16
+
+/* consecutive failures that open a breaker */
+#define BREAKER_THRESHOLD 3
+/* doubled every time a half-open probe fails; the tests shorten these */
+#ifndef BREAKER_COOLDOWN_MS
+#define BREAKER_COOLDOWN_MS 30000
+#endif
+#ifndef BREAKER_MAX_COOLDOWN_MS
+#define BREAKER_MAX_COOLDOWN_MS 300000
+#endif
+/* a probe that has not reported back by then is presumed dead */
+#ifndef BREAKER_PROBE_LEASE_MS
+#define BREAKER_PROBE_LEASE_MS 60000
+#endif
+/* what callers are told while someone else is probing */
+#define BREAKER_PROBE_RETRY_MS 5000
+
+enum breaker_state {
+	BREAKER_CLOSED = 0,
+	BREAKER_OPEN,
+	BREAKER_HALF_OPEN
+};
+
+/*
+ * False if calls to endpoint should fail fast, in which case retry_after_ms
+ * says when it is worth trying again. Once the cooldown is over exactly one
+ * caller is let through as a probe, and whatever it passes to breaker_record
+ * closes the breaker or opens it again. If the breakers cannot be mapped
+ * every call is allowed.
+ */
+bool breaker_allow(const char* endpoint, long* retry_after_ms);
+
+/* ok is whether the endpoint answered; an answer refusing the request still counts */
+void breaker_record(const char* endpoint, bool ok);
+
+/* prints every breaker as a JSON array */
+void breaker_print();
+
+const char* breaker_state_name(enum breaker_state state);
+
+#endif
@@ -23,104 +23,100 @@
 #include <config.h>
 #include "check.h"
 
-#include <ctype.h>
 #include <stdbool.h>
 #include <stdio.h>
-#include <string.h>
 #include <syslog.h>
-#include <curl/curl.h>
-#include <yajl/yajl_tree.h>
+#include "downtime.h"
+#include "probe.h"
 #include "reboot.h"
-#include "syslog_syserror.h"
+#include "recover.h"
+#include "single_flight.h"
 #include "xsrf.h"
 #include "xsrfc.h"
 
-#define CA_FILE "/etc/ssl/certs/f081611a.0"
-#define CHECK_URL "https://www.whoisonmywifi.net/easteregg.txt"
-#define CHECK_CABLE_COMMAND "cat /sys/class/net/`uci -q get network.wan.ifname`/carrier"
+#define CHECK_BUDGET_MS 8000
+#define CHECK_FLIGHT_KEY "check"
+/* a little longer than the probes themselves are allowed */
+#define CHECK_FLIGHT_WAIT_MS (CHECK_BUDGET_MS + 2000)
 
-size_t identity_cb(char* ptr, size_t size, size_t nmemb, void* userdata)
+/* checks made at the same time share one set of probes */
+static bool shared_probe(struct probe_result* result)
 {
-	return size * nmemb;
+	struct single_flight flight;
+	size_t length = 0;
+	bool ok;
+
+	switch (single_flight_begin(&flight, CHECK_FLIGHT_KEY, CHECK_FLIGHT_WAIT_MS, result, sizeof(struct probe_result), &length)) {
+	case SINGLE_FLIGHT_FOLLOWER:
+		if (length == sizeof(struct probe_result)) {
+			return true;
+		}
+		return probe_run(result, CHECK_BUDGET_MS);
+	case SINGLE_FLIGHT_LEADER:
+		if ((ok = probe_run(result, CHECK_BUDGET_MS))) {
+			single_flight_publish(&flight, result, sizeof(struct probe_result));
+		} else {
+			single_flight_end(&flight);
+		}
+		return ok;
+	default:
+		return probe_run(result, CHECK_BUDGET_MS);
+	}
 }
 
 static bool go_check(bool suppress)
 {
-	CURL* curl_handle = curl_easy_init();
-	char error_buffer[BUFSIZ];
-	long http_code = 0;
-
-	curl_easy_setopt(curl_handle, CURLOPT_URL, CHECK_URL);
-	curl_easy_setopt(curl_handle, CURLOPT_CAINFO, CA_FILE);
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, &identity_cb);
-	curl_easy_setopt(curl_handle, CURLOPT_ERRORBUFFER, error_buffer);
+	struct probe_result result;
 
-	if (curl_easy_perform(curl_handle) == 0 && curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &http_code) == 0) {
-		if (http_code >= 400) {
-			curl_easy_cleanup(curl_handle);
-			syslog(LOG_ERR, "Unable to check internet connection: Got unexpected HTTP code from server: %ld", http_code);
-			if (!suppress) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"errors\":[\"Unable to check connection to the internet.\"]}");
-			}
-			return false;
-		} else {
-			curl_easy_cleanup(curl_handle);
-			if (!suppress) {
-				printf("Status: 200 OK\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"connected\":true,\"cable_connected\":true}");
-			}
-			return true;
+	if (!shared_probe(&result)) {
+		if (!suppress) {
+			printf("Status: 500 Internal Server Error\n");
+			printf("Content-type: application/json\n\n");
+			printf("{\"errors\":[\"Unable to check connection to the internet.\"]}");
 		}
-	} else {
-		FILE* command_output = popen(CHECK_CABLE_COMMAND, "r");
-		char c = '\0';
-		if (command_output == NULL) {
-			curl_easy_cleanup(curl_handle);
-			if (!suppress) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"errors\":[\"Unable to check connection to the internet.\"]}");
-			}
-			return false;
-		} else if ((c = fgetc(command_output)) == '0') {
-			curl_easy_cleanup(curl_handle);
-			if (!suppress) {
-				printf("Status: 404 Not Found\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"errors\":[\"WAN ethernet cable is not connected.\"], \"connected\":false,\"cable_connected\":false}");
-			}
-			return false;
-		} else if (c == '1') {
-			syslog(LOG_ERR, "Unable to connect to internet: %s", error_buffer);
-			curl_easy_cleanup(curl_handle);
-			/* curl failure (probably network failure) */
-			if (!suppress) {
-				printf("Status: 404 Not Found\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"errors\":[\"Unable to connect to the internet.\"], \"connected\":false,\"cable_connected\":true}");
-			}
-			return false;
-		} else {
-			if (c == EOF) {
-				syslog_syserror(LOG_ERR, "Unable to connect to internet: Unexpected response from cable check: Read error");
-			} else {
-				error_buffer[0] = c;
-				fgets(error_buffer, BUFSIZ, command_output);
-				syslog(LOG_ERR, "Unable to connect to internet: Unexpected response from cable check: %s", error_buffer);
+		return false;
+	} else if (result.failed_layer == PROBE_LAYER_NONE) {
+		if (!suppress) {
+			printf("Status: 200 OK\n");
+			printf("Content-type: application/json\n\n");
+			printf("{\"connected\":true,\"cable_connected\":true,\"elapsed_ms\":%ld}", result.elapsed_ms);
+		}
+		return true;
+	} else if (result.failed_layer == PROBE_LAYER_HTTPS && result.http_code >= 400) {
+		syslog(LOG_ERR, "Unable to check internet connection: Got unexpected HTTP code from server: %ld", result.http_code);
+		if (!suppress) {
+			printf("Status: 500 Internal Server Error\n");
+			printf("Content-type: application/json\n\n");
+			printf("{\"errors\":[\"Unable to check connection to the internet.\"]}");
+		}
+		return false;
+	}
 
-			}
-			curl_easy_cleanup(curl_handle);
-			if (!suppress) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"errors\":[\"Unable to check connection to the internet.\"]}");
-			}
-			return false;
+	if (result.failed_layer != PROBE_LAYER_CABLE) {
+		syslog(LOG_ERR, "Unable to connect to internet (%s layer failed): %s", probe_layer_name(result.failed_layer), result.error);
+	}
+	if (!suppress) {
+		const char* message = NULL;
+		switch (result.failed_layer) {
+		case PROBE_LAYER_CABLE:
+			message = "WAN ethernet cable is not connected.";
+			break;
+		case PROBE_LAYER_GATEWAY:
+			message = "Unable to reach the WAN gateway.";
+			break;
+		case PROBE_LAYER_DNS:
+			message = "Unable to look up names on the internet.";
+			break;
+		default:
+			message = "Unable to connect to the internet.";
+			break;
 		}
+		printf("Status: 404 Not Found\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"errors\":[\"%s\"], \"connected\":false,\"cable_connected\":%s,\"failed_layer\":\"%s\"", message, (result.failed_layer == PROBE_LAYER_CABLE) ? "false" : "true", probe_layer_name(result.failed_layer));
+		printf(",\"probes\":{\"cable\":\"%s\",\"gateway\":\"%s\",\"dns\":\"%s\",\"https\":\"%s\"},\"elapsed_ms\":%ld}", probe_status_name(result.cable), probe_status_name(result.gateway), probe_status_name(result.dns), probe_status_name(result.https), result.elapsed_ms);
 	}
+	return false;
 }
 
 void get_check()
@@ -128,11 +124,59 @@ void get_check()
 	go_check(false);
 }
 
+static void print_attempts(const struct recover_result* result)
+{
+	size_t i;
+
+	printf(",\"steps\":[");
+	for (i = 0; i < result->attempt_count; i++) {
+		printf("%s{\"name\":\"%s\",\"ok\":%s,\"connected\":%s,\"elapsed_ms\":%ld}", (i == 0) ? "" : ",",
+				recover_step_name(result->attempts[i].step), result->attempts[i].ok ? "true" : "false",
+				result->attempts[i].connected ? "true" : "false", result->attempts[i].elapsed_ms);
+	}
+	printf("]}");
+}
+
+/* tries everything short of a reboot before rebooting */
+static void recover()
+{
+	struct recover_result result;
+
+	if (recover_run(&result)) {
+		printf("Status: 200 OK\n");
+		printf("Content-type: application/json\n\n");
+		if (result.rebooting) {
+			printf("{\"rebooting\":true,\"estimate_ms\":%ld,\"recovered\":false", downtime_estimate_ms());
+		} else {
+			printf("{\"rebooting\":false,\"recovered\":true,\"restored_by\":\"%s\"", recover_step_name(result.restored_by));
+		}
+		print_attempts(&result);
+	} else if (result.busy) {
+		printf("Status: 503 Service Unavailable\n");
+		printf("Retry-After: 30\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"rebooting\":false,\"errors\":[\"The router is already trying to restore the connection.\"]}");
+	} else if (result.reboot_suppressed) {
+		printf("Status: 503 Service Unavailable\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"rebooting\":false,\"recovered\":false,\"errors\":[\"The router has already rebooted %u times in the last hour without restoring the connection.\"]", result.recent_reboots);
+		print_attempts(&result);
+	} else {
+		printf("Status: 500 Internal Server Error\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"rebooting\":false,\"recovered\":false,\"errors\":[\"Unable to reboot system.\"]");
+		print_attempts(&result);
+	}
+}
+
 void get_check_reboot()
 {
 	struct xsrft token;
 	token.val[0] = (char)0x00;
-	if (!go_check(true) || xsrfc(&token) <= 0) {
+	if (!go_check(true)) {
+		recover();
+	} else if (xsrfc(&token) <= 0) {
+		/* nothing is wrong, but there is no login yet to keep others from rebooting */
 		post_reboot();
 	} else {
 		printf("Status: 403 Forbidden\n");
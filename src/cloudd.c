@@ -0,0 +1,627 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "cloudd.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <curl/curl.h>
+
+#include "http_client.h"
+#include "monotonic.h"
+#include "syslog_syserror.h"
+#include "tls_cache.h"
+
+#define CLOUDD_QUEUE_LEN 16
+#define CLOUDD_MAX_CALLS 8
+/* how long a client may leave its request unfinished or its response unread */
+#define CLOUDD_CLIENT_IO_TIMEOUT_MS 2000
+/* beyond this much unread response the client's transfer is paused */
+#define CLOUDD_CLIENT_BUFFER_LENGTH 65536
+#define CLOUDD_MAX_WAIT_MS 1000
+#define CLOUDD_WARM_URL CLOUDD_URL_PREFIX "easteregg.txt"
+#define CLOUDD_WARM_INTERVAL_MS 45000
+#define CLOUDD_WARM_WINDOW_MS 600000
+#define CLOUDD_BACKOFF_MIN_MS 1000
+#define CLOUDD_BACKOFF_MAX_MS 60000
+#define CLOUDD_MAX_HOST_CONNECTIONS 2
+
+enum cloudd_call_state {
+	CLOUDD_CALL_READING = 0,
+	CLOUDD_CALL_RUNNING,
+	/* the transfer is over and only the last frames are still to go out */
+	CLOUDD_CALL_DRAINING
+};
+
+struct cloudd_call {
+	/* -1 for the keep-warm request, which has nobody to answer */
+	int sock;
+	CURL* curl;
+	struct curl_slist* headers;
+	struct tls_cache_slot tls_slot;
+	char* url;
+	char* post;
+	char etag[HTTP_VALIDATOR_LENGTH];
+	char last_modified[HTTP_VALIDATOR_LENGTH];
+	char error[CURL_ERROR_SIZE];
+	enum cloudd_call_state state;
+	/* the request as it trickles in: the fixed header, then the rest in one piece */
+	struct cloudd_request request;
+	size_t header_received;
+	char* body;
+	size_t body_received;
+	/* frames the client has yet to take */
+	char* out;
+	size_t out_length;
+	size_t out_sent;
+	size_t out_capacity;
+	bool paused;
+	long last_io;
+	struct cloudd_call* next;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void handle_term(int signum)
+{
+	running = 0;
+}
+
+/* frames are queued for a client and written out as its socket takes them */
+static bool queue_out(struct cloudd_call* call, const void* data, size_t len)
+{
+	if (call->out_length == call->out_sent) {
+		/* the stall clock only runs while something is waiting */
+		call->out_length = call->out_sent = 0;
+		call->last_io = monotonic_ms();
+	}
+	if (call->out_length + len > call->out_capacity) {
+		size_t capacity = (call->out_capacity == 0) ? BUFSIZ : call->out_capacity;
+		char* grown;
+		while (capacity < call->out_length + len) {
+			capacity *= 2;
+		}
+		if ((grown = realloc(call->out, capacity)) == NULL) {
+			return false;
+		}
+		call->out = grown;
+		call->out_capacity = capacity;
+	}
+	memcpy(call->out + call->out_length, data, len);
+	call->out_length += len;
+	return true;
+}
+
+static size_t pending_out(const struct cloudd_call* call)
+{
+	return call->out_length - call->out_sent;
+}
+
+/* writes what the socket will take without waiting; false if the client is gone */
+static bool flush_out(struct cloudd_call* call)
+{
+	while (pending_out(call) > 0) {
+		ssize_t sent = send(call->sock, call->out + call->out_sent, pending_out(call), MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent == -1 && errno == EINTR) {
+			continue;
+		} else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		} else if (sent <= 0) {
+			return false;
+		}
+		call->out_sent += sent;
+		call->last_io = monotonic_ms();
+	}
+	return true;
+}
+
+static size_t relay_cb(void* data, size_t size, size_t nmemb, void* raw_call)
+{
+	struct cloudd_call* call = (struct cloudd_call*)raw_call;
+	struct cloudd_frame frame;
+	size_t len = size * nmemb;
+
+	if (call->sock == -1) {
+		return len;
+	}
+	/* a slow client holds up its own transfer and nobody else's; curl hands the chunk over again later */
+	if (pending_out(call) > 0 && pending_out(call) + sizeof(struct cloudd_frame) + len > CLOUDD_CLIENT_BUFFER_LENGTH) {
+		call->paused = true;
+		return CURL_WRITEFUNC_PAUSE;
+	}
+	frame.type = CLOUDD_FRAME_DATA;
+	frame.length = len;
+	if (!queue_out(call, &frame, sizeof(struct cloudd_frame)) || !queue_out(call, data, len)) {
+		return 0;
+	}
+	return len;
+}
+
+static size_t header_cb(char* line, size_t size, size_t nmemb, void* raw_call)
+{
+	struct cloudd_call* call = (struct cloudd_call*)raw_call;
+
+	http_collect_validators(line, size * nmemb, call->etag, call->last_modified);
+	return size * nmemb;
+}
+
+static void free_call(struct cloudd_call* call)
+{
+	if (call->curl != NULL) {
+		curl_easy_cleanup(call->curl);
+	}
+	if (call->sock != -1) {
+		close(call->sock);
+	}
+	curl_slist_free_all(call->headers);
+	free(call->url);
+	free(call->post);
+	free(call->body);
+	free(call->out);
+	free(call);
+}
+
+static void configure_call(struct cloudd_call* call, long connect_timeout_ms, long timeout_ms)
+{
+	curl_easy_setopt(call->curl, CURLOPT_URL, call->url);
+	/* no file:// or plain http, not even by way of a redirect */
+#if LIBCURL_VERSION_NUM >= 0x075500
+	curl_easy_setopt(call->curl, CURLOPT_PROTOCOLS_STR, "https");
+	curl_easy_setopt(call->curl, CURLOPT_REDIR_PROTOCOLS_STR, "https");
+#else
+	curl_easy_setopt(call->curl, CURLOPT_PROTOCOLS, (long)CURLPROTO_HTTPS);
+	curl_easy_setopt(call->curl, CURLOPT_REDIR_PROTOCOLS, (long)CURLPROTO_HTTPS);
+#endif
+	tls_cache_prepare(call->curl, call->url, &(call->tls_slot));
+	curl_easy_setopt(call->curl, CURLOPT_PRIVATE, call);
+	curl_easy_setopt(call->curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(call->curl, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(call->curl, CURLOPT_CONNECTTIMEOUT_MS, connect_timeout_ms);
+	curl_easy_setopt(call->curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+	curl_easy_setopt(call->curl, CURLOPT_WRITEFUNCTION, &relay_cb);
+	curl_easy_setopt(call->curl, CURLOPT_WRITEDATA, call);
+	curl_easy_setopt(call->curl, CURLOPT_HEADERFUNCTION, &header_cb);
+	curl_easy_setopt(call->curl, CURLOPT_HEADERDATA, call);
+	curl_easy_setopt(call->curl, CURLOPT_ERRORBUFFER, call->error);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/* wait for the warm connection rather than opening a second one beside it */
+	curl_easy_setopt(call->curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072f00
+	curl_easy_setopt(call->curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+#endif
+}
+
+static struct cloudd_call* accept_call(int sock)
+{
+	struct cloudd_call* call;
+
+	if ((call = calloc(1, sizeof(struct cloudd_call))) == NULL) {
+		syslog(LOG_ERR, "Unable to allocate memory for request");
+		return NULL;
+	}
+	call->sock = sock;
+	call->state = CLOUDD_CALL_READING;
+	call->last_io = monotonic_ms();
+	return call;
+}
+
+static size_t body_length(const struct cloudd_request* request)
+{
+	return request->url_length + request->headers_length + request->post_length;
+}
+
+/* reads what has arrived so far; returns 1 once the request is complete, 0 for more, -1 to drop it */
+static int read_call(struct cloudd_call* call)
+{
+	struct cloudd_request* request = &(call->request);
+
+	while (call->header_received < sizeof(struct cloudd_request) || call->body_received < body_length(request)) {
+		bool in_header = call->header_received < sizeof(struct cloudd_request);
+		char* next = in_header ? (char*)request + call->header_received : call->body + call->body_received;
+		size_t wanted = in_header ? sizeof(struct cloudd_request) - call->header_received : body_length(request) - call->body_received;
+		ssize_t received = recv(call->sock, next, wanted, MSG_DONTWAIT);
+
+		if (received == -1 && errno == EINTR) {
+			continue;
+		} else if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;
+		} else if (received <= 0) {
+			syslog(LOG_WARNING, "Received truncated request from sui.cgi");
+			return -1;
+		}
+		call->last_io = monotonic_ms();
+		if (!in_header) {
+			call->body_received += received;
+		} else if ((call->header_received += received) == sizeof(struct cloudd_request)) {
+			if (request->magic != CLOUDD_MAGIC
+					|| request->url_length == 0 || request->url_length > CLOUDD_MAX_URL_LENGTH
+					|| request->headers_length > CLOUDD_MAX_HEADERS_LENGTH
+					|| request->post_length > CLOUDD_MAX_POST_LENGTH) {
+				syslog(LOG_WARNING, "Received malformed request from sui.cgi");
+				return -1;
+			}
+			if ((call->body = malloc(body_length(request) + 1)) == NULL) {
+				syslog(LOG_ERR, "Unable to allocate memory for request");
+				return -1;
+			}
+		}
+	}
+	return 1;
+}
+
+/* splits up the request that has been read and hands it to curl */
+static bool start_call(struct cloudd_call* call)
+{
+	const struct cloudd_request* request = &(call->request);
+	char* headers = NULL;
+
+	if ((call->url = calloc(1, request->url_length + 1)) == NULL
+			|| (headers = calloc(1, request->headers_length + 1)) == NULL
+			|| (call->post = calloc(1, request->post_length + 1)) == NULL
+			|| (call->curl = curl_easy_init()) == NULL) {
+		syslog(LOG_ERR, "Unable to allocate memory for request");
+		free(headers);
+		return false;
+	}
+	memcpy(call->url, call->body, request->url_length);
+	if (strlen(call->url) != request->url_length
+			|| strncmp(call->url, CLOUDD_URL_PREFIX, strlen(CLOUDD_URL_PREFIX)) != 0) {
+		syslog(LOG_WARNING, "Refused request for a URL outside of " CLOUDD_URL_PREFIX);
+		free(headers);
+		return false;
+	}
+	memcpy(headers, call->body + request->url_length, request->headers_length);
+	memcpy(call->post, call->body + request->url_length + request->headers_length, request->post_length);
+	free(call->body);
+	call->body = NULL;
+
+	configure_call(call, request->connect_timeout_ms, request->timeout_ms);
+	if (request->headers_length > 0) {
+		char* saveptr = NULL;
+		char* line;
+		for (line = strtok_r(headers, "\n", &saveptr); line != NULL; line = strtok_r(NULL, "\n", &saveptr)) {
+			call->headers = curl_slist_append(call->headers, line);
+		}
+		curl_easy_setopt(call->curl, CURLOPT_HTTPHEADER, call->headers);
+	}
+	if (request->resume_from > 0) {
+		curl_easy_setopt(call->curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)request->resume_from);
+	}
+	if (request->is_post) {
+		curl_easy_setopt(call->curl, CURLOPT_POSTFIELDS, call->post);
+		curl_easy_setopt(call->curl, CURLOPT_POSTFIELDSIZE, (long)request->post_length);
+	}
+	free(headers);
+
+	call->state = CLOUDD_CALL_RUNNING;
+	return true;
+}
+
+static struct cloudd_call* warm_call()
+{
+	struct cloudd_call* call;
+
+	if ((call = calloc(1, sizeof(struct cloudd_call))) == NULL
+			|| (call->url = strdup(CLOUDD_WARM_URL)) == NULL
+			|| (call->curl = curl_easy_init()) == NULL) {
+		if (call != NULL) {
+			call->sock = -1;
+			free_call(call);
+		}
+		return NULL;
+	}
+	call->sock = -1;
+	call->state = CLOUDD_CALL_RUNNING;
+	configure_call(call, CLOUDD_BACKOFF_MAX_MS, CLOUDD_BACKOFF_MAX_MS);
+	curl_easy_setopt(call->curl, CURLOPT_NOBODY, 1L);
+	return call;
+}
+
+static void finish_call(struct cloudd_call* call, CURLcode result)
+{
+	struct cloudd_frame frame;
+	struct cloudd_done done;
+	double seconds = 0;
+	long http_code = 0;
+
+	curl_easy_getinfo(call->curl, CURLINFO_RESPONSE_CODE, &http_code);
+	tls_cache_finish(call->curl, &(call->tls_slot), result == CURLE_OK || http_code != 0);
+	if (call->sock == -1) {
+		return;
+	}
+
+	memset(&done, 0x00, sizeof(struct cloudd_done));
+	done.result = result;
+	done.http_code = http_code;
+	if (curl_easy_getinfo(call->curl, CURLINFO_NAMELOOKUP_TIME, &seconds) == CURLE_OK) {
+		done.namelookup_ms = (uint32_t)(seconds * 1000);
+	}
+	if (curl_easy_getinfo(call->curl, CURLINFO_CONNECT_TIME, &seconds) == CURLE_OK) {
+		done.connect_ms = (uint32_t)(seconds * 1000);
+	}
+	if (curl_easy_getinfo(call->curl, CURLINFO_APPCONNECT_TIME, &seconds) == CURLE_OK) {
+		done.appconnect_ms = (uint32_t)(seconds * 1000);
+	}
+	if (curl_easy_getinfo(call->curl, CURLINFO_STARTTRANSFER_TIME, &seconds) == CURLE_OK) {
+		done.starttransfer_ms = (uint32_t)(seconds * 1000);
+	}
+	strncpy(done.etag, call->etag, CLOUDD_VALIDATOR_LENGTH - 1);
+	strncpy(done.last_modified, call->last_modified, CLOUDD_VALIDATOR_LENGTH - 1);
+	if (result != CURLE_OK) {
+		strncpy(done.error, (call->error[0] != '\0') ? call->error : curl_easy_strerror(result), CLOUDD_ERROR_LENGTH - 1);
+	}
+
+	frame.type = CLOUDD_FRAME_DONE;
+	frame.length = sizeof(struct cloudd_done);
+	if (!queue_out(call, &frame, sizeof(struct cloudd_frame)) || !queue_out(call, &done, sizeof(struct cloudd_done))) {
+		syslog(LOG_ERR, "Unable to allocate memory for response");
+	}
+}
+
+/* unlinks call and frees it, taking its transfer out of multi if it still has one */
+static void drop_call(CURLM* multi, struct cloudd_call** calls, struct cloudd_call* call)
+{
+	struct cloudd_call** link;
+
+	if (call->state == CLOUDD_CALL_RUNNING) {
+		curl_multi_remove_handle(multi, call->curl);
+	}
+	for (link = calls; *link != NULL; link = &((*link)->next)) {
+		if (*link == call) {
+			*link = call->next;
+			break;
+		}
+	}
+	free_call(call);
+}
+
+/* moves every client along as far as its socket allows; false if call had to be dropped */
+static bool service_call(CURLM* multi, struct cloudd_call** calls, struct cloudd_call* call, long now)
+{
+	if (call->state == CLOUDD_CALL_READING) {
+		int complete = read_call(call);
+		if (complete < 0) {
+			drop_call(multi, calls, call);
+			return false;
+		} else if (complete > 0) {
+			if (!start_call(call)) {
+				drop_call(multi, calls, call);
+				return false;
+			} else if (curl_multi_add_handle(multi, call->curl) != CURLM_OK) {
+				syslog(LOG_ERR, "Unable to start request for %s", call->url);
+				call->state = CLOUDD_CALL_DRAINING;
+				drop_call(multi, calls, call);
+				return false;
+			}
+		}
+	}
+
+	if (!flush_out(call)) {
+		syslog(LOG_INFO, "Client went away before its response was complete");
+		drop_call(multi, calls, call);
+		return false;
+	}
+	if (call->paused && pending_out(call) < CLOUDD_CLIENT_BUFFER_LENGTH) {
+		call->paused = false;
+		curl_easy_pause(call->curl, CURLPAUSE_CONT);
+	}
+	if (call->state == CLOUDD_CALL_DRAINING && pending_out(call) == 0) {
+		drop_call(multi, calls, call);
+		return false;
+	}
+	if ((call->state == CLOUDD_CALL_READING || pending_out(call) > 0)
+			&& now - call->last_io > CLOUDD_CLIENT_IO_TIMEOUT_MS) {
+		syslog(LOG_INFO, "Dropping client that stopped %s", (call->state == CLOUDD_CALL_READING) ? "sending" : "reading");
+		drop_call(multi, calls, call);
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	struct sockaddr_un uaddr;
+	struct sigaction action;
+	struct cloudd_call* calls = NULL;
+	CURLM* multi;
+	int sock = -1;
+	size_t call_count = 0;
+	long next_warm = 0;
+	long backoff = CLOUDD_BACKOFF_MIN_MS;
+	long last_activity = monotonic_ms();
+	bool warming = false;
+
+	openlog("SUI-CLOUDD", 0, LOG_DAEMON);
+
+	memset(&action, 0x00, sizeof(struct sigaction));
+	action.sa_handler = &handle_term;
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	action.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &action, NULL);
+
+	memset(&uaddr, 0x00, sizeof(struct sockaddr_un));
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		syslog_syserror(LOG_ALERT, "Unable to create unix socket");
+		exit(EX_OSERR);
+	}
+
+	uaddr.sun_family = AF_UNIX;
+	strcpy(uaddr.sun_path, CLOUDD_SOCK_PATH);
+	unlink(CLOUDD_SOCK_PATH);
+	if (bind(sock, (struct sockaddr*)&uaddr, sizeof(struct sockaddr_un)) == -1) {
+		syslog_syserror(LOG_ALERT, "Unable to bind to unix socket");
+		exit(EX_OSERR);
+	}
+	/* only root, which sui.cgi runs as, may have requests fetched */
+	if (chmod(CLOUDD_SOCK_PATH, 0600) == -1) {
+		syslog_syserror(LOG_ALERT, "Unable to restrict the unix socket");
+		exit(EX_OSERR);
+	}
+
+	if (listen(sock, CLOUDD_QUEUE_LEN) == -1) {
+		syslog_syserror(LOG_ALERT, "Unable to listen on unix socket");
+		exit(EX_OSERR);
+	}
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+	if ((multi = curl_multi_init()) == NULL) {
+		syslog(LOG_ALERT, "Unable to initialize curl");
+		exit(EX_SOFTWARE);
+	}
+#ifdef CURLPIPE_MULTIPLEX
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)CLOUDD_MAX_HOST_CONNECTIONS);
+#endif
+
+	while (running) {
+		struct curl_waitfd wait_fds[CLOUDD_MAX_CALLS + 1];
+		unsigned int wait_count = 0;
+		struct cloudd_call* call;
+		struct cloudd_call* next;
+		struct CURLMsg* msg;
+		int still_running = 0;
+		int queued = 0;
+		long now = monotonic_ms();
+		long wait_ms = CLOUDD_MAX_WAIT_MS;
+
+		/*
+		 * Keep a connection open for a while after the UI was last used,
+		 * backing off while the cloud is unreachable.
+		 */
+		bool want_warm = !warming && call_count == 0 && now - last_activity < CLOUDD_WARM_WINDOW_MS;
+
+		if (want_warm && now >= next_warm) {
+			call = warm_call();
+			if (call != NULL && curl_multi_add_handle(multi, call->curl) == CURLM_OK) {
+				call->next = calls;
+				calls = call;
+				call_count++;
+				warming = true;
+			} else if (call != NULL) {
+				free_call(call);
+			}
+			next_warm = now + CLOUDD_WARM_INTERVAL_MS;
+		}
+
+		/* curl's sockets, the listening socket, and every client that can make progress */
+		wait_count = 0;
+		if (call_count < CLOUDD_MAX_CALLS) {
+			wait_fds[wait_count].fd = sock;
+			wait_fds[wait_count].events = CURL_WAIT_POLLIN;
+			wait_fds[wait_count].revents = 0;
+			wait_count++;
+		}
+		for (call = calls; call != NULL; call = call->next) {
+			if (call->sock != -1 && (call->state == CLOUDD_CALL_READING || pending_out(call) > 0)) {
+				wait_fds[wait_count].fd = call->sock;
+				wait_fds[wait_count].events = (call->state == CLOUDD_CALL_READING) ? CURL_WAIT_POLLIN : CURL_WAIT_POLLOUT;
+				wait_fds[wait_count].revents = 0;
+				wait_count++;
+			}
+		}
+		if (want_warm && next_warm - now < wait_ms) {
+			wait_ms = (next_warm > now) ? next_warm - now : 0;
+		}
+		curl_multi_wait(multi, wait_fds, wait_count, (int)wait_ms, NULL);
+
+		if (call_count < CLOUDD_MAX_CALLS) {
+			int tsock;
+			while (call_count < CLOUDD_MAX_CALLS && (tsock = accept(sock, NULL, NULL)) != -1) {
+				/* accepted sockets do not inherit O_NONBLOCK */
+				fcntl(tsock, F_SETFL, fcntl(tsock, F_GETFL, 0) | O_NONBLOCK);
+				if ((call = accept_call(tsock)) == NULL) {
+					close(tsock);
+				} else {
+					call->next = calls;
+					calls = call;
+					call_count++;
+					last_activity = monotonic_ms();
+				}
+			}
+		}
+
+		now = monotonic_ms();
+		for (call = calls; call != NULL; call = next) {
+			next = call->next;
+			if (call->sock != -1 && !service_call(multi, &calls, call, now)) {
+				call_count--;
+			}
+		}
+
+		curl_multi_perform(multi, &still_running);
+		while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+			call = NULL;
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&call);
+			if (call == NULL) {
+				continue;
+			}
+			if (call->sock == -1) {
+				warming = false;
+				if (msg->data.result == CURLE_OK) {
+					backoff = CLOUDD_BACKOFF_MIN_MS;
+				} else {
+					syslog(LOG_INFO, "Unable to reach cloud, retrying in %ld ms: %s", backoff, call->error);
+					next_warm = monotonic_ms() + backoff;
+					backoff = (backoff * 2 > CLOUDD_BACKOFF_MAX_MS) ? CLOUDD_BACKOFF_MAX_MS : backoff * 2;
+				}
+			}
+			finish_call(call, msg->data.result);
+			curl_multi_remove_handle(multi, call->curl);
+			call->state = CLOUDD_CALL_DRAINING;
+			if (call->sock == -1) {
+				drop_call(multi, &calls, call);
+				call_count--;
+			} else if (!service_call(multi, &calls, call, monotonic_ms())) {
+				call_count--;
+			}
+		}
+	}
+
+	while (calls != NULL) {
+		drop_call(multi, &calls, calls);
+	}
+	curl_multi_cleanup(multi);
+	close(sock);
+	unlink(CLOUDD_SOCK_PATH);
+	return EX_OK;
+}
@@ -0,0 +1,77 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_CLOUDD_H
+#define WIOMW_SUI_CLOUDD_H
+
+#include <stdint.h>
+
+#define CLOUDD_SOCK_PATH "/var/run/sui-cloudd.sock"
+/* the daemon fetches nothing outside of this */
+#define CLOUDD_URL_PREFIX "https://www.whoisonmywifi.net/"
+#define CLOUDD_MAGIC 0x434C4432
+#define CLOUDD_MAX_URL_LENGTH 2048
+#define CLOUDD_MAX_HEADERS_LENGTH 4096
+#define CLOUDD_MAX_POST_LENGTH 65536
+#define CLOUDD_ERROR_LENGTH 256
+#define CLOUDD_VALIDATOR_LENGTH 128
+
+/*
+ * A client sends one request header followed by the URL, the extra header
+ * lines ("Name: value\n" each) and the POST body, then reads frames until
+ * a DONE frame arrives. DATA frames carry the response body as it streams
+ * in; the DONE frame carries a struct cloudd_done.
+ */
+struct cloudd_request {
+	uint32_t magic;
+	uint32_t is_post;
+	uint32_t url_length;
+	uint32_t headers_length;
+	uint32_t post_length;
+	uint32_t connect_timeout_ms;
+	uint32_t timeout_ms;
+	uint64_t resume_from;
+};
+
+enum cloudd_frame_type {
+	CLOUDD_FRAME_DATA = 1,
+	CLOUDD_FRAME_DONE
+};
+
+struct cloudd_frame {
+	uint32_t type;
+	uint32_t length;
+};
+
+struct cloudd_done {
+	int32_t result;
+	int32_t http_code;
+	uint32_t namelookup_ms;
+	uint32_t connect_ms;
+	uint32_t appconnect_ms;
+	uint32_t starttransfer_ms;
+	char etag[CLOUDD_VALIDATOR_LENGTH];
+	char last_modified[CLOUDD_VALIDATOR_LENGTH];
+	char error[CLOUDD_ERROR_LENGTH];
+};
+
+#endif
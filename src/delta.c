@@ -0,0 +1,297 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "delta.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "digest.h"
+#include "download.h"
+#include "http_client.h"
+#include "mtd.h"
+
+#define DELTA_HEADER_LENGTH 28
+#define DELTA_COPY_ARGS_LENGTH 12
+#define DELTA_LENGTH_LENGTH 4
+#define DELTA_COPY_BUFFER_LENGTH 65536
+#define DELTA_REQUEST_RETRIES 2
+
+enum delta_stage {
+	DELTA_STAGE_HEADER = 0,
+	DELTA_STAGE_OPCODE,
+	DELTA_STAGE_COPY_ARGS,
+	DELTA_STAGE_ADD_LENGTH,
+	DELTA_STAGE_ADD_DATA,
+	DELTA_STAGE_DONE,
+	DELTA_STAGE_FAILED
+};
+
+struct delta_state {
+	const struct delta_job* delta;
+	const struct download_job* target;
+	FILE* out;
+	int source_fd;
+	long long source_limit;
+	long long source_size;
+	long long written;
+	long long received;
+	struct digest digest;
+	enum delta_stage stage;
+	/* fixed-size fields may be split across chunks */
+	unsigned char field[DELTA_HEADER_LENGTH];
+	size_t field_length;
+	size_t field_needed;
+	uint32_t add_remaining;
+	const char* error;
+};
+
+static uint64_t read_be(const unsigned char* data, size_t len)
+{
+	uint64_t value = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		value = (value << 8) | data[i];
+	}
+	return value;
+}
+
+static int open_source(const char* source, long long* size)
+{
+	int fd;
+	off_t end;
+
+	if (source == NULL) {
+		return mtd_open(MTD_FIRMWARE_PARTITION, size);
+	}
+	if ((fd = open(source, O_RDONLY)) == -1) {
+		return -1;
+	}
+	if ((end = lseek(fd, 0, SEEK_END)) == (off_t)-1) {
+		close(fd);
+		return -1;
+	}
+	*size = (long long)end;
+	return fd;
+}
+
+static void fail(struct delta_state* state, const char* error)
+{
+	state->stage = DELTA_STAGE_FAILED;
+	state->error = error;
+}
+
+static void emit(struct delta_state* state, const unsigned char* data, size_t len)
+{
+	if (state->written + (long long)len > state->target->size) {
+		fail(state, "Update delta produces more than the expected image.");
+	} else if (fwrite(data, 1, len, state->out) != len) {
+		fail(state, "Error while preparing update file.");
+	} else {
+		digest_update(&(state->digest), data, len);
+		state->written += len;
+	}
+}
+
+static void copy_source(struct delta_state* state, long long offset, uint32_t length)
+{
+	unsigned char buffer[DELTA_COPY_BUFFER_LENGTH];
+
+	while (length > 0 && state->stage != DELTA_STAGE_FAILED) {
+		size_t chunk = (length < DELTA_COPY_BUFFER_LENGTH) ? length : DELTA_COPY_BUFFER_LENGTH;
+		ssize_t got = pread(state->source_fd, buffer, chunk, (off_t)offset);
+		if (got <= 0) {
+			syslog(LOG_ERR, "Unable to read the running firmware at byte %lld: %s", offset, strerror(errno));
+			fail(state, "Error while reading the running firmware.");
+			return;
+		}
+		emit(state, buffer, got);
+		offset += got;
+		length -= got;
+	}
+}
+
+static void expect(struct delta_state* state, enum delta_stage stage, size_t needed)
+{
+	state->stage = stage;
+	state->field_length = 0;
+	state->field_needed = needed;
+}
+
+static void handle_field(struct delta_state* state)
+{
+	const unsigned char* field = state->field;
+	long long offset;
+	uint32_t length;
+
+	switch (state->stage) {
+	case DELTA_STAGE_HEADER:
+		state->source_size = (long long)read_be(field + 12, 8);
+		if (memcmp(field, DELTA_MAGIC, 8) != 0 || read_be(field + 8, 4) != DELTA_FORMAT) {
+			fail(state, "Update delta is not in a known format.");
+		} else if ((long long)read_be(field + 20, 8) != state->target->size) {
+			fail(state, "Update delta does not describe the expected image.");
+		} else if (state->source_size > state->source_limit) {
+			fail(state, "Update delta expects a larger running firmware.");
+		} else {
+			expect(state, DELTA_STAGE_OPCODE, 1);
+		}
+		break;
+	case DELTA_STAGE_OPCODE:
+		if (field[0] == 'C') {
+			expect(state, DELTA_STAGE_COPY_ARGS, DELTA_COPY_ARGS_LENGTH);
+		} else if (field[0] == 'A') {
+			expect(state, DELTA_STAGE_ADD_LENGTH, DELTA_LENGTH_LENGTH);
+		} else if (field[0] == 'E' && state->written == state->target->size) {
+			expect(state, DELTA_STAGE_DONE, 0);
+		} else {
+			fail(state, "Update delta is corrupt.");
+		}
+		break;
+	case DELTA_STAGE_COPY_ARGS:
+		offset = (long long)read_be(field, 8);
+		length = (uint32_t)read_be(field + 8, 4);
+		if (offset < 0 || offset + length > state->source_size) {
+			fail(state, "Update delta reads past the running firmware.");
+		} else {
+			copy_source(state, offset, length);
+			if (state->stage != DELTA_STAGE_FAILED) {
+				expect(state, DELTA_STAGE_OPCODE, 1);
+			}
+		}
+		break;
+	case DELTA_STAGE_ADD_LENGTH:
+		state->add_remaining = (uint32_t)read_be(field, 4);
+		if (state->add_remaining == 0) {
+			expect(state, DELTA_STAGE_OPCODE, 1);
+		} else {
+			expect(state, DELTA_STAGE_ADD_DATA, 0);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static bool delta_hook(void* raw_state, const unsigned char* data, size_t len)
+{
+	struct delta_state* state = (struct delta_state*)raw_state;
+
+	state->received += len;
+	while (len > 0 && state->stage != DELTA_STAGE_FAILED) {
+		if (state->stage == DELTA_STAGE_DONE) {
+			fail(state, "Update delta is corrupt.");
+		} else if (state->stage == DELTA_STAGE_ADD_DATA) {
+			size_t chunk = (len < state->add_remaining) ? len : state->add_remaining;
+			emit(state, data, chunk);
+			data += chunk;
+			len -= chunk;
+			if ((state->add_remaining -= chunk) == 0 && state->stage != DELTA_STAGE_FAILED) {
+				expect(state, DELTA_STAGE_OPCODE, 1);
+			}
+		} else {
+			size_t chunk = state->field_needed - state->field_length;
+			if (chunk > len) {
+				chunk = len;
+			}
+			memcpy(state->field + state->field_length, data, chunk);
+			state->field_length += chunk;
+			data += chunk;
+			len -= chunk;
+			if (state->field_length == state->field_needed) {
+				handle_field(state);
+			}
+		}
+	}
+
+	if (state->target->progress != NULL) {
+		state->target->progress(state->target->progress_arg, state->received, state->delta->size);
+	}
+	/* there is no point fetching the rest of a delta that went wrong */
+	return state->stage != DELTA_STAGE_FAILED;
+}
+
+const char* delta_fetch(const struct delta_job* delta, const struct download_job* target, struct digest_result* result)
+{
+	struct delta_state state;
+	struct http_request request;
+	struct http_response response;
+	const char* error = NULL;
+	bool ok;
+
+	memset(&state, 0x00, sizeof(struct delta_state));
+	state.delta = delta;
+	state.target = target;
+	expect(&state, DELTA_STAGE_HEADER, DELTA_HEADER_LENGTH);
+	digest_init(&(state.digest));
+
+	if ((state.source_fd = open_source(delta->source, &(state.source_limit))) == -1) {
+		syslog(LOG_WARNING, "Unable to open the running firmware: %s", strerror(errno));
+		return "Error while reading the running firmware.";
+	}
+	/* whatever an earlier full download left behind is about to be overwritten */
+	download_discard(target->path);
+	if ((state.out = fopen(target->path, "w")) == NULL) {
+		syslog(LOG_ERR, "Unable to open update file for writing: %s", strerror(errno));
+		close(state.source_fd);
+		return "Error while preparing update file.";
+	}
+
+	memset(&request, 0x00, sizeof(struct http_request));
+	request.url = delta->url;
+	request.timeout_ms = target->timeout_ms;
+	request.retries = DELTA_REQUEST_RETRIES;
+	request.hook = &delta_hook;
+	request.hook_arg = &state;
+
+	ok = http_perform(&request, &response);
+	close(state.source_fd);
+	if (fclose(state.out) != 0 && state.stage != DELTA_STAGE_FAILED) {
+		fail(&state, "Error while preparing update file.");
+	}
+
+	if (state.stage == DELTA_STAGE_FAILED) {
+		error = state.error;
+	} else if (!ok) {
+		syslog(LOG_WARNING, "Unable to get update delta (HTTP code %lu): %s", response.http_code, response.error);
+		error = "Error while contacting update server.";
+	} else if (state.stage != DELTA_STAGE_DONE) {
+		error = "Update delta ended early.";
+	} else if (state.received != delta->size) {
+		error = "Update delta was the wrong size.";
+	}
+
+	if (error != NULL) {
+		remove(target->path);
+		return error;
+	}
+	digest_finish(&(state.digest), result);
+	return NULL;
+}
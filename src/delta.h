@@ -0,0 +1,60 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_DELTA_H
+#define WIOMW_SUI_DELTA_H
+
+#include <stdbool.h>
+
+#include "digest.h"
+#include "download.h"
+
+/*
+ * A delta rebuilds the new image from the one in flash. It is a header
+ * followed by records, with every integer big-endian:
+ *
+ *   "SUIDELTA" u32 format, u64 source size, u64 target size
+ *   'C' u64 offset, u32 length     copies length bytes of the running image
+ *   'A' u32 length, bytes          appends length literal bytes
+ *   'E'                            ends the delta
+ *
+ * Records are applied as they arrive, so the delta itself is never stored.
+ */
+#define DELTA_MAGIC "SUIDELTA"
+#define DELTA_FORMAT 1
+
+struct delta_job {
+	const char* url;
+	long long size;
+	/* NULL finds the firmware partition through /proc/mtd */
+	const char* source;
+};
+
+/*
+ * Writes the image described by target by applying delta to the running
+ * firmware. target->progress, if set, is told about the delta bytes. Returns
+ * NULL and the digest of the rebuilt image on success; on failure the
+ * partial image is removed and a message is returned.
+ */
+const char* delta_fetch(const struct delta_job* delta, const struct download_job* target, struct digest_result* result);
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "digest.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <polarssl/md5.h>
+#include <polarssl/sha256.h>
+
+#include "b2h.h"
+
+#define DIGEST_MD5_LENGTH 16
+#define DIGEST_SHA256_LENGTH 32
+#define DIGEST_READ_LENGTH 16384
+
+void digest_init(struct digest* digest)
+{
+	md5_starts(&(digest->md5));
+	sha256_starts(&(digest->sha256), 0);
+}
+
+void digest_update(struct digest* digest, const unsigned char* data, size_t len)
+{
+	md5_update(&(digest->md5), data, len);
+	sha256_update(&(digest->sha256), data, len);
+}
+
+void digest_finish(struct digest* digest, struct digest_result* result)
+{
+	unsigned char raw_md5[DIGEST_MD5_LENGTH];
+	unsigned char raw_sha256[DIGEST_SHA256_LENGTH];
+
+	md5_finish(&(digest->md5), raw_md5);
+	sha256_finish(&(digest->sha256), raw_sha256);
+	b2h(result->md5, raw_md5, DIGEST_MD5_LENGTH);
+	result->md5[DIGEST_MD5_HEX_LENGTH - 1] = '\0';
+	b2h(result->sha256, raw_sha256, DIGEST_SHA256_LENGTH);
+	result->sha256[DIGEST_SHA256_HEX_LENGTH - 1] = '\0';
+}
+
+bool digest_hook(void* digest, const unsigned char* data, size_t len)
+{
+	digest_update((struct digest*)digest, data, len);
+	return true;
+}
+
+bool digest_file(const char* path, struct digest_result* result)
+{
+	struct digest digest;
+	struct stat file_stat;
+	void* mapped;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		return false;
+	}
+	if (fstat(fd, &file_stat) == -1) {
+		close(fd);
+		return false;
+	}
+
+	digest_init(&digest);
+	if (file_stat.st_size == 0) {
+		close(fd);
+		digest_finish(&digest, result);
+		return true;
+	}
+
+	/* the image lives in tmpfs, so mapping it hashes the page cache in place */
+	if ((mapped = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED) {
+		madvise(mapped, file_stat.st_size, MADV_SEQUENTIAL);
+		digest_update(&digest, (const unsigned char*)mapped, file_stat.st_size);
+		munmap(mapped, file_stat.st_size);
+	} else {
+		unsigned char buffer[DIGEST_READ_LENGTH];
+		ssize_t len;
+		while ((len = read(fd, buffer, DIGEST_READ_LENGTH)) > 0) {
+			digest_update(&digest, buffer, len);
+		}
+		if (len == -1) {
+			close(fd);
+			return false;
+		}
+	}
+	close(fd);
+
+	digest_finish(&digest, result);
+	return true;
+}
+
+bool digest_matches(const struct digest_result* result, const char* md5, const char* sha256)
+{
+	return md5 != NULL && strcasecmp(result->md5, md5) == 0
+		&& (sha256 == NULL || strcasecmp(result->sha256, sha256) == 0);
+}
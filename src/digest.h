@@ -0,0 +1,58 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_DIGEST_H
+#define WIOMW_SUI_DIGEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <polarssl/md5.h>
+#include <polarssl/sha256.h>
+
+#define DIGEST_MD5_HEX_LENGTH 33
+#define DIGEST_SHA256_HEX_LENGTH 65
+
+struct digest {
+	md5_context md5;
+	sha256_context sha256;
+};
+
+/* hex digests; the letters are uppercase, so compare with digest_matches */
+struct digest_result {
+	char md5[DIGEST_MD5_HEX_LENGTH];
+	char sha256[DIGEST_SHA256_HEX_LENGTH];
+};
+
+void digest_init(struct digest* digest);
+void digest_update(struct digest* digest, const unsigned char* data, size_t len);
+void digest_finish(struct digest* digest, struct digest_result* result);
+
+/* an http_data_hook, so a download can be hashed as it is written */
+bool digest_hook(void* digest, const unsigned char* data, size_t len);
+
+/* hashes a file already on disk without copying it through stdio */
+bool digest_file(const char* path, struct digest_result* result);
+
+/* sha256 is only checked when an expected value is given */
+bool digest_matches(const struct digest_result* result, const char* md5, const char* sha256);
+
+#endif
@@ -32,31 +32,33 @@
 #include <arpa/inet.h>
 #include <yajl/yajl_tree.h>
 
+#include "dns_bench.h"
+#include "resolv.h"
 #include "string_helpers.h"
+#include "uci_cache.h"
+#include "uci_txn.h"
 #include "xsrf.h"
 
 #define DNS_UCI_PATH "network.wan.dns"
 #define LAN_IP_UCI_PATH "network.lan.ipaddr"
 #define INTERCEPT_UCI_PATH "firewall.dns_intercept"
-#define INTERCEPT_UCI_VALUE INTERCEPT_UCI_PATH "=redirect"
-#define INTERCEPT_NAME_UCI_VALUE INTERCEPT_UCI_PATH ".name=DNS Interception"
-#define INTERCEPT_SRC_UCI_VALUE INTERCEPT_UCI_PATH ".src=lan"
-#define INTERCEPT_PROTO_UCI_VALUE INTERCEPT_UCI_PATH ".proto=udp"
-#define INTERCEPT_SPORT_UCI_VALUE INTERCEPT_UCI_PATH ".src_dport=53"
-#define INTERCEPT_DPORT_UCI_VALUE INTERCEPT_UCI_PATH ".dest_port=53"
-#define INTERCEPT_SRC_IP_UCI_PREFIX INTERCEPT_UCI_PATH ".src_dip=!"
-#define INTERCEPT_DEST_IP_UCI_PREFIX INTERCEPT_UCI_PATH ".dest_ip="
-
-#define OPENDNS_ENHANCED_DNS_1 "208.67.222.222"
-#define OPENDNS_ENHANCED_DNS_2 "208.67.220.220"
-#define OPENDNS_FAMILY_SHIELD_DNS_1 "208.67.222.123"
-#define OPENDNS_FAMILY_SHIELD_DNS_2 "208.67.220.123"
-#define GOOGLE_DNS_1 "8.8.8.8"
-#define GOOGLE_DNS_2 "8.8.4.4"
+#define INTERCEPT_NAME_UCI_PATH INTERCEPT_UCI_PATH ".name"
+#define INTERCEPT_SRC_UCI_PATH INTERCEPT_UCI_PATH ".src"
+#define INTERCEPT_PROTO_UCI_PATH INTERCEPT_UCI_PATH ".proto"
+#define INTERCEPT_SPORT_UCI_PATH INTERCEPT_UCI_PATH ".src_dport"
+#define INTERCEPT_DPORT_UCI_PATH INTERCEPT_UCI_PATH ".dest_port"
+#define INTERCEPT_SRC_IP_UCI_PATH INTERCEPT_UCI_PATH ".src_dip"
+#define INTERCEPT_DEST_IP_UCI_PATH INTERCEPT_UCI_PATH ".dest_ip"
+#define INTERCEPT_TYPE "redirect"
+#define INTERCEPT_NAME "DNS Interception"
+#define INTERCEPT_SRC "lan"
+#define INTERCEPT_PROTO "udp"
+#define INTERCEPT_PORT "53"
 
 #define MAX_IP_LENGTH 32
 
-#define GET_DNS_COMMAND "cat /var/resolv.conf.auto | awk '$1 == \"nameserver\" {print $2;}'"
+#define DNS_BENCH_MIN_TIMEOUT_MS 100
+#define DNS_BENCH_MAX_TIMEOUT_MS 5000
 
 void post_dns(yajl_val top, struct xsrft* token)
 {
@@ -208,238 +210,95 @@ void post_dns(yajl_val top, struct xsrft* token)
 		}
 	}
 
-	struct uci_context* ctx;
-	struct uci_ptr ptr;
-	int res = 0;
-	char uci_lookup_str[BUFSIZ];
-	int i = 0;
-	tdns = dns;
-	ctx = uci_alloc_context();
+	struct uci_txn txn;
+	enum uci_cache_status status;
+	uci_txn_begin(&txn, uci_alloc_context());
 
 	if (custom_nameservers_yajl != NULL || opendns != 0 || opendns_family_shield != 0 || google != 0) {
-		strncpy(uci_lookup_str, DNS_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| ((ptr.flags & UCI_LOOKUP_COMPLETE) != 0
-					&& ((res = uci_delete(ctx, &ptr)) != UCI_OK
-						|| (res = uci_save(ctx, ptr.p)) != UCI_OK))) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to change old DNS servers in UCI.\"]}", token->val);
-			return;
-		}
-
-		for (i = 0; i < dns_count; i++) {
-			snprintf(uci_lookup_str, BUFSIZ, DNS_UCI_PATH "=%s", tdns);
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-					|| (res = uci_add_list(ctx, &ptr)) != UCI_OK) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to add DNS server to UCI.\"]}", token->val);
-				return;
-			}
-			tdns += strlen(tdns) + 1;
-		}
-		if (dns_count > 0 && (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save DNS servers to UCI.\"]}", token->val);
-			return;
-		}
-
-		if ((res = uci_commit(ctx, &(ptr.p), false)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save DNS servers to UCI.\"]}", token->val);
-			return;
-		}
+		uci_txn_set_list(&txn, DNS_UCI_PATH, dns, dns_count);
 	}
 
 	if (interception == -1) {
-		strncpy(uci_lookup_str, INTERCEPT_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| ((ptr.flags & UCI_LOOKUP_COMPLETE) != 0
-					&& ((res = uci_delete(ctx, &ptr)) != UCI_OK
-						|| (res = uci_save(ctx, ptr.p)) != UCI_OK))) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to change DNS interception setting in UCI.\"]}", token->val);
-			return;
-		}
-
-		if ((res = uci_commit(ctx, &(ptr.p), false)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to disable DNS interception setting in UCI.\"]}", token->val);
-			return;
-		}
+		uci_txn_delete(&txn, INTERCEPT_UCI_PATH);
 	} else if (interception == 1) {
 		char lan_ip[BUFSIZ];
+		char lan_ip_rule[BUFSIZ];
 		lan_ip[0] = '\0';
 
-		strncpy(uci_lookup_str, LAN_IP_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK
-				&& (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-			strncpy(lan_ip, ptr.o->v.string, BUFSIZ);
-		} else {
+		if (uci_cache_string(LAN_IP_UCI_PATH, lan_ip, BUFSIZ) != UCI_CACHE_FOUND) {
+			uci_txn_discard(&txn);
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to retrieve LAN IP address from UCI (needed for DNS interception setting).\"]}", token->val);
 			return;
 		}
 
-		strncpy(uci_lookup_str, INTERCEPT_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| ((ptr.flags & UCI_LOOKUP_COMPLETE) != 0
-					&& ((res = uci_delete(ctx, &ptr)) != UCI_OK
-						|| (res = uci_save(ctx, ptr.p)) != UCI_OK))) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to access DNS interception setting in UCI.\"]}", token->val);
-			return;
-		}
-
-		strncpy(uci_lookup_str, INTERCEPT_UCI_VALUE, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save DNS interception setting to UCI.\"]}", token->val);
-			return;
-		}
-		strncpy(uci_lookup_str, INTERCEPT_NAME_UCI_VALUE, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save DNS interception setting to UCI.\"]}", token->val);
-			return;
-		}
-		strncpy(uci_lookup_str, INTERCEPT_SRC_UCI_VALUE, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save DNS interception setting to UCI.\"]}", token->val);
-			return;
-		}
-		strncpy(uci_lookup_str, INTERCEPT_PROTO_UCI_VALUE, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save DNS interception setting to UCI.\"]}", token->val);
-			return;
-		}
-		strncpy(uci_lookup_str, INTERCEPT_SPORT_UCI_VALUE, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save DNS interception setting to UCI.\"]}", token->val);
-			return;
-		}
-		strncpy(uci_lookup_str, INTERCEPT_DPORT_UCI_VALUE, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save DNS interception setting to UCI.\"]}", token->val);
-			return;
-		}
-		snprintf(uci_lookup_str, BUFSIZ, INTERCEPT_SRC_IP_UCI_PREFIX "%s", lan_ip);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save DNS interception setting to UCI.\"]}", token->val);
-			return;
-		}
-		snprintf(uci_lookup_str, BUFSIZ, INTERCEPT_DEST_IP_UCI_PREFIX "%s", lan_ip);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save DNS interception setting to UCI.\"]}", token->val);
-			return;
-		}
+		uci_txn_set(&txn, INTERCEPT_UCI_PATH, INTERCEPT_TYPE);
+		uci_txn_set(&txn, INTERCEPT_NAME_UCI_PATH, INTERCEPT_NAME);
+		uci_txn_set(&txn, INTERCEPT_SRC_UCI_PATH, INTERCEPT_SRC);
+		uci_txn_set(&txn, INTERCEPT_PROTO_UCI_PATH, INTERCEPT_PROTO);
+		uci_txn_set(&txn, INTERCEPT_SPORT_UCI_PATH, INTERCEPT_PORT);
+		uci_txn_set(&txn, INTERCEPT_DPORT_UCI_PATH, INTERCEPT_PORT);
+		snprintf(lan_ip_rule, BUFSIZ, "!%s", lan_ip);
+		uci_txn_set(&txn, INTERCEPT_SRC_IP_UCI_PATH, lan_ip_rule);
+		uci_txn_set(&txn, INTERCEPT_DEST_IP_UCI_PATH, lan_ip);
+	}
 
-		if ((res = uci_commit(ctx, &(ptr.p), false)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to enable DNS interception setting to UCI.\"]}", token->val);
-			return;
-		}
+	if (!uci_txn_commit(&txn)) {
+		printf("Status: 500 Internal Server Error\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save DNS settings to UCI.\"]}", token->val);
+		return;
 	}
 
-	FILE* output = NULL;
+	struct resolv_state active;
+	size_t i;
 	char active_dns[BUFSIZ];
-	char tstr[BUFSIZ];
 	char* atdns = active_dns;
 	size_t adnslen = BUFSIZ;
-	size_t len = 0;
+	char sources[BUFSIZ];
+	char* tsources = sources;
+	size_t sourceslen = BUFSIZ;
 	active_dns[0] = '\0';
+	sources[0] = '\0';
 	opendns = false;
 	opendns_family_shield = false;
 	google = false;
 	interception = false;
 	dns[0] = '\0';
 
-	if ((output = popen(GET_DNS_COMMAND, "r")) == NULL) {
+	if (!resolv_read(&active, true)) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to get current nameservers.\"]}", token->val);
 		return;
 	}
-	while (fgets(tstr, BUFSIZ, output) != NULL) {
-		if ((len = strnlen(tstr, BUFSIZ)) >= BUFSIZ) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to get current nameservers.\"]}", token->val);
-			pclose(output);
-			return;
-		} else if (tstr[len-1] == '\n') {
-			tstr[len-1] = '\0';
-		}
-		astpnprintf(&atdns, &adnslen, ",\"%s\"", tstr);
+	for (i = 0; i < active.count; i++) {
+		astpnprintf(&atdns, &adnslen, ",\"%s\"", active.nameservers[i].address);
+		astpnprintf(&tsources, &sourceslen, ",{\"address\":\"%s\",\"source\":\"%s\"}", active.nameservers[i].address, resolv_source_name(active.nameservers[i].source));
 	}
-	if (!feof(output)) {
-		printf("Status: 500 Internal Server Error\n");
-		printf("Content-type: application/json\n\n");
-		printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to get current nameservers.\"]}", token->val);
-		pclose(output);
-		return;
-	}
-	pclose(output);
 
-	strncpy(uci_lookup_str, DNS_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK
-			&& (ptr.flags & UCI_LOOKUP_COMPLETE)) {
+	char configured_dns[BUFSIZ];
+	size_t configured_count = 0;
+	if ((status = uci_cache_list(DNS_UCI_PATH, configured_dns, BUFSIZ, &configured_count)) == UCI_CACHE_FOUND) {
 		size_t dnslen = BUFSIZ;
-		struct uci_element* elm;
+		const char* name = configured_dns;
 		tdns = dns;
-		uci_foreach_element(&(ptr.o->v.list), elm) {
-			if (strcmp(elm->name, OPENDNS_ENHANCED_DNS_1) == 0
-					|| strcmp(elm->name, OPENDNS_ENHANCED_DNS_2) == 0) {
+		for (i = 0; i < configured_count; i++, name += strlen(name) + 1) {
+			if (strcmp(name, OPENDNS_ENHANCED_DNS_1) == 0
+					|| strcmp(name, OPENDNS_ENHANCED_DNS_2) == 0) {
 				opendns = true;
-			} else if (strcmp(elm->name, OPENDNS_FAMILY_SHIELD_DNS_1) == 0
-					|| strcmp(elm->name, OPENDNS_FAMILY_SHIELD_DNS_2) == 0) {
+			} else if (strcmp(name, OPENDNS_FAMILY_SHIELD_DNS_1) == 0
+					|| strcmp(name, OPENDNS_FAMILY_SHIELD_DNS_2) == 0) {
 				opendns_family_shield = true;
-			} else if (strcmp(elm->name, GOOGLE_DNS_1) == 0
-					|| strcmp(elm->name, GOOGLE_DNS_2) == 0) {
+			} else if (strcmp(name, GOOGLE_DNS_1) == 0
+					|| strcmp(name, GOOGLE_DNS_2) == 0) {
 				google = true;
 			} else {
-				astpnprintf(&tdns, &dnslen, ",\"%s\"", elm->name);
+				astpnprintf(&tdns, &dnslen, ",\"%s\"", name);
 			}
 		}
-	} else if (res == UCI_ERR_NOTFOUND || (ptr.flags & UCI_LOOKUP_DONE)) {
+	} else if (status == UCI_CACHE_MISSING) {
 		/* astpnprintf(&terrors, &errlen, ",\"The WAN gateway has not yet been set in UCI.\""); */
 		/* TODO: get from ifconfig if dhcp */
 	} else {
@@ -449,13 +308,12 @@ void post_dns(yajl_val top, struct xsrft* token)
 		return;
 	}
 
-	strncpy(uci_lookup_str, INTERCEPT_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK) {
+	if ((status = uci_cache_exists(INTERCEPT_UCI_PATH)) == UCI_CACHE_ERROR) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to get DNS interception setting from UCI.\"]}", token->val);
 		return;
-	} else if (ptr.flags & UCI_LOOKUP_COMPLETE) {
+	} else if (status == UCI_CACHE_FOUND) {
 		interception = true;
 	}
 
@@ -465,6 +323,7 @@ void post_dns(yajl_val top, struct xsrft* token)
 	data[0] = '\0';
 
 	astpnprintf(&tdata, &datalen, ",\"current_nameservers\":[%s]", active_dns + 1);
+	astpnprintf(&tdata, &datalen, ",\"nameservers\":[%s]", sources + 1);
 	if (opendns) {
 		astpnprintf(&tdata, &datalen, ",\"opendns_enhanced_dns\":true");
 	} else {
@@ -514,3 +373,185 @@ void post_dns(yajl_val top, struct xsrft* token)
 
 }
 
+/* true if the nameservers in UCI filter for FamilyShield, which speed alone should not undo */
+static bool family_shield_configured()
+{
+	char configured[BUFSIZ];
+	const char* name = configured;
+	size_t count = 0;
+	size_t i;
+
+	if (uci_cache_list(DNS_UCI_PATH, configured, BUFSIZ, &count) != UCI_CACHE_FOUND) {
+		return false;
+	}
+	for (i = 0; i < count; i++, name += strlen(name) + 1) {
+		if (strcmp(name, OPENDNS_FAMILY_SHIELD_DNS_1) == 0 || strcmp(name, OPENDNS_FAMILY_SHIELD_DNS_2) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* points the WAN at the members of group, quickest first; the DHCP group clears the list */
+static bool apply_group(const struct dns_bench_candidate* candidates, const struct dns_bench_result* results, size_t count, const char* group)
+{
+	struct uci_txn txn;
+	char dns[BUFSIZ];
+	char* tdns = dns;
+	size_t dnslen = BUFSIZ;
+	unsigned int dns_count = 0;
+	bool used[DNS_BENCH_MAX_CANDIDATES];
+	size_t best;
+	size_t i;
+
+	memset(used, 0x00, sizeof(used));
+	while (strcmp(group, DNS_BENCH_GROUP_DHCP) != 0) {
+		best = count;
+		for (i = 0; i < count; i++) {
+			if (!used[i] && strcmp(candidates[i].group, group) == 0
+					&& (best == count || results[i].median_ms < results[best].median_ms)) {
+				best = i;
+			}
+		}
+		if (best == count) {
+			break;
+		}
+		used[best] = true;
+		astpnprintf(&tdns, &dnslen, "%s", candidates[best].address);
+		dns_count++;
+		if (dnslen > 0) {
+			dnslen--;
+			tdns++;
+		}
+	}
+
+	uci_txn_begin(&txn, uci_alloc_context());
+	uci_txn_set_list(&txn, DNS_UCI_PATH, dns, dns_count);
+	return uci_txn_commit(&txn);
+}
+
+void post_dns_bench(yajl_val top, struct xsrft* token)
+{
+	const char* names_yajl_path[] = {"names", (const char*)0};
+	const char* rounds_yajl_path[] = {"rounds", (const char*)0};
+	const char* timeout_yajl_path[] = {"timeout_ms", (const char*)0};
+	const char* custom_nameservers_yajl_path[] = {"custom_nameservers", (const char*)0};
+	const char* apply_yajl_path[] = {"apply", (const char*)0};
+	yajl_val names_yajl = yajl_tree_get(top, names_yajl_path, yajl_t_array);
+	yajl_val rounds_yajl = yajl_tree_get(top, rounds_yajl_path, yajl_t_any);
+	yajl_val timeout_yajl = yajl_tree_get(top, timeout_yajl_path, yajl_t_any);
+	yajl_val custom_nameservers_yajl = yajl_tree_get(top, custom_nameservers_yajl_path, yajl_t_array);
+	yajl_val apply_yajl = yajl_tree_get(top, apply_yajl_path, yajl_t_any);
+	const char* names[DNS_BENCH_MAX_NAMES];
+	struct dns_bench_candidate candidates[DNS_BENCH_MAX_CANDIDATES];
+	struct dns_bench_result results[DNS_BENCH_MAX_CANDIDATES];
+	struct dns_bench_options options;
+	struct resolv_state active;
+	size_t count = 0;
+	const char* fastest;
+	bool applied = false;
+	size_t i;
+
+	memset(&options, 0x00, sizeof(struct dns_bench_options));
+	if (names_yajl != NULL) {
+		if (names_yajl->u.array.len == 0 || names_yajl->u.array.len > DNS_BENCH_MAX_NAMES) {
+			printf("Status: 422 Unprocessable Entity\n");
+			printf("Content-type: application/json\n\n");
+			printf("{\"xsrf\":\"%s\",\"errors\":[\"Between 1 and %d names may be benchmarked.\"]}", token->val, DNS_BENCH_MAX_NAMES);
+			return;
+		}
+		for (i = 0; i < names_yajl->u.array.len; i++) {
+			names[i] = YAJL_GET_STRING(names_yajl->u.array.values[i]);
+			if (names[i] == NULL || !dns_bench_valid_name(names[i])) {
+				printf("Status: 422 Unprocessable Entity\n");
+				printf("Content-type: application/json\n\n");
+				printf("{\"xsrf\":\"%s\",\"errors\":[\"Each name to benchmark must be a host name such as 'www.example.com'.\"]}", token->val);
+				return;
+			}
+		}
+		options.names = names;
+		options.name_count = names_yajl->u.array.len;
+	}
+	if (rounds_yajl != NULL) {
+		if (!YAJL_IS_INTEGER(rounds_yajl) || YAJL_GET_INTEGER(rounds_yajl) < 1 || YAJL_GET_INTEGER(rounds_yajl) > DNS_BENCH_MAX_ROUNDS) {
+			printf("Status: 422 Unprocessable Entity\n");
+			printf("Content-type: application/json\n\n");
+			printf("{\"xsrf\":\"%s\",\"errors\":[\"Rounds must be a number from 1 to %d.\"]}", token->val, DNS_BENCH_MAX_ROUNDS);
+			return;
+		}
+		options.rounds = (unsigned int)YAJL_GET_INTEGER(rounds_yajl);
+	}
+	if (timeout_yajl != NULL) {
+		if (!YAJL_IS_INTEGER(timeout_yajl) || YAJL_GET_INTEGER(timeout_yajl) < DNS_BENCH_MIN_TIMEOUT_MS || YAJL_GET_INTEGER(timeout_yajl) > DNS_BENCH_MAX_TIMEOUT_MS) {
+			printf("Status: 422 Unprocessable Entity\n");
+			printf("Content-type: application/json\n\n");
+			printf("{\"xsrf\":\"%s\",\"errors\":[\"The timeout must be from %d to %d milliseconds.\"]}", token->val, DNS_BENCH_MIN_TIMEOUT_MS, DNS_BENCH_MAX_TIMEOUT_MS);
+			return;
+		}
+		options.timeout_ms = (long)YAJL_GET_INTEGER(timeout_yajl);
+	}
+	if (apply_yajl != NULL && !YAJL_IS_TRUE(apply_yajl) && !YAJL_IS_FALSE(apply_yajl)) {
+		printf("Status: 422 Unprocessable Entity\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"xsrf\":\"%s\",\"errors\":[\"Apply value must be true or false (literally {'apply':true} or {'apply':false} as per the JSON spec).\"]}", token->val);
+		return;
+	}
+
+	dns_bench_add_presets(candidates, &count);
+	if (resolv_read(&active, true)) {
+		for (i = 0; i < active.count; i++) {
+			if (active.nameservers[i].source == RESOLV_SOURCE_DHCP) {
+				dns_bench_add(candidates, &count, active.nameservers[i].address, DNS_BENCH_GROUP_DHCP);
+			}
+		}
+	}
+	if (custom_nameservers_yajl != NULL) {
+		for (i = 0; i < custom_nameservers_yajl->u.array.len; i++) {
+			char* tstr = YAJL_GET_STRING(custom_nameservers_yajl->u.array.values[i]);
+			struct in_addr temp;
+			if (tstr == NULL || strnlen(tstr, MAX_IP_LENGTH + 1) > MAX_IP_LENGTH || inet_pton(AF_INET, tstr, &temp) != 1) {
+				printf("Status: 422 Unprocessable Entity\n");
+				printf("Content-type: application/json\n\n");
+				printf("{\"xsrf\":\"%s\",\"errors\":[\"A custom nameserver is currently required to be an IPv4 address sent in dotted-quad notation.\"]}", token->val);
+				return;
+			}
+			dns_bench_add(candidates, &count, tstr, DNS_BENCH_GROUP_CUSTOM);
+		}
+	}
+
+	if (!dns_bench_run(candidates, count, &options, results)) {
+		printf("Status: 500 Internal Server Error\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to run the DNS benchmark.\"]}", token->val);
+		syslog(LOG_ERR, "Unable to run the DNS benchmark");
+		return;
+	}
+	/* FamilyShield filters; picking it, or leaving it, is not a question of speed */
+	fastest = dns_bench_fastest(candidates, results, count, DNS_BENCH_GROUP_FAMILY_SHIELD);
+
+	if (apply_yajl != NULL && YAJL_IS_TRUE(apply_yajl) && fastest != NULL && !family_shield_configured()) {
+		if (!apply_group(candidates, results, count, fastest)) {
+			printf("Status: 500 Internal Server Error\n");
+			printf("Content-type: application/json\n\n");
+			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save DNS settings to UCI.\"]}", token->val);
+			return;
+		}
+		applied = true;
+	}
+
+	printf("Status: 200 OK\n");
+	printf("Content-type: application/json\n\n");
+	printf("{\"xsrf\":\"%s\",\"results\":[", token->val);
+	for (i = 0; i < count; i++) {
+		printf("%s{\"address\":\"%s\",\"group\":\"%s\",\"sent\":%u,\"answered\":%u,", (i == 0) ? "" : ",", candidates[i].address, candidates[i].group, results[i].sent, results[i].answered);
+		if (results[i].answered > 0) {
+			printf("\"median_ms\":%.1f,\"p95_ms\":%.1f,", results[i].median_ms, results[i].p95_ms);
+		}
+		printf("\"failure_rate\":%.2f}", results[i].failure_rate);
+	}
+	printf("]");
+	if (fastest != NULL) {
+		printf(",\"fastest\":\"%s\"", fastest);
+	}
+	printf(",\"applied\":%s}", applied ? "true" : "false");
+}
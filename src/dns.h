@@ -28,4 +28,7 @@
 
 void post_dns(yajl_val top, struct xsrft* token);
 
+/* times the preset, DHCP, and custom resolvers and can switch to the fastest */
+void post_dns_bench(yajl_val top, struct xsrft* token);
+
 #endif
@@ -0,0 +1,440 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "dns_bench.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "resolv.h"
+#include "urandom.h"
+
+#define DNS_PORT 53
+#define DNS_HEADER_LENGTH 12
+#define DNS_MAX_PACKET_LENGTH 512
+#define DNS_MAX_NAME_LENGTH 253
+#define DNS_MAX_LABEL_LENGTH 63
+#define DNS_FLAG_RESPONSE 0x80
+#define DNS_FLAG_RECURSION_DESIRED 0x01
+#define DNS_RCODE_MASK 0x0F
+#define DNS_RCODE_NOERROR 0
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_TYPE_A 1
+#define DNS_CLASS_IN 1
+#define MAX_QUERIES (DNS_BENCH_MAX_NAMES * DNS_BENCH_MAX_ROUNDS)
+#define RECEIVE_BATCH 16
+
+enum query_state {
+	QUERY_PENDING = 0,
+	QUERY_ANSWERED,
+	QUERY_FAILED
+};
+
+/* everything after the ID, which is the same for every query of a name */
+struct question {
+	unsigned char packet[DNS_MAX_PACKET_LENGTH];
+	size_t length;
+};
+
+struct target {
+	int sock;
+	uint16_t first_id;
+	size_t queries;
+	size_t outstanding;
+	long sent_us;
+	unsigned char ids[MAX_QUERIES][2];
+	enum query_state states[MAX_QUERIES];
+	long latencies_us[MAX_QUERIES];
+	size_t answered;
+};
+
+static const char* const default_names[] = {
+	"www.google.com",
+	"www.facebook.com",
+	"www.youtube.com",
+	"www.amazon.com",
+	"www.wikipedia.org",
+	"www.netflix.com"
+};
+
+static long monotonic_us()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+bool dns_bench_valid_name(const char* name)
+{
+	size_t length = strlen(name);
+	size_t label = 0;
+	size_t i;
+
+	if (length == 0 || length > DNS_MAX_NAME_LENGTH) {
+		return false;
+	}
+	for (i = 0; i < length; i++) {
+		if (name[i] == '.') {
+			if (label == 0) {
+				return false;
+			}
+			label = 0;
+		} else if (++label > DNS_MAX_LABEL_LENGTH
+				|| !((name[i] >= 'a' && name[i] <= 'z') || (name[i] >= 'A' && name[i] <= 'Z')
+					|| (name[i] >= '0' && name[i] <= '9') || name[i] == '-' || name[i] == '_')) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* the flags, counts, and question of a recursive A query */
+static void build_question(const char* name, struct question* question)
+{
+	unsigned char* out = question->packet;
+	const char* label = name;
+	const char* dot;
+	size_t len;
+
+	memset(out, 0x00, DNS_HEADER_LENGTH - 2);
+	out[0] = DNS_FLAG_RECURSION_DESIRED;
+	out[3] = 1;
+	out += DNS_HEADER_LENGTH - 2;
+	while (*label != '\0') {
+		dot = strchr(label, '.');
+		len = (dot == NULL) ? strlen(label) : (size_t)(dot - label);
+		*(out++) = (unsigned char)len;
+		memcpy(out, label, len);
+		out += len;
+		label += len + ((dot == NULL) ? 0 : 1);
+	}
+	*(out++) = 0;
+	*(out++) = 0;
+	*(out++) = DNS_TYPE_A;
+	*(out++) = 0;
+	*(out++) = DNS_CLASS_IN;
+	question->length = out - question->packet;
+}
+
+static int open_target(const struct dns_bench_candidate* candidate)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	uint16_t port = htons((candidate->port == 0) ? DNS_PORT : candidate->port);
+	int sock;
+
+	memset(&addr, 0x00, sizeof(struct sockaddr_storage));
+	if (inet_pton(AF_INET, candidate->address, &(((struct sockaddr_in*)&addr)->sin_addr)) == 1) {
+		((struct sockaddr_in*)&addr)->sin_family = AF_INET;
+		((struct sockaddr_in*)&addr)->sin_port = port;
+		addr_len = sizeof(struct sockaddr_in);
+	} else if (inet_pton(AF_INET6, candidate->address, &(((struct sockaddr_in6*)&addr)->sin6_addr)) == 1) {
+		((struct sockaddr_in6*)&addr)->sin6_family = AF_INET6;
+		((struct sockaddr_in6*)&addr)->sin6_port = port;
+		addr_len = sizeof(struct sockaddr_in6);
+	} else {
+		return -1;
+	}
+
+	/* connected, so that only this resolver's answers arrive and ICMP errors are reported */
+	if ((sock = socket(addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+		return -1;
+	} else if (connect(sock, (struct sockaddr*)&addr, addr_len) == -1) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+static void give_up(struct target* target)
+{
+	size_t i;
+
+	for (i = 0; i < target->queries; i++) {
+		if (target->states[i] == QUERY_PENDING) {
+			target->states[i] = QUERY_FAILED;
+		}
+	}
+	target->outstanding = 0;
+	if (target->sock != -1) {
+		close(target->sock);
+		target->sock = -1;
+	}
+}
+
+static void send_queries(struct target* target, const struct question* questions, size_t name_count)
+{
+	struct mmsghdr messages[MAX_QUERIES];
+	struct iovec iovs[MAX_QUERIES][2];
+	size_t done = 0;
+	uint16_t id;
+	size_t i;
+	int res;
+
+	memset(messages, 0x00, sizeof(struct mmsghdr) * target->queries);
+	for (i = 0; i < target->queries; i++) {
+		id = (uint16_t)(target->first_id + i);
+		target->ids[i][0] = (unsigned char)(id >> 8);
+		target->ids[i][1] = (unsigned char)(id & 0xFF);
+		iovs[i][0].iov_base = target->ids[i];
+		iovs[i][0].iov_len = 2;
+		iovs[i][1].iov_base = (void*)questions[i % name_count].packet;
+		iovs[i][1].iov_len = questions[i % name_count].length;
+		messages[i].msg_hdr.msg_iov = iovs[i];
+		messages[i].msg_hdr.msg_iovlen = 2;
+	}
+
+	target->sent_us = monotonic_us();
+	while (done < target->queries) {
+		if ((res = sendmmsg(target->sock, messages + done, target->queries - done, 0)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			/* whatever could not be sent has failed */
+			for (i = done; i < target->queries; i++) {
+				target->states[i] = QUERY_FAILED;
+			}
+			target->outstanding = done;
+			return;
+		}
+		done += res;
+	}
+	target->outstanding = target->queries;
+}
+
+static void receive_answers(struct target* target)
+{
+	unsigned char buffers[RECEIVE_BATCH][DNS_MAX_PACKET_LENGTH];
+	struct mmsghdr messages[RECEIVE_BATCH];
+	struct iovec iovs[RECEIVE_BATCH];
+	const unsigned char* packet;
+	long now;
+	size_t index;
+	int count;
+	int i;
+
+	while (target->outstanding > 0) {
+		memset(messages, 0x00, sizeof(messages));
+		for (i = 0; i < RECEIVE_BATCH; i++) {
+			iovs[i].iov_base = buffers[i];
+			iovs[i].iov_len = DNS_MAX_PACKET_LENGTH;
+			messages[i].msg_hdr.msg_iov = &iovs[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+		}
+		if ((count = recvmmsg(target->sock, messages, RECEIVE_BATCH, MSG_DONTWAIT, NULL)) == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				/* most likely port unreachable */
+				give_up(target);
+			}
+			return;
+		}
+		now = monotonic_us();
+		for (i = 0; i < count; i++) {
+			packet = buffers[i];
+			if (messages[i].msg_len < DNS_HEADER_LENGTH || (packet[2] & DNS_FLAG_RESPONSE) == 0) {
+				continue;
+			}
+			index = (uint16_t)(((packet[0] << 8) | packet[1]) - target->first_id);
+			if (index >= target->queries || target->states[index] != QUERY_PENDING) {
+				continue;
+			}
+			target->outstanding--;
+			if ((packet[3] & DNS_RCODE_MASK) == DNS_RCODE_NOERROR || (packet[3] & DNS_RCODE_MASK) == DNS_RCODE_NXDOMAIN) {
+				target->states[index] = QUERY_ANSWERED;
+				target->latencies_us[target->answered++] = now - target->sent_us;
+			} else {
+				target->states[index] = QUERY_FAILED;
+			}
+		}
+	}
+}
+
+static int compare_longs(const void* a, const void* b)
+{
+	long x = *(const long*)a;
+	long y = *(const long*)b;
+	return (x > y) - (x < y);
+}
+
+/* nearest rank, so the value is one that was really measured */
+static double percentile_ms(const long* sorted_us, size_t count, unsigned int percent)
+{
+	size_t rank = (count * percent + 99) / 100;
+	return (rank == 0) ? 0.0 : sorted_us[rank - 1] / 1000.0;
+}
+
+static void summarize(struct target* target, struct dns_bench_result* result)
+{
+	memset(result, 0x00, sizeof(struct dns_bench_result));
+	result->sent = target->queries;
+	result->answered = target->answered;
+	result->failure_rate = 1.0;
+	if (target->queries > 0) {
+		result->failure_rate = (double)(target->queries - target->answered) / target->queries;
+	}
+	if (target->answered > 0) {
+		qsort(target->latencies_us, target->answered, sizeof(long), &compare_longs);
+		result->median_ms = percentile_ms(target->latencies_us, target->answered, 50);
+		result->p95_ms = percentile_ms(target->latencies_us, target->answered, 95);
+	}
+}
+
+bool dns_bench_run(const struct dns_bench_candidate* candidates, size_t count, const struct dns_bench_options* options, struct dns_bench_result* results)
+{
+	const char* const* names = (options->names != NULL) ? options->names : default_names;
+	size_t name_count = (options->names != NULL) ? options->name_count : sizeof(default_names) / sizeof(default_names[0]);
+	unsigned int rounds = (options->rounds == 0) ? DNS_BENCH_DEFAULT_ROUNDS : options->rounds;
+	long timeout_ms = (options->timeout_ms <= 0) ? DNS_BENCH_DEFAULT_TIMEOUT_MS : options->timeout_ms;
+	struct question questions[DNS_BENCH_MAX_NAMES];
+	struct pollfd fds[DNS_BENCH_MAX_CANDIDATES];
+	struct target* owners[DNS_BENCH_MAX_CANDIDATES];
+	uint16_t first_ids[DNS_BENCH_MAX_CANDIDATES];
+	struct target* targets;
+	long deadline_us;
+	long wait_ms;
+	nfds_t waiting;
+	size_t i;
+
+	if (count == 0 || count > DNS_BENCH_MAX_CANDIDATES || name_count == 0 || name_count > DNS_BENCH_MAX_NAMES
+			|| rounds > DNS_BENCH_MAX_ROUNDS) {
+		return false;
+	}
+	for (i = 0; i < name_count; i++) {
+		if (!dns_bench_valid_name(names[i])) {
+			return false;
+		}
+		build_question(names[i], &questions[i]);
+	}
+	if ((targets = calloc(count, sizeof(struct target))) == NULL) {
+		return false;
+	}
+
+	if (urandom((unsigned char*)first_ids, sizeof(uint16_t) * count) < 0) {
+		for (i = 0; i < count; i++) {
+			first_ids[i] = (uint16_t)(monotonic_us() + i * MAX_QUERIES);
+		}
+	}
+	for (i = 0; i < count; i++) {
+		targets[i].queries = name_count * rounds;
+		targets[i].first_id = first_ids[i];
+		if ((targets[i].sock = open_target(&candidates[i])) == -1) {
+			give_up(&targets[i]);
+		}
+	}
+	/* every resolver gets its batch before any answer is read, so none has a head start */
+	for (i = 0; i < count; i++) {
+		if (targets[i].sock != -1) {
+			send_queries(&targets[i], questions, name_count);
+		}
+	}
+
+	deadline_us = monotonic_us() + timeout_ms * 1000;
+	while (1) {
+		waiting = 0;
+		for (i = 0; i < count; i++) {
+			if (targets[i].sock != -1 && targets[i].outstanding > 0) {
+				fds[waiting].fd = targets[i].sock;
+				fds[waiting].events = POLLIN;
+				owners[waiting++] = &targets[i];
+			}
+		}
+		if (waiting == 0 || (wait_ms = (deadline_us - monotonic_us()) / 1000) <= 0) {
+			break;
+		}
+		if (poll(fds, waiting, wait_ms) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		for (i = 0; i < waiting; i++) {
+			if (fds[i].revents != 0) {
+				receive_answers(owners[i]);
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		give_up(&targets[i]);
+		summarize(&targets[i], &results[i]);
+	}
+	free(targets);
+	return true;
+}
+
+const char* dns_bench_fastest(const struct dns_bench_candidate* candidates, const struct dns_bench_result* results, size_t count, const char* skip_group)
+{
+	const char* fastest = NULL;
+	double best = 0.0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (candidates[i].group == NULL || results[i].answered == 0
+				|| results[i].failure_rate > DNS_BENCH_MAX_FAILURE_RATE
+				|| (skip_group != NULL && strcmp(candidates[i].group, skip_group) == 0)) {
+			continue;
+		}
+		if (fastest == NULL || results[i].median_ms < best) {
+			fastest = candidates[i].group;
+			best = results[i].median_ms;
+		}
+	}
+	return fastest;
+}
+
+void dns_bench_add(struct dns_bench_candidate* candidates, size_t* count, const char* address, const char* group)
+{
+	size_t i;
+
+	for (i = 0; i < *count; i++) {
+		if (strcmp(candidates[i].address, address) == 0) {
+			return;
+		}
+	}
+	if (*count < DNS_BENCH_MAX_CANDIDATES && strlen(address) < DNS_BENCH_ADDRESS_LENGTH) {
+		memset(&candidates[*count], 0x00, sizeof(struct dns_bench_candidate));
+		strcpy(candidates[*count].address, address);
+		candidates[*count].group = group;
+		(*count)++;
+	}
+}
+
+void dns_bench_add_presets(struct dns_bench_candidate* candidates, size_t* count)
+{
+	dns_bench_add(candidates, count, OPENDNS_ENHANCED_DNS_1, DNS_BENCH_GROUP_OPENDNS);
+	dns_bench_add(candidates, count, OPENDNS_ENHANCED_DNS_2, DNS_BENCH_GROUP_OPENDNS);
+	dns_bench_add(candidates, count, OPENDNS_FAMILY_SHIELD_DNS_1, DNS_BENCH_GROUP_FAMILY_SHIELD);
+	dns_bench_add(candidates, count, OPENDNS_FAMILY_SHIELD_DNS_2, DNS_BENCH_GROUP_FAMILY_SHIELD);
+	dns_bench_add(candidates, count, GOOGLE_DNS_1, DNS_BENCH_GROUP_GOOGLE);
+	dns_bench_add(candidates, count, GOOGLE_DNS_2, DNS_BENCH_GROUP_GOOGLE);
+}
@@ -0,0 +1,94 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_DNS_BENCH_H
+#define WIOMW_SUI_DNS_BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DNS_BENCH_ADDRESS_LENGTH 46
+#define DNS_BENCH_MAX_CANDIDATES 16
+#define DNS_BENCH_MAX_NAMES 16
+#define DNS_BENCH_MAX_ROUNDS 8
+#define DNS_BENCH_DEFAULT_ROUNDS 2
+#define DNS_BENCH_DEFAULT_TIMEOUT_MS 2000
+/* the presets are grouped under the names post_dns uses for them */
+#define DNS_BENCH_GROUP_OPENDNS "opendns_enhanced_dns"
+#define DNS_BENCH_GROUP_FAMILY_SHIELD "opendns_family_shield_dns"
+#define DNS_BENCH_GROUP_GOOGLE "google_dns"
+#define DNS_BENCH_GROUP_DHCP "dhcp"
+#define DNS_BENCH_GROUP_CUSTOM "custom_nameservers"
+/* a resolver that loses more than this share of queries is never the fastest */
+#define DNS_BENCH_MAX_FAILURE_RATE 0.25
+
+struct dns_bench_candidate {
+	char address[DNS_BENCH_ADDRESS_LENGTH];
+	/* 0 means the standard port */
+	uint16_t port;
+	/* resolvers that are chosen together, such as both Google addresses, share a group */
+	const char* group;
+};
+
+struct dns_bench_options {
+	/* NULL for a built-in set of popular names */
+	const char* const* names;
+	size_t name_count;
+	/* how many times each name is asked of each resolver */
+	unsigned int rounds;
+	long timeout_ms;
+};
+
+struct dns_bench_result {
+	unsigned int sent;
+	unsigned int answered;
+	double median_ms;
+	double p95_ms;
+	/* unanswered, refused, or failed queries over those that should have been sent */
+	double failure_rate;
+};
+
+/*
+ * Sends every name to every candidate at once, rounds times over, and
+ * collects the answers until they are all in or timeout_ms has passed.
+ * NOERROR and NXDOMAIN count as answers. Returns false if the options are
+ * unusable; an unreachable candidate just fails all of its queries.
+ */
+bool dns_bench_run(const struct dns_bench_candidate* candidates, size_t count, const struct dns_bench_options* options, struct dns_bench_result* results);
+
+/*
+ * The group whose quickest reliable member has the lowest median, leaving
+ * out skip_group if it is not NULL. Returns NULL if no group is reliable.
+ */
+const char* dns_bench_fastest(const struct dns_bench_candidate* candidates, const struct dns_bench_result* results, size_t count, const char* skip_group);
+
+/* appends a candidate unless the address is already listed or there is no room */
+void dns_bench_add(struct dns_bench_candidate* candidates, size_t* count, const char* address, const char* group);
+
+/* the OpenDNS, FamilyShield, and Google addresses */
+void dns_bench_add_presets(struct dns_bench_candidate* candidates, size_t* count);
+
+/* true if name can be sent as a query */
+bool dns_bench_valid_name(const char* name);
+
+#endif
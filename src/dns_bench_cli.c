@@ -0,0 +1,130 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dns_bench.h"
+#include "resolv.h"
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-n name]... [-r rounds] [-t timeout_ms] [address[#port]]...\n", name);
+	fprintf(stderr, "Without addresses, the OpenDNS, FamilyShield, Google, and DHCP resolvers are timed.\n");
+}
+
+/* "1.2.3.4#5353", as dnsmasq writes it, picks a port other than 53 */
+static bool parse_address(const char* arg, struct dns_bench_candidate* candidate)
+{
+	const char* port = strchr(arg, '#');
+	size_t len = (port == NULL) ? strlen(arg) : (size_t)(port - arg);
+	long number = 0;
+
+	if (len == 0 || len >= DNS_BENCH_ADDRESS_LENGTH) {
+		return false;
+	}
+	if (port != NULL && ((number = strtol(port + 1, NULL, 10)) <= 0 || number > 65535)) {
+		return false;
+	}
+	memset(candidate, 0x00, sizeof(struct dns_bench_candidate));
+	memcpy(candidate->address, arg, len);
+	candidate->port = (uint16_t)number;
+	/* each address given is its own group, so that the fastest can be named */
+	candidate->group = arg;
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	const char* names[DNS_BENCH_MAX_NAMES];
+	struct dns_bench_candidate candidates[DNS_BENCH_MAX_CANDIDATES];
+	struct dns_bench_result results[DNS_BENCH_MAX_CANDIDATES];
+	struct dns_bench_options options;
+	struct resolv_state active;
+	const char* fastest;
+	size_t count = 0;
+	size_t i;
+	int opt;
+
+	memset(&options, 0x00, sizeof(struct dns_bench_options));
+	while ((opt = getopt(argc, argv, "n:r:t:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			if (options.name_count >= DNS_BENCH_MAX_NAMES || !dns_bench_valid_name(optarg)) {
+				fprintf(stderr, "Invalid or too many names: %s\n", optarg);
+				return 2;
+			}
+			names[options.name_count++] = optarg;
+			options.names = names;
+			break;
+		case 'r':
+			options.rounds = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			options.timeout_ms = strtol(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return (opt == 'h') ? 0 : 2;
+		}
+	}
+
+	for (i = optind; i < (size_t)argc; i++) {
+		if (count >= DNS_BENCH_MAX_CANDIDATES || !parse_address(argv[i], &candidates[count++])) {
+			fprintf(stderr, "Invalid or too many addresses: %s\n", argv[i]);
+			return 2;
+		}
+	}
+	if (count == 0) {
+		dns_bench_add_presets(candidates, &count);
+		if (resolv_read(&active, false)) {
+			for (i = 0; i < active.count; i++) {
+				if (active.nameservers[i].source == RESOLV_SOURCE_DHCP) {
+					dns_bench_add(candidates, &count, active.nameservers[i].address, DNS_BENCH_GROUP_DHCP);
+				}
+			}
+		}
+	}
+
+	if (!dns_bench_run(candidates, count, &options, results)) {
+		fprintf(stderr, "Unable to run the benchmark; check the names and the number of rounds (at most %d).\n", DNS_BENCH_MAX_ROUNDS);
+		return 1;
+	}
+
+	printf("%-40s %-26s %9s %9s %9s %6s\n", "address", "group", "answered", "median", "p95", "fail");
+	for (i = 0; i < count; i++) {
+		printf("%-40s %-26s %4u/%-4u %7.1fms %7.1fms %5.0f%%\n", candidates[i].address, candidates[i].group,
+				results[i].answered, results[i].sent, results[i].median_ms, results[i].p95_ms,
+				results[i].failure_rate * 100.0);
+	}
+	if ((fastest = dns_bench_fastest(candidates, results, count, NULL)) != NULL) {
+		printf("fastest: %s\n", fastest);
+	} else {
+		printf("fastest: none answered reliably\n");
+	}
+	return 0;
+}
@@ -0,0 +1,289 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "download.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "digest.h"
+#include "http_client.h"
+
+#define DOWNLOAD_META_MAGIC 0x444C4D31
+#define DOWNLOAD_URL_LENGTH 1024
+#define DOWNLOAD_PATH_LENGTH 1024
+#define DOWNLOAD_CHECKPOINT_BYTES 262144
+#define DOWNLOAD_REQUEST_RETRIES 2
+
+/*
+ * The polarssl contexts are plain data, so the hash state of the validated
+ * prefix is stored as is. The layout check keeps a different build from
+ * trusting it.
+ */
+struct download_meta {
+	uint32_t magic;
+	uint32_t layout;
+	char url[DOWNLOAD_URL_LENGTH];
+	char md5[DIGEST_MD5_HEX_LENGTH];
+	long long size;
+	long long validated;
+	struct digest digest;
+};
+
+struct download_state {
+	const struct download_job* job;
+	char meta_path[DOWNLOAD_PATH_LENGTH];
+	struct download_meta meta;
+	FILE* file;
+	long long since_checkpoint;
+};
+
+static void meta_path_for(const char* path, char meta_path[DOWNLOAD_PATH_LENGTH])
+{
+	snprintf(meta_path, DOWNLOAD_PATH_LENGTH, "%s" DOWNLOAD_META_SUFFIX, path);
+}
+
+static bool meta_describes(const struct download_meta* meta, const struct download_job* job)
+{
+	return meta->magic == DOWNLOAD_META_MAGIC
+		&& meta->layout == sizeof(struct download_meta)
+		&& strncmp(meta->url, job->url, DOWNLOAD_URL_LENGTH) == 0
+		&& strncmp(meta->md5, job->md5, DIGEST_MD5_HEX_LENGTH) == 0
+		&& meta->size == job->size
+		&& meta->validated >= 0 && meta->validated <= meta->size;
+}
+
+static bool load_meta(const char* meta_path, struct download_meta* meta)
+{
+	FILE* meta_file;
+	bool ok;
+
+	if ((meta_file = fopen(meta_path, "r")) == NULL) {
+		return false;
+	}
+	ok = fread(meta, sizeof(struct download_meta), 1, meta_file) == 1;
+	fclose(meta_file);
+	return ok;
+}
+
+static bool save_meta(struct download_state* state)
+{
+	char temp_path[DOWNLOAD_PATH_LENGTH + 4];
+	FILE* meta_file;
+
+	/* the recorded prefix must never get ahead of what is really in the file */
+	if (fflush(state->file) != 0) {
+		return false;
+	}
+
+	snprintf(temp_path, sizeof(temp_path), "%s.tmp", state->meta_path);
+	if ((meta_file = fopen(temp_path, "w")) == NULL) {
+		return false;
+	}
+	if (fwrite(&(state->meta), sizeof(struct download_meta), 1, meta_file) != 1) {
+		fclose(meta_file);
+		unlink(temp_path);
+		return false;
+	}
+	if (fclose(meta_file) != 0 || rename(temp_path, state->meta_path) != 0) {
+		unlink(temp_path);
+		return false;
+	}
+	state->since_checkpoint = 0;
+	return true;
+}
+
+static void reset_meta(struct download_state* state)
+{
+	memset(&(state->meta), 0x00, sizeof(struct download_meta));
+	state->meta.magic = DOWNLOAD_META_MAGIC;
+	state->meta.layout = sizeof(struct download_meta);
+	strncpy(state->meta.url, state->job->url, DOWNLOAD_URL_LENGTH - 1);
+	strncpy(state->meta.md5, state->job->md5, DIGEST_MD5_HEX_LENGTH - 1);
+	state->meta.size = state->job->size;
+	state->meta.validated = 0;
+	digest_init(&(state->meta.digest));
+}
+
+static bool restart(struct download_state* state)
+{
+	reset_meta(state);
+	return fflush(state->file) == 0 && ftruncate(fileno(state->file), 0) == 0
+		&& fseeko(state->file, 0, SEEK_SET) == 0;
+}
+
+static bool progress_hook(void* raw_state, const unsigned char* data, size_t len)
+{
+	struct download_state* state = (struct download_state*)raw_state;
+
+	digest_update(&(state->meta.digest), data, len);
+	state->meta.validated += len;
+	state->since_checkpoint += len;
+	if (state->since_checkpoint >= DOWNLOAD_CHECKPOINT_BYTES) {
+		save_meta(state);
+	}
+	if (state->job->progress != NULL) {
+		state->job->progress(state->job->progress_arg, state->meta.validated, state->job->size);
+	}
+	return true;
+}
+
+static bool open_file(struct download_state* state)
+{
+	struct stat file_stat;
+	int fd;
+
+	if ((fd = open(state->job->path, O_WRONLY | O_CREAT, 0644)) == -1) {
+		return false;
+	}
+	if (fstat(fd, &file_stat) == -1 || (state->file = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		return false;
+	}
+
+	if (!load_meta(state->meta_path, &(state->meta)) || !meta_describes(&(state->meta), state->job)
+			|| file_stat.st_size < state->meta.validated) {
+		return restart(state);
+	}
+
+	/* anything past the recorded prefix was never hashed, so fetch it again */
+	return ftruncate(fd, state->meta.validated) == 0
+		&& fseeko(state->file, state->meta.validated, SEEK_SET) == 0;
+}
+
+const char* download_fetch(const struct download_job* job, struct digest_result* result)
+{
+	struct download_state state;
+	struct http_request request;
+	struct http_response response;
+	const char* error = "Error while contacting update server.";
+	unsigned int attempt;
+	bool ok = false;
+
+	memset(&state, 0x00, sizeof(struct download_state));
+	state.job = job;
+	meta_path_for(job->path, state.meta_path);
+
+	if (!open_file(&state)) {
+		syslog(LOG_ERR, "Unable to open update file for writing: %s", strerror(errno));
+		if (state.file != NULL) {
+			fclose(state.file);
+		}
+		return "Error while preparing update file.";
+	}
+	if (state.meta.validated > 0) {
+		syslog(LOG_INFO, "Resuming update download at byte %lld of %lld", state.meta.validated, job->size);
+	}
+	if (job->progress != NULL) {
+		job->progress(job->progress_arg, state.meta.validated, job->size);
+	}
+
+	for (attempt = 0; attempt < job->attempts && state.meta.validated < job->size; attempt++) {
+		if (attempt > 0 && job->retry_delay_ms > 0) {
+			http_sleep_ms(job->retry_delay_ms);
+		}
+
+		memset(&request, 0x00, sizeof(struct http_request));
+		request.url = job->url;
+		request.timeout_ms = job->timeout_ms;
+		request.retries = DOWNLOAD_REQUEST_RETRIES;
+		request.resume_from = state.meta.validated;
+		/* nothing past the expected size ever reaches tmpfs */
+		request.max_length = job->size - state.meta.validated;
+		request.file = state.file;
+		request.hook = &progress_hook;
+		request.hook_arg = &state;
+
+		ok = http_perform(&request, &response);
+		save_meta(&state);
+		if (ok) {
+			break;
+		} else if (response.result == CURLE_RANGE_ERROR || response.http_code == 416) {
+			/* the server will not resume this one, so start it over */
+			syslog(LOG_WARNING, "Update server refused to resume the download, starting over");
+			if (!restart(&state) || !save_meta(&state)) {
+				error = "Error while preparing update file.";
+				break;
+			}
+		} else if (response.overflowed) {
+			/* what did fit is left for the md5 to judge */
+			syslog(LOG_WARNING, "Update server sent more than the expected %lld bytes", job->size);
+			error = "Downloaded update file was the wrong size.";
+			break;
+		} else if (response.http_code >= 400) {
+			syslog(LOG_WARNING, "Unable to get update file, got HTTP code: %lu", response.http_code);
+			break;
+		} else if (response.result == CURLE_WRITE_ERROR) {
+			syslog(LOG_ERR, "Unable to write update file: %s", response.error);
+			error = "Error while preparing update file.";
+			break;
+		} else {
+			syslog(LOG_WARNING, "Update download interrupted at byte %lld: %s", state.meta.validated, response.error);
+		}
+	}
+
+	if (fclose(state.file) != 0) {
+		syslog(LOG_ERR, "Unable to finish writing update file: %s", strerror(errno));
+		download_discard(job->path);
+		return "Error while preparing update file.";
+	}
+
+	if (state.meta.validated == job->size) {
+		digest_finish(&(state.meta.digest), result);
+		download_discard(job->path);
+		return NULL;
+	}
+
+	if (state.meta.validated > job->size) {
+		download_discard(job->path);
+		return "Downloaded update file was the wrong size.";
+	}
+	/* keep what we have so the next attempt only fetches the rest */
+	return error;
+}
+
+bool download_resumable(const struct download_job* job)
+{
+	char meta_path[DOWNLOAD_PATH_LENGTH];
+	struct download_meta meta;
+	struct stat file_stat;
+
+	meta_path_for(job->path, meta_path);
+	return load_meta(meta_path, &meta) && meta_describes(&meta, job)
+		&& stat(job->path, &file_stat) == 0 && file_stat.st_size >= meta.validated;
+}
+
+void download_discard(const char* path)
+{
+	char meta_path[DOWNLOAD_PATH_LENGTH];
+
+	meta_path_for(path, meta_path);
+	unlink(meta_path);
+}
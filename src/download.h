@@ -0,0 +1,65 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_DOWNLOAD_H
+#define WIOMW_SUI_DOWNLOAD_H
+
+#include <stdbool.h>
+
+#include "digest.h"
+
+#define DOWNLOAD_META_SUFFIX ".meta"
+
+/* called with the number of bytes of the file that are in place so far */
+typedef void (*download_progress)(void* arg, long long received, long long size);
+
+struct download_job {
+	const char* url;
+	const char* path;
+	long long size;
+	const char* md5;
+	/* how many times a dropped transfer is resumed before giving up for now */
+	unsigned int attempts;
+	/* per attempt */
+	long timeout_ms;
+	long retry_delay_ms;
+	/* optional */
+	download_progress progress;
+	void* progress_arg;
+};
+
+/*
+ * Fetches job->url into job->path, picking up where an earlier attempt
+ * (possibly in an earlier process) left off. Progress is recorded next to
+ * the file, so a failed call can simply be repeated. Nothing past job->size
+ * is ever written. Returns NULL and the digest of the complete file on
+ * success, or a message for the user.
+ */
+const char* download_fetch(const struct download_job* job, struct digest_result* result);
+
+/* true if job->path holds a partial download of this very job */
+bool download_resumable(const struct download_job* job);
+
+/* forgets the progress recorded for path; the file itself is left alone */
+void download_discard(const char* path);
+
+#endif
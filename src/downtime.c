@@ -0,0 +1,156 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "downtime.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#define UPTIME_PATH "/proc/uptime"
+#define STAMP_NEW_PATH DOWNTIME_STAMP_PATH ".new"
+/* beyond this the clock is not trusted to have bridged the reboot */
+#define MAX_TRUSTED_GAP_MS 600000
+/* noticed any later than this, the boot itself can no longer be told apart */
+#define MAX_BOOT_MS 300000
+
+long long downtime_wall_ms()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return ((long long)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+static long uptime_ms()
+{
+	double seconds = -1;
+	FILE* uptime;
+
+	if ((uptime = fopen(UPTIME_PATH, "r")) == NULL) {
+		return -1;
+	}
+	if (fscanf(uptime, "%lf", &seconds) != 1) {
+		seconds = -1;
+	}
+	fclose(uptime);
+	return (seconds < 0) ? -1 : (long)(seconds * 1000);
+}
+
+bool downtime_read(struct downtime* downtime)
+{
+	FILE* stamp;
+	bool ok;
+
+	downtime->shutdown_ms = 0;
+	downtime->prepare_ms = 0;
+	downtime->last_ms = -1;
+	if ((stamp = fopen(DOWNTIME_STAMP_PATH, "r")) == NULL) {
+		return errno == ENOENT;
+	}
+	ok = fscanf(stamp, "%lld %ld %ld", &(downtime->shutdown_ms), &(downtime->prepare_ms), &(downtime->last_ms)) == 3;
+	fclose(stamp);
+	return ok;
+}
+
+/* replaces the stamp whole, so a reboot in the middle leaves the old one */
+static bool write_stamp(const struct downtime* downtime)
+{
+	FILE* stamp;
+	bool ok;
+
+	if ((stamp = fopen(STAMP_NEW_PATH, "w")) == NULL) {
+		return false;
+	}
+	ok = fprintf(stamp, "%lld %ld %ld\n", downtime->shutdown_ms, downtime->prepare_ms, downtime->last_ms) > 0;
+	ok = fflush(stamp) == 0 && ok;
+	ok = fsync(fileno(stamp)) == 0 && ok;
+	ok = fclose(stamp) == 0 && ok;
+	if (!ok || rename(STAMP_NEW_PATH, DOWNTIME_STAMP_PATH) != 0) {
+		unlink(STAMP_NEW_PATH);
+		return false;
+	}
+	return true;
+}
+
+bool downtime_mark_shutdown(long long shutdown_ms, long prepare_ms)
+{
+	struct downtime downtime;
+
+	downtime_read(&downtime);
+	downtime.shutdown_ms = shutdown_ms;
+	downtime.prepare_ms = prepare_ms;
+	return write_stamp(&downtime);
+}
+
+void downtime_mark_up()
+{
+	struct downtime downtime;
+	long long gap_ms;
+	long up_ms;
+	int flag;
+
+	if (access(DOWNTIME_UP_PATH, F_OK) == 0) {
+		return;
+	} else if ((flag = open(DOWNTIME_UP_PATH, O_WRONLY | O_CREAT | O_EXCL, 0644)) == -1) {
+		/* someone else got here first */
+		return;
+	}
+	close(flag);
+
+	if (!downtime_read(&downtime) || downtime.shutdown_ms == 0 || (up_ms = uptime_ms()) < 0) {
+		return;
+	} else if (up_ms > MAX_BOOT_MS) {
+		downtime.shutdown_ms = 0;
+		write_stamp(&downtime);
+		return;
+	}
+	/*
+	 * The time between handing over to /sbin/reboot and the kernel starting
+	 * again is only known if the clock was right on both sides; before NTP
+	 * answers it is only as late as the newest file in /etc.
+	 */
+	gap_ms = (downtime_wall_ms() - up_ms) - (downtime.shutdown_ms + downtime.prepare_ms);
+	if (gap_ms < 0 || gap_ms > MAX_TRUSTED_GAP_MS) {
+		gap_ms = 0;
+	}
+	downtime.last_ms = downtime.prepare_ms + (long)gap_ms + up_ms;
+	downtime.shutdown_ms = 0;
+	if (write_stamp(&downtime)) {
+		syslog(LOG_INFO, "Back up %ld ms after the reboot was requested", downtime.last_ms);
+	}
+}
+
+long downtime_estimate_ms()
+{
+	struct downtime downtime;
+
+	if (!downtime_read(&downtime) || downtime.last_ms <= 0) {
+		return DOWNTIME_DEFAULT_MS;
+	}
+	return downtime.last_ms;
+}
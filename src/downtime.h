@@ -0,0 +1,60 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_DOWNTIME_H
+#define WIOMW_SUI_DOWNTIME_H
+
+#include <stdbool.h>
+
+/* in /etc so that it outlasts the reboot, which also keeps the clock from going back past it */
+#define DOWNTIME_STAMP_PATH "/etc/sui-downtime"
+/* in tmpfs, so it only exists once something has noticed this boot */
+#define DOWNTIME_UP_PATH "/tmp/sui-up"
+/* what the interface waited before anything was measured */
+#define DOWNTIME_DEFAULT_MS 60000
+
+struct downtime {
+	/* wall clock when the last reboot was asked for; 0 once it has been measured */
+	long long shutdown_ms;
+	/* from the request to handing over to /sbin/reboot */
+	long prepare_ms;
+	/* from the request to being back up, or -1 if no reboot has been measured */
+	long last_ms;
+};
+
+bool downtime_read(struct downtime* downtime);
+
+/* records a reboot requested at shutdown_ms, keeping the last measurement */
+bool downtime_mark_shutdown(long long shutdown_ms, long prepare_ms);
+
+/*
+ * Measures the reboot that was recorded, if there was one, the first time
+ * it is called after each boot; later calls cost one access().
+ */
+void downtime_mark_up();
+
+/* how long the next reboot is expected to take */
+long downtime_estimate_ms();
+
+long long downtime_wall_ms();
+
+#endif
@@ -0,0 +1,123 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "hostapd_ctrl.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "monotonic.h"
+
+#define LOCAL_PATH_FORMAT "/tmp/sui-hostapd-%d-%u"
+
+static unsigned int local_counter = 0;
+
+bool hostapd_ctrl_open(struct hostapd_ctrl* ctrl, const char* socket_path)
+{
+	struct sockaddr_un dest;
+
+	memset(ctrl, 0x00, sizeof(struct hostapd_ctrl));
+	memset(&dest, 0x00, sizeof(struct sockaddr_un));
+	dest.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(dest.sun_path)) {
+		ctrl->sock = -1;
+		return false;
+	}
+	strcpy(dest.sun_path, socket_path);
+
+	if ((ctrl->sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1) {
+		return false;
+	}
+	/* a datagram socket has to be bound for hostapd to have somewhere to reply */
+	ctrl->local.sun_family = AF_UNIX;
+	snprintf(ctrl->local.sun_path, sizeof(ctrl->local.sun_path), LOCAL_PATH_FORMAT, (int)getpid(), local_counter++);
+	unlink(ctrl->local.sun_path);
+	if (bind(ctrl->sock, (struct sockaddr*)&(ctrl->local), sizeof(struct sockaddr_un)) == -1) {
+		close(ctrl->sock);
+		ctrl->sock = -1;
+		return false;
+	}
+	if (connect(ctrl->sock, (struct sockaddr*)&dest, sizeof(struct sockaddr_un)) == -1) {
+		hostapd_ctrl_close(ctrl);
+		return false;
+	}
+	return true;
+}
+
+bool hostapd_ctrl_request(struct hostapd_ctrl* ctrl, const char* command, char* reply, size_t reply_size, long timeout_ms)
+{
+	long deadline = monotonic_ms() + timeout_ms;
+	struct pollfd pfd;
+
+	reply[0] = '\0';
+	if (ctrl->sock == -1 || send(ctrl->sock, command, strlen(command), 0) == -1) {
+		return false;
+	}
+
+	pfd.fd = ctrl->sock;
+	pfd.events = POLLIN;
+	while (1) {
+		long remaining = deadline - monotonic_ms();
+		ssize_t len;
+		int ready;
+		if (remaining <= 0) {
+			return false;
+		} else if ((ready = poll(&pfd, 1, (int)remaining)) == -1 && errno == EINTR) {
+			continue;
+		} else if (ready <= 0) {
+			return false;
+		} else if ((len = recv(ctrl->sock, reply, reply_size - 1, 0)) == -1) {
+			return false;
+		}
+		reply[len] = '\0';
+		/* unsolicited events start with a priority in angle brackets */
+		if (len > 0 && reply[0] == '<') {
+			reply[0] = '\0';
+			continue;
+		}
+		return true;
+	}
+}
+
+bool hostapd_ctrl_command(struct hostapd_ctrl* ctrl, const char* command, long timeout_ms)
+{
+	char reply[HOSTAPD_CTRL_REPLY_LENGTH];
+
+	return hostapd_ctrl_request(ctrl, command, reply, HOSTAPD_CTRL_REPLY_LENGTH, timeout_ms)
+			&& strncmp(reply, "OK", 2) == 0;
+}
+
+void hostapd_ctrl_close(struct hostapd_ctrl* ctrl)
+{
+	if (ctrl->sock != -1) {
+		close(ctrl->sock);
+		unlink(ctrl->local.sun_path);
+		ctrl->sock = -1;
+	}
+}
@@ -0,0 +1,55 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_HOSTAPD_CTRL_H
+#define WIOMW_SUI_HOSTAPD_CTRL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/un.h>
+
+/* hostapd makes one socket here for each interface it runs, named after it */
+#define HOSTAPD_CTRL_DIR "/var/run/hostapd"
+#define HOSTAPD_CTRL_TIMEOUT_MS 5000
+#define HOSTAPD_CTRL_REPLY_LENGTH 4096
+
+struct hostapd_ctrl {
+	int sock;
+	/* the address hostapd replies to, removed again by hostapd_ctrl_close */
+	struct sockaddr_un local;
+};
+
+/* connects to the control socket at socket_path */
+bool hostapd_ctrl_open(struct hostapd_ctrl* ctrl, const char* socket_path);
+
+/*
+ * Sends command and waits up to timeout_ms for the reply, which is always
+ * terminated. Returns false if nothing came back.
+ */
+bool hostapd_ctrl_request(struct hostapd_ctrl* ctrl, const char* command, char* reply, size_t reply_size, long timeout_ms);
+
+/* for commands that only answer OK or FAIL; true means OK */
+bool hostapd_ctrl_command(struct hostapd_ctrl* ctrl, const char* command, long timeout_ms);
+
+void hostapd_ctrl_close(struct hostapd_ctrl* ctrl);
+
+#endif
@@ -0,0 +1,504 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "http_client.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <curl/curl.h>
+
+#include "breaker.h"
+#include "cloudd.h"
+#include "monotonic.h"
+#include "tls_cache.h"
+
+#define HTTP_BUFFER_INITIAL_CAPACITY 1024
+#define HTTP_RETRY_BACKOFF_MS 500
+#define HTTP_CLOUDD_GRACE_MS 2000
+
+static CURL* reusable_handle = NULL;
+static http_timing_hook timing_hook = NULL;
+
+void http_buffer_init(struct http_buffer* buffer, size_t limit)
+{
+	buffer->data = NULL;
+	buffer->length = 0;
+	buffer->capacity = 0;
+	buffer->limit = limit;
+}
+
+void http_buffer_free(struct http_buffer* buffer)
+{
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->length = 0;
+	buffer->capacity = 0;
+}
+
+static bool buffer_append(struct http_buffer* buffer, const char* data, size_t len)
+{
+	size_t needed = buffer->length + len + 1;
+
+	if (buffer->limit != 0 && buffer->length + len > buffer->limit) {
+		return false;
+	}
+	if (needed > buffer->capacity) {
+		size_t capacity = (buffer->capacity == 0) ? HTTP_BUFFER_INITIAL_CAPACITY : buffer->capacity;
+		char* grown;
+		while (capacity < needed) {
+			capacity *= 2;
+		}
+		if (buffer->limit != 0 && capacity > buffer->limit + 1) {
+			capacity = buffer->limit + 1;
+		}
+		if ((grown = realloc(buffer->data, capacity)) == NULL) {
+			return false;
+		}
+		buffer->data = grown;
+		buffer->capacity = capacity;
+	}
+
+	memcpy(buffer->data + buffer->length, data, len);
+	buffer->length += len;
+	buffer->data[buffer->length] = '\0';
+	return true;
+}
+
+static bool deliver(struct http_transfer* transfer, const void* data, size_t len)
+{
+	const struct http_request* request = transfer->request;
+
+	if (request->max_length > 0 && (long long)(transfer->response->received + len) > request->max_length) {
+		transfer->response->overflowed = true;
+		return false;
+	}
+	if (request->body != NULL && !buffer_append(request->body, (const char*)data, len)) {
+		transfer->response->overflowed = true;
+		return false;
+	}
+	if (request->file != NULL && fwrite(data, 1, len, request->file) != len) {
+		return false;
+	}
+	if (request->hook != NULL && !request->hook(request->hook_arg, (const unsigned char*)data, len)) {
+		return false;
+	}
+
+	transfer->response->received += len;
+	return true;
+}
+
+static size_t write_cb(void* data, size_t size, size_t nmemb, void* raw_transfer)
+{
+	return deliver((struct http_transfer*)raw_transfer, data, size * nmemb) ? size * nmemb : 0;
+}
+
+static size_t header_cb(char* line, size_t size, size_t nmemb, void* raw_transfer)
+{
+	struct http_response* response = ((struct http_transfer*)raw_transfer)->response;
+
+	http_collect_validators(line, size * nmemb, response->etag, response->last_modified);
+	return size * nmemb;
+}
+
+static bool copy_header_value(const char* line, size_t len, const char* name, char value[HTTP_VALIDATOR_LENGTH])
+{
+	size_t name_len = strlen(name);
+
+	if (len <= name_len || strncasecmp(line, name, name_len) != 0 || line[name_len] != ':') {
+		return false;
+	}
+	line += name_len + 1;
+	len -= name_len + 1;
+	while (len > 0 && (*line == ' ' || *line == '\t')) {
+		line++;
+		len--;
+	}
+	while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n' || line[len - 1] == ' ')) {
+		len--;
+	}
+	if (len >= HTTP_VALIDATOR_LENGTH) {
+		/* a truncated validator would never match, so keep none */
+		len = 0;
+	}
+	memcpy(value, line, len);
+	value[len] = '\0';
+	return true;
+}
+
+void http_collect_validators(const char* line, size_t len, char etag[HTTP_VALIDATOR_LENGTH], char last_modified[HTTP_VALIDATOR_LENGTH])
+{
+	if (len >= 5 && strncmp(line, "HTTP/", 5) == 0) {
+		etag[0] = '\0';
+		last_modified[0] = '\0';
+	} else if (!copy_header_value(line, len, "ETag", etag)) {
+		copy_header_value(line, len, "Last-Modified", last_modified);
+	}
+}
+
+static bool send_all(int sock, const void* data, size_t len)
+{
+	const char* next = (const char*)data;
+
+	while (len > 0) {
+		ssize_t sent = send(sock, next, len, MSG_NOSIGNAL);
+		if (sent <= 0) {
+			if (sent == -1 && errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		next += sent;
+		len -= sent;
+	}
+	return true;
+}
+
+static bool recv_all(int sock, void* data, size_t len)
+{
+	char* next = (char*)data;
+
+	while (len > 0) {
+		ssize_t received = recv(sock, next, len, 0);
+		if (received <= 0) {
+			if (received == -1 && errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		next += received;
+		len -= received;
+	}
+	return true;
+}
+
+/*
+ * Hands the request to sui-cloudd, which keeps a warm connection to the
+ * cloud. Returns false without touching the response if the daemon is not
+ * running, so the caller can do the transfer itself.
+ */
+static bool perform_via_cloudd(const struct http_request* request, struct http_response* response, long timeout_ms)
+{
+	struct sockaddr_un uaddr;
+	struct cloudd_request header;
+	struct cloudd_frame frame;
+	struct cloudd_done done;
+	struct http_transfer transfer;
+	struct timeval io_timeout;
+	struct curl_slist* line;
+	char headers[CLOUDD_MAX_HEADERS_LENGTH];
+	size_t headers_length = 0;
+	char chunk[BUFSIZ];
+	long started = monotonic_ms();
+	bool failed = false;
+	bool refused = false;
+	int sock;
+
+	if (strncmp(request->url, CLOUDD_URL_PREFIX, strlen(CLOUDD_URL_PREFIX)) != 0) {
+		/* the daemon would refuse it */
+		return false;
+	}
+	for (line = request->headers; line != NULL; line = line->next) {
+		int written = snprintf(headers + headers_length, CLOUDD_MAX_HEADERS_LENGTH - headers_length, "%s\n", line->data);
+		if (written < 0 || (size_t)written >= CLOUDD_MAX_HEADERS_LENGTH - headers_length) {
+			return false;
+		}
+		headers_length += written;
+	}
+	memset(&header, 0x00, sizeof(struct cloudd_request));
+	header.magic = CLOUDD_MAGIC;
+	header.is_post = (request->post_data != NULL) ? 1 : 0;
+	header.url_length = strlen(request->url);
+	header.headers_length = headers_length;
+	header.post_length = (request->post_data != NULL) ? request->post_length : 0;
+	header.connect_timeout_ms = (request->connect_timeout_ms > 0 && request->connect_timeout_ms < timeout_ms) ? request->connect_timeout_ms : timeout_ms;
+	header.timeout_ms = timeout_ms;
+	header.resume_from = (request->resume_from > 0) ? request->resume_from : 0;
+	if (header.url_length > CLOUDD_MAX_URL_LENGTH || header.post_length > CLOUDD_MAX_POST_LENGTH) {
+		return false;
+	}
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		return false;
+	}
+	memset(&uaddr, 0x00, sizeof(struct sockaddr_un));
+	uaddr.sun_family = AF_UNIX;
+	strcpy(uaddr.sun_path, CLOUDD_SOCK_PATH);
+	if (connect(sock, (struct sockaddr*)&uaddr, sizeof(struct sockaddr_un)) == -1) {
+		close(sock);
+		return false;
+	}
+
+	/* the daemon enforces the deadline; this only covers the daemon itself hanging */
+	timeout_ms += HTTP_CLOUDD_GRACE_MS;
+	io_timeout.tv_sec = timeout_ms / 1000;
+	io_timeout.tv_usec = (timeout_ms % 1000) * 1000;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &io_timeout, sizeof(struct timeval));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &io_timeout, sizeof(struct timeval));
+
+	if (!send_all(sock, &header, sizeof(struct cloudd_request))
+			|| !send_all(sock, request->url, header.url_length)
+			|| !send_all(sock, headers, headers_length)
+			|| !send_all(sock, request->post_data, header.post_length)) {
+		close(sock);
+		return false;
+	}
+
+	memset(&transfer, 0x00, sizeof(struct http_transfer));
+	transfer.request = request;
+	transfer.response = response;
+	response->error[0] = '\0';
+	response->http_code = 0;
+
+	while (!failed && !refused) {
+		if (!recv_all(sock, &frame, sizeof(struct cloudd_frame))) {
+			failed = true;
+		} else if (frame.type == CLOUDD_FRAME_DONE && frame.length == sizeof(struct cloudd_done)) {
+			break;
+		} else if (frame.type != CLOUDD_FRAME_DATA) {
+			failed = true;
+		}
+		while (!failed && !refused && frame.length > 0) {
+			size_t len = (frame.length < BUFSIZ) ? frame.length : BUFSIZ;
+			if (!recv_all(sock, chunk, len)) {
+				failed = true;
+			} else if (!deliver(&transfer, chunk, len)) {
+				refused = true;
+			}
+			frame.length -= len;
+		}
+	}
+
+	if (refused) {
+		/* dropping the connection makes the daemon abort the transfer */
+		response->result = CURLE_WRITE_ERROR;
+		strncpy(response->error, curl_easy_strerror(CURLE_WRITE_ERROR), CURL_ERROR_SIZE - 1);
+	} else if (failed || !recv_all(sock, &done, sizeof(struct cloudd_done))) {
+		response->result = CURLE_RECV_ERROR;
+		strncpy(response->error, "Lost connection to sui-cloudd", CURL_ERROR_SIZE - 1);
+	} else {
+		response->result = (CURLcode)done.result;
+		response->http_code = done.http_code;
+		response->namelookup_ms = done.namelookup_ms;
+		response->connect_ms = done.connect_ms;
+		response->appconnect_ms = done.appconnect_ms;
+		response->starttransfer_ms = done.starttransfer_ms;
+		strncpy(response->etag, done.etag, HTTP_VALIDATOR_LENGTH - 1);
+		strncpy(response->last_modified, done.last_modified, HTTP_VALIDATOR_LENGTH - 1);
+		strncpy(response->error, done.error, CURL_ERROR_SIZE - 1);
+	}
+	response->error[CURL_ERROR_SIZE - 1] = '\0';
+	response->attempts++;
+	response->elapsed_ms = monotonic_ms() - started;
+	close(sock);
+
+	if (timing_hook != NULL) {
+		timing_hook(request, response);
+	}
+	return true;
+}
+
+static void configure(CURL* curl, const struct http_request* request, struct http_response* response, struct http_transfer* transfer, long timeout_ms)
+{
+	long connect_timeout_ms = (request->connect_timeout_ms > 0) ? request->connect_timeout_ms : HTTP_DEFAULT_CONNECT_TIMEOUT_MS;
+
+	memset(transfer, 0x00, sizeof(struct http_transfer));
+	transfer->request = request;
+	transfer->response = response;
+	transfer->started_ms = monotonic_ms();
+	response->error[0] = '\0';
+
+	curl_easy_setopt(curl, CURLOPT_URL, request->url);
+	tls_cache_prepare(curl, request->url, &(transfer->tls_slot));
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (connect_timeout_ms < timeout_ms) ? connect_timeout_ms : timeout_ms);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+	/* error bodies never reach the sinks, so a failed attempt leaves nothing to undo */
+	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &write_cb);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, transfer);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &header_cb);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, transfer);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, response->error);
+	if (request->post_data != NULL) {
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->post_data);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)request->post_length);
+	}
+	if (request->headers != NULL) {
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request->headers);
+	}
+	if (request->resume_from > 0) {
+		curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)request->resume_from);
+	}
+}
+
+void http_transfer_begin(CURL* curl, const struct http_request* request, struct http_response* response, struct http_transfer* transfer)
+{
+	memset(response, 0x00, sizeof(struct http_response));
+	configure(curl, request, response, transfer,
+			(request->timeout_ms > 0) ? request->timeout_ms : HTTP_DEFAULT_TIMEOUT_MS);
+}
+
+bool http_transfer_end(CURL* curl, struct http_transfer* transfer, CURLcode result)
+{
+	struct http_response* response = transfer->response;
+	double seconds = 0;
+
+	response->result = result;
+	response->attempts++;
+	response->http_code = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &(response->http_code));
+	if (curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &seconds) == CURLE_OK) {
+		response->namelookup_ms = (long)(seconds * 1000);
+	}
+	if (curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &seconds) == CURLE_OK) {
+		response->connect_ms = (long)(seconds * 1000);
+	}
+	if (curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &seconds) == CURLE_OK) {
+		response->appconnect_ms = (long)(seconds * 1000);
+	}
+	if (curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &seconds) == CURLE_OK) {
+		response->starttransfer_ms = (long)(seconds * 1000);
+	}
+	response->elapsed_ms = monotonic_ms() - transfer->started_ms;
+	if (response->error[0] == '\0' && result != CURLE_OK) {
+		strncpy(response->error, curl_easy_strerror(result), CURL_ERROR_SIZE - 1);
+		response->error[CURL_ERROR_SIZE - 1] = '\0';
+	}
+
+	/* only a connection that actually talked to the server vouches for its address */
+	tls_cache_finish(curl, &(transfer->tls_slot), result == CURLE_OK || response->http_code != 0);
+
+	if (timing_hook != NULL) {
+		timing_hook(transfer->request, response);
+	}
+
+	return result == CURLE_OK && response->http_code < 400;
+}
+
+static bool retryable(const struct http_response* response)
+{
+	if (response->received != 0 || response->overflowed) {
+		return false;
+	}
+	switch (response->result) {
+	case CURLE_COULDNT_RESOLVE_HOST:
+	case CURLE_COULDNT_CONNECT:
+	case CURLE_OPERATION_TIMEDOUT:
+	case CURLE_SSL_CONNECT_ERROR:
+	case CURLE_SEND_ERROR:
+	case CURLE_RECV_ERROR:
+	case CURLE_GOT_NOTHING:
+		return true;
+	case CURLE_HTTP_RETURNED_ERROR:
+		return response->http_code >= 500 || response->http_code == 408 || response->http_code == 429;
+	default:
+		return false;
+	}
+}
+
+bool http_perform(const struct http_request* request, struct http_response* response)
+{
+	struct http_transfer transfer;
+	long timeout_ms = (request->timeout_ms > 0) ? request->timeout_ms : HTTP_DEFAULT_TIMEOUT_MS;
+	long start = monotonic_ms();
+	long deadline = start + timeout_ms;
+	unsigned int attempt;
+	bool ok = false;
+
+	memset(response, 0x00, sizeof(struct http_response));
+
+	if (request->breaker != NULL && !breaker_allow(request->breaker, &(response->retry_after_ms))) {
+		response->result = CURLE_COULDNT_CONNECT;
+		snprintf(response->error, CURL_ERROR_SIZE, "Recent calls to %s failed, not trying again for %ld ms",
+				request->breaker, response->retry_after_ms);
+		return false;
+	}
+
+	/* keeping one handle keeps its connection, session and CA caches warm */
+	if (reusable_handle == NULL) {
+		if ((reusable_handle = curl_easy_init()) == NULL) {
+			response->result = CURLE_FAILED_INIT;
+			strncpy(response->error, curl_easy_strerror(CURLE_FAILED_INIT), CURL_ERROR_SIZE - 1);
+			if (request->breaker != NULL) {
+				/* a half-open breaker is waiting to hear how its probe went */
+				breaker_record(request->breaker, false);
+			}
+			return false;
+		}
+	} else {
+		curl_easy_reset(reusable_handle);
+	}
+
+	for (attempt = 0; ; attempt++) {
+		long remaining = deadline - monotonic_ms();
+		long backoff = HTTP_RETRY_BACKOFF_MS << attempt;
+
+		if (perform_via_cloudd(request, response, (remaining > 0) ? remaining : 1)) {
+			ok = response->result == CURLE_OK && response->http_code < 400;
+		} else {
+			configure(reusable_handle, request, response, &transfer, (remaining > 0) ? remaining : 1);
+			ok = http_transfer_end(reusable_handle, &transfer, curl_easy_perform(reusable_handle));
+		}
+		if (ok || attempt >= request->retries || !retryable(response)
+				|| monotonic_ms() + backoff >= deadline) {
+			break;
+		}
+		http_sleep_ms(backoff);
+		curl_easy_reset(reusable_handle);
+	}
+
+	if (request->breaker != NULL) {
+		/* anything short of a 5xx shows that the server is there and listening */
+		breaker_record(request->breaker, (response->http_code != 0) ? response->http_code < 500 : response->result == CURLE_OK);
+	}
+	response->elapsed_ms = monotonic_ms() - start;
+	return ok;
+}
+
+void http_sleep_ms(long ms)
+{
+	struct timespec delay;
+
+	if (ms <= 0) {
+		return;
+	}
+	delay.tv_sec = ms / 1000;
+	delay.tv_nsec = (ms % 1000) * 1000000;
+	/* only a signal cuts the delay short; the rest of it is slept off */
+	while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+	}
+}
+
+void http_set_timing_hook(http_timing_hook hook)
+{
+	timing_hook = hook;
+}
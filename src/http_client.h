@@ -0,0 +1,133 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_HTTP_CLIENT_H
+#define WIOMW_SUI_HTTP_CLIENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <curl/curl.h>
+
+#include "tls_cache.h"
+
+#define HTTP_DEFAULT_CONNECT_TIMEOUT_MS 10000
+#define HTTP_DEFAULT_TIMEOUT_MS 30000
+#define HTTP_VALIDATOR_LENGTH 128
+
+/* grows geometrically and refuses to grow past limit (0 means no limit) */
+struct http_buffer {
+	char* data;
+	size_t length;
+	size_t capacity;
+	size_t limit;
+};
+
+/* called with every chunk of the body, e.g. to feed a digest; false aborts the transfer */
+typedef bool (*http_data_hook)(void* arg, const unsigned char* data, size_t len);
+
+struct http_request {
+	const char* url;
+	/* NULL for a GET */
+	const char* post_data;
+	size_t post_length;
+	/* extra "Name: value" lines, may be NULL */
+	struct curl_slist* headers;
+	long connect_timeout_ms;
+	/* deadline for the whole call, including every retry */
+	long timeout_ms;
+	unsigned int retries;
+	/* asks for the body from this offset on; curl fails if the server ignores it */
+	long long resume_from;
+	/* a longer body is cut off before it reaches any sink (0 means no limit) */
+	long long max_length;
+	/* any combination of sinks; with none the body is discarded */
+	struct http_buffer* body;
+	FILE* file;
+	http_data_hook hook;
+	void* hook_arg;
+	/* names the circuit breaker guarding this endpoint, NULL for none */
+	const char* breaker;
+};
+
+struct http_response {
+	CURLcode result;
+	long http_code;
+	bool overflowed;
+	/* nonzero if the breaker was open and nothing was sent; when to try again */
+	long retry_after_ms;
+	unsigned int attempts;
+	size_t received;
+	long elapsed_ms;
+	long namelookup_ms;
+	long connect_ms;
+	long appconnect_ms;
+	long starttransfer_ms;
+	/* cache validators of the final response, empty if it had none */
+	char etag[HTTP_VALIDATOR_LENGTH];
+	char last_modified[HTTP_VALIDATOR_LENGTH];
+	char error[CURL_ERROR_SIZE];
+};
+
+typedef void (*http_timing_hook)(const struct http_request* request, const struct http_response* response);
+
+/* per-transfer state for callers that drive their own curl multi handle */
+struct http_transfer {
+	const struct http_request* request;
+	struct http_response* response;
+	struct tls_cache_slot tls_slot;
+	struct curl_slist* headers;
+	long started_ms;
+};
+
+/*
+ * Performs request on the process's reusable handle, retrying transport
+ * failures and 5xx answers with backoff as long as no body has been handed
+ * to the sinks yet. Returns true if a response under 400 was received.
+ * With request->breaker set, fails at once while that breaker is open and
+ * otherwise reports the outcome to it.
+ */
+bool http_perform(const struct http_request* request, struct http_response* response);
+
+/* applies request to curl; the caller adds curl to its multi handle */
+void http_transfer_begin(CURL* curl, const struct http_request* request, struct http_response* response, struct http_transfer* transfer);
+
+/* fills in the response once the multi handle reports curl as done */
+bool http_transfer_end(CURL* curl, struct http_transfer* transfer, CURLcode result);
+
+/* the buffer always holds a terminating NUL after length bytes */
+void http_buffer_init(struct http_buffer* buffer, size_t limit);
+void http_buffer_free(struct http_buffer* buffer);
+
+void http_set_timing_hook(http_timing_hook hook);
+
+/* sleeps for ms milliseconds, carrying on after signals; does nothing for ms <= 0 */
+void http_sleep_ms(long ms);
+
+/*
+ * For CURLOPT_HEADERFUNCTION callbacks: clears both validators at every
+ * status line, so only the final response's survive, and fills them in from
+ * the ETag and Last-Modified lines.
+ */
+void http_collect_validators(const char* line, size_t len, char etag[HTTP_VALIDATOR_LENGTH], char last_modified[HTTP_VALIDATOR_LENGTH]);
+
+#endif
@@ -32,6 +32,8 @@
 #include <yajl/yajl_tree.h>
 
 #include "string_helpers.h"
+#include "uci_cache.h"
+#include "uci_txn.h"
 #include "xsrf.h"
 
 #define IPADDR_UCI_PATH "network.lan.ipaddr"
@@ -44,9 +46,7 @@
 bool set_lan_ip4(const char* base, const char* netmask)
 {
 	struct uci_context* ctx;
-	struct uci_ptr ptr;
-	int res = 0;
-	char uci_lookup_str[BUFSIZ];
+	struct uci_txn txn;
 	uint32_t dummy = 0;
 
 	if (base == NULL
@@ -60,34 +60,20 @@ bool set_lan_ip4(const char* base, const char* netmask)
 
 	ctx = uci_alloc_context();
 
-	snprintf(uci_lookup_str, BUFSIZ, IPADDR_UCI_PATH "=%s", base);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-			|| uci_set(ctx, &ptr) != UCI_OK
-			|| uci_save(ctx, ptr.p) != UCI_OK) {
+	uci_txn_begin(&txn, ctx);
+	uci_txn_set(&txn, IPADDR_UCI_PATH, base);
+	uci_txn_set(&txn, NETMASK_UCI_PATH, netmask);
+	if (!uci_txn_commit(&txn)) {
 		return false;
 	}
 
-	snprintf(uci_lookup_str, BUFSIZ, NETMASK_UCI_PATH "=%s", netmask);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-			|| uci_set(ctx, &ptr) != UCI_OK
-			|| uci_save(ctx, ptr.p) != UCI_OK) {
-		return false;
-	}
-
-	if ((res = uci_commit(ctx, &(ptr.p), false)) != UCI_OK) {
-		return false;
-	}
-
-	snprintf(uci_lookup_str, BUFSIZ, LOCAL_DNS_ENTRY_UCI_PATH "=%s", base);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-			|| (res = uci_set(ctx, &ptr)) != UCI_OK
-			|| (res = uci_save(ctx, ptr.p)) != UCI_OK
-			|| (res = uci_commit(ctx, &(ptr.p), false)) != UCI_OK) {
-		/* TODO: syslog */
-		return true;
-	} else {
-		return true;
+	/* the local DNS entry is a convenience, so failing to update it is not fatal */
+	uci_txn_begin(&txn, ctx);
+	uci_txn_set(&txn, LOCAL_DNS_ENTRY_UCI_PATH, base);
+	if (!uci_txn_commit(&txn)) {
+		syslog(LOG_WARNING, "Unable to update the local DNS entry for the LAN IP address");
 	}
+	return true;
 }
 
 /*
@@ -95,47 +81,30 @@ bool set_lan_ip4(const char* base, const char* netmask)
  */
 bool get_lan_ip4(uint32_t* base, uint32_t* netmask)
 {
-	bool never_changed = true;
-	struct uci_context* ctx;
-	struct uci_ptr ptr;
-	int res = 0;
-	char uci_lookup_str[BUFSIZ];
-	ctx = uci_alloc_context();
+	int changed = 0;
+	char value[BUFSIZ];
 
-	strncpy(uci_lookup_str, LAN_CHANGED_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK) {
+	if (uci_cache_int(LAN_CHANGED_UCI_PATH, &changed) == UCI_CACHE_ERROR) {
 		*base = 0;
 		*netmask = 0;
 		return false;
-	} else if ((ptr.flags & UCI_LOOKUP_COMPLETE) != 0) {
-		never_changed = (atoi(ptr.o->v.string) != 1);
 	}
 
-	strncpy(uci_lookup_str, IPADDR_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-			|| (ptr.flags & UCI_LOOKUP_COMPLETE) == 0) {
-		*base = 0;
-		*netmask = 0;
-		return false;
-	} else if (inet_pton(AF_INET, ptr.o->v.string, base) != 1) {
+	if (uci_cache_string(IPADDR_UCI_PATH, value, BUFSIZ) != UCI_CACHE_FOUND
+			|| inet_pton(AF_INET, value, base) != 1) {
 		*base = 0;
 		*netmask = 0;
 		return false;
 	}
 
-	strncpy(uci_lookup_str, NETMASK_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-			|| (ptr.flags & UCI_LOOKUP_COMPLETE) == 0) {
-		*base = 0;
-		*netmask = 0;
-		return false;
-	} else if (inet_pton(AF_INET, ptr.o->v.string, netmask) != 1) {
+	if (uci_cache_string(NETMASK_UCI_PATH, value, BUFSIZ) != UCI_CACHE_FOUND
+			|| inet_pton(AF_INET, value, netmask) != 1) {
 		*base = 0;
 		*netmask = 0;
 		return false;
 	}
 
-	return never_changed;
+	return changed != 1;
 }
 
 void post_lan_ip(yajl_val top, struct xsrft* token)
@@ -198,81 +167,41 @@ void post_lan_ip(yajl_val top, struct xsrft* token)
 		}
 	}
 
-	struct uci_context* ctx;
-	struct uci_ptr ptr;
-	int res = 0;
-	char uci_lookup_str[BUFSIZ];
-	ctx = uci_alloc_context();
+	enum uci_cache_status status;
 
 	if (valid && (strnlen(ipaddr, BUFSIZ) != 0 || strnlen(netmask, BUFSIZ) != 0)) {
+		struct uci_txn txn;
+		uci_txn_begin(&txn, uci_alloc_context());
 		if (strnlen(ipaddr, BUFSIZ) != 0) {
-			snprintf(uci_lookup_str, BUFSIZ, IPADDR_UCI_PATH "=%s", ipaddr);
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-					|| (res = uci_set(ctx, &ptr)) != UCI_OK
-					|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save LAN IP address to UCI.\"]}", token->val);
-				return;
-			}
+			uci_txn_set(&txn, IPADDR_UCI_PATH, ipaddr);
+			uci_txn_set(&txn, LOCAL_DNS_ENTRY_UCI_PATH, ipaddr);
 		}
 		if (strnlen(netmask, BUFSIZ) != 0) {
-			snprintf(uci_lookup_str, BUFSIZ, NETMASK_UCI_PATH "=%s", netmask);
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-					|| (res = uci_set(ctx, &ptr)) != UCI_OK
-					|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save LAN netmask to UCI.\"]}", token->val);
-				return;
-			}
+			uci_txn_set(&txn, NETMASK_UCI_PATH, netmask);
 		}
-
-		strncpy(uci_lookup_str, LAN_CHANGED_UCI_PATH "=1", BUFSIZ);
-		if ((res = uci_commit(ctx, &(ptr.p), false)) != UCI_OK
-				|| (res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK
-				|| (res = uci_commit(ctx, &(ptr.p), false)) != UCI_OK) {
+		uci_txn_set(&txn, LAN_CHANGED_UCI_PATH, "1");
+		if (!uci_txn_commit(&txn)) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save LAN data to UCI.\"]}", token->val);
 			return;
 		}
-		if (strnlen(ipaddr, BUFSIZ) != 0) {
-			snprintf(uci_lookup_str, BUFSIZ, LOCAL_DNS_ENTRY_UCI_PATH "=%s", ipaddr);
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-					|| (res = uci_set(ctx, &ptr)) != UCI_OK
-					|| (res = uci_save(ctx, ptr.p)) != UCI_OK
-					|| (res = uci_commit(ctx, &(ptr.p), false)) != UCI_OK) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save IP address for DNS entry to UCI.\"]}", token->val);
-				return;
-			}
-		}
 	}
 
 	ipaddr[0] = '\0';
 	netmask[0] = '\0';
 
-	strncpy(uci_lookup_str, IPADDR_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK && (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-		strncpy(ipaddr, ptr.o->v.string, BUFSIZ);
-	} else if (res == UCI_ERR_NOTFOUND || (ptr.flags & UCI_LOOKUP_DONE)) {
+	if ((status = uci_cache_string(IPADDR_UCI_PATH, ipaddr, BUFSIZ)) == UCI_CACHE_MISSING) {
 		astpnprintf(&terrors, &errlen, ",\"The LAN IP address has not yet been set in UCI.\"");
-	} else {
+	} else if (status == UCI_CACHE_ERROR) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to retrieve LAN IP address from UCI.\"]}", token->val);
 		return;
 	}
-	strncpy(uci_lookup_str, NETMASK_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK && (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-		strncpy(netmask, ptr.o->v.string, BUFSIZ);
-	} else if (res == UCI_ERR_NOTFOUND || (ptr.flags & UCI_LOOKUP_DONE)) {
+	if ((status = uci_cache_string(NETMASK_UCI_PATH, netmask, BUFSIZ)) == UCI_CACHE_MISSING) {
 		astpnprintf(&terrors, &errlen, ",\"The LAN netmask has not yet been set in UCI.\"");
-	} else {
+	} else if (status == UCI_CACHE_ERROR) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to retrieve LAN netmask from UCI.\"]}", token->val);
@@ -0,0 +1,291 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "latest.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include <yajl/yajl_tree.h>
+
+#include "http_client.h"
+#include "single_flight.h"
+
+#define LATEST_CACHE_MAGIC "sui-latest 1"
+#define LATEST_MAX_LENGTH 65536
+#define LATEST_TIMEOUT_MS 20000
+#define LATEST_RETRIES 2
+#define JSON_ERROR_BUFFER_LEN 1024
+#define LATEST_BREAKER "latest"
+#define LATEST_FLIGHT_KEY "latest"
+/* long enough for one fetch with its retries to finish, short enough for the CGI */
+#define LATEST_FLIGHT_WAIT_MS 30000
+
+struct cached {
+	/* when the body arrived, and when the server last vouched for it */
+	time_t stored;
+	time_t validated;
+	char etag[HTTP_VALIDATOR_LENGTH];
+	char last_modified[HTTP_VALIDATOR_LENGTH];
+	char* body;
+	size_t length;
+};
+
+/* what the process that fetched latest.json tells the ones that waited for it */
+struct shared_refresh {
+	enum latest_status status;
+	struct http_response response;
+};
+
+/* a persistent process keeps the tree between requests */
+static yajl_val parsed = NULL;
+static time_t parsed_stored = 0;
+static size_t parsed_length = 0;
+
+static bool read_line(FILE* file, char* line, size_t len)
+{
+	size_t end;
+
+	if (fgets(line, len, file) == NULL || (end = strlen(line)) == 0 || line[end - 1] != '\n') {
+		return false;
+	}
+	line[end - 1] = '\0';
+	return true;
+}
+
+static bool load_cache(struct cached* cached)
+{
+	FILE* file;
+	char line[BUFSIZ];
+	long long stored;
+	long long validated;
+	bool ok = false;
+
+	memset(cached, 0x00, sizeof(struct cached));
+	if ((file = fopen(LATEST_CACHE_PATH, "r")) == NULL) {
+		return false;
+	}
+	if (read_line(file, line, BUFSIZ) && strcmp(line, LATEST_CACHE_MAGIC) == 0
+			&& read_line(file, line, BUFSIZ) && sscanf(line, "%lld %lld", &stored, &validated) == 2
+			&& read_line(file, cached->etag, HTTP_VALIDATOR_LENGTH)
+			&& read_line(file, cached->last_modified, HTTP_VALIDATOR_LENGTH)
+			&& (cached->body = malloc(LATEST_MAX_LENGTH + 1)) != NULL) {
+		cached->stored = (time_t)stored;
+		cached->validated = (time_t)validated;
+		cached->length = fread(cached->body, 1, LATEST_MAX_LENGTH, file);
+		cached->body[cached->length] = '\0';
+		ok = !ferror(file) && cached->length > 0;
+	}
+	fclose(file);
+
+	if (!ok) {
+		free(cached->body);
+		cached->body = NULL;
+	}
+	return ok;
+}
+
+static void store_cache(const struct cached* cached)
+{
+	FILE* file;
+	bool ok;
+
+	if ((file = fopen(LATEST_CACHE_PATH ".tmp", "w")) == NULL) {
+		return;
+	}
+	ok = fprintf(file, LATEST_CACHE_MAGIC "\n%lld %lld\n%s\n%s\n", (long long)cached->stored, (long long)cached->validated,
+			cached->etag, cached->last_modified) > 0
+		&& fwrite(cached->body, 1, cached->length, file) == cached->length;
+	if (fclose(file) != 0 || !ok || rename(LATEST_CACHE_PATH ".tmp", LATEST_CACHE_PATH) != 0) {
+		unlink(LATEST_CACHE_PATH ".tmp");
+	}
+}
+
+static bool parsed_matches(const struct cached* cached)
+{
+	return parsed != NULL && parsed_stored == cached->stored && parsed_length == cached->length;
+}
+
+/* makes the kept tree describe cached, parsing only if it does not already */
+static bool adopt(const struct cached* cached)
+{
+	char errbuff[JSON_ERROR_BUFFER_LEN];
+	yajl_val tree;
+
+	if (parsed_matches(cached)) {
+		return true;
+	}
+	if ((tree = yajl_tree_parse(cached->body, errbuff, JSON_ERROR_BUFFER_LEN)) == NULL || !YAJL_IS_OBJECT(tree)) {
+		syslog(LOG_ERR, "Unable to parse latest.json: %s", (tree == NULL) ? errbuff : "not an object");
+		if (tree != NULL) {
+			yajl_tree_free(tree);
+		}
+		return false;
+	}
+	if (parsed != NULL) {
+		yajl_tree_free(parsed);
+	}
+	parsed = tree;
+	parsed_stored = cached->stored;
+	parsed_length = cached->length;
+	return true;
+}
+
+static bool fresh(const struct cached* cached, time_t now)
+{
+	/* a clock that jumped backwards says nothing about the copy's age */
+	return now >= cached->validated && now - cached->validated < LATEST_TTL_SECONDS;
+}
+
+static enum latest_status refresh(const char* url, struct cached* cached, bool have, struct http_response* response)
+{
+	struct http_buffer body;
+	struct http_request request;
+	struct curl_slist* headers = NULL;
+	char line[BUFSIZ];
+	bool ok;
+
+	http_buffer_init(&body, LATEST_MAX_LENGTH);
+	memset(&request, 0x00, sizeof(struct http_request));
+	request.url = url;
+	request.timeout_ms = LATEST_TIMEOUT_MS;
+	request.retries = LATEST_RETRIES;
+	request.body = &body;
+	request.breaker = LATEST_BREAKER;
+	if (have && cached->etag[0] != '\0') {
+		snprintf(line, BUFSIZ, "If-None-Match: %s", cached->etag);
+		headers = curl_slist_append(headers, line);
+	}
+	if (have && cached->last_modified[0] != '\0') {
+		snprintf(line, BUFSIZ, "If-Modified-Since: %s", cached->last_modified);
+		headers = curl_slist_append(headers, line);
+	}
+	request.headers = headers;
+
+	ok = http_perform(&request, response);
+	curl_slist_free_all(headers);
+
+	if (!ok) {
+		http_buffer_free(&body);
+		return LATEST_UNREACHABLE;
+	} else if (have && response->http_code == 304) {
+		http_buffer_free(&body);
+		if (!adopt(cached)) {
+			/* the next call then fetches a whole new copy */
+			unlink(LATEST_CACHE_PATH);
+			return LATEST_UNPARSABLE;
+		}
+		cached->validated = time(NULL);
+		store_cache(cached);
+		return LATEST_OK;
+	} else if (body.data == NULL) {
+		return LATEST_NO_MEMORY;
+	}
+
+	free(cached->body);
+	cached->body = body.data;
+	cached->length = body.length;
+	cached->stored = cached->validated = time(NULL);
+	strncpy(cached->etag, response->etag, HTTP_VALIDATOR_LENGTH - 1);
+	strncpy(cached->last_modified, response->last_modified, HTTP_VALIDATOR_LENGTH - 1);
+	if (!adopt(cached)) {
+		/* never keep what cannot be used */
+		return LATEST_UNPARSABLE;
+	}
+	store_cache(cached);
+	return LATEST_OK;
+}
+
+/* one process fetches while any others that want a fresh copy wait and use what it stored */
+static enum latest_status shared_refresh(const char* url, struct cached* cached, bool conditional, struct http_response* response)
+{
+	struct single_flight flight;
+	struct shared_refresh shared;
+	size_t length = 0;
+
+	switch (single_flight_begin(&flight, LATEST_FLIGHT_KEY, LATEST_FLIGHT_WAIT_MS, &shared, sizeof(struct shared_refresh), &length)) {
+	case SINGLE_FLIGHT_FOLLOWER:
+		if (length == sizeof(struct shared_refresh)) {
+			*response = shared.response;
+			if (shared.status != LATEST_OK) {
+				return shared.status;
+			}
+			free(cached->body);
+			if (load_cache(cached) && adopt(cached)) {
+				return LATEST_OK;
+			}
+		}
+		/* the copy it stored is gone again, so this one has to be fetched whole */
+		return refresh(url, cached, false, response);
+	case SINGLE_FLIGHT_BUSY:
+		snprintf(response->error, CURL_ERROR_SIZE, "Still waiting for another request to fetch latest.json");
+		return LATEST_UNREACHABLE;
+	case SINGLE_FLIGHT_LEADER:
+		/* the last leader may have finished since this process looked */
+		free(cached->body);
+		if (load_cache(cached) && fresh(cached, time(NULL)) && adopt(cached)) {
+			shared.status = LATEST_OK;
+		} else {
+			shared.status = refresh(url, cached, conditional && cached->body != NULL, response);
+		}
+		shared.response = *response;
+		single_flight_publish(&flight, &shared, sizeof(struct shared_refresh));
+		return shared.status;
+	default:
+		return refresh(url, cached, conditional, response);
+	}
+}
+
+enum latest_status latest_get(const char* url, const char* model, yajl_val* entry, struct http_response* response)
+{
+	struct cached cached;
+	const char* model_path[] = {model, (const char*)0};
+	enum latest_status status = LATEST_OK;
+	bool have;
+
+	*entry = NULL;
+	memset(response, 0x00, sizeof(struct http_response));
+
+	have = load_cache(&cached);
+	if (have && !fresh(&cached, time(NULL))) {
+		status = shared_refresh(url, &cached, true, response);
+	} else if (have && !adopt(&cached)) {
+		/* the copy is damaged, so fetch a whole new one */
+		status = shared_refresh(url, &cached, false, response);
+	} else if (!have) {
+		status = shared_refresh(url, &cached, false, response);
+	}
+	free(cached.body);
+
+	if (status != LATEST_OK) {
+		return status;
+	} else if ((*entry = yajl_tree_get(parsed, model_path, yajl_t_object)) == NULL) {
+		return LATEST_NO_MODEL;
+	}
+	return LATEST_OK;
+}
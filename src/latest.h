@@ -0,0 +1,50 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_LATEST_H
+#define WIOMW_SUI_LATEST_H
+
+#include <yajl/yajl_tree.h>
+
+#include "http_client.h"
+
+#define LATEST_CACHE_PATH "/tmp/sui-latest.json"
+#define LATEST_TTL_SECONDS 60
+
+enum latest_status {
+	LATEST_OK = 0,
+	LATEST_NO_MEMORY,
+	LATEST_UNREACHABLE,
+	LATEST_UNPARSABLE,
+	LATEST_NO_MODEL
+};
+
+/*
+ * Finds model's entry in the latest.json at url. A copy validated less than
+ * LATEST_TTL_SECONDS ago is used as is; an older one is revalidated with
+ * If-None-Match and If-Modified-Since, and kept on a 304. The entry belongs
+ * to this module and stays valid until the next call. response is filled in
+ * whenever the server was asked.
+ */
+enum latest_status latest_get(const char* url, const char* model, yajl_val* entry, struct http_response* response);
+
+#endif
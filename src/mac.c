@@ -24,37 +24,33 @@
 #include "mac.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-#define GET_MAC_COMMAND "ifconfig -a | awk '$1 == \"'`uci get network.wan.ifname`'\" {print $5;}'"
+#include "netboard.h"
 
 void get_mac()
 {
-	char mac[18];
-	FILE* output = popen(GET_MAC_COMMAND, "r");
-	if (output == NULL) {
-		printf("Status: 500 Internal Server Error\n");
-		printf("Content-type: application/json\n\n");
-		printf("\"errors\":[\"Unable to retrieve MAC address.\"]}");
-		return;
-	}
-	if (fread(mac, 1, 18, output) != 18) {
-		pclose(output);
-		printf("Status: 500 Internal Server Error\n");
-		printf("Content-type: application/json\n\n");
-		printf("{\"errors\":[\"Unable to retrieve entire MAC address.\"]}");
+	char mac[NETINFO_MAC_LENGTH];
+	char etag[NETBOARD_ETAG_LENGTH];
+	const char* if_none_match = getenv("HTTP_IF_NONE_MATCH");
+	bool tagged = netboard_etag(etag);
+
+	if (tagged && if_none_match != NULL && strcmp(if_none_match, etag) == 0) {
+		printf("Status: 304 Not Modified\n");
+		printf("ETag: %s\n\n", etag);
 		return;
 	}
-	pclose(output);
-	if (mac[17] == '\n') {
-		mac[17] = '\0';
-	} else if (mac[17] != '\0') {
+	if (!netboard_wan_mac(mac)) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
-		printf("{\"errors\":[\"Retrieved invalid MAC address.\"]}");
+		printf("{\"errors\":[\"Unable to retrieve MAC address.\"]}");
 		return;
 	}
 	printf("Status: 200 OK\n");
+	if (tagged) {
+		printf("ETag: %s\n", etag);
+	}
 	printf("Content-type: application/json\n\n");
 	printf("{\"mac\":\"%s\"}", mac);
 }
-
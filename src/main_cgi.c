@@ -49,6 +49,9 @@
 #include "version.h"
 #include "xsrf.h"
 #include "dns.h"
+#include "apply.h"
+#include "downtime.h"
+#include "metrics.h"
 
 #define JSON_ERROR_BUFFER_LEN 1024
 
@@ -59,6 +62,8 @@ int main()
 #endif
 		const char* method = getenv("REQUEST_METHOD");
 		const char* query = getenv("QUERY_STRING");
+		/* the interface answering again is what a reboot's downtime is measured to */
+		downtime_mark_up();
 		if (method == NULL) {
 			printf("Status: 400 Bad Request\n");
 			printf("Allow: GET, POST, HEAD\n");
@@ -102,6 +107,11 @@ int main()
 				if (valid_creds(top, &token)) {
 					post_reboot();
 				}
+			} else if (strcmp(query, "apply") == 0) {
+				struct xsrft token;
+				if (valid_creds(top, &token)) {
+					post_apply(top, &token);
+				}
 			} else if (strcmp(query, "wan_ip") == 0) {
 				struct xsrft token;
 				if (valid_creds(top, &token)) {
@@ -112,6 +122,11 @@ int main()
 				if (valid_creds(top, &token)) {
 					post_dns(top, &token);
 				}
+			} else if (strcmp(query, "dns_bench") == 0) {
+				struct xsrft token;
+				if (valid_creds(top, &token)) {
+					post_dns_bench(top, &token);
+				}
 			} else if (strcmp(query, "lan_ip") == 0) {
 				struct xsrft token;
 				if (valid_creds(top, &token)) {
@@ -147,6 +162,10 @@ int main()
 				get_mac();
 			} else if (strcmp(query, "check_reboot") == 0) {
 				get_check_reboot();
+			} else if (strcmp(query, "update_status") == 0) {
+				get_update_status();
+			} else if (strcmp(query, "metrics") == 0) {
+				get_metrics();
 			} else {
 				printf("Status: 400 Bad Request\n");
 				printf("Content-type: application/json\n\n");
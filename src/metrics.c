@@ -0,0 +1,56 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "metrics.h"
+
+#include <stdio.h>
+
+#include "breaker.h"
+#include "downtime.h"
+#include "recover.h"
+
+void get_metrics()
+{
+	struct downtime downtime;
+	enum recover_step step;
+	long long when;
+
+	if (!downtime_read(&downtime)) {
+		printf("Status: 500 Internal Server Error\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"errors\":[\"Unable to read reboot times.\"]}");
+		return;
+	}
+
+	printf("Status: 200 OK\n");
+	printf("Content-type: application/json\n\n");
+	printf("{\"reboot\":{\"pending\":%s,\"prepare_ms\":%ld,\"downtime_ms\":%ld,\"estimate_ms\":%ld}",
+			(downtime.shutdown_ms != 0) ? "true" : "false", downtime.prepare_ms,
+			downtime.last_ms, downtime_estimate_ms());
+	if (recover_last(&step, &when)) {
+		printf(",\"recovery\":{\"last_step\":\"%s\",\"last_at\":%lld}", recover_step_name(step), when);
+	}
+	printf(",\"breakers\":");
+	breaker_print();
+	printf("}");
+}
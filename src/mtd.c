@@ -0,0 +1,69 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "mtd.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MTD_PROC_PATH "/proc/mtd"
+#define MTD_DEVICE_FORMAT "/dev/mtd%d"
+
+bool mtd_find(const char* name, char device[MTD_DEVICE_LENGTH], long long* size)
+{
+	FILE* mtd;
+	char line[BUFSIZ];
+	char mtd_name[BUFSIZ];
+	unsigned long long mtd_size;
+	unsigned int erase_size;
+	int index;
+	bool found = false;
+
+	if ((mtd = fopen(MTD_PROC_PATH, "r")) == NULL) {
+		return false;
+	}
+	/* e.g. mtd3: 007a0000 00010000 "firmware" */
+	while (!found && fgets(line, BUFSIZ, mtd) != NULL) {
+		if (sscanf(line, "mtd%d: %llx %x \"%[^\"]\"", &index, &mtd_size, &erase_size, mtd_name) == 4
+				&& strcmp(mtd_name, name) == 0) {
+			snprintf(device, MTD_DEVICE_LENGTH, MTD_DEVICE_FORMAT, index);
+			*size = (long long)mtd_size;
+			found = true;
+		}
+	}
+	fclose(mtd);
+	return found;
+}
+
+int mtd_open(const char* name, long long* size)
+{
+	char device[MTD_DEVICE_LENGTH];
+
+	if (!mtd_find(name, device, size)) {
+		return -1;
+	}
+	return open(device, O_RDONLY);
+}
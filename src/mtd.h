@@ -0,0 +1,37 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_MTD_H
+#define WIOMW_SUI_MTD_H
+
+#include <stdbool.h>
+
+#define MTD_FIRMWARE_PARTITION "firmware"
+#define MTD_DEVICE_LENGTH 32
+
+/* looks name up in /proc/mtd and gives its character device and size */
+bool mtd_find(const char* name, char device[MTD_DEVICE_LENGTH], long long* size);
+
+/* opens the partition called name read-only, or returns -1 */
+int mtd_open(const char* name, long long* size);
+
+#endif
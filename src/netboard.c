@@ -0,0 +1,157 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "netboard.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "netinfo.h"
+
+#define NETBOARD_READ_ATTEMPTS 64
+
+/* kept mapped for the life of the process so FastCGI only pays for it once */
+static const struct netboard* board = NULL;
+
+static const struct netboard* map_board()
+{
+	struct stat board_stat;
+	void* mapped;
+	int fd;
+
+	if (board != NULL) {
+		return board;
+	}
+	if ((fd = open(NETBOARD_PATH, O_RDONLY)) == -1) {
+		return NULL;
+	}
+	if (fstat(fd, &board_stat) == -1 || board_stat.st_size < (off_t)sizeof(struct netboard)) {
+		close(fd);
+		return NULL;
+	}
+	mapped = mmap(NULL, sizeof(struct netboard), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		return NULL;
+	}
+	if (((const struct netboard*)mapped)->magic != NETBOARD_MAGIC) {
+		munmap(mapped, sizeof(struct netboard));
+		return NULL;
+	}
+
+	board = (const struct netboard*)mapped;
+	return board;
+}
+
+bool netboard_read(struct netboard_snapshot* snapshot)
+{
+	const struct netboard* mapped;
+	size_t attempt;
+
+	if ((mapped = map_board()) == NULL) {
+		return false;
+	}
+
+	for (attempt = 0; attempt < NETBOARD_READ_ATTEMPTS; attempt++) {
+		uint32_t before = mapped->sequence;
+		uint32_t after;
+		__sync_synchronize();
+		if ((before & 1) == 0) {
+			memcpy(snapshot, (const void*)&(mapped->snapshot), sizeof(struct netboard_snapshot));
+			__sync_synchronize();
+			after = mapped->sequence;
+			if (before == after) {
+				/* a board that was never filled in is as good as no board */
+				return snapshot->generation != 0;
+			}
+		}
+	}
+
+	/* the writer is stuck or died mid-update, so let the caller ask the kernel */
+	return false;
+}
+
+bool netboard_etag(char etag[NETBOARD_ETAG_LENGTH])
+{
+	struct netboard_snapshot snapshot;
+
+	if (!netboard_read(&snapshot)) {
+		return false;
+	}
+	snprintf(etag, NETBOARD_ETAG_LENGTH, "\"%x-%x\"", snapshot.epoch, snapshot.generation);
+	return true;
+}
+
+int netboard_wan_carrier()
+{
+	struct netboard_snapshot snapshot;
+
+	if (netboard_read(&snapshot)) {
+		return snapshot.wan.carrier;
+	}
+	return netinfo_carrier(netinfo_wan_ifname());
+}
+
+bool netboard_wan_mac(char mac[NETINFO_MAC_LENGTH])
+{
+	struct netboard_snapshot snapshot;
+
+	if (netboard_read(&snapshot)) {
+		if (snapshot.wan.has_mac == 0) {
+			return false;
+		}
+		memcpy(mac, snapshot.wan.mac, NETINFO_MAC_LENGTH);
+		mac[NETINFO_MAC_LENGTH - 1] = '\0';
+		return true;
+	}
+	return netinfo_mac(netinfo_wan_ifname(), mac);
+}
+
+bool netboard_wan_ipv4(uint32_t* address, uint32_t* netmask)
+{
+	struct netboard_snapshot snapshot;
+
+	if (netboard_read(&snapshot)) {
+		*address = snapshot.wan.address;
+		*netmask = snapshot.wan.netmask;
+		return snapshot.wan.address != 0;
+	}
+	return netinfo_ipv4(netinfo_wan_ifname(), address, netmask);
+}
+
+bool netboard_gateway4(uint32_t* gateway)
+{
+	struct netboard_snapshot snapshot;
+
+	if (netboard_read(&snapshot)) {
+		*gateway = snapshot.gateway;
+		return snapshot.gateway != 0;
+	}
+	return netinfo_gateway4(NULL, gateway);
+}
@@ -0,0 +1,76 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_NETBOARD_H
+#define WIOMW_SUI_NETBOARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "netinfo.h"
+
+#define NETBOARD_PATH "/var/run/sui-netboard"
+#define NETBOARD_MAGIC 0x4E425244
+#define NETBOARD_ETAG_LENGTH 32
+
+struct netboard_iface {
+	char ifname[NETINFO_IFNAME_LENGTH];
+	int32_t carrier;
+	uint32_t address;
+	uint32_t netmask;
+	uint32_t has_mac;
+	char mac[NETINFO_MAC_LENGTH];
+};
+
+struct netboard_snapshot {
+	/* epoch is when netstatd started, so restarting it never reuses an ETag */
+	uint32_t epoch;
+	uint32_t generation;
+	uint32_t gateway;
+	struct netboard_iface wan;
+	struct netboard_iface lan;
+};
+
+/*
+ * The file at NETBOARD_PATH holds exactly one of these. netstatd is the only
+ * writer: it makes sequence odd, rewrites the snapshot, and makes it even
+ * again. Readers copy the snapshot and retry if sequence moved underneath.
+ */
+struct netboard {
+	uint32_t magic;
+	volatile uint32_t sequence;
+	struct netboard_snapshot snapshot;
+};
+
+/* a consistent copy of the board; false if netstatd is not running */
+bool netboard_read(struct netboard_snapshot* snapshot);
+
+/* quoted entity tag for the current board, or false if there is no board */
+bool netboard_etag(char etag[NETBOARD_ETAG_LENGTH]);
+
+/* the same facts as netinfo, served from the board when it is available */
+int netboard_wan_carrier();
+bool netboard_wan_mac(char mac[NETINFO_MAC_LENGTH]);
+bool netboard_wan_ipv4(uint32_t* address, uint32_t* netmask);
+bool netboard_gateway4(uint32_t* gateway);
+
+#endif
@@ -0,0 +1,304 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "netinfo.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include "uci_cache.h"
+
+#define WAN_IFNAME_UCI_PATH "network.wan.ifname"
+#define LAN_IFNAME_UCI_PATH "network.lan.ifname"
+#define LAN_TYPE_UCI_PATH "network.lan.type"
+#define LAN_BRIDGE_IFNAME "br-lan"
+#define CARRIER_PATH_FORMAT "/sys/class/net/%s/carrier"
+
+#define NETLINK_BUFFER_LENGTH 8192
+
+typedef bool (*netlink_cb)(struct nlmsghdr* msg, void* arg);
+
+struct addr_query {
+	int ifindex;
+	uint32_t address;
+	uint32_t netmask;
+	bool found;
+};
+
+struct gateway_query {
+	int ifindex;
+	uint32_t gateway;
+	bool found;
+};
+
+struct link_query {
+	int ifindex;
+	unsigned char mac[6];
+	bool found;
+};
+
+/*
+ * Sends a dump request and hands every reply to cb until the kernel is done
+ * or cb returns false. Returns false on any socket or protocol error.
+ */
+static bool netlink_dump(uint16_t type, unsigned char family, netlink_cb cb, void* arg)
+{
+	struct {
+		struct nlmsghdr header;
+		struct rtgenmsg body;
+	} request;
+	char buffer[NETLINK_BUFFER_LENGTH];
+	struct sockaddr_nl addr;
+	int sock = -1;
+	bool done = false;
+	bool ok = true;
+
+	if ((sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) == -1) {
+		return false;
+	}
+
+	memset(&addr, 0x00, sizeof(struct sockaddr_nl));
+	addr.nl_family = AF_NETLINK;
+	memset(&request, 0x00, sizeof(request));
+	request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+	request.header.nlmsg_type = type;
+	request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	request.header.nlmsg_seq = 1;
+	request.body.rtgen_family = family;
+
+	if (sendto(sock, &request, request.header.nlmsg_len, 0, (struct sockaddr*)&addr, sizeof(struct sockaddr_nl)) == -1) {
+		close(sock);
+		return false;
+	}
+
+	while (!done && ok) {
+		ssize_t len = recv(sock, buffer, NETLINK_BUFFER_LENGTH, 0);
+		struct nlmsghdr* msg = (struct nlmsghdr*)buffer;
+		if (len <= 0) {
+			ok = false;
+			break;
+		}
+		for (; !done && NLMSG_OK(msg, (size_t)len); msg = NLMSG_NEXT(msg, len)) {
+			if (msg->nlmsg_type == NLMSG_DONE) {
+				done = true;
+			} else if (msg->nlmsg_type == NLMSG_ERROR) {
+				ok = false;
+				break;
+			} else if (!cb(msg, arg)) {
+				/* closing the socket discards whatever is left of the dump */
+				done = true;
+			}
+		}
+	}
+
+	close(sock);
+	return ok;
+}
+
+static bool link_cb(struct nlmsghdr* msg, void* arg)
+{
+	struct link_query* query = (struct link_query*)arg;
+	struct ifinfomsg* info = (struct ifinfomsg*)NLMSG_DATA(msg);
+	struct rtattr* attr = IFLA_RTA(info);
+	int len = IFLA_PAYLOAD(msg);
+
+	if (msg->nlmsg_type != RTM_NEWLINK || info->ifi_index != query->ifindex) {
+		return true;
+	}
+	for (; RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
+		if (attr->rta_type == IFLA_ADDRESS && RTA_PAYLOAD(attr) == 6) {
+			memcpy(query->mac, RTA_DATA(attr), 6);
+			query->found = true;
+		}
+	}
+	return false;
+}
+
+static bool addr_cb(struct nlmsghdr* msg, void* arg)
+{
+	struct addr_query* query = (struct addr_query*)arg;
+	struct ifaddrmsg* info = (struct ifaddrmsg*)NLMSG_DATA(msg);
+	struct rtattr* attr = IFA_RTA(info);
+	int len = IFA_PAYLOAD(msg);
+
+	if (msg->nlmsg_type != RTM_NEWADDR || info->ifa_family != AF_INET || (int)info->ifa_index != query->ifindex) {
+		return true;
+	}
+	for (; RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
+		/* IFA_LOCAL is our own end of a point-to-point link, IFA_ADDRESS otherwise */
+		if ((attr->rta_type == IFA_LOCAL || (attr->rta_type == IFA_ADDRESS && !query->found))
+				&& RTA_PAYLOAD(attr) == 4) {
+			memcpy(&(query->address), RTA_DATA(attr), 4);
+			query->found = true;
+		}
+	}
+	if (query->found) {
+		query->netmask = (info->ifa_prefixlen == 0) ? 0 : htonl(0xFFFFFFFF << (32 - info->ifa_prefixlen));
+		return false;
+	}
+	return true;
+}
+
+static bool route_cb(struct nlmsghdr* msg, void* arg)
+{
+	struct gateway_query* query = (struct gateway_query*)arg;
+	struct rtmsg* info = (struct rtmsg*)NLMSG_DATA(msg);
+	struct rtattr* attr = RTM_RTA(info);
+	int len = RTM_PAYLOAD(msg);
+	uint32_t gateway = 0;
+	int oif = 0;
+
+	if (msg->nlmsg_type != RTM_NEWROUTE || info->rtm_family != AF_INET
+			|| info->rtm_dst_len != 0 || info->rtm_table != RT_TABLE_MAIN) {
+		return true;
+	}
+	for (; RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
+		if (attr->rta_type == RTA_GATEWAY && RTA_PAYLOAD(attr) == 4) {
+			memcpy(&gateway, RTA_DATA(attr), 4);
+		} else if (attr->rta_type == RTA_OIF && RTA_PAYLOAD(attr) == sizeof(int)) {
+			memcpy(&oif, RTA_DATA(attr), sizeof(int));
+		}
+	}
+	if (gateway != 0 && (query->ifindex == 0 || query->ifindex == oif)) {
+		query->gateway = gateway;
+		query->found = true;
+		return false;
+	}
+	return true;
+}
+
+static char wan_ifname[NETINFO_IFNAME_LENGTH] = "";
+static char lan_ifname[NETINFO_IFNAME_LENGTH] = "";
+
+const char* netinfo_wan_ifname()
+{
+	if (wan_ifname[0] == '\0') {
+		uci_cache_string(WAN_IFNAME_UCI_PATH, wan_ifname, NETINFO_IFNAME_LENGTH);
+	}
+
+	return (wan_ifname[0] == '\0') ? NULL : wan_ifname;
+}
+
+const char* netinfo_lan_ifname()
+{
+	if (lan_ifname[0] == '\0') {
+		char type[BUFSIZ];
+		if (uci_cache_string(LAN_TYPE_UCI_PATH, type, BUFSIZ) == UCI_CACHE_FOUND && strcmp(type, "bridge") == 0) {
+			/* netifd names bridges after the interface section */
+			strncpy(lan_ifname, LAN_BRIDGE_IFNAME, NETINFO_IFNAME_LENGTH - 1);
+		} else {
+			uci_cache_string(LAN_IFNAME_UCI_PATH, lan_ifname, NETINFO_IFNAME_LENGTH);
+		}
+	}
+
+	return (lan_ifname[0] == '\0') ? NULL : lan_ifname;
+}
+
+void netinfo_reset()
+{
+	wan_ifname[0] = '\0';
+	lan_ifname[0] = '\0';
+}
+
+int netinfo_carrier(const char* ifname)
+{
+	char carrier_path[BUFSIZ];
+	FILE* carrier_file;
+	int c = EOF;
+
+	if (ifname == NULL) {
+		return -1;
+	}
+	snprintf(carrier_path, BUFSIZ, CARRIER_PATH_FORMAT, ifname);
+	if ((carrier_file = fopen(carrier_path, "r")) == NULL) {
+		return -1;
+	}
+	c = fgetc(carrier_file);
+	fclose(carrier_file);
+
+	if (c == '1') {
+		return 1;
+	} else if (c == '0') {
+		return 0;
+	} else {
+		/* reading carrier of an administratively down interface gives EINVAL */
+		return -1;
+	}
+}
+
+bool netinfo_mac(const char* ifname, char mac[NETINFO_MAC_LENGTH])
+{
+	struct link_query query;
+
+	memset(&query, 0x00, sizeof(struct link_query));
+	if (ifname == NULL || (query.ifindex = if_nametoindex(ifname)) == 0
+			|| !netlink_dump(RTM_GETLINK, AF_UNSPEC, &link_cb, &query)
+			|| !query.found) {
+		return false;
+	}
+
+	snprintf(mac, NETINFO_MAC_LENGTH, "%02X:%02X:%02X:%02X:%02X:%02X",
+			query.mac[0], query.mac[1], query.mac[2], query.mac[3], query.mac[4], query.mac[5]);
+	return true;
+}
+
+bool netinfo_ipv4(const char* ifname, uint32_t* address, uint32_t* netmask)
+{
+	struct addr_query query;
+
+	memset(&query, 0x00, sizeof(struct addr_query));
+	if (ifname == NULL || (query.ifindex = if_nametoindex(ifname)) == 0
+			|| !netlink_dump(RTM_GETADDR, AF_INET, &addr_cb, &query)
+			|| !query.found) {
+		*address = 0;
+		*netmask = 0;
+		return false;
+	}
+
+	*address = query.address;
+	*netmask = query.netmask;
+	return true;
+}
+
+bool netinfo_gateway4(const char* ifname, uint32_t* gateway)
+{
+	struct gateway_query query;
+
+	memset(&query, 0x00, sizeof(struct gateway_query));
+	if ((ifname != NULL && (query.ifindex = if_nametoindex(ifname)) == 0)
+			|| !netlink_dump(RTM_GETROUTE, AF_INET, &route_cb, &query)
+			|| !query.found) {
+		*gateway = 0;
+		return false;
+	}
+
+	*gateway = query.gateway;
+	return true;
+}
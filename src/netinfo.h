@@ -0,0 +1,51 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_NETINFO_H
+#define WIOMW_SUI_NETINFO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NETINFO_IFNAME_LENGTH 16
+#define NETINFO_MAC_LENGTH 18
+
+/* the WAN and LAN device names from UCI, looked up once per process */
+const char* netinfo_wan_ifname();
+const char* netinfo_lan_ifname();
+
+/* forgets the device names so that the next lookup goes back to UCI */
+void netinfo_reset();
+
+/* returns 1 if a carrier is present, 0 if not, and -1 if unknown */
+int netinfo_carrier(const char* ifname);
+
+/* formats the hardware address as "01:23:45:67:89:AB" */
+bool netinfo_mac(const char* ifname, char mac[NETINFO_MAC_LENGTH]);
+
+/* address and netmask are returned in network byte order */
+bool netinfo_ipv4(const char* ifname, uint32_t* address, uint32_t* netmask);
+
+/* default IPv4 gateway in network byte order; a NULL ifname matches any device */
+bool netinfo_gateway4(const char* ifname, uint32_t* gateway);
+
+#endif
@@ -0,0 +1,216 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "netboard.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "downtime.h"
+#include "netinfo.h"
+#include "syslog_syserror.h"
+
+#define NETSTATD_REFRESH_MS 60000
+#define NETSTATD_BUFFER_LENGTH 8192
+
+static volatile sig_atomic_t reload = 0;
+static volatile sig_atomic_t running = 1;
+
+static void handle_hup(int signum)
+{
+	reload = 1;
+}
+
+static void handle_term(int signum)
+{
+	running = 0;
+}
+
+static struct netboard* open_board()
+{
+	void* mapped;
+	int fd;
+
+	/* reuse the file in place so long-lived readers keep seeing updates */
+	if ((fd = open(NETBOARD_PATH, O_RDWR | O_CREAT, 0644)) == -1) {
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(struct netboard)) == -1) {
+		close(fd);
+		return NULL;
+	}
+	mapped = mmap(NULL, sizeof(struct netboard), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	return (mapped == MAP_FAILED) ? NULL : (struct netboard*)mapped;
+}
+
+static void publish(struct netboard* board, const struct netboard_snapshot* snapshot)
+{
+	/* a previous writer may have died with the sequence left odd */
+	board->sequence |= 1;
+	__sync_synchronize();
+	memcpy(&(board->snapshot), snapshot, sizeof(struct netboard_snapshot));
+	board->magic = NETBOARD_MAGIC;
+	__sync_synchronize();
+	board->sequence++;
+}
+
+static void fill_iface(struct netboard_iface* iface, const char* ifname)
+{
+	memset(iface, 0x00, sizeof(struct netboard_iface));
+	if (ifname == NULL) {
+		iface->carrier = -1;
+		return;
+	}
+	strncpy(iface->ifname, ifname, NETINFO_IFNAME_LENGTH - 1);
+	iface->carrier = netinfo_carrier(ifname);
+	netinfo_ipv4(ifname, &(iface->address), &(iface->netmask));
+	iface->has_mac = netinfo_mac(ifname, iface->mac) ? 1 : 0;
+}
+
+static void refresh(struct netboard* board, uint32_t epoch)
+{
+	struct netboard_snapshot next;
+
+	memset(&next, 0x00, sizeof(struct netboard_snapshot));
+	fill_iface(&(next.wan), netinfo_wan_ifname());
+	fill_iface(&(next.lan), netinfo_lan_ifname());
+	netinfo_gateway4(NULL, &(next.gateway));
+
+	/* only a real change moves the generation, so ETags stay valid across refreshes */
+	if (board->magic == NETBOARD_MAGIC && board->snapshot.epoch == epoch
+			&& memcmp(&(next.gateway), &(board->snapshot.gateway),
+				sizeof(struct netboard_snapshot) - offsetof(struct netboard_snapshot, gateway)) == 0) {
+		return;
+	}
+	next.epoch = epoch;
+	next.generation = (board->snapshot.epoch == epoch) ? board->snapshot.generation + 1 : 1;
+	if (next.generation == 0) {
+		next.generation = 1;
+	}
+	publish(board, &next);
+}
+
+static void retire(struct netboard* board)
+{
+	struct netboard_snapshot empty;
+
+	/* generation zero sends readers back to asking the kernel themselves */
+	memset(&empty, 0x00, sizeof(struct netboard_snapshot));
+	publish(board, &empty);
+}
+
+int main()
+{
+	struct sockaddr_nl addr;
+	struct sigaction action;
+	struct netboard* board;
+	char buffer[NETSTATD_BUFFER_LENGTH];
+	uint32_t epoch;
+	int sock = -1;
+
+	openlog("NETSTATD", 0, LOG_DAEMON);
+
+	memset(&action, 0x00, sizeof(struct sigaction));
+	action.sa_handler = &handle_hup;
+	sigaction(SIGHUP, &action, NULL);
+	action.sa_handler = &handle_term;
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+
+	if ((sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) == -1) {
+		syslog_syserror(LOG_ALERT, "Unable to create netlink socket");
+		exit(EX_OSERR);
+	}
+
+	memset(&addr, 0x00, sizeof(struct sockaddr_nl));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE;
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(struct sockaddr_nl)) == -1) {
+		syslog_syserror(LOG_ALERT, "Unable to subscribe to netlink groups");
+		exit(EX_OSERR);
+	}
+
+	if ((board = open_board()) == NULL) {
+		syslog_syserror(LOG_ALERT, "Unable to map status board");
+		exit(EX_OSERR);
+	}
+
+	epoch = (uint32_t)time(NULL);
+	refresh(board, epoch);
+	/* started at boot, so this is usually the first to see the router back */
+	downtime_mark_up();
+
+	while (running) {
+		struct pollfd pfd;
+		int ready;
+
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if ((ready = poll(&pfd, 1, NETSTATD_REFRESH_MS)) == -1 && errno != EINTR) {
+			syslog_syserror(LOG_ALERT, "Unable to poll netlink socket");
+			break;
+		}
+
+		if (ready > 0) {
+			/*
+			 * The events only say that something changed; drain them all and
+			 * then take one fresh look, which also covers ENOBUFS overruns.
+			 */
+			while (true) {
+				ssize_t len = recv(sock, buffer, NETSTATD_BUFFER_LENGTH, MSG_DONTWAIT);
+				if (len == 0 || (len < 0 && errno != ENOBUFS)) {
+					break;
+				}
+			}
+		}
+
+		if (reload) {
+			reload = 0;
+			netinfo_reset();
+		}
+		if (running) {
+			refresh(board, epoch);
+		}
+	}
+
+	retire(board);
+	close(sock);
+	return EX_OK;
+}
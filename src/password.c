@@ -33,7 +33,8 @@
 #include <unistd.h>
 #include <polarssl/sha512.h>
 #include <yajl/yajl_tree.h>
-#include <uci.h>
+#include "run.h"
+#include "uci_cache.h"
 #include "urandom.h"
 #include "xsrf.h"
 #include "xsrfc.h"
@@ -45,7 +46,8 @@
 
 #define WIFI_CHANGED_UCI_PATH "sui.changed.wifi"
 
-#define PARTIAL_PASSWD_CMD "passwd >/dev/null; echo $? > "
+#define PASSWD_PATH "/bin/passwd"
+#define PASSWD_TIMEOUT_MS 10000
 
 void post_password(yajl_val top)
 {
@@ -80,42 +82,30 @@ void post_password(yajl_val top)
 
 	bool valid_password = false;
 	if (strlen(spass->sp_pwdp) < 3) {
-		char passwd_cmd[BUFSIZ] = PARTIAL_PASSWD_CMD "/tmp/sui-error-XXXXXX";
-		char* tempfile = passwd_cmd + strlen(PARTIAL_PASSWD_CMD);
-		int tfd = -1;
-		if ((tfd = mkstemp(tempfile)) == -1) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"errors\":[\"Unable to set password (unable to create file).\"]}");
-			return;
-		}
-
-		FILE* passwd_input;
-		if ((passwd_input = popen(passwd_cmd, "w")) == NULL) {
-			printf("Status: 500 Internal Server Error\n");
+		const char* passwd_argv[] = {PASSWD_PATH, NULL};
+		struct run_options passwd;
+		char passwd_input[BUFSIZ];
+		int passwd_input_length = snprintf(passwd_input, BUFSIZ, "%s\n%s\n", password, password);
+		if (passwd_input_length < 0 || passwd_input_length >= BUFSIZ) {
+			printf("Status: 403 Forbidden\n");
 			printf("Content-type: application/json\n\n");
-			printf("{\"errors\":[\"Unable to set password (unable to begin process).\"]}");
-			close(tfd);
-			remove(tempfile);
+			printf("{\"errors\":[\"Invalid password.\"]}");
 			return;
 		}
-		fprintf(passwd_input, "%s\n%s\n", password, password);
-		pclose(passwd_input);
 
-		FILE* passwd_result = fdopen(tfd, "r");
-		rewind(passwd_result);
-		if (fgetc(passwd_result) != '0') {
+		memset(&passwd, 0x00, sizeof(struct run_options));
+		passwd.timeout_ms = PASSWD_TIMEOUT_MS;
+		passwd.input = passwd_input;
+		passwd.input_length = (size_t)passwd_input_length;
+		bool passwd_ok = run(passwd_argv, &passwd, NULL);
+		memset(passwd_input, 0x00, BUFSIZ);
+		if (!passwd_ok) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"errors\":[\"Unable to set password (failure during the process).\"]}");
-			fclose(passwd_result);
-			remove(tempfile);
 			return;
 		}
 
-		fclose(passwd_result);
-		remove(tempfile);
-
 		if ((spass = getspnam("root")) == NULL) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
@@ -193,20 +183,15 @@ void post_password(yajl_val top)
 		psalt_and_shash[CRED_RANDOM_DATA_LEN * 2] = '\0';
 	}
 
-	struct uci_context* ctx;
-	struct uci_ptr ptr;
-	int res = 0;
-	char uci_lookup_str[BUFSIZ];
+	enum uci_cache_status status;
 	bool setup = false;
-	ctx = uci_alloc_context();
 
-	strncpy(uci_lookup_str, WIFI_CHANGED_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK) {
+	if ((status = uci_cache_exists(WIFI_CHANGED_UCI_PATH)) == UCI_CACHE_ERROR) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"errors\":[\"Unable to determine setup status.\"]}");
 		return;
-	} else if ((ptr.flags & UCI_LOOKUP_COMPLETE) != 0) {
+	} else if (status == UCI_CACHE_FOUND) {
 		setup = true;
 	}
 
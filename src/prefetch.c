@@ -0,0 +1,397 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "prefetch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "delta.h"
+#include "digest.h"
+#include "download.h"
+#include "monotonic.h"
+#include "preflight.h"
+#include "stream.h"
+
+#define PREFETCH_PUBLISH_INTERVAL_MS 1000
+#define PREFETCH_PATH_LENGTH 1024
+
+struct worker {
+	struct prefetch_status status;
+	/* services stopped to make room, which are started again if the download fails */
+	struct preflight_result* preflight;
+	/* rate is measured over what this worker fetched, not what it resumed */
+	long long first_received;
+	long started_ms;
+	long published_ms;
+};
+
+static bool write_status(struct prefetch_status* status)
+{
+	char temp_path[PREFETCH_PATH_LENGTH];
+	FILE* status_file;
+
+	status->updated = time(NULL);
+	snprintf(temp_path, PREFETCH_PATH_LENGTH, PREFETCH_STATUS_PATH ".%d", (int)getpid());
+	if ((status_file = fopen(temp_path, "w")) == NULL) {
+		return false;
+	}
+	if (fwrite(status, sizeof(struct prefetch_status), 1, status_file) != 1) {
+		fclose(status_file);
+		unlink(temp_path);
+		return false;
+	}
+	/* readers must never see half a status */
+	if (fclose(status_file) != 0 || rename(temp_path, PREFETCH_STATUS_PATH) != 0) {
+		unlink(temp_path);
+		return false;
+	}
+	return true;
+}
+
+static void worker_progress(void* raw_worker, long long received, long long size)
+{
+	struct worker* worker = (struct worker*)raw_worker;
+	long now = monotonic_ms();
+	long elapsed;
+
+	if (worker->first_received < 0 || received < worker->first_received) {
+		/* first report, or the server made us start over */
+		worker->first_received = received;
+		worker->started_ms = now;
+	}
+	worker->status.received = received;
+
+	elapsed = now - worker->started_ms;
+	if (elapsed > 0 && received > worker->first_received) {
+		worker->status.rate = (received - worker->first_received) * 1000 / elapsed;
+	}
+	worker->status.eta = (worker->status.rate > 0) ? (size - received) / worker->status.rate : -1;
+
+	if (now - worker->published_ms >= PREFETCH_PUBLISH_INTERVAL_MS) {
+		worker->published_ms = now;
+		write_status(&(worker->status));
+	}
+}
+
+static void fail(struct worker* worker, const char* error)
+{
+	worker->status.state = PREFETCH_FAILED;
+	worker->status.eta = -1;
+	strncpy(worker->status.error, error, PREFETCH_ERROR_LENGTH - 1);
+	write_status(&(worker->status));
+	if (worker->preflight != NULL) {
+		preflight_restart_services(worker->preflight);
+	}
+}
+
+static void start_phase(struct worker* worker, bool delta, long long size)
+{
+	worker->status.delta = delta;
+	worker->status.size = size;
+	worker->status.received = 0;
+	worker->status.rate = 0;
+	worker->status.eta = -1;
+	worker->first_received = -1;
+	worker->published_ms = 0;
+}
+
+static void run_worker(const struct download_job* job, const struct delta_job* delta, const char* sha256, struct worker* worker)
+{
+	struct download_job worker_job;
+	struct digest_result digest_result;
+	struct stat file_stat;
+	const char* error = NULL;
+	bool rebuilt = false;
+
+	memcpy(&worker_job, job, sizeof(struct download_job));
+	worker_job.progress = &worker_progress;
+	worker_job.progress_arg = worker;
+
+	if (delta != NULL) {
+		start_phase(worker, true, delta->size);
+		if ((error = delta_fetch(delta, &worker_job, &digest_result)) == NULL
+				&& !digest_matches(&digest_result, job->md5, sha256)) {
+			remove(job->path);
+			error = "Image rebuilt from the update delta did not have the correct md5.";
+		}
+		if (error != NULL) {
+			syslog(LOG_WARNING, "Falling back to the full update image: %s", error);
+		} else {
+			syslog(LOG_INFO, "Rebuilt update %s from a delta", worker->status.version);
+			rebuilt = true;
+		}
+	}
+	start_phase(worker, false, job->size);
+	worker->status.received = rebuilt ? job->size : 0;
+
+	if (!rebuilt && (error = download_fetch(&worker_job, &digest_result)) != NULL) {
+		fail(worker, error);
+	} else if (stat(job->path, &file_stat) != 0) {
+		syslog(LOG_ERR, "Unable to stat the new update file: %s", strerror(errno));
+		fail(worker, "Error while reading the downloaded update file.");
+	} else if (file_stat.st_size != job->size) {
+		remove(job->path);
+		fail(worker, "Downloaded update file was the wrong size.");
+	} else if (!digest_matches(&digest_result, job->md5, sha256)) {
+		remove(job->path);
+		fail(worker, "Downloaded update file did not have the correct md5.");
+	} else {
+		worker->status.state = PREFETCH_STAGED;
+		worker->status.received = job->size;
+		worker->status.eta = 0;
+		worker->status.staged_mtime = file_stat.st_mtime;
+		write_status(&(worker->status));
+		syslog(LOG_INFO, "Update %s is downloaded and verified", worker->status.version);
+	}
+}
+
+/* the image lives on its own ramfs, so it goes to sysupgrade right away instead of waiting to be staged */
+static void run_stream_worker(const struct download_job* job, const char* sha256, struct worker* worker)
+{
+	struct download_job worker_job;
+	const char* error;
+
+	memcpy(&worker_job, job, sizeof(struct download_job));
+	worker_job.progress = &worker_progress;
+	worker_job.progress_arg = worker;
+
+	start_phase(worker, false, job->size);
+	if ((error = stream_stage(&worker_job, sha256)) != NULL) {
+		fail(worker, error);
+		return;
+	}
+	syslog(LOG_NOTICE, "Handing update %s to sysupgrade", worker->status.version);
+	if ((error = stream_apply()) != NULL) {
+		stream_discard();
+		fail(worker, error);
+		return;
+	}
+	worker->status.state = PREFETCH_FLASHED;
+	worker->status.received = job->size;
+	worker->status.eta = 0;
+	write_status(&(worker->status));
+}
+
+static void detach()
+{
+	int null_fd;
+
+	setsid();
+	signal(SIGPIPE, SIG_IGN);
+	/* the web server waits for the CGI's output to close */
+	if ((null_fd = open("/dev/null", O_RDWR)) != -1) {
+		dup2(null_fd, STDIN_FILENO);
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+		if (null_fd > STDERR_FILENO) {
+			close(null_fd);
+		}
+	}
+}
+
+static bool start_worker(const struct download_job* job, const struct delta_job* delta, struct preflight_result* preflight, bool stream, const char* version, const char* sha256, struct prefetch_status* status)
+{
+	struct worker worker;
+	int lock_fd;
+	int child_status;
+	pid_t child;
+
+	if ((lock_fd = open(PREFETCH_LOCK_PATH, O_RDWR | O_CREAT, 0644)) == -1) {
+		syslog(LOG_ERR, "Unable to open the update download lock: %s", strerror(errno));
+		memset(status, 0x00, sizeof(struct prefetch_status));
+		return false;
+	}
+	if (flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+		/* a worker is already on it, and it did not need the room */
+		close(lock_fd);
+		if (preflight != NULL) {
+			preflight_restart_services(preflight);
+		}
+		if (!prefetch_read(status)) {
+			memset(status, 0x00, sizeof(struct prefetch_status));
+			status->state = PREFETCH_RUNNING;
+		}
+		return true;
+	}
+
+	memset(&worker, 0x00, sizeof(struct worker));
+	worker.preflight = preflight;
+	worker.status.state = PREFETCH_RUNNING;
+	strncpy(worker.status.version, version, PREFETCH_VERSION_LENGTH - 1);
+	strncpy(worker.status.md5, job->md5, DIGEST_MD5_HEX_LENGTH - 1);
+	worker.status.stream = stream;
+	worker.status.delta = (delta != NULL);
+	worker.status.size = (delta != NULL) ? delta->size : job->size;
+	worker.status.eta = -1;
+	worker.status.started = time(NULL);
+	/* stands in until the worker has written its own pid a moment from now */
+	worker.status.pid = getpid();
+	write_status(&(worker.status));
+
+	fflush(stdout);
+	if ((child = fork()) == -1) {
+		syslog(LOG_ERR, "Unable to fork the update download: %s", strerror(errno));
+		fail(&worker, "Error while starting the update download.");
+		memcpy(status, &(worker.status), sizeof(struct prefetch_status));
+		close(lock_fd);
+		return false;
+	} else if (child == 0) {
+		/* the grandchild is adopted by init, so nobody has to reap it */
+		detach();
+		if ((child = fork()) != 0) {
+			_exit((child == -1) ? 1 : 0);
+		}
+		worker.status.pid = getpid();
+		write_status(&(worker.status));
+		if (stream) {
+			run_stream_worker(job, sha256, &worker);
+		} else {
+			run_worker(job, delta, sha256, &worker);
+		}
+		_exit(0);
+	}
+
+	/* the lock stays with the worker's copy of the descriptor */
+	close(lock_fd);
+	while (waitpid(child, &child_status, 0) == -1 && errno == EINTR) {
+	}
+	if (!WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0) {
+		syslog(LOG_ERR, "Unable to fork the update download worker");
+		fail(&worker, "Error while starting the update download.");
+		memcpy(status, &(worker.status), sizeof(struct prefetch_status));
+		return false;
+	}
+
+	memcpy(status, &(worker.status), sizeof(struct prefetch_status));
+	return true;
+}
+
+bool prefetch_start(const struct download_job* job, const struct delta_job* delta, struct preflight_result* preflight, const char* version, const char* sha256, struct prefetch_status* status)
+{
+	return start_worker(job, delta, preflight, false, version, sha256, status);
+}
+
+bool prefetch_stream(const struct download_job* job, const char* version, const char* sha256, struct prefetch_status* status)
+{
+	return start_worker(job, NULL, NULL, true, version, sha256, status);
+}
+
+static bool load_status(struct prefetch_status* status)
+{
+	FILE* status_file;
+	bool ok;
+
+	memset(status, 0x00, sizeof(struct prefetch_status));
+	if ((status_file = fopen(PREFETCH_STATUS_PATH, "r")) == NULL) {
+		return false;
+	}
+	ok = fread(status, sizeof(struct prefetch_status), 1, status_file) == 1;
+	fclose(status_file);
+	if (!ok || status->state > PREFETCH_FLASHED) {
+		memset(status, 0x00, sizeof(struct prefetch_status));
+		return false;
+	}
+
+	status->version[PREFETCH_VERSION_LENGTH - 1] = '\0';
+	status->md5[DIGEST_MD5_HEX_LENGTH - 1] = '\0';
+	status->error[PREFETCH_ERROR_LENGTH - 1] = '\0';
+	return true;
+}
+
+static bool worker_alive(const struct prefetch_status* status)
+{
+	return status->state == PREFETCH_RUNNING
+		&& status->pid > 0 && (kill(status->pid, 0) == 0 || errno == EPERM);
+}
+
+bool prefetch_running()
+{
+	struct prefetch_status status;
+
+	return load_status(&status) && worker_alive(&status);
+}
+
+bool prefetch_read(struct prefetch_status* status)
+{
+	if (!load_status(status)) {
+		return false;
+	}
+	if (status->state == PREFETCH_RUNNING && !worker_alive(status)) {
+		/* the worker died without saying so; what it fetched is kept for resuming */
+		status->state = PREFETCH_FAILED;
+		status->eta = -1;
+		strncpy(status->error, "The update download was interrupted.", PREFETCH_ERROR_LENGTH - 1);
+	}
+	return true;
+}
+
+bool prefetch_staged(const char* path, long long size, const char* md5)
+{
+	struct prefetch_status status;
+	struct stat file_stat;
+
+	return prefetch_read(&status) && status.state == PREFETCH_STAGED
+		&& status.size == size && strcasecmp(status.md5, md5) == 0
+		&& stat(path, &file_stat) == 0 && file_stat.st_size == size
+		&& file_stat.st_mtime == status.staged_mtime;
+}
+
+const char* prefetch_state_name(enum prefetch_state state)
+{
+	switch (state) {
+	case PREFETCH_RUNNING:
+		return "downloading";
+	case PREFETCH_STAGED:
+		return "ready";
+	case PREFETCH_FAILED:
+		return "failed";
+	case PREFETCH_FLASHED:
+		return "rebooting";
+	default:
+		return "idle";
+	}
+}
+
+void prefetch_print(const struct prefetch_status* status)
+{
+	printf("\"download\":{\"state\":\"%s\",\"version\":\"%s\",\"stream\":%s,\"delta\":%s,\"size\":%lld,\"received\":%lld,\"rate\":%lld,\"eta\":%lld",
+			prefetch_state_name(status->state), status->version, status->stream ? "true" : "false", status->delta ? "true" : "false", status->size,
+			status->received, status->rate, status->eta);
+	if (status->state == PREFETCH_FAILED) {
+		printf(",\"error\":\"%s\"", status->error);
+	}
+	printf("}");
+}
@@ -0,0 +1,103 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_PREFETCH_H
+#define WIOMW_SUI_PREFETCH_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "delta.h"
+#include "digest.h"
+#include "download.h"
+#include "preflight.h"
+
+#define PREFETCH_STATUS_PATH "/var/run/sui-prefetch.status"
+#define PREFETCH_LOCK_PATH "/var/run/sui-prefetch.lock"
+#define PREFETCH_VERSION_LENGTH 64
+#define PREFETCH_ERROR_LENGTH 256
+
+enum prefetch_state {
+	PREFETCH_IDLE = 0,
+	PREFETCH_RUNNING,
+	PREFETCH_STAGED,
+	PREFETCH_FAILED,
+	/* only in stream mode, once sysupgrade has the image */
+	PREFETCH_FLASHED
+};
+
+struct prefetch_status {
+	enum prefetch_state state;
+	char version[PREFETCH_VERSION_LENGTH];
+	char md5[DIGEST_MD5_HEX_LENGTH];
+	bool stream;
+	/* while a delta is being applied, size and received count delta bytes */
+	bool delta;
+	long long size;
+	long long received;
+	/* bytes per second over this run, and seconds left at that rate (-1 if unknown) */
+	long long rate;
+	long long eta;
+	time_t started;
+	time_t updated;
+	/* identifies the staged file, so that it need not be hashed again */
+	time_t staged_mtime;
+	/* the process doing the work, so that its death can be noticed */
+	pid_t pid;
+	char error[PREFETCH_ERROR_LENGTH];
+};
+
+/*
+ * Hands job to a detached worker so that the CGI can answer straight away.
+ * If delta is given the worker first tries to rebuild the image from it and
+ * falls back to the full download. Either way the finished file is verified
+ * against job->md5 and, if given, sha256. Nothing is started while another
+ * worker is still running. Returns false if no worker could be started;
+ * status describes the download either way. The services preflight stopped
+ * for the download, if given, are started again should it fail or never
+ * start.
+ */
+bool prefetch_start(const struct download_job* job, const struct delta_job* delta, struct preflight_result* preflight, const char* version, const char* sha256, struct prefetch_status* status);
+
+/*
+ * Like prefetch_start, but for when tmpfs has no room for the image while
+ * memory does: the worker keeps the image on a ramfs of its own, verifies
+ * it, and hands it straight to sysupgrade, which reboots the router.
+ */
+bool prefetch_stream(const struct download_job* job, const char* version, const char* sha256, struct prefetch_status* status);
+
+/* returns false if no download has been started since boot */
+bool prefetch_read(struct prefetch_status* status);
+
+/* true if the worker named in the status is still alive; takes no lock, so it never gets in the way of one starting */
+bool prefetch_running();
+
+/* true if path is the file a worker verified against md5 and left untouched since */
+bool prefetch_staged(const char* path, long long size, const char* md5);
+
+const char* prefetch_state_name(enum prefetch_state state);
+
+/* prints "download":{...} describing status as part of a JSON object */
+void prefetch_print(const struct prefetch_status* status);
+
+#endif
@@ -0,0 +1,239 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "preflight.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/statvfs.h>
+#include <sys/sysinfo.h>
+
+#include "run.h"
+#include "uci_cache.h"
+
+#define MEMINFO_PATH "/proc/meminfo"
+#define DROP_CACHES_PATH "/proc/sys/vm/drop_caches"
+#define STOP_SERVICES_UCI_PATH "sui.update.stop_service"
+#define SERVICE_CONTROL_TIMEOUT_MS 30000
+#define MINIMUM_EXTRA_MEMORY 2097152
+
+/* MemAvailable counts reclaimable cache; older kernels only offer sysinfo */
+static long long memory_available()
+{
+	struct sysinfo info;
+	FILE* meminfo;
+	char line[BUFSIZ];
+	long long kilobytes = -1;
+
+	if ((meminfo = fopen(MEMINFO_PATH, "r")) != NULL) {
+		while (fgets(line, BUFSIZ, meminfo) != NULL) {
+			if (sscanf(line, "MemAvailable: %lld kB", &kilobytes) == 1) {
+				break;
+			}
+		}
+		fclose(meminfo);
+	}
+	if (kilobytes >= 0) {
+		return kilobytes * 1024;
+	}
+
+	if (sysinfo(&info) != 0) {
+		return -1;
+	}
+	return ((long long)info.freeram + (long long)info.bufferram) * info.mem_unit;
+}
+
+static long long storage_available(const char* path)
+{
+	struct statvfs fs;
+
+	if (statvfs(path, &fs) != 0) {
+		return -1;
+	}
+	return (long long)fs.f_bavail * (long long)fs.f_frsize;
+}
+
+static void measure(const char* path, struct preflight_result* result)
+{
+	result->memory_available = memory_available();
+	result->storage_available = storage_available(path);
+
+	if (result->memory_available < 0 || result->storage_available < 0) {
+		result->verdict = PREFLIGHT_ERROR;
+	} else if (result->storage_available < result->needed) {
+		result->verdict = PREFLIGHT_INSUFFICIENT_STORAGE;
+	} else if (result->memory_available < result->needed + MINIMUM_EXTRA_MEMORY) {
+		/* tmpfs pages are RAM, so the file has to fit beside everything else */
+		result->verdict = PREFLIGHT_INSUFFICIENT_MEMORY;
+	} else {
+		result->verdict = PREFLIGHT_OK;
+	}
+}
+
+static bool drop_caches()
+{
+	FILE* drop;
+	bool ok;
+
+	sync();
+	if ((drop = fopen(DROP_CACHES_PATH, "w")) == NULL) {
+		return false;
+	}
+	ok = fputs("3", drop) >= 0;
+	return fclose(drop) == 0 && ok;
+}
+
+static bool valid_service_name(const char* name)
+{
+	size_t i;
+
+	if (name[0] == '\0' || strlen(name) >= PREFLIGHT_SERVICE_NAME_LENGTH) {
+		return false;
+	}
+	for (i = 0; name[i] != '\0'; i++) {
+		if (!isalnum((unsigned char)name[i]) && name[i] != '-' && name[i] != '_') {
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t preflight_list_services(char services[PREFLIGHT_MAX_SERVICES][PREFLIGHT_SERVICE_NAME_LENGTH])
+{
+	char names[BUFSIZ];
+	const char* name = names;
+	size_t listed = 0;
+	size_t count = 0;
+	size_t i;
+
+	if (uci_cache_list(STOP_SERVICES_UCI_PATH, names, BUFSIZ, &listed) != UCI_CACHE_FOUND) {
+		return 0;
+	}
+	for (i = 0; i < listed; i++, name += strlen(name) + 1) {
+		if (count < PREFLIGHT_MAX_SERVICES && valid_service_name(name)) {
+			strcpy(services[count++], name);
+		}
+	}
+	return count;
+}
+
+static bool control_service(const char* name, const char* action)
+{
+	char script[BUFSIZ];
+	const char* argv[] = {script, action, NULL};
+	struct run_options options;
+
+	snprintf(script, BUFSIZ, PREFLIGHT_INIT_SCRIPT_FORMAT, name);
+	if (access(script, X_OK) != 0) {
+		return false;
+	}
+	memset(&options, 0x00, sizeof(struct run_options));
+	options.timeout_ms = SERVICE_CONTROL_TIMEOUT_MS;
+	return run(argv, &options, NULL);
+}
+
+void preflight_restart_services(struct preflight_result* result)
+{
+	unsigned int i;
+
+	for (i = 0; i < result->services_stopped; i++) {
+		if (control_service(result->stopped[i], "start")) {
+			syslog(LOG_INFO, "Started %s again", result->stopped[i]);
+		} else {
+			syslog(LOG_WARNING, "Unable to start %s again", result->stopped[i]);
+		}
+	}
+	result->services_stopped = 0;
+}
+
+bool preflight_check(const char* path, long long bytes, enum preflight_reclaim reclaim, struct preflight_result* result)
+{
+	char services[PREFLIGHT_MAX_SERVICES][PREFLIGHT_SERVICE_NAME_LENGTH];
+	size_t service_count;
+	size_t i;
+
+	memset(result, 0x00, sizeof(struct preflight_result));
+	result->needed = (bytes > 0) ? bytes : 0;
+	measure(path, result);
+
+	/* cheapest first: cache comes back on its own, services have to be restarted */
+	if (reclaim != PREFLIGHT_RECLAIM_NONE && result->verdict == PREFLIGHT_INSUFFICIENT_MEMORY) {
+		if ((result->dropped_caches = drop_caches())) {
+			syslog(LOG_INFO, "Dropped page cache to make room for the update");
+			measure(path, result);
+		}
+		if (reclaim == PREFLIGHT_RECLAIM_SERVICES && result->verdict == PREFLIGHT_INSUFFICIENT_MEMORY) {
+			service_count = preflight_list_services(services);
+			for (i = 0; i < service_count && result->verdict == PREFLIGHT_INSUFFICIENT_MEMORY; i++) {
+				if (control_service(services[i], "stop")) {
+					syslog(LOG_INFO, "Stopped %s to make room for the update", services[i]);
+					strcpy(result->stopped[result->services_stopped++], services[i]);
+					measure(path, result);
+				}
+			}
+			if (result->verdict != PREFLIGHT_OK) {
+				/* they made no difference that counts, so put them back */
+				preflight_restart_services(result);
+			}
+		}
+		if (result->verdict == PREFLIGHT_OK) {
+			result->verdict = PREFLIGHT_RECLAIMED;
+		}
+	}
+
+	return result->verdict == PREFLIGHT_OK || result->verdict == PREFLIGHT_RECLAIMED;
+}
+
+bool preflight_memory_holds(const struct preflight_result* result, long long bytes)
+{
+	return result->verdict != PREFLIGHT_ERROR && result->memory_available >= bytes + MINIMUM_EXTRA_MEMORY;
+}
+
+const char* preflight_verdict_name(enum preflight_verdict verdict)
+{
+	switch (verdict) {
+	case PREFLIGHT_OK:
+		return "ok";
+	case PREFLIGHT_RECLAIMED:
+		return "reclaimed";
+	case PREFLIGHT_INSUFFICIENT_MEMORY:
+		return "insufficient_memory";
+	case PREFLIGHT_INSUFFICIENT_STORAGE:
+		return "insufficient_storage";
+	default:
+		return "error";
+	}
+}
+
+void preflight_print(const struct preflight_result* result)
+{
+	printf("\"preflight\":{\"verdict\":\"%s\",\"needed\":%lld,\"memory_available\":%lld,\"storage_available\":%lld,\"dropped_caches\":%s,\"services_stopped\":%u}",
+			preflight_verdict_name(result->verdict), result->needed,
+			result->memory_available, result->storage_available,
+			result->dropped_caches ? "true" : "false", result->services_stopped);
+}
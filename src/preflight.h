@@ -0,0 +1,84 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_PREFLIGHT_H
+#define WIOMW_SUI_PREFLIGHT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PREFLIGHT_INIT_SCRIPT_FORMAT "/etc/init.d/%s"
+#define PREFLIGHT_MAX_SERVICES 8
+#define PREFLIGHT_SERVICE_NAME_LENGTH 64
+
+enum preflight_verdict {
+	PREFLIGHT_OK = 0,
+	PREFLIGHT_RECLAIMED,
+	PREFLIGHT_INSUFFICIENT_MEMORY,
+	PREFLIGHT_INSUFFICIENT_STORAGE,
+	PREFLIGHT_ERROR
+};
+
+enum preflight_reclaim {
+	PREFLIGHT_RECLAIM_NONE = 0,
+	/* the page cache comes back on its own, so this is safe at any time */
+	PREFLIGHT_RECLAIM_CACHE,
+	/* also stops services, so only once the user has asked for the update */
+	PREFLIGHT_RECLAIM_SERVICES
+};
+
+struct preflight_result {
+	enum preflight_verdict verdict;
+	/* all sizes are in bytes */
+	long long needed;
+	long long memory_available;
+	long long storage_available;
+	bool dropped_caches;
+	unsigned int services_stopped;
+	char stopped[PREFLIGHT_MAX_SERVICES][PREFLIGHT_SERVICE_NAME_LENGTH];
+};
+
+/*
+ * Decides whether bytes more can be written to the tmpfs at path, counting
+ * both the filesystem's own limit and the RAM backing it. Depending on
+ * reclaim, the page cache is dropped and the services listed in UCI are
+ * stopped, one step at a time, until the bytes fit. Services stopped for
+ * nothing are started again. Returns false if the verdict is not OK or
+ * RECLAIMED.
+ */
+bool preflight_check(const char* path, long long bytes, enum preflight_reclaim reclaim, struct preflight_result* result);
+
+/* true if RAM alone, leaving aside the tmpfs limit, has room for bytes as measured by preflight_check */
+bool preflight_memory_holds(const struct preflight_result* result, long long bytes);
+
+/* starts whatever preflight_check stopped, e.g. when the download it made room for did not start */
+void preflight_restart_services(struct preflight_result* result);
+
+/* the services in UCI that are safe to stop for memory, skipping bad names */
+size_t preflight_list_services(char services[PREFLIGHT_MAX_SERVICES][PREFLIGHT_SERVICE_NAME_LENGTH]);
+
+const char* preflight_verdict_name(enum preflight_verdict verdict);
+
+/* prints "preflight":{...} describing result as part of a JSON object */
+void preflight_print(const struct preflight_result* result);
+
+#endif
@@ -0,0 +1,525 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "probe.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <sys/socket.h>
+#include <curl/curl.h>
+
+#include "http_client.h"
+#include "monotonic.h"
+#include "netboard.h"
+#include "tls_cache.h"
+#include "urandom.h"
+
+#define CHECK_URL "https://www.whoisonmywifi.net/easteregg.txt"
+#define CHECK_HOSTNAME "www.whoisonmywifi.net"
+
+#define RESOLV_AUTO_PATH "/var/resolv.conf.auto"
+#define RESOLV_FALLBACK_PATH "/etc/resolv.conf"
+
+#define PROBE_MAX_NAMESERVERS 3
+#define PROBE_RESEND_INTERVAL_MS 1000
+#define PROBE_PACKET_LENGTH 512
+#define DNS_PORT 53
+#define DNS_HEADER_LENGTH 12
+#define DNS_TYPE_A 1
+#define DNS_CLASS_IN 1
+
+struct probe_state {
+	CURLM* multi;
+	CURL* curl;
+	struct http_request https_request;
+	struct http_response https_response;
+	struct http_transfer https_transfer;
+	bool https_done;
+	/* the HTTPS probe got an answer of some kind back from the far end */
+	bool https_reached;
+	int dns_sock;
+	uint16_t dns_id;
+	struct sockaddr_in nameservers[PROBE_MAX_NAMESERVERS];
+	size_t nameserver_count;
+	size_t dns_refusals;
+	int ping_sock;
+	bool ping_raw;
+	uint16_t ping_id;
+	uint16_t ping_seq;
+	struct in_addr gateway;
+	long next_resend;
+};
+
+static bool set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+static enum probe_status probe_carrier()
+{
+	switch (netboard_wan_carrier()) {
+	case 1:
+		return PROBE_OK;
+	case 0:
+		return PROBE_FAILED;
+	default:
+		return PROBE_SKIPPED;
+	}
+}
+
+static bool start_https(struct probe_state* state, long budget_ms)
+{
+	if ((state->multi = curl_multi_init()) == NULL
+			|| (state->curl = curl_easy_init()) == NULL) {
+		return false;
+	}
+
+	/* no sinks, so the body is discarded */
+	state->https_request.url = CHECK_URL;
+	state->https_request.connect_timeout_ms = budget_ms;
+	state->https_request.timeout_ms = budget_ms;
+	http_transfer_begin(state->curl, &(state->https_request), &(state->https_response), &(state->https_transfer));
+
+	return curl_multi_add_handle(state->multi, state->curl) == CURLM_OK;
+}
+
+static enum probe_status start_gateway(struct probe_state* state)
+{
+	uint32_t gateway = 0;
+
+	if (!netboard_gateway4(&gateway)) {
+		/* no default route means nothing beyond the LAN is reachable */
+		return PROBE_FAILED;
+	}
+	state->gateway.s_addr = gateway;
+
+	if ((state->ping_sock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) != -1) {
+		state->ping_raw = true;
+	} else if ((state->ping_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP)) != -1) {
+		/* unprivileged ping socket; the kernel owns the echo identifier */
+		state->ping_raw = false;
+	} else {
+		return PROBE_SKIPPED;
+	}
+	if (!set_nonblocking(state->ping_sock)) {
+		return PROBE_SKIPPED;
+	}
+	state->ping_id = (uint16_t)getpid();
+	return PROBE_PENDING;
+}
+
+static uint16_t icmp_checksum(const unsigned char* data, size_t len)
+{
+	uint32_t sum = 0;
+	size_t i = 0;
+	for (i = 0; i + 1 < len; i += 2) {
+		sum += (data[i] << 8) | data[i + 1];
+	}
+	if (i < len) {
+		sum += data[i] << 8;
+	}
+	while (sum >> 16) {
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	}
+	return htons((uint16_t)~sum);
+}
+
+static void send_gateway(struct probe_state* state)
+{
+	unsigned char packet[sizeof(struct icmphdr) + 8];
+	struct icmphdr* header = (struct icmphdr*)packet;
+	struct sockaddr_in addr;
+
+	memset(packet, 0x00, sizeof(packet));
+	header->type = ICMP_ECHO;
+	header->un.echo.id = htons(state->ping_id);
+	header->un.echo.sequence = htons(++state->ping_seq);
+	memcpy(packet + sizeof(struct icmphdr), "wiomwsui", 8);
+	header->checksum = icmp_checksum(packet, sizeof(packet));
+
+	memset(&addr, 0x00, sizeof(struct sockaddr_in));
+	addr.sin_family = AF_INET;
+	addr.sin_addr = state->gateway;
+	sendto(state->ping_sock, packet, sizeof(packet), 0, (struct sockaddr*)&addr, sizeof(struct sockaddr_in));
+}
+
+static enum probe_status read_gateway(struct probe_state* state)
+{
+	unsigned char packet[PROBE_PACKET_LENGTH];
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(struct sockaddr_in);
+	ssize_t len = 0;
+
+	while ((len = recvfrom(state->ping_sock, packet, PROBE_PACKET_LENGTH, 0, (struct sockaddr*)&from, &fromlen)) > 0) {
+		struct icmphdr* header = NULL;
+		size_t offset = 0;
+		if (state->ping_raw) {
+			/* raw sockets deliver the IP header as well */
+			offset = (packet[0] & 0x0F) * 4;
+		}
+		if (from.sin_addr.s_addr != state->gateway.s_addr || (size_t)len < offset + sizeof(struct icmphdr)) {
+			continue;
+		}
+		header = (struct icmphdr*)(packet + offset);
+		if (header->type == ICMP_ECHOREPLY
+				&& (!state->ping_raw || ntohs(header->un.echo.id) == state->ping_id)) {
+			return PROBE_OK;
+		}
+	}
+	return PROBE_PENDING;
+}
+
+static size_t load_nameservers(struct probe_state* state, const char* path)
+{
+	FILE* resolv;
+	char line[BUFSIZ];
+
+	if ((resolv = fopen(path, "r")) == NULL) {
+		return 0;
+	}
+	while (state->nameserver_count < PROBE_MAX_NAMESERVERS && fgets(line, BUFSIZ, resolv) != NULL) {
+		char address[BUFSIZ];
+		struct sockaddr_in* nameserver = state->nameservers + state->nameserver_count;
+		if (sscanf(line, "nameserver %s", address) == 1
+				&& inet_pton(AF_INET, address, &(nameserver->sin_addr)) == 1) {
+			nameserver->sin_family = AF_INET;
+			nameserver->sin_port = htons(DNS_PORT);
+			state->nameserver_count++;
+		}
+	}
+	fclose(resolv);
+	return state->nameserver_count;
+}
+
+static enum probe_status start_dns(struct probe_state* state)
+{
+	unsigned char random_id[2];
+
+	memset(state->nameservers, 0x00, sizeof(state->nameservers));
+	if (load_nameservers(state, RESOLV_AUTO_PATH) == 0
+			&& load_nameservers(state, RESOLV_FALLBACK_PATH) == 0) {
+		return PROBE_FAILED;
+	}
+
+	if (urandom(random_id, 2) >= 0) {
+		state->dns_id = (random_id[0] << 8) | random_id[1];
+	} else {
+		state->dns_id = (uint16_t)(getpid() ^ monotonic_ms());
+	}
+
+	if ((state->dns_sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1
+			|| !set_nonblocking(state->dns_sock)) {
+		return PROBE_SKIPPED;
+	}
+	return PROBE_PENDING;
+}
+
+static void send_dns(struct probe_state* state)
+{
+	unsigned char query[PROBE_PACKET_LENGTH];
+	const char* label = CHECK_HOSTNAME;
+	size_t len = DNS_HEADER_LENGTH;
+	size_t i = 0;
+
+	memset(query, 0x00, DNS_HEADER_LENGTH);
+	query[0] = state->dns_id >> 8;
+	query[1] = state->dns_id & 0xFF;
+	/* standard query, recursion desired, one question */
+	query[2] = 0x01;
+	query[5] = 0x01;
+	while (*label != '\0') {
+		const char* dot = strchr(label, '.');
+		size_t label_len = (dot == NULL) ? strlen(label) : (size_t)(dot - label);
+		query[len++] = (unsigned char)label_len;
+		memcpy(query + len, label, label_len);
+		len += label_len;
+		label += label_len + ((dot == NULL) ? 0 : 1);
+	}
+	query[len++] = 0x00;
+	query[len++] = 0x00;
+	query[len++] = DNS_TYPE_A;
+	query[len++] = 0x00;
+	query[len++] = DNS_CLASS_IN;
+
+	for (i = 0; i < state->nameserver_count; i++) {
+		sendto(state->dns_sock, query, len, 0, (struct sockaddr*)(state->nameservers + i), sizeof(struct sockaddr_in));
+	}
+}
+
+static enum probe_status read_dns(struct probe_state* state)
+{
+	unsigned char answer[PROBE_PACKET_LENGTH];
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(struct sockaddr_in);
+	ssize_t len = 0;
+
+	while ((len = recvfrom(state->dns_sock, answer, PROBE_PACKET_LENGTH, 0, (struct sockaddr*)&from, &fromlen)) > 0) {
+		size_t i = 0;
+		bool known = false;
+		for (i = 0; i < state->nameserver_count; i++) {
+			if (from.sin_addr.s_addr == state->nameservers[i].sin_addr.s_addr) {
+				known = true;
+			}
+		}
+		if (!known || len < DNS_HEADER_LENGTH
+				|| ((answer[0] << 8) | answer[1]) != state->dns_id
+				|| (answer[2] & 0x80) == 0) {
+			continue;
+		} else if ((answer[3] & 0x0F) == 0 && ((answer[6] << 8) | answer[7]) > 0) {
+			return PROBE_OK;
+		} else if (++state->dns_refusals >= state->nameserver_count) {
+			return PROBE_FAILED;
+		}
+	}
+	return PROBE_PENDING;
+}
+
+static void cleanup_state(struct probe_state* state)
+{
+	if (state->curl != NULL) {
+		if (!state->https_done) {
+			tls_cache_finish(state->curl, &(state->https_transfer.tls_slot), false);
+		}
+		if (state->multi != NULL) {
+			curl_multi_remove_handle(state->multi, state->curl);
+		}
+		curl_easy_cleanup(state->curl);
+	}
+	if (state->multi != NULL) {
+		curl_multi_cleanup(state->multi);
+	}
+	if (state->dns_sock != -1) {
+		close(state->dns_sock);
+	}
+	if (state->ping_sock != -1) {
+		close(state->ping_sock);
+	}
+}
+
+/* a refusal counts as well: packets got there and back, only nobody was listening */
+static bool https_reached(CURL* curl)
+{
+	double connect_seconds = 0;
+	long os_errno = 0;
+
+	if (curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect_seconds) == CURLE_OK && connect_seconds > 0) {
+		return true;
+	}
+	return curl_easy_getinfo(curl, CURLINFO_OS_ERRNO, &os_errno) == CURLE_OK && os_errno == ECONNREFUSED;
+}
+
+/* many ISP gateways drop echo requests, so silence only counts once nothing got further */
+static enum probe_status gateway_timeout(const struct probe_result* result, const struct probe_state* state)
+{
+	if (result->https == PROBE_OK || result->dns == PROBE_OK || state->https_reached) {
+		return PROBE_SKIPPED;
+	}
+	return PROBE_FAILED;
+}
+
+/* true once the probes still out cannot change what classify says */
+static bool decided(const struct probe_result* result, const struct probe_state* state)
+{
+	if (result->https == PROBE_OK) {
+		return true;
+	} else if (result->https == PROBE_PENDING || result->dns == PROBE_PENDING) {
+		return false;
+	}
+	return result->gateway != PROBE_PENDING || gateway_timeout(result, state) == PROBE_SKIPPED;
+}
+
+static enum probe_layer classify(struct probe_result* result)
+{
+	if (result->https == PROBE_OK) {
+		return PROBE_LAYER_NONE;
+	} else if (result->cable == PROBE_FAILED) {
+		return PROBE_LAYER_CABLE;
+	} else if (result->gateway == PROBE_FAILED) {
+		return PROBE_LAYER_GATEWAY;
+	} else if (result->dns == PROBE_FAILED) {
+		return PROBE_LAYER_DNS;
+	} else {
+		return PROBE_LAYER_HTTPS;
+	}
+}
+
+bool probe_run(struct probe_result* result, long budget_ms)
+{
+	struct probe_state state;
+	const long start = monotonic_ms();
+	const long deadline = start + budget_ms;
+
+	memset(result, 0x00, sizeof(struct probe_result));
+	memset(&state, 0x00, sizeof(struct probe_state));
+	state.dns_sock = -1;
+	state.ping_sock = -1;
+
+	/* a missing carrier is decisive on its own, so don't bother with the network */
+	if ((result->cable = probe_carrier()) == PROBE_FAILED) {
+		result->https = PROBE_SKIPPED;
+		result->gateway = PROBE_SKIPPED;
+		result->dns = PROBE_SKIPPED;
+		result->failed_layer = PROBE_LAYER_CABLE;
+		result->elapsed_ms = monotonic_ms() - start;
+		return true;
+	}
+
+	if (!start_https(&state, budget_ms)) {
+		syslog(LOG_ERR, "Unable to start the HTTPS connectivity probe");
+		cleanup_state(&state);
+		return false;
+	}
+	result->gateway = start_gateway(&state);
+	result->dns = start_dns(&state);
+
+	while (result->https == PROBE_PENDING || result->gateway == PROBE_PENDING || result->dns == PROBE_PENDING) {
+		struct curl_waitfd extra_fds[2];
+		unsigned int extra_count = 0;
+		int running = 0;
+		int queued = 0;
+		CURLMsg* msg = NULL;
+		long now = monotonic_ms();
+		long wait_ms = 0;
+
+		if (now >= deadline) {
+			break;
+		}
+
+		if (now >= state.next_resend) {
+			if (result->gateway == PROBE_PENDING) {
+				send_gateway(&state);
+			}
+			if (result->dns == PROBE_PENDING) {
+				send_dns(&state);
+			}
+			state.next_resend = now + PROBE_RESEND_INTERVAL_MS;
+		}
+
+		curl_multi_perform(state.multi, &running);
+		while ((msg = curl_multi_info_read(state.multi, &queued)) != NULL) {
+			if (msg->msg == CURLMSG_DONE && msg->easy_handle == state.curl) {
+				state.https_done = true;
+				if (http_transfer_end(state.curl, &(state.https_transfer), msg->data.result)) {
+					result->https = PROBE_OK;
+				} else {
+					result->https = PROBE_FAILED;
+					state.https_reached = https_reached(state.curl);
+					strncpy(result->error, state.https_response.error, PROBE_ERROR_LENGTH - 1);
+				}
+				result->http_code = state.https_response.http_code;
+			}
+		}
+
+		if (decided(result, &state)) {
+			/* e.g. the top of the stack works, so everything beneath it must too */
+			break;
+		}
+
+		if (result->gateway == PROBE_PENDING) {
+			extra_fds[extra_count].fd = state.ping_sock;
+			extra_fds[extra_count].events = CURL_WAIT_POLLIN;
+			extra_fds[extra_count].revents = 0;
+			extra_count++;
+		}
+		if (result->dns == PROBE_PENDING) {
+			extra_fds[extra_count].fd = state.dns_sock;
+			extra_fds[extra_count].events = CURL_WAIT_POLLIN;
+			extra_fds[extra_count].revents = 0;
+			extra_count++;
+		}
+
+		wait_ms = deadline - now;
+		if (state.next_resend - now < wait_ms) {
+			wait_ms = state.next_resend - now;
+		}
+		curl_multi_wait(state.multi, extra_fds, extra_count, (int)wait_ms, NULL);
+
+		if (result->gateway == PROBE_PENDING) {
+			result->gateway = read_gateway(&state);
+		}
+		if (result->dns == PROBE_PENDING) {
+			result->dns = read_dns(&state);
+		}
+		if (decided(result, &state)) {
+			break;
+		}
+	}
+
+	/* anything still outstanding ran out of time */
+	if (result->https == PROBE_PENDING) {
+		result->https = PROBE_FAILED;
+		snprintf(result->error, PROBE_ERROR_LENGTH, "Timed out after %ld ms", budget_ms);
+	}
+	if (result->dns == PROBE_PENDING) {
+		result->dns = (result->https == PROBE_OK) ? PROBE_SKIPPED : PROBE_FAILED;
+	}
+	if (result->gateway == PROBE_PENDING) {
+		result->gateway = gateway_timeout(result, &state);
+	}
+
+	result->failed_layer = classify(result);
+	result->elapsed_ms = monotonic_ms() - start;
+	cleanup_state(&state);
+	return true;
+}
+
+const char* probe_layer_name(enum probe_layer layer)
+{
+	switch (layer) {
+	case PROBE_LAYER_CABLE:
+		return "cable";
+	case PROBE_LAYER_GATEWAY:
+		return "gateway";
+	case PROBE_LAYER_DNS:
+		return "dns";
+	case PROBE_LAYER_HTTPS:
+		return "https";
+	default:
+		return "none";
+	}
+}
+
+const char* probe_status_name(enum probe_status status)
+{
+	switch (status) {
+	case PROBE_OK:
+		return "ok";
+	case PROBE_FAILED:
+		return "failed";
+	case PROBE_SKIPPED:
+		return "skipped";
+	default:
+		return "pending";
+	}
+}
@@ -0,0 +1,67 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_PROBE_H
+#define WIOMW_SUI_PROBE_H
+
+#include <stdbool.h>
+
+#define PROBE_ERROR_LENGTH 256
+
+enum probe_status {
+	PROBE_PENDING = 0,
+	PROBE_OK,
+	PROBE_FAILED,
+	PROBE_SKIPPED
+};
+
+/* ordered from the bottom of the stack to the top */
+enum probe_layer {
+	PROBE_LAYER_NONE = 0,
+	PROBE_LAYER_CABLE,
+	PROBE_LAYER_GATEWAY,
+	PROBE_LAYER_DNS,
+	PROBE_LAYER_HTTPS
+};
+
+struct probe_result {
+	enum probe_status cable;
+	enum probe_status gateway;
+	enum probe_status dns;
+	enum probe_status https;
+	enum probe_layer failed_layer;
+	long http_code;
+	long elapsed_ms;
+	char error[PROBE_ERROR_LENGTH];
+};
+
+/*
+ * Runs the cable, gateway, DNS, and HTTPS probes concurrently and waits no
+ * longer than budget_ms for them. Returns false only if the probes could not
+ * be started at all; otherwise the outcome is described by result.
+ */
+bool probe_run(struct probe_result* result, long budget_ms);
+
+const char* probe_layer_name(enum probe_layer layer);
+const char* probe_status_name(enum probe_status status);
+
+#endif
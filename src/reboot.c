@@ -23,17 +23,36 @@
 #include <config.h>
 #include "reboot.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <mntent.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
 #include <arpa/inet.h>
+#include <uci.h>
+#include "downtime.h"
+#include "monotonic.h"
 #include "wan_ip.h"
 #include "lan_ip.h"
+#include "preflight.h"
 #include "range_check.h"
+#include "run.h"
+#include "uci_cache.h"
 
-#define REBOOT_COMMAND "sleep 3 && reboot &"
+#define REBOOT_PATH "/sbin/reboot"
+/* long enough for the response to reach the browser */
+#define REBOOT_DELAY_SECONDS "3"
+#define RESPONSE_DELAY_SECONDS 1
+#define STOP_TIMEOUT_MS 10000
+#define MOUNTS_PATH "/proc/mounts"
 
-void post_reboot()
+void reboot_avoid_wan_subnet()
 {
 	uint32_t lan_ip = 0;
 	uint32_t lan_netmask = 0;
@@ -52,7 +71,154 @@ void post_reboot()
 			}
 		}
 	}
-	if (system(REBOOT_COMMAND) == -1) {
+}
+
+/* commits changes that were saved to UCI but left uncommitted, which a reboot would lose */
+static void commit_saved()
+{
+	struct uci_context* ctx;
+	struct dirent* entry;
+	DIR* delta;
+
+	if ((delta = opendir(UCI_CACHE_DELTA_DIR)) == NULL) {
+		return;
+	} else if ((ctx = uci_alloc_context()) == NULL) {
+		closedir(delta);
+		return;
+	}
+	while ((entry = readdir(delta)) != NULL) {
+		struct uci_package* package = NULL;
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+		if (uci_load(ctx, entry->d_name, &package) != UCI_OK || package == NULL
+				|| uci_commit(ctx, &package, false) != UCI_OK) {
+			syslog(LOG_WARNING, "Unable to commit saved changes to %s before rebooting", entry->d_name);
+		}
+	}
+	uci_free_context(ctx);
+	closedir(delta);
+}
+
+/* stops them all at once rather than one after another as the shutdown scripts would */
+static void stop_services()
+{
+	char services[PREFLIGHT_MAX_SERVICES][PREFLIGHT_SERVICE_NAME_LENGTH];
+	char scripts[PREFLIGHT_MAX_SERVICES][BUFSIZ];
+	struct run_process processes[PREFLIGHT_MAX_SERVICES];
+	bool started[PREFLIGHT_MAX_SERVICES];
+	struct run_options options;
+	size_t count = preflight_list_services(services);
+	size_t i;
+
+	memset(&options, 0x00, sizeof(struct run_options));
+	options.timeout_ms = STOP_TIMEOUT_MS;
+	for (i = 0; i < count; i++) {
+		const char* argv[] = {scripts[i], "stop", NULL};
+		snprintf(scripts[i], BUFSIZ, PREFLIGHT_INIT_SCRIPT_FORMAT, services[i]);
+		started[i] = access(scripts[i], X_OK) == 0 && run_start(argv, &options, &(processes[i]));
+	}
+	for (i = 0; i < count; i++) {
+		if (started[i] && !run_finish(&(processes[i]), NULL)) {
+			syslog(LOG_WARNING, "Unable to stop %s before rebooting", services[i]);
+		}
+	}
+}
+
+/* tmpfs and the like are about to vanish and read-only ones have nothing to write */
+static bool persistent(const struct mntent* mount)
+{
+	const char* volatile_types[] = {"tmpfs", "ramfs", "proc", "sysfs", "devtmpfs", "devpts",
+			"debugfs", "cgroup", "cgroup2", "pstore", "tracefs", "bpf", "squashfs", NULL};
+	size_t i;
+
+	if (hasmntopt(mount, "ro") != NULL) {
+		return false;
+	}
+	for (i = 0; volatile_types[i] != NULL; i++) {
+		if (strcmp(mount->mnt_type, volatile_types[i]) == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void sync_persistent()
+{
+	struct mntent* mount;
+	FILE* mounts;
+
+	if ((mounts = setmntent(MOUNTS_PATH, "r")) == NULL) {
+		sync();
+		return;
+	}
+	while ((mount = getmntent(mounts)) != NULL) {
+		int fd;
+		if (!persistent(mount)) {
+			continue;
+		} else if ((fd = open(mount->mnt_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+			continue;
+		}
+		if (syncfs(fd) != 0) {
+			syslog(LOG_WARNING, "Unable to sync %s before rebooting", mount->mnt_dir);
+		}
+		close(fd);
+	}
+	endmntent(mounts);
+}
+
+/* runs in a session of its own, after the response has had time to go out */
+static void prepare_and_reboot()
+{
+	const char* reboot_argv[] = {REBOOT_PATH, NULL};
+	long long shutdown_ms = downtime_wall_ms();
+	long started = monotonic_ms();
+	long elapsed;
+
+	sleep(RESPONSE_DELAY_SECONDS);
+	commit_saved();
+	stop_services();
+	elapsed = monotonic_ms() - started;
+	if (!downtime_mark_shutdown(shutdown_ms, elapsed)) {
+		syslog(LOG_WARNING, "Unable to record when the reboot started");
+	}
+	sync_persistent();
+	syslog(LOG_INFO, "Rebooting after %ld ms of preparation", monotonic_ms() - started);
+	if (!run_detached(reboot_argv, NULL, 0)) {
+		syslog(LOG_ERR, "Unable to reboot");
+	}
+}
+
+bool reboot_start()
+{
+	const char* reboot_argv[] = {REBOOT_PATH, "-d", REBOOT_DELAY_SECONDS, NULL};
+	pid_t pid;
+
+	if ((pid = fork()) == -1) {
+		syslog(LOG_WARNING, "Unable to fork to prepare for rebooting: %s", strerror(errno));
+		return run_detached(reboot_argv, NULL, 0);
+	} else if (pid == 0) {
+		int null_fd;
+		setsid();
+		/* stdio still belongs to the parent, which may be answering a request */
+		if ((null_fd = open("/dev/null", O_RDWR)) != -1) {
+			dup2(null_fd, STDIN_FILENO);
+			dup2(null_fd, STDOUT_FILENO);
+			dup2(null_fd, STDERR_FILENO);
+			if (null_fd > STDERR_FILENO) {
+				close(null_fd);
+			}
+		}
+		prepare_and_reboot();
+		_exit(EXIT_SUCCESS);
+	}
+	return true;
+}
+
+void post_reboot()
+{
+	reboot_avoid_wan_subnet();
+	if (!reboot_start()) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"rebooting\":false,\"errors\":[\"Unable to reboot system.\"]}");
@@ -60,6 +226,6 @@ void post_reboot()
 	}
 	printf("Status: 200 OK\n");
 	printf("Content-type: application/json\n\n");
-	printf("{\"rebooting\":true}");
+	printf("{\"rebooting\":true,\"estimate_ms\":%ld}", downtime_estimate_ms());
 }
 
@@ -23,6 +23,18 @@
 #ifndef OPENWRT_SUI_REBOOT_H
 #define OPENWRT_SUI_REBOOT_H
 
+#include <stdbool.h>
+
+/* moves the LAN out of the way if the WAN has been given an address in it */
+void reboot_avoid_wan_subnet();
+
+/*
+ * Returns at once, so the caller can still answer, and then commits saved
+ * UCI changes, stops the heavy services together, syncs the filesystems
+ * that outlast a reboot, records when all this started, and reboots.
+ */
+bool reboot_start();
+
 void post_reboot();
 
 #endif
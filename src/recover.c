@@ -0,0 +1,284 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "recover.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "monotonic.h"
+#include "probe.h"
+#include "reboot.h"
+#include "run.h"
+#include "uci_cache.h"
+
+#define UBUS_PATH "/bin/ubus"
+#define IFUP_PATH "/sbin/ifup"
+#define NETWORK_INIT_PATH "/etc/init.d/network"
+#define WAN_INTERFACE "wan"
+#define WAN_UBUS_OBJECT "network.interface." WAN_INTERFACE
+#define WAN_PROTO_UCI_PATH "network." WAN_INTERFACE ".proto"
+
+#define HISTORY_NEW_PATH RECOVER_HISTORY_PATH ".new"
+#define HISTORY_LENGTH 16
+/* uhttpd gives up on a script after a minute, and the answer still has to go out */
+#define RECOVER_BUDGET_MS 50000
+#define PROBE_BUDGET_MS 4000
+#define PROBE_INTERVAL_MS 1000
+
+struct ladder_rung {
+	enum recover_step step;
+	const char* const* argv;
+	long timeout_ms;
+	/* how long the connection gets to come back afterwards */
+	long settle_ms;
+};
+
+struct history_entry {
+	long long when;
+	char step[32];
+};
+
+static const char* const renew_argv[] = {UBUS_PATH, "call", WAN_UBUS_OBJECT, "renew", NULL};
+static const char* const restart_wan_argv[] = {IFUP_PATH, WAN_INTERFACE, NULL};
+static const char* const restart_network_argv[] = {NETWORK_INIT_PATH, "restart", NULL};
+
+static const struct ladder_rung ladder[] = {
+	{RECOVER_RENEW_DHCP, renew_argv, 5000, 6000},
+	{RECOVER_RESTART_WAN, restart_wan_argv, 10000, 12000},
+	{RECOVER_RESTART_NETWORK, restart_network_argv, 20000, 15000}
+};
+
+const char* recover_step_name(enum recover_step step)
+{
+	switch (step) {
+	case RECOVER_RENEW_DHCP:
+		return "renew_dhcp";
+	case RECOVER_RESTART_WAN:
+		return "restart_wan";
+	case RECOVER_RESTART_NETWORK:
+		return "restart_network";
+	case RECOVER_REBOOT:
+		return "reboot";
+	default:
+		return "none";
+	}
+}
+
+static size_t read_history(struct history_entry entries[HISTORY_LENGTH])
+{
+	char line[BUFSIZ];
+	size_t count = 0;
+	FILE* history;
+
+	if ((history = fopen(RECOVER_HISTORY_PATH, "r")) == NULL) {
+		return 0;
+	}
+	while (fgets(line, BUFSIZ, history) != NULL) {
+		struct history_entry entry;
+		if (sscanf(line, "%lld %31s", &(entry.when), entry.step) != 2) {
+			continue;
+		}
+		/* only the newest are kept */
+		if (count == HISTORY_LENGTH) {
+			memmove(entries, entries + 1, sizeof(struct history_entry) * (HISTORY_LENGTH - 1));
+			count--;
+		}
+		entries[count++] = entry;
+	}
+	fclose(history);
+	return count;
+}
+
+/* written to the side and renamed, since a reboot may follow straight away */
+static void record(enum recover_step step)
+{
+	struct history_entry entries[HISTORY_LENGTH];
+	size_t count = read_history(entries);
+	size_t i = (count == HISTORY_LENGTH) ? 1 : 0;
+	FILE* history;
+	bool ok = true;
+
+	if ((history = fopen(HISTORY_NEW_PATH, "w")) == NULL) {
+		syslog(LOG_WARNING, "Unable to record recovery history: %s", strerror(errno));
+		return;
+	}
+	for (; i < count; i++) {
+		ok = fprintf(history, "%lld %s\n", entries[i].when, entries[i].step) > 0 && ok;
+	}
+	ok = fprintf(history, "%lld %s\n", (long long)time(NULL), recover_step_name(step)) > 0 && ok;
+	ok = fflush(history) == 0 && ok;
+	ok = fsync(fileno(history)) == 0 && ok;
+	ok = fclose(history) == 0 && ok;
+	if (!ok || rename(HISTORY_NEW_PATH, RECOVER_HISTORY_PATH) != 0) {
+		syslog(LOG_WARNING, "Unable to record recovery history");
+		unlink(HISTORY_NEW_PATH);
+	}
+}
+
+/* the clock only goes forward across reboots here, since it restarts from the newest file in /etc */
+static unsigned int recent_reboots()
+{
+	struct history_entry entries[HISTORY_LENGTH];
+	size_t count = read_history(entries);
+	long long since = (long long)time(NULL) - RECOVER_LOOP_WINDOW_SECONDS;
+	unsigned int reboots = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (entries[i].when >= since && strcmp(entries[i].step, recover_step_name(RECOVER_REBOOT)) == 0) {
+			reboots++;
+		}
+	}
+	return reboots;
+}
+
+bool recover_last(enum recover_step* step, long long* when)
+{
+	struct history_entry entries[HISTORY_LENGTH];
+	size_t count = read_history(entries);
+	enum recover_step i;
+
+	if (count == 0) {
+		return false;
+	}
+	*when = entries[count - 1].when;
+	*step = RECOVER_NONE;
+	for (i = RECOVER_RENEW_DHCP; i <= RECOVER_REBOOT; i++) {
+		if (strcmp(entries[count - 1].step, recover_step_name(i)) == 0) {
+			*step = i;
+		}
+	}
+	return true;
+}
+
+/* keeps probing until the connection is back or settle_ms is up */
+static bool wait_connected(long settle_ms)
+{
+	long deadline = monotonic_ms() + settle_ms;
+	struct probe_result probe;
+
+	while (1) {
+		long started = monotonic_ms();
+		long remaining = deadline - started;
+		if (remaining <= 0) {
+			return false;
+		} else if (probe_run(&probe, (remaining < PROBE_BUDGET_MS) ? remaining : PROBE_BUDGET_MS)
+				&& probe.failed_layer == PROBE_LAYER_NONE) {
+			return true;
+		}
+		/* a probe that failed at once, say for want of a gateway, is not retried straight away */
+		if (monotonic_ms() - started < PROBE_INTERVAL_MS && deadline - monotonic_ms() > PROBE_INTERVAL_MS) {
+			usleep((PROBE_INTERVAL_MS - (monotonic_ms() - started)) * 1000);
+		}
+	}
+}
+
+static bool wan_uses_dhcp()
+{
+	char proto[BUFSIZ];
+
+	return uci_cache_string(WAN_PROTO_UCI_PATH, proto, BUFSIZ) == UCI_CACHE_FOUND && strcmp(proto, "dhcp") == 0;
+}
+
+static bool climb(struct recover_result* result, long deadline)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(ladder) / sizeof(ladder[0]); i++) {
+		struct recover_attempt* attempt;
+		struct run_options options;
+		long started = monotonic_ms();
+		long remaining = deadline - started;
+
+		if (ladder[i].step == RECOVER_RENEW_DHCP && !wan_uses_dhcp()) {
+			continue;
+		} else if (remaining < ladder[i].timeout_ms) {
+			syslog(LOG_INFO, "No time left to %s", recover_step_name(ladder[i].step));
+			break;
+		}
+
+		attempt = &(result->attempts[result->attempt_count++]);
+		attempt->step = ladder[i].step;
+		memset(&options, 0x00, sizeof(struct run_options));
+		options.timeout_ms = ladder[i].timeout_ms;
+		attempt->ok = run(ladder[i].argv, &options, NULL);
+		if (!attempt->ok) {
+			syslog(LOG_WARNING, "Unable to %s", recover_step_name(ladder[i].step));
+		}
+		remaining = deadline - monotonic_ms();
+		attempt->connected = wait_connected((remaining < ladder[i].settle_ms) ? remaining : ladder[i].settle_ms);
+		attempt->elapsed_ms = monotonic_ms() - started;
+		if (attempt->connected) {
+			syslog(LOG_NOTICE, "Connection restored by %s after %ld ms", recover_step_name(ladder[i].step), attempt->elapsed_ms);
+			record(ladder[i].step);
+			result->restored_by = ladder[i].step;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool recover_run(struct recover_result* result)
+{
+	long deadline = monotonic_ms() + RECOVER_BUDGET_MS;
+	struct recover_attempt* attempt;
+	int lock;
+
+	memset(result, 0x00, sizeof(struct recover_result));
+	if ((lock = open(RECOVER_LOCK_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1) {
+		syslog(LOG_ERR, "Unable to open %s: %s", RECOVER_LOCK_PATH, strerror(errno));
+		return false;
+	} else if (flock(lock, LOCK_EX | LOCK_NB) != 0) {
+		close(lock);
+		result->busy = true;
+		return false;
+	}
+
+	if (climb(result, deadline)) {
+		close(lock);
+		return true;
+	}
+
+	attempt = &(result->attempts[result->attempt_count++]);
+	attempt->step = RECOVER_REBOOT;
+	if ((result->recent_reboots = recent_reboots()) >= RECOVER_MAX_REBOOTS) {
+		syslog(LOG_ERR, "Not rebooting to restore the connection; it has already been tried %u times in the last hour",
+				result->recent_reboots);
+		result->reboot_suppressed = true;
+	} else {
+		record(RECOVER_REBOOT);
+		reboot_avoid_wan_subnet();
+		attempt->ok = reboot_start();
+		result->rebooting = attempt->ok;
+	}
+	close(lock);
+	return result->rebooting;
+}
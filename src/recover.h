@@ -0,0 +1,81 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_RECOVER_H
+#define WIOMW_SUI_RECOVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* in /etc so that it outlasts the reboots it is there to count */
+#define RECOVER_HISTORY_PATH "/etc/sui-recovery"
+#define RECOVER_LOCK_PATH "/tmp/sui-recover.lock"
+/* no more than this many reboots an hour, or the router would never stay up */
+#define RECOVER_MAX_REBOOTS 3
+#define RECOVER_LOOP_WINDOW_SECONDS 3600
+
+/* cheapest and least disruptive first */
+enum recover_step {
+	RECOVER_NONE = 0,
+	RECOVER_RENEW_DHCP,
+	RECOVER_RESTART_WAN,
+	RECOVER_RESTART_NETWORK,
+	RECOVER_REBOOT
+};
+
+#define RECOVER_STEP_COUNT 4
+
+struct recover_attempt {
+	enum recover_step step;
+	/* the step itself ran without error, whatever the connection did */
+	bool ok;
+	bool connected;
+	long elapsed_ms;
+};
+
+struct recover_result {
+	struct recover_attempt attempts[RECOVER_STEP_COUNT];
+	size_t attempt_count;
+	/* RECOVER_NONE if nothing short of a reboot was enough */
+	enum recover_step restored_by;
+	bool rebooting;
+	/* the reboot was skipped because of the ones before it */
+	bool reboot_suppressed;
+	unsigned int recent_reboots;
+	/* another recovery was already running */
+	bool busy;
+};
+
+/*
+ * Works up the steps, probing the connection after each, until it is back.
+ * A reboot is started only when everything else has failed and the history
+ * allows it. Returns true if the connection came back or a reboot was
+ * started.
+ */
+bool recover_run(struct recover_result* result);
+
+const char* recover_step_name(enum recover_step step);
+
+/* the step that last ran, and when, from the history; false if there is none */
+bool recover_last(enum recover_step* step, long long* when);
+
+#endif
@@ -0,0 +1,250 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "resolv.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/stat.h>
+
+#include "uci_cache.h"
+
+#define NAMESERVER_KEYWORD "nameserver"
+#define DNSMASQ_SERVER_KEYWORD "server="
+
+struct file_stamp {
+	bool exists;
+	dev_t device;
+	ino_t inode;
+	off_t size;
+	struct timespec mtime;
+};
+
+/* what one file said when it was last parsed */
+struct parsed_file {
+	const char* path;
+	bool from_dnsmasq;
+	bool loaded;
+	struct file_stamp stamp;
+	char addresses[RESOLV_MAX_NAMESERVERS][RESOLV_ADDRESS_LENGTH];
+	size_t count;
+};
+
+static struct parsed_file parsed_files[] = {
+	{RESOLV_CONF_AUTO_PATH, false},
+	{RESOLV_DNSMASQ_CONF_PATH, true}
+};
+
+static bool stamp(const char* path, struct file_stamp* file)
+{
+	struct stat file_stat;
+
+	memset(file, 0x00, sizeof(struct file_stamp));
+	if (stat(path, &file_stat) == 0) {
+		file->exists = true;
+		file->device = file_stat.st_dev;
+		file->inode = file_stat.st_ino;
+		file->size = file_stat.st_size;
+		file->mtime = file_stat.st_mtim;
+		return true;
+	}
+	return errno == ENOENT;
+}
+
+static bool same_stamp(const struct file_stamp* a, const struct file_stamp* b)
+{
+	return a->exists == b->exists && a->device == b->device && a->inode == b->inode && a->size == b->size
+		&& a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+static char* skip_space(char* str)
+{
+	while (isspace((unsigned char)*str)) {
+		str++;
+	}
+	return str;
+}
+
+/* "nameserver 1.2.3.4" */
+static const char* resolv_conf_address(char* line)
+{
+	char* address;
+	char* end;
+
+	line = skip_space(line);
+	if (strncmp(line, NAMESERVER_KEYWORD, strlen(NAMESERVER_KEYWORD)) != 0
+			|| !isspace((unsigned char)line[strlen(NAMESERVER_KEYWORD)])) {
+		return NULL;
+	}
+	address = skip_space(line + strlen(NAMESERVER_KEYWORD));
+	for (end = address; *end != '\0' && !isspace((unsigned char)*end); end++) {
+	}
+	*end = '\0';
+	return (*address == '\0') ? NULL : address;
+}
+
+/* "server=1.2.3.4" or "server=1.2.3.4#5353", but not "server=/lan/1.2.3.4" */
+static const char* dnsmasq_address(char* line)
+{
+	char* address;
+	char* end;
+
+	line = skip_space(line);
+	if (strncmp(line, DNSMASQ_SERVER_KEYWORD, strlen(DNSMASQ_SERVER_KEYWORD)) != 0) {
+		return NULL;
+	}
+	address = line + strlen(DNSMASQ_SERVER_KEYWORD);
+	if (*address == '/') {
+		/* only for one domain, so not an upstream for everything else */
+		return NULL;
+	}
+	for (end = address; *end != '\0' && *end != '#' && *end != '@' && !isspace((unsigned char)*end); end++) {
+	}
+	*end = '\0';
+	return (*address == '\0') ? NULL : address;
+}
+
+static bool parse(struct parsed_file* file)
+{
+	char line[BUFSIZ];
+	const char* address;
+	FILE* input;
+
+	file->count = 0;
+	if (!file->stamp.exists) {
+		return true;
+	} else if ((input = fopen(file->path, "r")) == NULL) {
+		/* the file was replaced between the stat and the open */
+		return errno == ENOENT;
+	}
+	while (fgets(line, BUFSIZ, input) != NULL && file->count < RESOLV_MAX_NAMESERVERS) {
+		address = file->from_dnsmasq ? dnsmasq_address(line) : resolv_conf_address(line);
+		if (address != NULL && strlen(address) < RESOLV_ADDRESS_LENGTH) {
+			strcpy(file->addresses[file->count++], address);
+		}
+	}
+	if (ferror(input)) {
+		syslog(LOG_ERR, "Unable to read %s", file->path);
+		fclose(input);
+		return false;
+	}
+	fclose(input);
+	return true;
+}
+
+static bool refresh(struct parsed_file* file, bool cached)
+{
+	struct file_stamp current;
+
+	if (!stamp(file->path, &current)) {
+		syslog(LOG_ERR, "Unable to stat %s: %s", file->path, strerror(errno));
+		file->loaded = false;
+		return false;
+	} else if (cached && file->loaded && same_stamp(&current, &(file->stamp))) {
+		return true;
+	}
+	file->stamp = current;
+	file->loaded = parse(file);
+	return file->loaded;
+}
+
+static bool listed(const struct resolv_state* state, const char* address)
+{
+	size_t i;
+
+	for (i = 0; i < state->count; i++) {
+		if (strcmp(state->nameservers[i].address, address) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+enum resolv_source resolv_classify(const char* address, bool from_dnsmasq)
+{
+	char configured[BUFSIZ];
+	const char* name = configured;
+	size_t count = 0;
+	size_t i;
+
+	if (strcmp(address, OPENDNS_ENHANCED_DNS_1) == 0 || strcmp(address, OPENDNS_ENHANCED_DNS_2) == 0
+			|| strcmp(address, OPENDNS_FAMILY_SHIELD_DNS_1) == 0 || strcmp(address, OPENDNS_FAMILY_SHIELD_DNS_2) == 0) {
+		return RESOLV_SOURCE_OPENDNS;
+	} else if (strcmp(address, GOOGLE_DNS_1) == 0 || strcmp(address, GOOGLE_DNS_2) == 0) {
+		return RESOLV_SOURCE_GOOGLE;
+	}
+	if (uci_cache_list(RESOLV_WAN_DNS_UCI_PATH, configured, BUFSIZ, &count) == UCI_CACHE_FOUND) {
+		for (i = 0; i < count; i++, name += strlen(name) + 1) {
+			if (strcmp(name, address) == 0) {
+				return RESOLV_SOURCE_UCI;
+			}
+		}
+	}
+	return from_dnsmasq ? RESOLV_SOURCE_CUSTOM : RESOLV_SOURCE_DHCP;
+}
+
+bool resolv_read(struct resolv_state* state, bool cached)
+{
+	struct resolv_nameserver* nameserver;
+	struct parsed_file* file;
+	size_t i;
+	size_t j;
+
+	memset(state, 0x00, sizeof(struct resolv_state));
+	for (i = 0; i < sizeof(parsed_files) / sizeof(parsed_files[0]); i++) {
+		file = &parsed_files[i];
+		if (!refresh(file, cached)) {
+			return false;
+		}
+		for (j = 0; j < file->count && state->count < RESOLV_MAX_NAMESERVERS; j++) {
+			if (!listed(state, file->addresses[j])) {
+				nameserver = &(state->nameservers[state->count++]);
+				strcpy(nameserver->address, file->addresses[j]);
+				nameserver->source = resolv_classify(nameserver->address, file->from_dnsmasq);
+			}
+		}
+	}
+	return true;
+}
+
+const char* resolv_source_name(enum resolv_source source)
+{
+	switch (source) {
+	case RESOLV_SOURCE_DHCP:
+		return "dhcp";
+	case RESOLV_SOURCE_UCI:
+		return "uci";
+	case RESOLV_SOURCE_OPENDNS:
+		return "opendns";
+	case RESOLV_SOURCE_GOOGLE:
+		return "google";
+	case RESOLV_SOURCE_CUSTOM:
+		return "custom";
+	default:
+		return "unknown";
+	}
+}
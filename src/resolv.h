@@ -0,0 +1,77 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_RESOLV_H
+#define WIOMW_SUI_RESOLV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RESOLV_CONF_AUTO_PATH "/var/resolv.conf.auto"
+#define RESOLV_DNSMASQ_CONF_PATH "/var/etc/dnsmasq.conf"
+#define RESOLV_WAN_DNS_UCI_PATH "network.wan.dns"
+
+#define RESOLV_MAX_NAMESERVERS 16
+#define RESOLV_ADDRESS_LENGTH 46
+
+#define OPENDNS_ENHANCED_DNS_1 "208.67.222.222"
+#define OPENDNS_ENHANCED_DNS_2 "208.67.220.220"
+#define OPENDNS_FAMILY_SHIELD_DNS_1 "208.67.222.123"
+#define OPENDNS_FAMILY_SHIELD_DNS_2 "208.67.220.123"
+#define GOOGLE_DNS_1 "8.8.8.8"
+#define GOOGLE_DNS_2 "8.8.4.4"
+
+enum resolv_source {
+	/* offered by the WAN, whether by DHCP, PPP, or a static setting outside UCI */
+	RESOLV_SOURCE_DHCP = 0,
+	RESOLV_SOURCE_UCI,
+	RESOLV_SOURCE_OPENDNS,
+	RESOLV_SOURCE_GOOGLE,
+	/* handed to dnsmasq directly with a server= line */
+	RESOLV_SOURCE_CUSTOM
+};
+
+struct resolv_nameserver {
+	char address[RESOLV_ADDRESS_LENGTH];
+	enum resolv_source source;
+};
+
+struct resolv_state {
+	struct resolv_nameserver nameservers[RESOLV_MAX_NAMESERVERS];
+	size_t count;
+};
+
+/*
+ * Lists the nameservers in use from RESOLV_CONF_AUTO_PATH and the upstream
+ * server= lines of RESOLV_DNSMASQ_CONF_PATH, without duplicates. With cached
+ * set, a file is only parsed again once its inode or mtime has changed.
+ * A file that is not there contributes nothing; false means one could not
+ * be read.
+ */
+bool resolv_read(struct resolv_state* state, bool cached);
+
+/* the source a given address would be tagged with */
+enum resolv_source resolv_classify(const char* address, bool from_dnsmasq);
+
+const char* resolv_source_name(enum resolv_source source);
+
+#endif
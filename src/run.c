@@ -0,0 +1,481 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "run.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "monotonic.h"
+
+#define RUN_KILL_GRACE_MS 500
+#define RUN_REAP_POLL_MS 10
+#define RUN_DRAIN_LENGTH 4096
+#define RUN_LOG_MODE 0644
+
+extern char** environ;
+
+struct capture {
+	int fd;
+	char* buffer;
+	size_t size;
+	size_t length;
+	bool truncated;
+};
+
+static struct run_stats stats;
+
+static void close_fd(int* fd)
+{
+	if (*fd != -1) {
+		close(*fd);
+		*fd = -1;
+	}
+}
+
+/* points fd at the pipe end given, or else at log_path or /dev/null */
+static int redirect(posix_spawn_file_actions_t* actions, int fd, int pipe_end, const char* log_path)
+{
+	if (pipe_end != -1) {
+		return posix_spawn_file_actions_adddup2(actions, pipe_end, fd);
+	} else if (fd == STDIN_FILENO) {
+		return posix_spawn_file_actions_addopen(actions, fd, "/dev/null", O_RDONLY, 0);
+	} else if (log_path != NULL) {
+		return posix_spawn_file_actions_addopen(actions, fd, log_path, O_WRONLY | O_APPEND | O_CREAT, RUN_LOG_MODE);
+	} else {
+		return posix_spawn_file_actions_addopen(actions, fd, "/dev/null", O_WRONLY, 0);
+	}
+}
+
+/*
+ * Pipe ends are created close-on-exec, so the child keeps only the copies
+ * made onto its standard descriptors.
+ */
+static bool spawn(const char* const argv[], int in_end, int out_end, int err_end, const char* log_path, bool detached, pid_t* pid)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t signals;
+	short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP;
+	int res = 0;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+
+	/* the CGI and the update worker ignore SIGPIPE; a command should not inherit that */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &signals);
+	sigemptyset(&signals);
+	posix_spawnattr_setsigmask(&attr, &signals);
+#ifdef POSIX_SPAWN_SETSID
+	if (detached) {
+		flags = (flags & ~POSIX_SPAWN_SETPGROUP) | POSIX_SPAWN_SETSID;
+	}
+#endif
+	/* a group of its own lets a timeout take down whatever the command started */
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setflags(&attr, flags);
+
+	if ((res = redirect(&actions, STDIN_FILENO, in_end, NULL)) == 0
+			&& (res = redirect(&actions, STDOUT_FILENO, out_end, log_path)) == 0) {
+		if (err_end == -1 && out_end == -1) {
+			res = posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+		} else {
+			res = redirect(&actions, STDERR_FILENO, err_end, log_path);
+		}
+	}
+	if (res == 0) {
+		res = posix_spawn(pid, argv[0], &actions, &attr, (char* const*)argv, environ);
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	if (res != 0) {
+		syslog(LOG_ERR, "Unable to start %s: %s", argv[0], strerror(res));
+		return false;
+	}
+	return true;
+}
+
+static void capture_read(struct capture* capture)
+{
+	char drain[RUN_DRAIN_LENGTH];
+	ssize_t len;
+
+	if (capture->length + 1 < capture->size) {
+		len = read(capture->fd, capture->buffer + capture->length, capture->size - capture->length - 1);
+		if (len > 0) {
+			capture->length += len;
+		}
+	} else {
+		if ((len = read(capture->fd, drain, RUN_DRAIN_LENGTH)) > 0) {
+			capture->truncated = true;
+		}
+	}
+	if (len == 0 || (len == -1 && errno != EINTR && errno != EAGAIN)) {
+		close_fd(&(capture->fd));
+	}
+}
+
+static bool reap(pid_t pid, int* wait_status, bool block)
+{
+	pid_t res;
+
+	while ((res = waitpid(pid, wait_status, block ? 0 : WNOHANG)) == -1 && errno == EINTR) {
+	}
+	return res == pid || res == -1;
+}
+
+static void terminate(pid_t pid, int* wait_status)
+{
+	long give_up = monotonic_ms() + RUN_KILL_GRACE_MS;
+
+	kill(-pid, SIGTERM);
+	while (!reap(pid, wait_status, false)) {
+		if (monotonic_ms() >= give_up) {
+			kill(-pid, SIGKILL);
+			reap(pid, wait_status, true);
+			return;
+		}
+		poll(NULL, 0, RUN_REAP_POLL_MS);
+	}
+	/* the command is gone but may have left children behind in its group */
+	kill(-pid, SIGKILL);
+}
+
+/*
+ * Feeds input to the command and collects its output until both are done
+ * and the command has exited, or the deadline passes.
+ */
+static bool collect(const char* path, pid_t pid, long started_ms, long timeout_ms, int* input, const char* data, size_t len, struct capture captures[2], struct run_result* result)
+{
+	long deadline = (timeout_ms > 0) ? started_ms + timeout_ms : 0;
+	struct pollfd fds[3];
+	struct pollfd* input_poll;
+	struct run_result local;
+	int wait_status = 0;
+	size_t written = 0;
+	bool exited = false;
+	nfds_t count;
+	long wait_ms;
+	ssize_t res;
+	size_t i;
+
+	if (result == NULL) {
+		result = &local;
+	}
+	memset(result, 0x00, sizeof(struct run_result));
+	result->status = -1;
+
+	while (!exited) {
+		count = 0;
+		input_poll = NULL;
+		if (*input != -1) {
+			input_poll = &fds[count];
+			fds[count].fd = *input;
+			fds[count++].events = POLLOUT;
+		}
+		for (i = 0; i < 2; i++) {
+			if (captures[i].fd != -1) {
+				fds[count].fd = captures[i].fd;
+				fds[count++].events = POLLIN;
+			}
+		}
+
+		wait_ms = -1;
+		if (deadline != 0 && (wait_ms = deadline - monotonic_ms()) <= 0) {
+			result->timed_out = true;
+			syslog(LOG_WARNING, "%s took longer than %ld ms, stopping it", path, timeout_ms);
+			terminate(pid, &wait_status);
+			break;
+		}
+
+		if (count == 0) {
+			/* nothing left to pass along; only the exit is left */
+			if (deadline == 0) {
+				exited = reap(pid, &wait_status, true);
+			} else if (reap(pid, &wait_status, false)) {
+				exited = true;
+			} else {
+				poll(NULL, 0, (wait_ms < RUN_REAP_POLL_MS) ? wait_ms : RUN_REAP_POLL_MS);
+			}
+			continue;
+		}
+
+		if (poll(fds, count, wait_ms) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			terminate(pid, &wait_status);
+			break;
+		}
+		if (input_poll != NULL && input_poll->revents != 0) {
+			if ((input_poll->revents & POLLOUT) == 0) {
+				/* the command closed its stdin early */
+				close_fd(input);
+			} else if ((res = write(*input, data + written, len - written)) > 0) {
+				if ((written += res) == len) {
+					close_fd(input);
+				}
+			} else if (res == -1 && errno != EINTR && errno != EAGAIN) {
+				close_fd(input);
+			}
+		}
+		for (i = (input_poll != NULL) ? 1 : 0; i < count; i++) {
+			if (fds[i].revents != 0) {
+				capture_read((fds[i].fd == captures[0].fd) ? &captures[0] : &captures[1]);
+			}
+		}
+	}
+
+	close_fd(input);
+	for (i = 0; i < 2; i++) {
+		close_fd(&(captures[i].fd));
+		if (captures[i].buffer != NULL && captures[i].size > 0) {
+			captures[i].buffer[captures[i].length] = '\0';
+		}
+	}
+	result->out_length = captures[0].length;
+	result->out_truncated = captures[0].truncated;
+	result->err_length = captures[1].length;
+	result->err_truncated = captures[1].truncated;
+	if (!result->timed_out && WIFEXITED(wait_status)) {
+		result->status = WEXITSTATUS(wait_status);
+	} else if (WIFSIGNALED(wait_status)) {
+		result->signal = WTERMSIG(wait_status);
+	}
+	result->elapsed_ms = monotonic_ms() - started_ms;
+
+	stats.calls++;
+	stats.total_ms += result->elapsed_ms;
+	if (result->elapsed_ms > stats.max_ms) {
+		stats.max_ms = result->elapsed_ms;
+	}
+	if (result->timed_out) {
+		stats.timeouts++;
+	}
+	if (result->status != 0) {
+		stats.failures++;
+	}
+	return result->status == 0;
+}
+
+static void fail_to_start(struct run_result* result)
+{
+	if (result != NULL) {
+		memset(result, 0x00, sizeof(struct run_result));
+		result->status = -1;
+	}
+	stats.calls++;
+	stats.failures++;
+}
+
+bool run(const char* const argv[], const struct run_options* options, struct run_result* result)
+{
+	struct capture captures[2];
+	int in_pipe[2] = {-1, -1};
+	int out_pipe[2] = {-1, -1};
+	int err_pipe[2] = {-1, -1};
+	long started_ms = monotonic_ms();
+	pid_t pid;
+
+	memset(captures, 0x00, sizeof(captures));
+	if ((options->input != NULL && pipe2(in_pipe, O_CLOEXEC) == -1)
+			|| (options->out != NULL && pipe2(out_pipe, O_CLOEXEC) == -1)
+			|| (options->err != NULL && pipe2(err_pipe, O_CLOEXEC) == -1)) {
+		syslog(LOG_ERR, "Unable to create pipes for %s: %s", argv[0], strerror(errno));
+		close_fd(&in_pipe[0]);
+		close_fd(&in_pipe[1]);
+		close_fd(&out_pipe[0]);
+		close_fd(&out_pipe[1]);
+		fail_to_start(result);
+		return false;
+	}
+
+	if (!spawn(argv, in_pipe[0], out_pipe[1], err_pipe[1], options->log_path, false, &pid)) {
+		close_fd(&in_pipe[0]);
+		close_fd(&in_pipe[1]);
+		close_fd(&out_pipe[0]);
+		close_fd(&out_pipe[1]);
+		close_fd(&err_pipe[0]);
+		close_fd(&err_pipe[1]);
+		fail_to_start(result);
+		return false;
+	}
+	close_fd(&in_pipe[0]);
+	close_fd(&out_pipe[1]);
+	close_fd(&err_pipe[1]);
+	if (in_pipe[1] != -1) {
+		/* a command that stops reading must not block us past the deadline */
+		fcntl(in_pipe[1], F_SETFL, fcntl(in_pipe[1], F_GETFL) | O_NONBLOCK);
+	}
+
+	captures[0].fd = out_pipe[0];
+	captures[0].buffer = options->out;
+	captures[0].size = options->out_size;
+	captures[1].fd = err_pipe[0];
+	captures[1].buffer = options->err;
+	captures[1].size = options->err_size;
+	return collect(argv[0], pid, started_ms, options->timeout_ms, &in_pipe[1], options->input, options->input_length, captures, result);
+}
+
+bool run_start(const char* const argv[], const struct run_options* options, struct run_process* process)
+{
+	int in_pipe[2];
+
+	process->path = argv[0];
+	process->input = -1;
+	process->started_ms = monotonic_ms();
+	process->timeout_ms = options->timeout_ms;
+	if (pipe2(in_pipe, O_CLOEXEC) == -1) {
+		syslog(LOG_ERR, "Unable to create a pipe for %s: %s", argv[0], strerror(errno));
+		fail_to_start(NULL);
+		return false;
+	}
+	if (!spawn(argv, in_pipe[0], -1, -1, options->log_path, false, &(process->pid))) {
+		close(in_pipe[0]);
+		close(in_pipe[1]);
+		fail_to_start(NULL);
+		return false;
+	}
+	close(in_pipe[0]);
+	process->input = in_pipe[1];
+	/* a command that stops reading must not block us past the deadline */
+	fcntl(process->input, F_SETFL, fcntl(process->input, F_GETFL) | O_NONBLOCK);
+	return true;
+}
+
+bool run_write(struct run_process* process, const void* data, size_t len)
+{
+	const char* next = (const char*)data;
+	long deadline = (process->timeout_ms > 0) ? process->started_ms + process->timeout_ms : 0;
+	struct pollfd input_poll;
+	long wait_ms;
+	ssize_t res;
+
+	while (len > 0) {
+		if ((res = write(process->input, next, len)) > 0) {
+			next += res;
+			len -= res;
+			continue;
+		} else if (res == -1 && errno != EINTR && errno != EAGAIN) {
+			return false;
+		}
+
+		wait_ms = -1;
+		if (deadline != 0 && (wait_ms = deadline - monotonic_ms()) <= 0) {
+			/* run_finish sees the deadline has passed and stops the command */
+			syslog(LOG_WARNING, "%s stopped reading its input for longer than %ld ms", process->path, process->timeout_ms);
+			return false;
+		}
+		input_poll.fd = process->input;
+		input_poll.events = POLLOUT;
+		if (poll(&input_poll, 1, wait_ms) == -1 && errno != EINTR) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool run_finish(struct run_process* process, struct run_result* result)
+{
+	struct capture captures[2];
+
+	memset(captures, 0x00, sizeof(captures));
+	captures[0].fd = -1;
+	captures[1].fd = -1;
+	close_fd(&(process->input));
+	return collect(process->path, process->pid, process->started_ms, process->timeout_ms, &(process->input), NULL, 0, captures, result);
+}
+
+/* the stdio of a CGI belongs to the web server, which waits for it to close */
+static void release_stdio()
+{
+	int null_fd;
+
+	if ((null_fd = open("/dev/null", O_RDWR)) != -1) {
+		dup2(null_fd, STDIN_FILENO);
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+		if (null_fd > STDERR_FILENO) {
+			close(null_fd);
+		}
+	}
+}
+
+bool run_detached(const char* const argv[], const char* log_path, unsigned int delay_seconds)
+{
+	int wait_status = 0;
+	pid_t pid;
+
+	stats.calls++;
+	if (access(argv[0], X_OK) != 0) {
+		syslog(LOG_ERR, "Unable to start %s: %s", argv[0], strerror(errno));
+		stats.failures++;
+		return false;
+	}
+
+	/* the command's parent exits at once, so init reaps it rather than us */
+	fflush(stdout);
+	if ((pid = fork()) == -1) {
+		syslog(LOG_ERR, "Unable to fork to start %s: %s", argv[0], strerror(errno));
+		stats.failures++;
+		return false;
+	} else if (pid == 0) {
+		pid_t command;
+		if (delay_seconds == 0) {
+			_exit(spawn(argv, -1, -1, -1, log_path, true, &command) ? 0 : 1);
+		}
+		if ((pid = fork()) != 0) {
+			_exit((pid == -1) ? 1 : 0);
+		}
+		setsid();
+		release_stdio();
+		sleep(delay_seconds);
+		spawn(argv, -1, -1, -1, log_path, true, &command);
+		_exit(0);
+	}
+
+	while (waitpid(pid, &wait_status, 0) == -1 && errno == EINTR) {
+	}
+	if (!WIFEXITED(wait_status) || WEXITSTATUS(wait_status) != 0) {
+		stats.failures++;
+		return false;
+	}
+	return true;
+}
+
+const struct run_stats* run_get_stats()
+{
+	return &stats;
+}
@@ -0,0 +1,107 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_RUN_H
+#define WIOMW_SUI_RUN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct run_options {
+	/* 0 waits as long as the command takes */
+	long timeout_ms;
+	/* written to the command's stdin, which is /dev/null if input is NULL */
+	const char* input;
+	size_t input_length;
+	/* output beyond size - 1 bytes is read and dropped; a NULL buffer drops all of it */
+	char* out;
+	size_t out_size;
+	char* err;
+	size_t err_size;
+	/* stdout and stderr that are not captured are appended here rather than dropped */
+	const char* log_path;
+};
+
+struct run_result {
+	/* the exit status, or -1 if the command never exited on its own */
+	int status;
+	int signal;
+	bool timed_out;
+	size_t out_length;
+	size_t err_length;
+	bool out_truncated;
+	bool err_truncated;
+	long elapsed_ms;
+};
+
+struct run_stats {
+	unsigned long calls;
+	unsigned long failures;
+	unsigned long timeouts;
+	long total_ms;
+	long max_ms;
+};
+
+/* a command started by run_start that is still reading its stdin */
+struct run_process {
+	const char* path;
+	pid_t pid;
+	int input;
+	long started_ms;
+	long timeout_ms;
+};
+
+/*
+ * Runs argv[0], which must be a full path, with no shell in between. A
+ * command still running after timeout_ms is sent SIGTERM and then SIGKILL,
+ * along with anything it started. Returns true only if the command exited
+ * with status 0; result, if not NULL, says what happened either way.
+ */
+bool run(const char* const argv[], const struct run_options* options, struct run_result* result);
+
+/*
+ * Starts argv[0] with a pipe on its stdin for run_write, and its stdout and
+ * stderr appended to options->log_path (or dropped if it is NULL).
+ * options->timeout_ms covers everything up to run_finish; input and the
+ * capture buffers are not used.
+ */
+bool run_start(const char* const argv[], const struct run_options* options, struct run_process* process);
+
+/* returns false if the command stopped reading, or did not read it all before the timeout */
+bool run_write(struct run_process* process, const void* data, size_t len);
+
+/* closes stdin and waits as run does, stopping the command once the timeout from run_start is up */
+bool run_finish(struct run_process* process, struct run_result* result);
+
+/*
+ * Starts argv[0] in a session of its own, delay_seconds from now, and does
+ * not wait for it, for commands that have to outlive the caller, such as a
+ * reboot. Nothing is left behind for the caller to reap. With a delay, only
+ * a command that cannot be run at all is reported as a failure.
+ */
+bool run_detached(const char* const argv[], const char* log_path, unsigned int delay_seconds);
+
+/* totals for this process */
+const struct run_stats* run_get_stats();
+
+#endif
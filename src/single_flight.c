@@ -0,0 +1,167 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "single_flight.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "monotonic.h"
+
+#define LOCK_PATH_FORMAT SINGLE_FLIGHT_DIR "/sui-flight-%s.lock"
+#define SLOT_PATH_FORMAT SINGLE_FLIGHT_DIR "/sui-flight-%s.slot"
+#define SLOT_MAGIC 0x53554946
+#define WAIT_INTERVAL_MS 20
+
+struct slot_header {
+	uint32_t magic;
+	uint32_t length;
+	unsigned long long seq;
+};
+
+static bool valid_key(const char* key)
+{
+	size_t i;
+
+	if (key[0] == '\0' || strlen(key) > SINGLE_FLIGHT_PATH_LENGTH - sizeof(SLOT_PATH_FORMAT)) {
+		return false;
+	}
+	for (i = 0; key[i] != '\0'; i++) {
+		if (!((key[i] >= 'a' && key[i] <= 'z') || (key[i] >= 'A' && key[i] <= 'Z')
+				|| (key[i] >= '0' && key[i] <= '9') || key[i] == '_' || key[i] == '-')) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* reads the header, and the data too if data is not NULL; a missing slot has seq 0 */
+static bool read_slot(const char* path, struct slot_header* header, void* data, size_t size, size_t* length)
+{
+	FILE* slot;
+	bool ok;
+
+	memset(header, 0x00, sizeof(struct slot_header));
+	if ((slot = fopen(path, "r")) == NULL) {
+		return errno == ENOENT;
+	}
+	ok = fread(header, sizeof(struct slot_header), 1, slot) == 1 && header->magic == SLOT_MAGIC;
+	if (ok && data != NULL) {
+		size_t wanted = (header->length < size) ? header->length : size;
+		ok = fread(data, 1, wanted, slot) == wanted;
+		*length = wanted;
+	}
+	fclose(slot);
+	if (!ok) {
+		memset(header, 0x00, sizeof(struct slot_header));
+	}
+	return ok;
+}
+
+static void unlock(struct single_flight* flight)
+{
+	if (flight->lock != -1) {
+		flock(flight->lock, LOCK_UN);
+		close(flight->lock);
+		flight->lock = -1;
+	}
+}
+
+enum single_flight_role single_flight_begin(struct single_flight* flight, const char* key, long wait_ms,
+		void* result, size_t result_size, size_t* result_length)
+{
+	char lock_path[SINGLE_FLIGHT_PATH_LENGTH];
+	struct slot_header header;
+	long deadline = monotonic_ms() + wait_ms;
+
+	memset(flight, 0x00, sizeof(struct single_flight));
+	flight->lock = -1;
+	*result_length = 0;
+	if (!valid_key(key)) {
+		return SINGLE_FLIGHT_ERROR;
+	}
+	snprintf(lock_path, SINGLE_FLIGHT_PATH_LENGTH, LOCK_PATH_FORMAT, key);
+	snprintf(flight->slot_path, SINGLE_FLIGHT_PATH_LENGTH, SLOT_PATH_FORMAT, key);
+
+	/* read first, so that anything published from here on is known to be new */
+	read_slot(flight->slot_path, &header, NULL, 0, NULL);
+	flight->seen = header.seq;
+	if ((flight->lock = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1) {
+		syslog(LOG_WARNING, "Unable to open %s: %s", lock_path, strerror(errno));
+		return SINGLE_FLIGHT_ERROR;
+	}
+	while (flock(flight->lock, LOCK_EX | LOCK_NB) != 0) {
+		if (errno != EWOULDBLOCK && errno != EINTR) {
+			unlock(flight);
+			return SINGLE_FLIGHT_ERROR;
+		} else if (monotonic_ms() >= deadline) {
+			close(flight->lock);
+			flight->lock = -1;
+			return SINGLE_FLIGHT_BUSY;
+		}
+		usleep(WAIT_INTERVAL_MS * 1000);
+	}
+
+	if (read_slot(flight->slot_path, &header, result, result_size, result_length) && header.seq > flight->seen) {
+		unlock(flight);
+		return SINGLE_FLIGHT_FOLLOWER;
+	}
+	*result_length = 0;
+	flight->seen = header.seq;
+	return SINGLE_FLIGHT_LEADER;
+}
+
+void single_flight_publish(struct single_flight* flight, const void* data, size_t length)
+{
+	char temp_path[SINGLE_FLIGHT_PATH_LENGTH + 16];
+	struct slot_header header;
+	FILE* slot;
+	bool ok;
+
+	snprintf(temp_path, sizeof(temp_path), "%s.%d", flight->slot_path, (int)getpid());
+	memset(&header, 0x00, sizeof(struct slot_header));
+	header.magic = SLOT_MAGIC;
+	header.length = (uint32_t)length;
+	header.seq = flight->seen + 1;
+	if ((slot = fopen(temp_path, "w")) != NULL) {
+		ok = fwrite(&header, sizeof(struct slot_header), 1, slot) == 1
+				&& (length == 0 || fwrite(data, 1, length, slot) == length);
+		/* replaced whole, so a reader never sees half of it */
+		if (fclose(slot) != 0 || !ok || rename(temp_path, flight->slot_path) != 0) {
+			unlink(temp_path);
+		}
+	}
+	unlock(flight);
+}
+
+void single_flight_end(struct single_flight* flight)
+{
+	unlock(flight);
+}
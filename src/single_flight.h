@@ -0,0 +1,67 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_SINGLE_FLIGHT_H
+#define WIOMW_SUI_SINGLE_FLIGHT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* each key gets a lock file and a result slot here */
+#define SINGLE_FLIGHT_DIR "/tmp"
+#define SINGLE_FLIGHT_PATH_LENGTH 128
+
+enum single_flight_role {
+	/* do the work, then single_flight_publish or single_flight_end */
+	SINGLE_FLIGHT_LEADER = 0,
+	/* someone else did the work while this caller waited; its result was copied out */
+	SINGLE_FLIGHT_FOLLOWER,
+	/* the work was still going on when the wait ran out */
+	SINGLE_FLIGHT_BUSY,
+	/* there is no way to coordinate, so go ahead uncoordinated */
+	SINGLE_FLIGHT_ERROR
+};
+
+struct single_flight {
+	int lock;
+	char slot_path[SINGLE_FLIGHT_PATH_LENGTH];
+	/* the last result published before this caller arrived */
+	unsigned long long seen;
+};
+
+/*
+ * Joins the operation named by key, which may only hold [A-Za-z0-9_-]. The
+ * first caller leads; anyone arriving while it works waits up to wait_ms
+ * and then takes the result it published, copying up to result_size bytes
+ * into result. If the leader published nothing, the next caller leads in
+ * turn.
+ */
+enum single_flight_role single_flight_begin(struct single_flight* flight, const char* key, long wait_ms,
+		void* result, size_t result_size, size_t* result_length);
+
+/* hands data to the callers waiting, and to those arriving before the next leader starts */
+void single_flight_publish(struct single_flight* flight, const void* data, size_t length);
+
+/* lets the next caller lead without publishing anything */
+void single_flight_end(struct single_flight* flight);
+
+#endif
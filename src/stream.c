@@ -0,0 +1,109 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "stream.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include "digest.h"
+#include "download.h"
+#include "run.h"
+
+#define SYSUPGRADE_PATH "/sbin/sysupgrade"
+#define STREAM_REBOOT_DELAY "3"
+
+static bool mounted()
+{
+	struct stat dir_stat;
+	struct stat parent_stat;
+
+	/* a mount point sits on a different device from the directory holding it */
+	return stat(STREAM_DIR, &dir_stat) == 0 && stat(STREAM_DIR "/..", &parent_stat) == 0
+		&& dir_stat.st_dev != parent_stat.st_dev;
+}
+
+bool stream_supported()
+{
+	return access(SYSUPGRADE_PATH, X_OK) == 0;
+}
+
+const char* stream_stage(const struct download_job* job, const char* sha256)
+{
+	struct download_job stream_job;
+	struct digest_result result;
+	struct stat file_stat;
+	const char* error;
+
+	if (job->size <= 0) {
+		return "Error while reading update file information.";
+	}
+	if ((mkdir(STREAM_DIR, 0700) != 0 && errno != EEXIST) || (!mounted() && mount("ramfs", STREAM_DIR, "ramfs", MS_NOSUID | MS_NODEV | MS_NOEXEC, NULL) != 0)) {
+		syslog(LOG_ERR, "Unable to mount a ramfs for the update: %s", strerror(errno));
+		return "Error while preparing room for the update file.";
+	}
+
+	memcpy(&stream_job, job, sizeof(struct download_job));
+	stream_job.path = STREAM_FILE;
+	/* a ramfs grows until memory runs out; download_fetch never writes past job->size, which is all that bounds it */
+	if ((error = download_fetch(&stream_job, &result)) != NULL) {
+		stream_discard();
+		return error;
+	}
+	if (stat(STREAM_FILE, &file_stat) != 0 || file_stat.st_size != job->size) {
+		stream_discard();
+		return "Downloaded update file was the wrong size.";
+	}
+	if (!digest_matches(&result, job->md5, sha256)) {
+		stream_discard();
+		return "Downloaded update file did not have the correct md5.";
+	}
+	return NULL;
+}
+
+const char* stream_apply()
+{
+	/* sysupgrade runs its own image check, and refuses an image meant for another router */
+	const char* sysupgrade_argv[] = {SYSUPGRADE_PATH, "-v", "-d", STREAM_REBOOT_DELAY, STREAM_FILE, NULL};
+
+	if (!run_detached(sysupgrade_argv, STREAM_LOG_FILE, 0)) {
+		syslog(LOG_ERR, "Unable to start sysupgrade for the staged update");
+		return "Error while starting the upgrade.";
+	}
+	return NULL;
+}
+
+void stream_discard()
+{
+	download_discard(STREAM_FILE);
+	remove(STREAM_FILE);
+	if (mounted() && umount(STREAM_DIR) != 0) {
+		syslog(LOG_WARNING, "Unable to unmount the update ramfs: %s", strerror(errno));
+	}
+}
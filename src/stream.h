@@ -0,0 +1,56 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_STREAM_H
+#define WIOMW_SUI_STREAM_H
+
+#include <stdbool.h>
+
+#include "download.h"
+
+#define STREAM_DIR "/tmp/sui-stream"
+#define STREAM_FILE STREAM_DIR "/sysupgrade.bin"
+#define STREAM_LOG_FILE "/tmp/sysupgrade.log"
+
+/* true if this router can be upgraded from an image kept outside of tmpfs */
+bool stream_supported();
+
+/*
+ * Fetches job->url into a ramfs of its own at STREAM_DIR, which is not bound
+ * by the size of tmpfs, and checks it against job->md5 and, if given, sha256.
+ * The caller must have made sure that the image fits in memory. Nothing is
+ * erased here. Returns NULL once the whole image is in place at STREAM_FILE,
+ * or a message for the user.
+ */
+const char* stream_stage(const struct download_job* job, const char* sha256);
+
+/*
+ * Hands the image from stream_stage to sysupgrade, which checks it, moves
+ * itself to a ramfs, stops every process and only then flashes and reboots.
+ * Returns NULL once sysupgrade is on its way, or a message for the user.
+ */
+const char* stream_apply();
+
+/* drops the staged image and the ramfs holding it */
+void stream_discard();
+
+#endif
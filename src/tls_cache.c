@@ -0,0 +1,230 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "tls_cache.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <curl/curl.h>
+
+#define DNS_CACHE_FILE "/tmp/sui-dns.cache"
+#define DNS_CACHE_PATH_LENGTH 64
+#define DNS_CACHE_TTL 300
+#define DNS_CACHE_MAX_ENTRIES 8
+#define DNS_CACHE_ADDRESS_LENGTH 64
+#define CA_CACHE_TIMEOUT 86400
+#define HTTPS_PORT 443
+
+struct dns_cache_entry {
+	char host[TLS_CACHE_HOST_LENGTH];
+	long port;
+	char address[DNS_CACHE_ADDRESS_LENGTH];
+	long expires;
+};
+
+/*
+ * Sessions only survive as long as the share does, so this pays off when
+ * FastCGI keeps the process around; plain CGI still gets the address cache.
+ */
+static CURLSH* share = NULL;
+
+static CURLSH* get_share()
+{
+	if (share == NULL && (share = curl_share_init()) != NULL) {
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	}
+	return share;
+}
+
+static size_t load_dns_cache(struct dns_cache_entry entries[DNS_CACHE_MAX_ENTRIES])
+{
+	FILE* cache_file;
+	char line[BUFSIZ];
+	size_t count = 0;
+
+	if ((cache_file = fopen(DNS_CACHE_FILE, "r")) == NULL) {
+		return 0;
+	}
+	while (count < DNS_CACHE_MAX_ENTRIES && fgets(line, BUFSIZ, cache_file) != NULL) {
+		struct dns_cache_entry* entry = entries + count;
+		if (sscanf(line, "%255s %ld %63s %ld", entry->host, &(entry->port), entry->address, &(entry->expires)) == 4) {
+			count++;
+		}
+	}
+	fclose(cache_file);
+	return count;
+}
+
+static void save_dns_cache(const struct dns_cache_entry entries[DNS_CACHE_MAX_ENTRIES], size_t count)
+{
+	FILE* cache_file;
+	char temp_path[DNS_CACHE_PATH_LENGTH];
+	size_t i;
+
+	/* every process writes its own copy, so two writers never share one */
+	snprintf(temp_path, DNS_CACHE_PATH_LENGTH, DNS_CACHE_FILE ".%d", (int)getpid());
+	if ((cache_file = fopen(temp_path, "w")) == NULL) {
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		fprintf(cache_file, "%s %ld %s %ld\n", entries[i].host, entries[i].port, entries[i].address, entries[i].expires);
+	}
+	/* readers in other CGI processes only ever see a complete file */
+	if (fclose(cache_file) != 0 || rename(temp_path, DNS_CACHE_FILE) != 0) {
+		unlink(temp_path);
+	}
+}
+
+static bool parse_host(const char* url, struct tls_cache_slot* slot)
+{
+	const char* start = strstr(url, "://");
+	size_t len;
+
+	start = (start == NULL) ? url : start + 3;
+	len = strcspn(start, ":/?#");
+	if (len == 0 || len >= TLS_CACHE_HOST_LENGTH) {
+		return false;
+	}
+	memcpy(slot->host, start, len);
+	slot->host[len] = '\0';
+	slot->port = (start[len] == ':') ? strtol(start + len + 1, NULL, 10) : HTTPS_PORT;
+	return slot->port > 0;
+}
+
+void tls_cache_prepare(CURL* curl, const char* url, struct tls_cache_slot* slot)
+{
+	struct dns_cache_entry entries[DNS_CACHE_MAX_ENTRIES];
+	size_t count;
+	size_t i;
+	CURLSH* shared;
+	char resolve[BUFSIZ];
+	long now = (long)time(NULL);
+
+	memset(slot, 0x00, sizeof(struct tls_cache_slot));
+
+	curl_easy_setopt(curl, CURLOPT_CAINFO, TLS_CACHE_CA_FILE);
+	curl_easy_setopt(curl, CURLOPT_SSL_SESSIONID_CACHE, 1L);
+#if LIBCURL_VERSION_NUM >= 0x075700
+	curl_easy_setopt(curl, CURLOPT_CA_CACHE_TIMEOUT, (long)CA_CACHE_TIMEOUT);
+#endif
+	if ((shared = get_share()) != NULL) {
+		curl_easy_setopt(curl, CURLOPT_SHARE, shared);
+	}
+
+	if (!parse_host(url, slot)) {
+		return;
+	}
+	/*
+	 * Entries seeded this way never expire from the share, so every transfer
+	 * first removes whatever an earlier one left behind; an address that has
+	 * since aged out or failed then really is looked up again.
+	 */
+	snprintf(resolve, BUFSIZ, "-%s:%ld", slot->host, slot->port);
+	if ((slot->resolve = curl_slist_append(NULL, resolve)) == NULL) {
+		return;
+	}
+	count = load_dns_cache(entries);
+	for (i = 0; i < count; i++) {
+		if (strcmp(entries[i].host, slot->host) == 0 && entries[i].port == slot->port && entries[i].expires > now) {
+			struct curl_slist* appended;
+			/* IPv6 addresses have to be bracketed to tell them from the port */
+			snprintf(resolve, BUFSIZ, (strchr(entries[i].address, ':') != NULL) ? "%s:%ld:[%s]" : "%s:%ld:%s",
+					slot->host, slot->port, entries[i].address);
+			if ((appended = curl_slist_append(slot->resolve, resolve)) != NULL) {
+				slot->resolve = appended;
+				slot->used_cached_address = true;
+			}
+			break;
+		}
+	}
+	curl_easy_setopt(curl, CURLOPT_RESOLVE, slot->resolve);
+}
+
+void tls_cache_finish(CURL* curl, struct tls_cache_slot* slot, bool ok)
+{
+	struct dns_cache_entry entries[DNS_CACHE_MAX_ENTRIES];
+	size_t count;
+	size_t i;
+	size_t kept = 0;
+	char* primary_ip = NULL;
+	long now = (long)time(NULL);
+	bool changed = false;
+	bool add = ok;
+
+	if (slot->host[0] == '\0') {
+		return;
+	}
+
+	/* an address that just failed us may be stale, so go back to DNS next time */
+	if (!ok && !slot->used_cached_address) {
+		curl_slist_free_all(slot->resolve);
+		slot->resolve = NULL;
+		return;
+	}
+	if (ok && (curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &primary_ip) != CURLE_OK
+			|| primary_ip == NULL || primary_ip[0] == '\0')) {
+		curl_slist_free_all(slot->resolve);
+		slot->resolve = NULL;
+		return;
+	}
+
+	count = load_dns_cache(entries);
+	for (i = 0; i < count; i++) {
+		if (strcmp(entries[i].host, slot->host) == 0 && entries[i].port == slot->port) {
+			/* a confirmed address keeps its original expiry so it still ages out */
+			if (ok && strcmp(entries[i].address, primary_ip) == 0 && entries[i].expires > now) {
+				memmove(entries + kept, entries + i, sizeof(struct dns_cache_entry));
+				kept++;
+				add = false;
+			} else {
+				changed = true;
+			}
+		} else if (entries[i].expires > now) {
+			memmove(entries + kept, entries + i, sizeof(struct dns_cache_entry));
+			kept++;
+		} else {
+			changed = true;
+		}
+	}
+	if (add && kept < DNS_CACHE_MAX_ENTRIES) {
+		strncpy(entries[kept].host, slot->host, TLS_CACHE_HOST_LENGTH - 1);
+		entries[kept].host[TLS_CACHE_HOST_LENGTH - 1] = '\0';
+		entries[kept].port = slot->port;
+		strncpy(entries[kept].address, primary_ip, DNS_CACHE_ADDRESS_LENGTH - 1);
+		entries[kept].address[DNS_CACHE_ADDRESS_LENGTH - 1] = '\0';
+		entries[kept].expires = now + DNS_CACHE_TTL;
+		kept++;
+		changed = true;
+	}
+	if (changed) {
+		save_dns_cache(entries, kept);
+	}
+
+	curl_slist_free_all(slot->resolve);
+	slot->resolve = NULL;
+}
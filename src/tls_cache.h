@@ -0,0 +1,49 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_TLS_CACHE_H
+#define WIOMW_SUI_TLS_CACHE_H
+
+#include <stdbool.h>
+#include <curl/curl.h>
+
+#define TLS_CACHE_CA_FILE "/etc/ssl/certs/f081611a.0"
+#define TLS_CACHE_HOST_LENGTH 256
+
+struct tls_cache_slot {
+	char host[TLS_CACHE_HOST_LENGTH];
+	long port;
+	bool used_cached_address;
+	struct curl_slist* resolve;
+};
+
+/*
+ * Points curl at the trusted CA, attaches the process-wide share for TLS
+ * sessions and DNS, and seeds the resolver from the tmpfs address cache.
+ * The slot must be handed to tls_cache_finish once the transfer is done.
+ */
+void tls_cache_prepare(CURL* curl, const char* url, struct tls_cache_slot* slot);
+
+/* records (or, on failure, forgets) the address used and releases the slot */
+void tls_cache_finish(CURL* curl, struct tls_cache_slot* slot, bool ok);
+
+#endif
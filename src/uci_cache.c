@@ -0,0 +1,371 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "uci_cache.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/stat.h>
+#include <uci.h>
+
+#define PACKAGE_NAME_LENGTH 64
+
+struct entry {
+	/* point into the same allocation as the entry */
+	char* key;
+	char* values;
+	size_t length;
+	size_t count;
+	bool list;
+};
+
+struct file_stamp {
+	bool exists;
+	ino_t inode;
+	off_t size;
+	struct timespec mtime;
+};
+
+struct snapshot {
+	char name[PACKAGE_NAME_LENGTH];
+	struct file_stamp config;
+	struct file_stamp delta;
+	struct entry** table;
+	size_t capacity;
+};
+
+static struct snapshot snapshots[UCI_CACHE_MAX_PACKAGES];
+static size_t next_eviction = 0;
+
+/* FNV-1a */
+static uint32_t hash(const char* key)
+{
+	uint32_t h = 2166136261u;
+	for (; *key != '\0'; key++) {
+		h = (h ^ (unsigned char)*key) * 16777619u;
+	}
+	return h;
+}
+
+static void stamp(const char* dir, const char* name, struct file_stamp* file)
+{
+	char path[BUFSIZ];
+	struct stat file_stat;
+
+	memset(file, 0x00, sizeof(struct file_stamp));
+	snprintf(path, BUFSIZ, "%s/%s", dir, name);
+	if (stat(path, &file_stat) == 0) {
+		file->exists = true;
+		file->inode = file_stat.st_ino;
+		file->size = file_stat.st_size;
+		file->mtime = file_stat.st_mtim;
+	}
+}
+
+static bool same_stamp(const struct file_stamp* a, const struct file_stamp* b)
+{
+	return a->exists == b->exists && a->inode == b->inode && a->size == b->size
+		&& a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+static void drop(struct snapshot* snapshot)
+{
+	size_t i;
+
+	for (i = 0; i < snapshot->capacity; i++) {
+		free(snapshot->table[i]);
+	}
+	free(snapshot->table);
+	memset(snapshot, 0x00, sizeof(struct snapshot));
+}
+
+static bool insert(struct snapshot* snapshot, const char* key, const struct uci_option* option, const char* type)
+{
+	size_t key_length = strlen(key) + 1;
+	size_t length = 0;
+	size_t count = 0;
+	struct uci_element* e;
+	struct entry* entry;
+	size_t i;
+
+	if (option == NULL) {
+		length = strlen(type) + 1;
+		count = 1;
+	} else if (option->type == UCI_TYPE_STRING) {
+		length = strlen(option->v.string) + 1;
+		count = 1;
+	} else {
+		uci_foreach_element(&(option->v.list), e) {
+			length += strlen(e->name) + 1;
+			count++;
+		}
+	}
+	if ((entry = (struct entry*)malloc(sizeof(struct entry) + key_length + length)) == NULL) {
+		return false;
+	}
+	entry->key = (char*)(entry + 1);
+	entry->values = entry->key + key_length;
+	entry->length = length;
+	entry->count = count;
+	entry->list = (option != NULL && option->type == UCI_TYPE_LIST);
+	memcpy(entry->key, key, key_length);
+	if (option == NULL) {
+		memcpy(entry->values, type, length);
+	} else if (option->type == UCI_TYPE_STRING) {
+		memcpy(entry->values, option->v.string, length);
+	} else {
+		char* value = entry->values;
+		uci_foreach_element(&(option->v.list), e) {
+			value = stpcpy(value, e->name) + 1;
+		}
+	}
+
+	for (i = hash(key) & (snapshot->capacity - 1); snapshot->table[i] != NULL; i = (i + 1) & (snapshot->capacity - 1)) {
+		if (strcmp(snapshot->table[i]->key, key) == 0) {
+			/* a later duplicate wins, just like in UCI */
+			free(snapshot->table[i]);
+			break;
+		}
+	}
+	snapshot->table[i] = entry;
+	return true;
+}
+
+/* every section is indexed under its name and as @type[index] */
+static bool index_section(struct snapshot* snapshot, struct uci_package* package, struct uci_section* section)
+{
+	char names[2][BUFSIZ];
+	char key[BUFSIZ];
+	struct uci_element* e;
+	unsigned int index = 0;
+	int n;
+
+	uci_foreach_element(&(package->sections), e) {
+		if (uci_to_section(e) == section) {
+			break;
+		} else if (strcmp(uci_to_section(e)->type, section->type) == 0) {
+			index++;
+		}
+	}
+	snprintf(names[0], BUFSIZ, "%s", section->e.name);
+	snprintf(names[1], BUFSIZ, "@%s[%u]", section->type, index);
+
+	for (n = 0; n < 2; n++) {
+		if (!insert(snapshot, names[n], NULL, section->type)) {
+			return false;
+		}
+		uci_foreach_element(&(section->options), e) {
+			snprintf(key, BUFSIZ, "%s.%s", names[n], e->name);
+			if (!insert(snapshot, key, uci_to_option(e), NULL)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static enum uci_cache_status load(struct snapshot* snapshot, const char* name)
+{
+	struct uci_context* ctx;
+	struct uci_package* package = NULL;
+	struct uci_element* section;
+	struct uci_element* option;
+	size_t entries = 0;
+	int res;
+
+	if ((ctx = uci_alloc_context()) == NULL) {
+		return UCI_CACHE_ERROR;
+	}
+	/* the times are taken first so that a change while parsing is caught next time */
+	strncpy(snapshot->name, name, PACKAGE_NAME_LENGTH - 1);
+	stamp(UCI_CACHE_CONFIG_DIR, name, &(snapshot->config));
+	stamp(UCI_CACHE_DELTA_DIR, name, &(snapshot->delta));
+	if ((res = uci_load(ctx, name, &package)) != UCI_OK) {
+		uci_free_context(ctx);
+		memset(snapshot, 0x00, sizeof(struct snapshot));
+		if (res == UCI_ERR_NOTFOUND) {
+			return UCI_CACHE_MISSING;
+		}
+		syslog(LOG_ERR, "Unable to load UCI package %s", name);
+		return UCI_CACHE_ERROR;
+	}
+
+	uci_foreach_element(&(package->sections), section) {
+		entries++;
+		uci_foreach_element(&(uci_to_section(section)->options), option) {
+			entries++;
+		}
+	}
+	/* two names for everything, at most half full */
+	snapshot->capacity = 16;
+	while (snapshot->capacity < entries * 4) {
+		snapshot->capacity *= 2;
+	}
+	if ((snapshot->table = (struct entry**)calloc(snapshot->capacity, sizeof(struct entry*))) == NULL) {
+		uci_free_context(ctx);
+		memset(snapshot, 0x00, sizeof(struct snapshot));
+		syslog(LOG_EMERG, "Unable to allocate memory");
+		return UCI_CACHE_ERROR;
+	}
+	uci_foreach_element(&(package->sections), section) {
+		if (!index_section(snapshot, package, uci_to_section(section))) {
+			uci_free_context(ctx);
+			drop(snapshot);
+			syslog(LOG_EMERG, "Unable to allocate memory");
+			return UCI_CACHE_ERROR;
+		}
+	}
+	uci_free_context(ctx);
+	return UCI_CACHE_FOUND;
+}
+
+static struct snapshot* find_snapshot(const char* name)
+{
+	size_t i;
+
+	for (i = 0; i < UCI_CACHE_MAX_PACKAGES; i++) {
+		if (snapshots[i].table != NULL && strcmp(snapshots[i].name, name) == 0) {
+			return &(snapshots[i]);
+		}
+	}
+	return NULL;
+}
+
+static enum uci_cache_status lookup(const char* path, const struct entry** found)
+{
+	char name[PACKAGE_NAME_LENGTH];
+	const char* key = strchr(path, '.');
+	struct snapshot* snapshot;
+	struct file_stamp config;
+	struct file_stamp delta;
+	enum uci_cache_status status;
+	size_t i;
+
+	if (key == NULL || key == path || (size_t)(key - path) >= PACKAGE_NAME_LENGTH) {
+		return UCI_CACHE_ERROR;
+	}
+	memcpy(name, path, key - path);
+	name[key - path] = '\0';
+	key++;
+
+	stamp(UCI_CACHE_CONFIG_DIR, name, &config);
+	stamp(UCI_CACHE_DELTA_DIR, name, &delta);
+	if ((snapshot = find_snapshot(name)) != NULL
+			&& (!same_stamp(&config, &(snapshot->config)) || !same_stamp(&delta, &(snapshot->delta)))) {
+		drop(snapshot);
+		snapshot = NULL;
+	}
+	if (snapshot == NULL) {
+		for (i = 0; i < UCI_CACHE_MAX_PACKAGES && snapshots[i].table != NULL; i++) {
+			/* looking for a free slot */
+		}
+		if (i == UCI_CACHE_MAX_PACKAGES) {
+			i = next_eviction;
+			next_eviction = (next_eviction + 1) % UCI_CACHE_MAX_PACKAGES;
+			drop(&(snapshots[i]));
+		}
+		snapshot = &(snapshots[i]);
+		if ((status = load(snapshot, name)) != UCI_CACHE_FOUND) {
+			return status;
+		}
+	}
+
+	for (i = hash(key) & (snapshot->capacity - 1); snapshot->table[i] != NULL; i = (i + 1) & (snapshot->capacity - 1)) {
+		if (strcmp(snapshot->table[i]->key, key) == 0) {
+			*found = snapshot->table[i];
+			return UCI_CACHE_FOUND;
+		}
+	}
+	return UCI_CACHE_MISSING;
+}
+
+enum uci_cache_status uci_cache_string(const char* path, char* value, size_t len)
+{
+	const struct entry* entry;
+	enum uci_cache_status status;
+
+	if ((status = lookup(path, &entry)) != UCI_CACHE_FOUND) {
+		return status;
+	} else if (entry->list) {
+		return UCI_CACHE_MISSING;
+	}
+	strncpy(value, entry->values, len - 1);
+	value[len - 1] = '\0';
+	return UCI_CACHE_FOUND;
+}
+
+enum uci_cache_status uci_cache_list(const char* path, char* values, size_t len, size_t* count)
+{
+	const struct entry* entry;
+	enum uci_cache_status status;
+
+	*count = 0;
+	if ((status = lookup(path, &entry)) != UCI_CACHE_FOUND) {
+		return status;
+	} else if (entry->length > len) {
+		return UCI_CACHE_ERROR;
+	}
+	memcpy(values, entry->values, entry->length);
+	*count = entry->count;
+	return UCI_CACHE_FOUND;
+}
+
+enum uci_cache_status uci_cache_int(const char* path, int* value)
+{
+	const struct entry* entry;
+	enum uci_cache_status status;
+	char* end;
+	long number;
+
+	if ((status = lookup(path, &entry)) != UCI_CACHE_FOUND) {
+		return status;
+	}
+	errno = 0;
+	number = strtol(entry->values, &end, 10);
+	if (entry->list || end == entry->values || *end != '\0' || errno != 0) {
+		return UCI_CACHE_MISSING;
+	}
+	*value = (int)number;
+	return UCI_CACHE_FOUND;
+}
+
+enum uci_cache_status uci_cache_exists(const char* path)
+{
+	const struct entry* entry;
+
+	return lookup(path, &entry);
+}
+
+void uci_cache_invalidate(const char* package)
+{
+	struct snapshot* snapshot;
+
+	if ((snapshot = find_snapshot(package)) != NULL) {
+		drop(snapshot);
+	}
+}
@@ -0,0 +1,59 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_UCI_CACHE_H
+#define WIOMW_SUI_UCI_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define UCI_CACHE_CONFIG_DIR "/etc/config"
+#define UCI_CACHE_DELTA_DIR "/tmp/.uci"
+#define UCI_CACHE_MAX_PACKAGES 8
+
+enum uci_cache_status {
+	UCI_CACHE_FOUND = 0,
+	UCI_CACHE_MISSING,
+	UCI_CACHE_ERROR
+};
+
+/*
+ * Reads go through a snapshot of each package that is kept for the life of
+ * the process and parsed again only once the package file or its saved
+ * changes in UCI_CACHE_DELTA_DIR have been touched. Paths look like
+ * "network.lan.ipaddr" or "wireless.@wifi-iface[0].ssid"; a path without an
+ * option names a section, whose value is its type.
+ */
+enum uci_cache_status uci_cache_string(const char* path, char* value, size_t len);
+
+/* a plain option reads as a list of one; values follow each other, each ending in '\0' */
+enum uci_cache_status uci_cache_list(const char* path, char* values, size_t len, size_t* count);
+
+/* value is left alone unless the option is there and is a number */
+enum uci_cache_status uci_cache_int(const char* path, int* value);
+
+enum uci_cache_status uci_cache_exists(const char* path);
+
+/* for writers that cannot rely on the file times alone, which may only count seconds */
+void uci_cache_invalidate(const char* package);
+
+#endif
@@ -0,0 +1,269 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include "uci_txn.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <uci.h>
+
+#include "apply.h"
+#include "uci_cache.h"
+
+enum uci_txn_op_type {
+	UCI_TXN_SET,
+	UCI_TXN_DELETE,
+	UCI_TXN_SET_LIST
+};
+
+struct uci_txn_op {
+	struct uci_txn_op* next;
+	enum uci_txn_op_type type;
+	/* point into the same allocation as the op */
+	char* path;
+	char* values;
+	size_t count;
+	/* set by uci_txn_commit once the change has been applied */
+	bool changed;
+};
+
+static void stage(struct uci_txn* txn, enum uci_txn_op_type type, const char* path, const char* values, size_t values_length, size_t count)
+{
+	size_t path_length = strlen(path) + 1;
+	struct uci_txn_op* op;
+
+	if (txn->failed) {
+		return;
+	} else if ((op = (struct uci_txn_op*)malloc(sizeof(struct uci_txn_op) + path_length + values_length)) == NULL) {
+		txn->failed = true;
+		return;
+	}
+	op->next = NULL;
+	op->type = type;
+	op->path = (char*)(op + 1);
+	op->values = op->path + path_length;
+	op->count = count;
+	op->changed = false;
+	memcpy(op->path, path, path_length);
+	memcpy(op->values, values, values_length);
+
+	if (txn->last == NULL) {
+		txn->first = op;
+	} else {
+		txn->last->next = op;
+	}
+	txn->last = op;
+}
+
+/* buffer has to outlive ptr, which points into it */
+static bool lookup(struct uci_context* ctx, const char* path, struct uci_ptr* ptr, char buffer[BUFSIZ])
+{
+	if (strnlen(path, BUFSIZ) >= BUFSIZ) {
+		return false;
+	}
+	strcpy(buffer, path);
+	return uci_lookup_ptr(ctx, ptr, buffer, true) == UCI_OK;
+}
+
+static bool already_set(const struct uci_ptr* ptr, const char* value)
+{
+	if ((ptr->flags & UCI_LOOKUP_COMPLETE) == 0) {
+		return false;
+	} else if (ptr->option == NULL) {
+		return ptr->s != NULL && strcmp(ptr->s->type, value) == 0;
+	} else {
+		return ptr->o != NULL && ptr->o->type == UCI_TYPE_STRING && strcmp(ptr->o->v.string, value) == 0;
+	}
+}
+
+static bool already_listed(const struct uci_ptr* ptr, const char* values, size_t count)
+{
+	struct uci_element* e;
+	size_t i = 0;
+
+	if ((ptr->flags & UCI_LOOKUP_COMPLETE) == 0 || ptr->o == NULL) {
+		return count == 0;
+	} else if (ptr->o->type != UCI_TYPE_LIST) {
+		return false;
+	}
+	uci_foreach_element(&(ptr->o->v.list), e) {
+		if (i == count || strcmp(e->name, values) != 0) {
+			return false;
+		}
+		values += strlen(values) + 1;
+		i++;
+	}
+	return i == count;
+}
+
+/* returns false on failure; changed is set only if UCI now holds something else */
+static bool apply(struct uci_context* ctx, const struct uci_txn_op* op, struct uci_package** package, bool* changed)
+{
+	char buffer[BUFSIZ];
+	struct uci_ptr ptr;
+	const char* value = op->values;
+	size_t i;
+
+	*changed = false;
+	if (!lookup(ctx, op->path, &ptr, buffer)) {
+		return false;
+	}
+	*package = ptr.p;
+
+	switch (op->type) {
+	case UCI_TXN_SET:
+		if (already_set(&ptr, op->values)) {
+			return true;
+		}
+		ptr.value = op->values;
+		*changed = true;
+		return uci_set(ctx, &ptr) == UCI_OK;
+	case UCI_TXN_DELETE:
+		if ((ptr.flags & UCI_LOOKUP_COMPLETE) == 0) {
+			return true;
+		}
+		*changed = true;
+		return uci_delete(ctx, &ptr) == UCI_OK;
+	case UCI_TXN_SET_LIST:
+		if (already_listed(&ptr, op->values, op->count)) {
+			return true;
+		}
+		*changed = true;
+		if ((ptr.flags & UCI_LOOKUP_COMPLETE) != 0 && uci_delete(ctx, &ptr) != UCI_OK) {
+			return false;
+		}
+		for (i = 0; i < op->count; i++) {
+			if (!lookup(ctx, op->path, &ptr, buffer)) {
+				return false;
+			}
+			ptr.value = value;
+			if (uci_add_list(ctx, &ptr) != UCI_OK) {
+				return false;
+			}
+			value += strlen(value) + 1;
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+void uci_txn_begin(struct uci_txn* txn, struct uci_context* ctx)
+{
+	memset(txn, 0x00, sizeof(struct uci_txn));
+	txn->ctx = ctx;
+}
+
+void uci_txn_set(struct uci_txn* txn, const char* path, const char* value)
+{
+	stage(txn, UCI_TXN_SET, path, value, strlen(value) + 1, 1);
+}
+
+void uci_txn_delete(struct uci_txn* txn, const char* path)
+{
+	stage(txn, UCI_TXN_DELETE, path, "", 1, 0);
+}
+
+void uci_txn_set_list(struct uci_txn* txn, const char* path, const char* values, size_t count)
+{
+	size_t length = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		length += strlen(values + length) + 1;
+	}
+	stage(txn, UCI_TXN_SET_LIST, path, values, length, count);
+}
+
+bool uci_txn_commit(struct uci_txn* txn)
+{
+	struct uci_package* packages[UCI_TXN_MAX_PACKAGES];
+	size_t package_count = 0;
+	struct uci_txn_op* op;
+	bool ok = !txn->failed;
+	size_t i;
+
+	txn->changed = false;
+	for (op = txn->first; ok && op != NULL; op = op->next) {
+		struct uci_package* package = NULL;
+		bool changed = false;
+		if (!apply(txn->ctx, op, &package, &changed)) {
+			syslog(LOG_ERR, "Unable to change %s in UCI", op->path);
+			ok = false;
+		} else if (changed) {
+			op->changed = true;
+			txn->changed = true;
+			for (i = 0; i < package_count && packages[i] != package; i++) {
+				/* already touched */
+			}
+			if (i == package_count && package_count < UCI_TXN_MAX_PACKAGES) {
+				packages[package_count++] = package;
+			} else if (i == package_count) {
+				syslog(LOG_ERR, "Too many UCI packages in one transaction");
+				ok = false;
+			}
+		}
+	}
+	if (txn->failed) {
+		syslog(LOG_ERR, "Unable to allocate memory for UCI changes");
+	}
+
+	for (i = 0; ok && i < package_count; i++) {
+		char name[BUFSIZ];
+		strncpy(name, packages[i]->e.name, BUFSIZ - 1);
+		name[BUFSIZ - 1] = '\0';
+		if (uci_save(txn->ctx, packages[i]) != UCI_OK
+				|| uci_commit(txn->ctx, &(packages[i]), false) != UCI_OK) {
+			syslog(LOG_ERR, "Unable to commit UCI changes");
+			ok = false;
+		}
+		uci_cache_invalidate(name);
+	}
+
+	/* only what really reached the files needs applying */
+	for (op = txn->first; ok && op != NULL; op = op->next) {
+		if (op->changed) {
+			apply_record(op->path);
+		}
+	}
+
+	uci_txn_discard(txn);
+	return ok;
+}
+
+void uci_txn_discard(struct uci_txn* txn)
+{
+	struct uci_txn_op* op = txn->first;
+
+	while (op != NULL) {
+		struct uci_txn_op* next = op->next;
+		free(op);
+		op = next;
+	}
+	txn->first = NULL;
+	txn->last = NULL;
+	txn->failed = false;
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#ifndef WIOMW_SUI_UCI_TXN_H
+#define WIOMW_SUI_UCI_TXN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <uci.h>
+
+#define UCI_TXN_MAX_PACKAGES 8
+
+struct uci_txn_op;
+
+/*
+ * Changes staged against one UCI context. Nothing is looked up or written
+ * until uci_txn_commit, which skips every change that would leave a value
+ * as it already is, then saves and commits each touched package once.
+ */
+struct uci_txn {
+	struct uci_context* ctx;
+	struct uci_txn_op* first;
+	struct uci_txn_op* last;
+	/* staging ran out of memory, so the commit will fail */
+	bool failed;
+	/* set by uci_txn_commit if any value was really different */
+	bool changed;
+};
+
+void uci_txn_begin(struct uci_txn* txn, struct uci_context* ctx);
+
+/* path names an option, or a section whose type is then value */
+void uci_txn_set(struct uci_txn* txn, const char* path, const char* value);
+
+/* deleting something that is not there is not a change */
+void uci_txn_delete(struct uci_txn* txn, const char* path);
+
+/*
+ * Replaces the list at path with count values that follow each other in
+ * values, each ending in '\0'. A count of 0 deletes the list.
+ */
+void uci_txn_set_list(struct uci_txn* txn, const char* path, const char* values, size_t count);
+
+/*
+ * Applies the staged changes in order and writes out the packages they
+ * touched. Returns false if anything could not be applied or written; the
+ * staged changes are released either way.
+ */
+bool uci_txn_commit(struct uci_txn* txn);
+
+/* releases the staged changes without applying them */
+void uci_txn_discard(struct uci_txn* txn);
+
+#endif
@@ -26,18 +26,34 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <linux/fs.h>
 #include <curl/curl.h>
 #include <yajl/yajl_tree.h>
-#include <uci.h>
 #include <polarssl/md5.h>
 
+#include "delta.h"
+#include "digest.h"
+#include "download.h"
+#include "http_client.h"
+#include "latest.h"
+#include "prefetch.h"
+#include "preflight.h"
+#include "run.h"
+#include "single_flight.h"
+#include "stream.h"
+#include "uci_cache.h"
 #include "version.h"
 #include "xsrf.h"
 
@@ -45,155 +61,187 @@
 
 #define BASE_URL "https://www.whoisonmywifi.net/hw/"
 #define LATEST_JSON_URL BASE_URL "latest.json"
-#define CA_FILE "/etc/ssl/certs/f081611a.0"
-#define UPGRADE_FILE "/tmp/sysupgrade.bin"
-#define UPGRADE_LOG_FILE "/tmp/sysupgrade.log"
+#define UPGRADE_DIR "/tmp"
+#define UPGRADE_FILE UPGRADE_DIR "/sysupgrade.bin"
+#define UPGRADE_LOG_FILE STREAM_LOG_FILE
 #define REBOOT_DELAY "30"
+/* long enough for the answer to reach the client before sysupgrade stops the web server */
+#define SYSUPGRADE_START_DELAY_SECONDS 3
 #define POLL_DELAY "45"
-#define JSON_ERROR_BUFFER_LEN 1024
-#define MINIMUM_EXTRA_MEMORY 2097152
+#define UPDATE_FILE_TIMEOUT_MS 900000
+#define UPDATE_FILE_ATTEMPTS 5
+#define UPDATE_FILE_RETRY_DELAY_MS 2000
+#define UPDATE_LOG_CHUNK_LENGTH 65536
+#define UPDATE_LOG_MAX_WAIT_SECONDS 25
+#define UPDATE_LOG_POLL_MS 250
 
-#define FREE_COMMAND "free | awk '$1 == \"Mem:\" {print $4;}'"
-#define MD5_COMMAND "md5sum " UPGRADE_FILE
-#define SYSUPGRADE_COMMAND "sleep 3 && sysupgrade -v -d " REBOOT_DELAY " " UPGRADE_FILE " >> " UPGRADE_LOG_FILE " 2>> " UPGRADE_LOG_FILE " & "
+#define SYSUPGRADE_PATH "/sbin/sysupgrade"
+#define UPDATE_FLIGHT_KEY "update"
+#define UPDATE_FLIGHT_WAIT_MS 30000
 
-struct data_holder {
-	size_t offset;
-	char data[];
-};
-
-static size_t latest_json_cb(void* buffer, size_t size, size_t nmemb, void* raw_holder)
+static yajl_val get_latest(const char* sui_model, struct xsrft* token)
 {
-	size_t count = 0;
-	struct data_holder* holder;
-
-	if (raw_holder == NULL) {
-		return 0;
-	}
-
-	if (*(void**)raw_holder == NULL) {
-		*(void**)raw_holder = malloc(sizeof(struct data_holder) + (size * nmemb) + 1);
-		(*(struct data_holder**)raw_holder)->offset = 0;
-	} else {
-		*(void**)raw_holder = realloc(*(void**)raw_holder, sizeof(struct data_holder) + (*(struct data_holder**)raw_holder)->offset + (size * nmemb) + 1);
-	}
-	holder = *(struct data_holder**)raw_holder;
-	if (holder == NULL) {
-		return 0;
-	}
-
-	for (count = 0; count < nmemb; count++) {
-		memcpy(holder->data + holder->offset, (char*)buffer + (count * size), size);
-		holder->offset += size;
-	}
-	holder->data[holder->offset] = '\0';
-
-	return count * size;
-}
+	struct http_response response;
+	yajl_val latest_yajl = NULL;
 
-static struct data_holder*  get_latest_json(struct xsrft* token)
-{
-	CURL* curl_handle = curl_easy_init();
-	struct data_holder* holder = NULL;
-	char error_buffer[BUFSIZ];
-	long http_code = 0;
-
-	curl_easy_setopt(curl_handle, CURLOPT_URL, LATEST_JSON_URL);
-	curl_easy_setopt(curl_handle, CURLOPT_CAINFO, CA_FILE);
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, &latest_json_cb);
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &holder);
-	curl_easy_setopt(curl_handle, CURLOPT_ERRORBUFFER, error_buffer);
-
-	if (curl_easy_perform(curl_handle) == 0 && curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &http_code) == 0) {
-		if (holder == NULL) {
-			curl_easy_cleanup(curl_handle);
-			free(holder);
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"The router is out of memory and needs to be restarted immediately.\"]}", token->val);
-			syslog(LOG_EMERG, "Unable to allocate memory");
-			return NULL;
-		} else if (http_code >= 400) {
-			curl_easy_cleanup(curl_handle);
-			free(holder);
-			printf("Status: 500 Internal Server Error\n");
+	switch (latest_get(LATEST_JSON_URL, sui_model, &latest_yajl, &response)) {
+	case LATEST_OK:
+		return latest_yajl;
+	case LATEST_NO_MEMORY:
+		printf("Status: 500 Internal Server Error\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"xsrf\":\"%s\",\"errors\":[\"The router is out of memory and needs to be restarted immediately.\"]}", token->val);
+		syslog(LOG_EMERG, "Unable to allocate memory");
+		return NULL;
+	case LATEST_UNPARSABLE:
+		/* the reason has already been logged */
+		printf("Status: 500 Internal Server Error\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading update information from server.\"]}", token->val);
+		return NULL;
+	case LATEST_NO_MODEL:
+		printf("Status: 500 Internal Server Error\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading update version number for device.\"]}", token->val);
+		syslog(LOG_ERR, "Unable to find %s in latest.json.", sui_model);
+		return NULL;
+	default:
+		if (response.retry_after_ms != 0) {
+			long retry_after = (response.retry_after_ms + 999) / 1000;
+			printf("Status: 503 Service Unavailable\n");
+			printf("Retry-After: %ld\n", retry_after);
 			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while contacting update server.\"]}", token->val);
-			syslog(LOG_WARNING, "Unable to get latest.json, got HTTP code: %lu", http_code);
+			printf("{\"xsrf\":\"%s\",\"errors\":[\"The update server is not answering. Please try again in %ld seconds.\"],\"retry_after\":%ld}", token->val, retry_after, retry_after);
 			return NULL;
-		} else {
-			curl_easy_cleanup(curl_handle);
-			return holder;
 		}
-	} else {
-		/* curl failure (probably network failure) */
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while contacting update server.\"]}", token->val);
-		syslog(LOG_ERR, "Unable to connect to update server: %s", error_buffer);
-		curl_easy_cleanup(curl_handle);
+		if (response.overflowed || response.http_code >= 400) {
+			syslog(LOG_WARNING, "Unable to get latest.json, got HTTP code: %lu", response.http_code);
+		} else {
+			/* curl failure (probably network failure) */
+			syslog(LOG_ERR, "Unable to connect to update server: %s", response.error);
+		}
 		return NULL;
 	}
 }
 
-const char* get_update_file(const char* url)
+/* a persistent process keeps the log open between polls */
+static int update_log_fd = -1;
+
+static void close_update_log()
 {
-	CURL* curl_handle = curl_easy_init();
-	char error_buffer[BUFSIZ];
-	FILE* update_file;
-	long http_code = 0;
-	char full_url[BUFSIZ];
+	if (update_log_fd != -1) {
+		close(update_log_fd);
+		update_log_fd = -1;
+	}
+}
+
+/* returns the open log, reopened if the file has been replaced since, or -1 */
+static int open_update_log(struct stat* log_stat)
+{
+	struct stat path_stat;
 
-	if ((update_file = fopen(UPGRADE_FILE, "w")) == NULL) {
-		syslog(LOG_ERR, "Unable to open update file for writing: %s", strerror(errno));
-		return "Error while preparing update file.";
+	if (stat(UPGRADE_LOG_FILE, &path_stat) != 0) {
+		close_update_log();
+		return -1;
 	}
+	if (update_log_fd != -1 && (fstat(update_log_fd, log_stat) != 0
+			|| log_stat->st_ino != path_stat.st_ino || log_stat->st_dev != path_stat.st_dev)) {
+		close_update_log();
+	}
+	if (update_log_fd == -1 && (update_log_fd = open(UPGRADE_LOG_FILE, O_RDONLY | O_CLOEXEC)) == -1) {
+		return -1;
+	}
+	if (fstat(update_log_fd, log_stat) != 0) {
+		close_update_log();
+		return -1;
+	}
+	return update_log_fd;
+}
 
-	snprintf(full_url, BUFSIZ, BASE_URL "%s", url);
+/*
+ * Waits until the log grows past offset or is replaced. inotify only makes
+ * the wait end sooner; without it the log is simply checked every so often.
+ */
+static void wait_for_update_log(long long offset, ino_t inode, unsigned int seconds)
+{
+	struct stat log_stat;
+	struct pollfd watch;
+	time_t deadline = time(NULL) + seconds;
+	char events[BUFSIZ];
 
-	curl_easy_setopt(curl_handle, CURLOPT_URL, full_url);
-	curl_easy_setopt(curl_handle, CURLOPT_CAINFO, CA_FILE);
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, update_file);
-	curl_easy_setopt(curl_handle, CURLOPT_ERRORBUFFER, error_buffer);
-
-	if (curl_easy_perform(curl_handle) == 0 && curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &http_code) == 0) {
-		if (http_code >= 400) {
-			curl_easy_cleanup(curl_handle);
-			syslog(LOG_WARNING, "Unable to get update file, got HTTP code: %lu", http_code);
-			fclose(update_file);
-			return "Error while contacting update server.";
-		} else {
-			curl_easy_cleanup(curl_handle);
-			fclose(update_file);
-			return NULL;
+	watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	watch.events = POLLIN;
+	if (watch.fd != -1 && inotify_add_watch(watch.fd, UPGRADE_LOG_FILE, IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF) == -1) {
+		close(watch.fd);
+		watch.fd = -1;
+	}
+	while (time(NULL) < deadline
+			&& stat(UPGRADE_LOG_FILE, &log_stat) == 0
+			&& log_stat.st_ino == inode && log_stat.st_size <= offset) {
+		poll(&watch, (watch.fd == -1) ? 0 : 1, UPDATE_LOG_POLL_MS);
+		if (watch.fd != -1) {
+			while (read(watch.fd, events, BUFSIZ) > 0) {
+				/* only the wakeup matters */
+			}
 		}
-	} else {
-		/* curl failure (probably network failure) */
-		syslog(LOG_ERR, "Unable to connect to update server: %s", error_buffer);
-		curl_easy_cleanup(curl_handle);
-		fclose(update_file);
-		return "Error while contacting update server.";
+	}
+	if (watch.fd != -1) {
+		close(watch.fd);
 	}
 }
 
-void post_update(yajl_val api_yajl, struct xsrft* token)
+static void update_job(struct download_job* job, char full_url[BUFSIZ], const char* url, long long size, const char* md5)
+{
+	snprintf(full_url, BUFSIZ, BASE_URL "%s", url);
+
+	memset(job, 0x00, sizeof(struct download_job));
+	job->url = full_url;
+	job->path = UPGRADE_FILE;
+	job->size = size;
+	job->md5 = md5;
+	job->attempts = UPDATE_FILE_ATTEMPTS;
+	job->timeout_ms = UPDATE_FILE_TIMEOUT_MS;
+	job->retry_delay_ms = UPDATE_FILE_RETRY_DELAY_MS;
+}
+
+/* a delta from the running version, if latest.json offers one */
+static bool update_delta(yajl_val latest_yajl, struct delta_job* delta, char delta_url[BUFSIZ])
+{
+	const char* delta_url_path[] = {"delta", FULL_VERSION, "url", (const char*)0};
+	const char* delta_size_path[] = {"delta", FULL_VERSION, "size", (const char*)0};
+	yajl_val delta_url_yajl = yajl_tree_get(latest_yajl, delta_url_path, yajl_t_string);
+	yajl_val delta_size_yajl = yajl_tree_get(latest_yajl, delta_size_path, yajl_t_number);
+
+	if (delta_url_yajl == NULL || delta_size_yajl == NULL || !YAJL_IS_INTEGER(delta_size_yajl)) {
+		return false;
+	}
+	snprintf(delta_url, BUFSIZ, BASE_URL "%s", YAJL_GET_STRING(delta_url_yajl));
+
+	memset(delta, 0x00, sizeof(struct delta_job));
+	delta->url = delta_url;
+	delta->size = YAJL_GET_INTEGER(delta_size_yajl);
+	return true;
+}
+
+static bool update_resumable(const char* url, long long size, const char* md5)
+{
+	struct download_job job;
+	char full_url[BUFSIZ];
+
+	update_job(&job, full_url, url, size, md5);
+	return download_resumable(&job);
+}
+
+static void update(yajl_val api_yajl, struct xsrft* token)
 {
-	struct uci_context* ctx;
-	struct uci_ptr ptr;
-	int res = 0;
-	char uci_lookup_str[BUFSIZ];
 	char sui_model[BUFSIZ];
-	struct data_holder* holder = NULL;
 	yajl_val latest_yajl = NULL;
 	yajl_val latest_version_yajl = NULL;
-	char errbuff[JSON_ERROR_BUFFER_LEN];
-	ctx = uci_alloc_context();
 
-	strncpy(uci_lookup_str, SUI_MODEL_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK
-			&& (ptr.flags & UCI_LOOKUP_COMPLETE) != 0) {
-		strncpy(sui_model, ptr.o->v.string, BUFSIZ);
-	} else {
+	if (uci_cache_string(SUI_MODEL_PATH, sui_model, BUFSIZ) != UCI_CACHE_FOUND) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to determine router model.\"]}", token->val);
@@ -202,26 +250,18 @@ void post_update(yajl_val api_yajl, struct xsrft* token)
 	}
 
 	/* const char* device_path[] = {JSON_DEVICE_NAME, (const char*)0}; */
-	const char* latest_version_path[] = {sui_model, "version", (const char*)0};
+	const char* latest_version_path[] = {"version", (const char*)0};
 
-	if ((holder = get_latest_json(token)) == NULL) {
+	/* latest_yajl is this model's entry, and belongs to the latest module */
+	if ((latest_yajl = get_latest(sui_model, token)) == NULL) {
 		/* error getting latest.json (error message has already been sent via cgi). */
 		return;
-	} else if ((latest_yajl = yajl_tree_parse(holder->data, errbuff, JSON_ERROR_BUFFER_LEN)) == NULL || !YAJL_IS_OBJECT(latest_yajl)) {
-		/* unable to parse latest.json */
-		printf("Status: 500 Internal Server Error\n");
-		printf("Content-type: application/json\n\n");
-		printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading update information from server.\"]}", token->val);
-		syslog(LOG_ERR, "Unable to parse latest.json: %s", errbuff);
-		free(holder);
-		return;
 	} else if ((latest_version_yajl = yajl_tree_get(latest_yajl, latest_version_path, yajl_t_string)) == NULL) {
 		/* no/invalid update version in latest.json */
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading update version number for device.\"]}", token->val);
 		syslog(LOG_ERR, "Unable to retrieve update version number from latest.json.");
-		free(holder);
 		return;
 	} else if (version_compare(YAJL_GET_STRING(latest_version_yajl)) > 0) {
 		/* update available */
@@ -231,9 +271,9 @@ void post_update(yajl_val api_yajl, struct xsrft* token)
 		yajl_val api_version_yajl = NULL;
 		yajl_val api_size_yajl = NULL;
 		yajl_val api_md5_yajl = NULL;
-		const char* latest_size_path[] = {sui_model, "size", (const char*)0};
-		const char* latest_url_path[] = {sui_model, "url", (const char*)0};
-		const char* latest_md5_path[] = {sui_model, "md5", (const char*)0};
+		const char* latest_size_path[] = {"size", (const char*)0};
+		const char* latest_url_path[] = {"url", (const char*)0};
+		const char* latest_md5_path[] = {"md5", (const char*)0};
 		const char* api_version_path[] = {"version", (const char*)0};
 		const char* api_size_path[] = {"size", (const char*)0};
 		const char* api_md5_path[] = {"md5", (const char*)0};
@@ -245,7 +285,6 @@ void post_update(yajl_val api_yajl, struct xsrft* token)
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading update file information.\"]}", token->val);
 			syslog(LOG_ERR, "Unable to retrieve update file info from latest.json.");
-			free(holder);
 			return;
 		}
 		if ((api_version_yajl = yajl_tree_get(api_yajl, api_version_path, yajl_t_string)) != NULL) {
@@ -261,7 +300,6 @@ void post_update(yajl_val api_yajl, struct xsrft* token)
 				printf("Content-type: application/json\n\n");
 				printf("{\"xsrf\":\"%s\",\"errors\":[\"Version, size (in bytes, as a number), and md5 must be supplied before an update will be applied.\"],", token->val);
 				printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-				free(holder);
 				return;
 			} else if ((latest_version_val = YAJL_GET_STRING(latest_version_yajl)) == NULL
 					|| (api_version_val = YAJL_GET_STRING(api_version_yajl)) == NULL
@@ -275,21 +313,31 @@ void post_update(yajl_val api_yajl, struct xsrft* token)
 				printf("Content-type: application/json\n\n");
 				printf("{\"xsrf\":\"%s\",\"errors\":[\"The version, size, and md5 supplied did not match the corresponding values that were expected.\"],", token->val);
 				printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-				free(holder);
 				return;
 			}
 		}
 		struct stat stat_res;
-		/*unsigned char raw_hash[16];*/
-		char hash[33];
-		FILE* command_output;
+		struct digest_result digest_result;
+		struct prefetch_status download;
+		bool staged = false;
 		char* latest_md5_val = NULL;
+		const char* latest_sha256_path[] = {"sha256", (const char*)0};
+		yajl_val latest_sha256_yajl = yajl_tree_get(latest_yajl, latest_sha256_path, yajl_t_string);
+		const char* latest_sha256_val = (latest_sha256_yajl != NULL) ? YAJL_GET_STRING(latest_sha256_yajl) : NULL;
 		if ((latest_md5_val = YAJL_GET_STRING(latest_md5_yajl)) == NULL) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading update information from server.\"]}", token->val);
 			syslog(LOG_ERR, "Received empty MD5 from latest.json");
-			free(holder);
+			return;
+		} else if (prefetch_running()) {
+			/* leave the file alone until the worker is done with it */
+			prefetch_read(&download);
+			printf("Status: 202 Accepted\n");
+			printf("Content-type: application/json\n\n");
+			printf("{\"xsrf\":\"%s\",", token->val);
+			prefetch_print(&download);
+			printf(",\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"%s\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl), download.stream ? "streaming" : "downloading");
 			return;
 		} else if (stat(UPGRADE_FILE, &stat_res) != 0) {
 			/* issue reading old update file (it probably hasn't been downloaded yet, which is normal) */
@@ -301,12 +349,15 @@ void post_update(yajl_val api_yajl, struct xsrft* token)
 				printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading the downloaded update file.\"],", token->val);
 				printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
 				syslog(LOG_ERR, "Unable to stat the old update file: %s", strerror(my_errno));
-				free(holder);
 				return;
 			}
+		} else if (stat_res.st_size != YAJL_GET_INTEGER(latest_size_yajl)
+				&& update_resumable(YAJL_GET_STRING(latest_url_yajl), YAJL_GET_INTEGER(latest_size_yajl), latest_md5_val)) {
+			/* an interrupted download of this very update, which is picked up below */
 		} else if (stat_res.st_size != YAJL_GET_INTEGER(latest_size_yajl)) {
 			/* old update file was wrong size, so it should be removed and replaced */
 			syslog(LOG_WARNING, "Size of previously downloaded update file is wrong, deleting it.");
+			download_discard(UPGRADE_FILE);
 			if (remove(UPGRADE_FILE) != 0) {
 				/* unable to remove old update file */
 				int my_errno = errno;
@@ -315,30 +366,19 @@ void post_update(yajl_val api_yajl, struct xsrft* token)
 				printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading the downloaded update file.\"],", token->val);
 				printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
 				syslog(LOG_ERR, "Unable to remove the old incorrect size update file: %s", strerror(my_errno));
-				free(holder);
 				return;
 			}
-		} else if ((command_output = popen(MD5_COMMAND, "r")) == NULL) {
-			/* unable to get md5 of old update file */
+		} else if (!(staged = prefetch_staged(UPGRADE_FILE, YAJL_GET_INTEGER(latest_size_yajl), latest_md5_val))
+				&& !digest_file(UPGRADE_FILE, &digest_result)) {
+			/* unable to hash old update file */
 			int my_errno = errno;
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading the downloaded update file.\"],", token->val);
 			printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			syslog(LOG_ERR, "Unable to md5 the old update file: %s", strerror(my_errno));
-			free(holder);
+			syslog(LOG_ERR, "Unable to hash the old update file: %s", strerror(my_errno));
 			return;
-		} else if (fgets(hash, 33, command_output) == NULL) {
-			/* unable to reformat md5 (very weird) */
-			int my_errno = errno;
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading the downloaded update file.\"],", token->val);
-			printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			syslog(LOG_ERR, "Unable to parse raw md5 of the old update file: %s", strerror(my_errno));
-			free(holder);
-			return;
-		} else if (strcmp(latest_md5_val, hash) != 0) {
+		} else if (!staged && !digest_matches(&digest_result, latest_md5_val, latest_sha256_val)) {
 			/* old update file has wrong md5, so it should be removed and replaced */
 			syslog(LOG_WARNING, "MD5 of previously downloaded update file is wrong, deleting it.");
 			if (remove(UPGRADE_FILE) != 0) {
@@ -349,28 +389,24 @@ void post_update(yajl_val api_yajl, struct xsrft* token)
 				printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading the downloaded update file.\"],", token->val);
 				printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
 				syslog(LOG_ERR, "Unable to remove the old incorrect md5 update file: %s", strerror(my_errno));
-				free(holder);
 				return;
 			}
 		} else if (api_version_yajl != NULL) {
 			/* old update file is legit and user has authorized upgrade */
-			if (pclose(command_output) != 0 || (command_output = popen(SYSUPGRADE_COMMAND, "r")) == NULL) {	
-				/* unable to open shell */
-				int my_errno = errno;
+			/* sysupgrade checks the image and saves the configuration before it stops anything */
+			const char* sysupgrade_argv[] = {SYSUPGRADE_PATH, "-v", "-d", REBOOT_DELAY, UPGRADE_FILE, NULL};
+			if (!run_detached(sysupgrade_argv, UPGRADE_LOG_FILE, SYSUPGRADE_START_DELAY_SECONDS)) {
+				/* unable to start sysupgrade */
 				printf("Status: 500 Internal Server Error\n");
 				printf("Content-type: application/json\n\n");
 				printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while starting the upgrade.\"],", token->val);
 				printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"ready\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-				syslog(LOG_ERR, "Unable to popen the sysupgrade command: %s", strerror(my_errno));
-				free(holder);
 				return;
 			} else {
 				/* upgrade complete */
 				printf("Status: 200 OK\n");
 				printf("Content-type: application/json\n\n");
 				printf("{\"xsrf\":\"%s\",\"update\":\"complete\",\"rebooting\":true}", token->val);
-				free(holder);
-				pclose(command_output);
 				return;
 			}
 		} else {
@@ -378,112 +414,99 @@ void post_update(yajl_val api_yajl, struct xsrft* token)
 			printf("Status: 200 OK\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"ready\"}", token->val, YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			free(holder);
 			return;
 		}
 		/* new update file should be downloaded */
-		size_t free_mem;
-		const char* curl_error = NULL;
-		if ((command_output = popen(FREE_COMMAND, "r")) == NULL) {
-			/* unable to open a shell */
-			int my_errno = errno;
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while checking for available memory.\"],", token->val);
-			printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			syslog(LOG_ERR, "Unable to popen the free command: %s", strerror(my_errno));
-			free(holder);
-			return;
-		} else if (fscanf(command_output, "%zu", &free_mem) != 1) {
-			/* perhaps didn't get a numeric output from free, more likely had some other problem reading it */
-			int my_errno = errno;
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while checking for available memory.\"],", token->val);
-			printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			syslog(LOG_ERR, "Unexpected results or read error for free command: %s", strerror(my_errno));
-			free(holder);
-			pclose(command_output);
-			return;
-		} else if ((free_mem * 1024) < YAJL_GET_INTEGER(latest_size_yajl) + MINIMUM_EXTRA_MEMORY) {
-			/* insufficient memory to download new update file */
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Insufficient free memory to download update file. Restarting the router will likely solve this problem.\"],", token->val);
-			printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			syslog(LOG_ERR, "Insufficient memory to download the update.");
-			free(holder);
-			pclose(command_output);
-			return;
-		} else if ((curl_error = get_update_file(YAJL_GET_STRING(latest_url_yajl))) != NULL) {
-			/* error during download of new update file */
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"%s\"],", token->val, curl_error);
-			printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			free(holder);
-			pclose(command_output);
-			return;
-		} else if (stat(UPGRADE_FILE, &stat_res) != 0) {
-			/* unable to access new update file */
-			int my_errno = errno;
-			printf("Status: 500 Internal Server Error\n");
+		struct preflight_result preflight;
+		char services[PREFLIGHT_MAX_SERVICES][PREFLIGHT_SERVICE_NAME_LENGTH];
+		struct download_job job;
+		struct delta_job delta;
+		char full_url[BUFSIZ];
+		char delta_url[BUFSIZ];
+		bool use_delta = false;
+		long long still_needed = YAJL_GET_INTEGER(latest_size_yajl);
+		if (stat(UPGRADE_FILE, &stat_res) == 0 && stat_res.st_size < still_needed) {
+			/* a resumable partial already holds part of the image */
+			still_needed -= stat_res.st_size;
+		}
+		update_job(&job, full_url, YAJL_GET_STRING(latest_url_yajl), YAJL_GET_INTEGER(latest_size_yajl), latest_md5_val);
+		/* services are only stopped for the user, never for a mere check */
+		bool room = preflight_check(UPGRADE_DIR, still_needed, (api_version_yajl != NULL) ? PREFLIGHT_RECLAIM_SERVICES : PREFLIGHT_RECLAIM_CACHE, &preflight);
+		if (!room && preflight.verdict == PREFLIGHT_INSUFFICIENT_MEMORY && api_version_yajl == NULL && preflight_list_services(services) > 0) {
+			/* stopping the services in sui.update.stop_service may still make room once the user asks for it */
+			printf("Status: 200 OK\n");
 			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading the downloaded update file.\"],", token->val);
-			printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			syslog(LOG_ERR, "Unable to stat the new update file: %s", strerror(my_errno));
-			free(holder);
-			pclose(command_output);
+			printf("{\"xsrf\":\"%s\",", token->val);
+			preflight_print(&preflight);
+			printf(",\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\",\"stop_services\":true}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
 			return;
-		} else if (stat_res.st_size != YAJL_GET_INTEGER(latest_size_yajl)) {
-			/* new update file was the wrong size */
+		} else if (!room && preflight.verdict == PREFLIGHT_INSUFFICIENT_STORAGE && preflight_memory_holds(&preflight, YAJL_GET_INTEGER(latest_size_yajl)) && stream_supported()) {
+			/* tmpfs is too small for the image but RAM is not, so it is kept on a ramfs of its own and flashed from there */
+			if (api_version_yajl == NULL) {
+				printf("Status: 200 OK\n");
+				printf("Content-type: application/json\n\n");
+				printf("{\"xsrf\":\"%s\",", token->val);
+				preflight_print(&preflight);
+				printf(",\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"ready\",\"stream\":true}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
+				return;
+			}
+			/* a partial image would only be in the way */
+			download_discard(UPGRADE_FILE);
 			remove(UPGRADE_FILE);
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Downloaded update file was the wrong size.\"],", token->val);
-			printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			free(holder);
-			pclose(command_output);
-			return;
-		} else if (pclose(command_output) != 0 || (command_output = popen(MD5_COMMAND, "r")) == NULL) {
-			/* unable to get md5 of new update file */
-			int my_errno = errno;
-			printf("Status: 500 Internal Server Error\n");
+			if (!prefetch_stream(&job, YAJL_GET_STRING(latest_version_yajl), latest_sha256_val, &download)) {
+				printf("Status: 500 Internal Server Error\n");
+				printf("Content-type: application/json\n\n");
+				printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while starting the upgrade.\"],", token->val);
+				prefetch_print(&download);
+				printf(",\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"ready\",\"stream\":true}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
+				return;
+			}
+			/* the worker hands the image to sysupgrade itself once it has been verified */
+			printf("Status: 202 Accepted\n");
 			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading the downloaded update file.\"],", token->val);
-			printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			syslog(LOG_ERR, "Unable to md5 the new update file: %s", strerror(my_errno));
-			free(holder);
-			pclose(command_output);
+			printf("{\"xsrf\":\"%s\",", token->val);
+			preflight_print(&preflight);
+			printf(",");
+			prefetch_print(&download);
+			printf(",\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"streaming\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
 			return;
-		} else if (fgets(hash, 33, command_output) == NULL) {
-			/* unable to reformat md5 (very weird) */
-			int my_errno = errno;
+		} else if (!room) {
+			/* insufficient memory or storage to download new update file, even after reclaiming what we could */
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while reading the downloaded update file.\"],", token->val);
-			printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			syslog(LOG_ERR, "Unable to parse raw md5 of the new update file: %s", strerror(my_errno));
-			free(holder);
-			pclose(command_output);
+			if (preflight.verdict == PREFLIGHT_ERROR) {
+				printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while checking for available memory.\"],", token->val);
+				syslog(LOG_ERR, "Unable to measure available memory or storage.");
+			} else {
+				printf("{\"xsrf\":\"%s\",\"errors\":[\"Insufficient free memory to download update file. Restarting the router will likely solve this problem.\"],", token->val);
+				syslog(LOG_ERR, "Insufficient %s to download the update.", (preflight.verdict == PREFLIGHT_INSUFFICIENT_STORAGE) ? "storage" : "memory");
+			}
+			preflight_print(&preflight);
+			printf(",\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
 			return;
-		} else if (strcmp(latest_md5_val, hash) != 0) {
-			/* md5 of new update file didn't match */
-			remove(UPGRADE_FILE);
+		}
+		/* a partial full image is closer to done than a delta would be */
+		if (!download_resumable(&job)) {
+			use_delta = update_delta(latest_yajl, &delta, delta_url);
+		}
+		if (!prefetch_start(&job, use_delta ? &delta : NULL, &preflight, YAJL_GET_STRING(latest_version_yajl), latest_sha256_val, &download)) {
+			/* unable to start the download worker, so nothing needs the room after all */
+			preflight_restart_services(&preflight);
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Downloaded update file did not have the correct md5.\"],", token->val);
-			printf("\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			free(holder);
-			pclose(command_output);
+			printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while starting the update download.\"],", token->val);
+			prefetch_print(&download);
+			printf(",\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"available\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
 			return;
 		} else {
-			/* new update file looks good */
-			printf("Status: 200 OK\n");
+			/* the worker verifies the file once it is down; progress is at ?update_status */
+			printf("Status: 202 Accepted\n");
 			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"ready\"}", token->val, YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
-			free(holder);
-			pclose(command_output);
+			printf("{\"xsrf\":\"%s\",", token->val);
+			preflight_print(&preflight);
+			printf(",");
+			prefetch_print(&download);
+			printf(",\"version\":\"%s\",\"size\":%lld,\"md5\":\"%s\",\"update\":\"downloading\"}", YAJL_GET_STRING(latest_version_yajl), YAJL_GET_INTEGER(latest_size_yajl), YAJL_GET_STRING(latest_md5_yajl));
 			return;
 		}
 	} else {
@@ -491,13 +514,119 @@ void post_update(yajl_val api_yajl, struct xsrft* token)
 		printf("Status: 200 OK\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"xsrf\":\"%s\",\"update\":\"none\"}", token->val);
-		free(holder);
 		return;
 	}
 }
 
+void post_update(yajl_val api_yajl, struct xsrft* token)
+{
+	struct single_flight flight;
+	size_t length = 0;
+
+	/* nothing is published, so whoever waited goes next and finds the work done */
+	switch (single_flight_begin(&flight, UPDATE_FLIGHT_KEY, UPDATE_FLIGHT_WAIT_MS, NULL, 0, &length)) {
+	case SINGLE_FLIGHT_BUSY:
+		printf("Status: 503 Service Unavailable\n");
+		printf("Retry-After: 5\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"xsrf\":\"%s\",\"errors\":[\"Another update request is still being handled.\"]}", token->val);
+		return;
+	case SINGLE_FLIGHT_LEADER:
+		update(api_yajl, token);
+		single_flight_end(&flight);
+		return;
+	default:
+		/* two of these at once could flash over a download in progress, so never go ahead unlocked */
+		syslog(LOG_ERR, "Unable to coordinate update requests");
+		printf("Status: 500 Internal Server Error\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"xsrf\":\"%s\",\"errors\":[\"Error while starting the update.\"]}", token->val);
+		return;
+	}
+}
+
+void get_update_status()
+{
+	struct prefetch_status download;
+
+	prefetch_read(&download);
+	printf("Status: 200 OK\n");
+	printf("Content-type: application/json\n\n");
+	printf("{");
+	prefetch_print(&download);
+	printf("}");
+}
+
+/* with an "offset" cursor only what was written since is sent, and the next cursor comes back in the headers */
+static void post_update_log_since(yajl_val api_yajl, long long offset, struct xsrft* token)
+{
+	const char* inode_path[] = {"inode", (const char*)0};
+	const char* wait_path[] = {"wait", (const char*)0};
+	yajl_val inode_yajl = yajl_tree_get(api_yajl, inode_path, yajl_t_number);
+	yajl_val wait_yajl = yajl_tree_get(api_yajl, wait_path, yajl_t_number);
+	static char chunk[UPDATE_LOG_CHUNK_LENGTH];
+	struct stat log_stat;
+	size_t length = 0;
+	size_t wanted;
+	int generation = 0;
+	int fd;
+
+	if ((fd = open_update_log(&log_stat)) == -1) {
+		printf("Status: 404 Not Found\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"xsrf\":\"%s\",\"errors\":[\"There is currently no update.log.\"]}", token->val);
+		return;
+	}
+	if ((inode_yajl != NULL && YAJL_IS_INTEGER(inode_yajl) && (ino_t)YAJL_GET_INTEGER(inode_yajl) != log_stat.st_ino)
+			|| offset < 0 || offset > log_stat.st_size) {
+		/* the log was replaced or truncated, so the cursor means nothing anymore */
+		offset = 0;
+	}
+	if (offset == log_stat.st_size && wait_yajl != NULL && YAJL_IS_INTEGER(wait_yajl) && YAJL_GET_INTEGER(wait_yajl) > 0) {
+		wait_for_update_log(offset, log_stat.st_ino,
+				(YAJL_GET_INTEGER(wait_yajl) > UPDATE_LOG_MAX_WAIT_SECONDS) ? UPDATE_LOG_MAX_WAIT_SECONDS : YAJL_GET_INTEGER(wait_yajl));
+		ino_t inode = log_stat.st_ino;
+		if ((fd = open_update_log(&log_stat)) == -1) {
+			printf("Status: 404 Not Found\n");
+			printf("Content-type: application/json\n\n");
+			printf("{\"xsrf\":\"%s\",\"errors\":[\"There is currently no update.log.\"]}", token->val);
+			return;
+		} else if (log_stat.st_ino != inode || offset > log_stat.st_size) {
+			offset = 0;
+		}
+	}
+	/* stays 0 where the filesystem keeps no generation; the inode alone then tells files apart */
+	ioctl(fd, FS_IOC_GETVERSION, &generation);
+	wanted = (log_stat.st_size - offset > UPDATE_LOG_CHUNK_LENGTH) ? UPDATE_LOG_CHUNK_LENGTH : (size_t)(log_stat.st_size - offset);
+	while (length < wanted) {
+		ssize_t rsize = pread(fd, chunk + length, wanted - length, offset + length);
+		if (rsize <= 0) {
+			/* the cursor only moves past what is actually sent, so the client just asks again */
+			if (rsize == -1) {
+				syslog(LOG_WARNING, "Unable to read the update log: %s", strerror(errno));
+			}
+			break;
+		}
+		length += rsize;
+	}
+
+	printf("Status: 200 OK\n");
+	printf("Content-Type: text/plain\n");
+	printf("X-Log-Offset: %lld\n", offset + (long long)length);
+	printf("X-Log-Size: %lld\n", (long long)log_stat.st_size);
+	printf("X-Log-Inode: %llu\n", (unsigned long long)log_stat.st_ino);
+	printf("X-Log-Generation: %u\n\n", (unsigned int)generation);
+	fwrite(chunk, 1, length, stdout);
+}
+
 void post_update_log(yajl_val api_yajl, struct xsrft* token)
 {
+	const char* offset_path[] = {"offset", (const char*)0};
+	yajl_val offset_yajl = yajl_tree_get(api_yajl, offset_path, yajl_t_number);
+	if (offset_yajl != NULL && YAJL_IS_INTEGER(offset_yajl)) {
+		post_update_log_since(api_yajl, YAJL_GET_INTEGER(offset_yajl), token);
+		return;
+	}
 	FILE* update_log = fopen(UPGRADE_LOG_FILE, "r");
 	if (update_log == NULL) {
 		printf("Status: 404 Not Found\n");
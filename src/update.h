@@ -28,5 +28,6 @@
 
 void post_update(yajl_val top, struct xsrft* token);
 void post_update_log(yajl_val top, struct xsrft* token);
+void get_update_status();
 
 #endif
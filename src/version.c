@@ -29,8 +29,6 @@
 #include <yajl/yajl_tree.h>
 #include "xsrf.h"
 
-#define FULL_VERSION VERSION "-r" RELEASE_NUMBER
-
 void post_version(yajl_val top, struct xsrft* token)
 {
 	printf("Status: 200 OK\n");
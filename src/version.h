@@ -26,6 +26,8 @@
 #include <yajl/yajl_tree.h>
 #include "xsrf.h"
 
+#define FULL_VERSION VERSION "-r" RELEASE_NUMBER
+
 void post_version(yajl_val top, struct xsrft* token);
 int version_compare(char* new_version);
 
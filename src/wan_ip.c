@@ -32,7 +32,10 @@
 #include <arpa/inet.h>
 #include <yajl/yajl_tree.h>
 
+#include "netboard.h"
 #include "string_helpers.h"
+#include "uci_cache.h"
+#include "uci_txn.h"
 #include "xsrf.h"
 
 #define PROTO_UCI_PATH "network.wan.proto"
@@ -42,91 +45,30 @@
 
 #define MAX_IP_LENGTH 32
 
-#define GET_WAN_COMMAND "ifconfig -a | awk '$1 == \"'`uci get network.wan.ifname`'\" {getline; if ($1 == \"inet\") {raddr = $2; split(raddr, saddr, \":\"); rmask = $4; split(rmask, smask, \":\"); print saddr[2] \" \" smask[2];}}'"
-#define GET_GATEWAY_COMMAND "netstat -nr | awk '$1 == \"0.0.0.0\" {print $2;}'"
-
 /*
  * returns true if successful
  * */
 bool get_wan_ip4(uint32_t* base, uint32_t* netmask)
 {
-	struct uci_context* ctx;
-	struct uci_ptr ptr;
-	int res = 0;
-	char tstr[BUFSIZ];
-	ctx = uci_alloc_context();
+	char proto[BUFSIZ];
+	char value[BUFSIZ];
 
-	strncpy(tstr, PROTO_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, tstr, true)) != UCI_OK
-			|| (ptr.flags & UCI_LOOKUP_COMPLETE) == 0) {
+	if (uci_cache_string(PROTO_UCI_PATH, proto, BUFSIZ) != UCI_CACHE_FOUND) {
 		*base = 0;
 		*netmask = 0;
 		return false;
-	} else if (strncmp(ptr.o->v.string, "dhcp", 5) == 0) {
-		FILE* output = popen(GET_WAN_COMMAND, "r");
-		char* delim = tstr;
-
-		if (output == NULL) {
-			*base = 0;
-			*netmask = 0;
-			pclose(output);
-			return false;
-		} else if (fgets(tstr, BUFSIZ, output) == NULL) {
-			*base = 0;
-			*netmask = 0;
-			pclose(output);
-			return false;
-		} else if ((delim = index(tstr, ' ')) == NULL) {
-			*base = 0;
-			*netmask = 0;
-			pclose(output);
-			return false;
-		} else {
-			size_t len = 0;
-			if ((len = strnlen(delim, BUFSIZ)) >= BUFSIZ) {
-				*base = 0;
-				*netmask = 0;
-				pclose(output);
-				return false;
-			} else if (delim[len-1] == '\n') {
-				delim[len-1] = '\0';
-			}
-			*delim = '\0';
-			if (inet_pton(AF_INET, tstr, base) == 0) {
-				*base = 0;
-				*netmask = 0;
-				pclose(output);
-				return false;
-			} else if (inet_pton(AF_INET, delim + 1, netmask) == 0) {
-				*base = 0;
-				*netmask = 0;
-				pclose(output);
-				return false;
-			}
-		}
-
-		pclose(output);
-		return true;
-	} else if (strncmp(ptr.o->v.string, "static", 7) == 0) {
-		strncpy(tstr, IPADDR_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, tstr, true)) != UCI_OK
-				|| (ptr.flags & UCI_LOOKUP_COMPLETE) == 0) {
-			*base = 0;
-			*netmask = 0;
-			return false;
-		} else if (inet_pton(AF_INET, ptr.o->v.string, base) == 0) {
+	} else if (strncmp(proto, "dhcp", 5) == 0) {
+		return netboard_wan_ipv4(base, netmask);
+	} else if (strncmp(proto, "static", 7) == 0) {
+		if (uci_cache_string(IPADDR_UCI_PATH, value, BUFSIZ) != UCI_CACHE_FOUND
+				|| inet_pton(AF_INET, value, base) == 0) {
 			*base = 0;
 			*netmask = 0;
 			return false;
 		}
 
-		strncpy(tstr, NETMASK_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, tstr, true)) != UCI_OK
-				|| (ptr.flags & UCI_LOOKUP_COMPLETE) == 0) {
-			*base = 0;
-			*netmask = 0;
-			return false;
-		} else if (inet_pton(AF_INET, ptr.o->v.string, netmask) == 0) {
+		if (uci_cache_string(NETMASK_UCI_PATH, value, BUFSIZ) != UCI_CACHE_FOUND
+				|| inet_pton(AF_INET, value, netmask) == 0) {
 			*base = 0;
 			*netmask = 0;
 			return false;
@@ -239,61 +181,25 @@ void post_wan_ip(yajl_val top, struct xsrft* token)
 		}
 	}
 
-	struct uci_context* ctx;
-	struct uci_ptr ptr;
-	int res = 0;
-	char uci_lookup_str[BUFSIZ];
-	ctx = uci_alloc_context();
-
 	if (valid && (dhcp_yajl != NULL
 				|| strnlen(ipaddr, BUFSIZ) != 0
 				|| strnlen(netmask, BUFSIZ) != 0
 				|| strnlen(gateway, BUFSIZ) != 0)) {
+		struct uci_txn txn;
+		uci_txn_begin(&txn, uci_alloc_context());
 		if (dhcp_yajl != NULL) {
-			snprintf(uci_lookup_str, BUFSIZ, PROTO_UCI_PATH "=%s", dhcp? "dhcp" : "static");
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-					|| (res = uci_set(ctx, &ptr)) != UCI_OK
-					|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save WAN DHCP status to UCI.\"]}", token->val);
-				return;
-			}
+			uci_txn_set(&txn, PROTO_UCI_PATH, dhcp? "dhcp" : "static");
 		}
 		if (strnlen(ipaddr, BUFSIZ) != 0) {
-			snprintf(uci_lookup_str, BUFSIZ, IPADDR_UCI_PATH "=%s", ipaddr);
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-					|| (res = uci_set(ctx, &ptr)) != UCI_OK
-					|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save WAN IP address to UCI.\"]}", token->val);
-				return;
-			}
+			uci_txn_set(&txn, IPADDR_UCI_PATH, ipaddr);
 		}
 		if (strnlen(netmask, BUFSIZ) != 0) {
-			snprintf(uci_lookup_str, BUFSIZ, NETMASK_UCI_PATH "=%s", netmask);
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-					|| (res = uci_set(ctx, &ptr)) != UCI_OK
-					|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save WAN netmask to UCI.\"]}", token->val);
-				return;
-			}
+			uci_txn_set(&txn, NETMASK_UCI_PATH, netmask);
 		}
 		if (strnlen(gateway, BUFSIZ) != 0) {
-			snprintf(uci_lookup_str, BUFSIZ, GATEWAY_UCI_PATH "=%s", gateway);
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-					|| (res = uci_set(ctx, &ptr)) != UCI_OK
-					|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save WAN gateway to UCI.\"]}", token->val);
-				return;
-			}
+			uci_txn_set(&txn, GATEWAY_UCI_PATH, gateway);
 		}
-		if ((res = uci_commit(ctx, &(ptr.p), false)) != UCI_OK) {
+		if (!uci_txn_commit(&txn)) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save WAN settings to UCI.\"]}", token->val);
@@ -307,11 +213,7 @@ void post_wan_ip(yajl_val top, struct xsrft* token)
 	netmask[0] = '\0';
 	gateway[0] = '\0';
 
-	strncpy(uci_lookup_str, PROTO_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK
-			&& (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-		strncpy(proto, ptr.o->v.string, BUFSIZ);
-	} else {
+	if (uci_cache_string(PROTO_UCI_PATH, proto, BUFSIZ) != UCI_CACHE_FOUND) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to retrieve WAN DHCP status from UCI.\"]}", token->val);
@@ -328,98 +230,38 @@ void post_wan_ip(yajl_val top, struct xsrft* token)
 		return;
 	}
 	if (dhcp) {
-		FILE* output = popen(GET_WAN_COMMAND, "r");
-		char tstr[BUFSIZ];
-		char* delim = tstr;
-		size_t len = 0;
+		uint32_t raw_ipaddr = 0;
+		uint32_t raw_netmask = 0;
+		uint32_t raw_gateway = 0;
 
-		if (output == NULL) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to get DHCP IPv4 adress and netmask for WAN.\"]}", token->val);
-			return;
-		} else if (fgets(tstr, BUFSIZ, output) == NULL) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to get DHCP IPv4 addres and netmask for WAN.\"]}", token->val);
-			pclose(output);
-			return;
-		} else if ((delim = index(tstr, ' ')) == NULL) {
+		if (!netboard_wan_ipv4(&raw_ipaddr, &raw_netmask)
+				|| inet_ntop(AF_INET, &raw_ipaddr, ipaddr, BUFSIZ) == NULL
+				|| inet_ntop(AF_INET, &raw_netmask, netmask, BUFSIZ) == NULL) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to get DHCP IPv4 address and netmask for WAN.\"]}", token->val);
-			pclose(output);
 			return;
-		} else {
-			if ((len = strnlen(delim, BUFSIZ)) >= BUFSIZ) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to get DHCP IPv4 address annd netmask for WAN.\"]}", token->val);
-				pclose(output);
-				return;
-			} else if (delim[len-1] == '\n') {
-				delim[len-1] = '\0';
-			}
-			*delim = '\0';
-			strncpy(ipaddr, tstr, BUFSIZ);
-			strncpy(netmask, delim + 1, BUFSIZ);
-		}
-
-		if (pclose(output) == -1 || (output = popen(GET_GATEWAY_COMMAND, "r")) == NULL) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to get DHCP IPv4 gateway adress for WAN.\"]}", token->val);
-			return;
-		} else if (fgets(gateway, BUFSIZ, output) == NULL) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to get DHCP IPv4 gateway addres for WAN.\"]}", token->val);
-			pclose(output);
-			return;
-		} else if ((len = strnlen(gateway, BUFSIZ)) >= BUFSIZ) {
+		} else if (!netboard_gateway4(&raw_gateway)
+				|| inet_ntop(AF_INET, &raw_gateway, gateway, BUFSIZ) == NULL) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to get DHCP IPv4 gateway address for WAN.\"]}", token->val);
-			pclose(output);
 			return;
-		} else if (gateway[len-1] == '\n') {
-			gateway[len-1] = '\0';
 		}
 	} else {
-		strncpy(uci_lookup_str, IPADDR_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK
-				&& (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-			strncpy(ipaddr, ptr.o->v.string, BUFSIZ);
-		} else if (res == UCI_ERR_NOTFOUND || (ptr.flags & UCI_LOOKUP_DONE)) {
-			/* astpnprintf(&terrors, &errlen, ",\"The WAN IP address has not yet been set in UCI.\""); */
-			/* TODO: get from ifconfig if dhcp */
-		} else {
+		if (uci_cache_string(IPADDR_UCI_PATH, ipaddr, BUFSIZ) == UCI_CACHE_ERROR) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to retrieve WAN IP address from UCI.\"]}", token->val);
 			return;
 		}
-		strncpy(uci_lookup_str, NETMASK_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK
-				&& (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-			strncpy(netmask, ptr.o->v.string, BUFSIZ);
-		} else if (res == UCI_ERR_NOTFOUND || (ptr.flags & UCI_LOOKUP_DONE)) {
-			/* astpnprintf(&terrors, &errlen, ",\"The WAN netmask has not yet been set in UCI.\""); */
-			/* TODO: get from ifconfig if dhcp */
-		} else {
+		if (uci_cache_string(NETMASK_UCI_PATH, netmask, BUFSIZ) == UCI_CACHE_ERROR) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to retrieve WAN netmask from UCI.\"]}", token->val);
 			return;
 		}
-		strncpy(uci_lookup_str, GATEWAY_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK
-				&& (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-			strncpy(gateway, ptr.o->v.string, BUFSIZ);
-		} else if (res == UCI_ERR_NOTFOUND || (ptr.flags & UCI_LOOKUP_DONE)) {
-			/* astpnprintf(&terrors, &errlen, ",\"The WAN gateway has not yet been set in UCI.\""); */
-			/* TODO: get from ifconfig if dhcp */
-		} else {
+		if (uci_cache_string(GATEWAY_UCI_PATH, gateway, BUFSIZ) == UCI_CACHE_ERROR) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to retrieve WAN gateway from UCI.\"]}", token->val);
@@ -30,7 +30,10 @@
 #include <syslog.h>
 #include <yajl/yajl_tree.h>
 
+#include "hostapd_ctrl.h"
 #include "string_helpers.h"
+#include "uci_cache.h"
+#include "uci_txn.h"
 #include "xsrf.h"
 
 #define MAX_SSID_LENGTH 32
@@ -50,6 +53,67 @@
 #define DUAL_ENCRYPTION_MODE_UCI_PATH "wireless.@wifi-iface[1].encryption"
 #define DUAL_WIFI_DISABLED_UCI_PATH "wireless.@wifi-device[1].disabled"
 
+#define IFACE_UCI_PATH_FORMAT "wireless.@wifi-iface[%d].%s"
+/* what netifd calls the first interface on each radio unless told otherwise */
+#define DEFAULT_IFNAME_FORMAT "wlan%d"
+
+/* pushes the SSID and PSK from UCI to the hostapd running iface */
+static bool update_hostapd(int iface)
+{
+	char path[BUFSIZ];
+	char ifname[BUFSIZ];
+	char ssid[BUFSIZ];
+	char psk[BUFSIZ];
+	char command[BUFSIZ];
+	struct hostapd_ctrl ctrl;
+	bool ok;
+
+	snprintf(path, BUFSIZ, IFACE_UCI_PATH_FORMAT, iface, "ifname");
+	if (uci_cache_string(path, ifname, BUFSIZ) != UCI_CACHE_FOUND) {
+		snprintf(ifname, BUFSIZ, DEFAULT_IFNAME_FORMAT, iface);
+	}
+	snprintf(path, BUFSIZ, IFACE_UCI_PATH_FORMAT, iface, "ssid");
+	if (uci_cache_string(path, ssid, BUFSIZ) != UCI_CACHE_FOUND) {
+		return false;
+	}
+	snprintf(path, BUFSIZ, IFACE_UCI_PATH_FORMAT, iface, "key");
+	if (uci_cache_string(path, psk, BUFSIZ) != UCI_CACHE_FOUND) {
+		return false;
+	}
+
+	snprintf(path, BUFSIZ, "%s/%s", HOSTAPD_CTRL_DIR, ifname);
+	if (!hostapd_ctrl_open(&ctrl, path)) {
+		syslog(LOG_WARNING, "Unable to reach hostapd for %s", ifname);
+		return false;
+	}
+	snprintf(command, BUFSIZ, "SET ssid %s", ssid);
+	ok = hostapd_ctrl_command(&ctrl, command, HOSTAPD_CTRL_TIMEOUT_MS);
+	if (ok) {
+		snprintf(command, BUFSIZ, "SET wpa_passphrase %s", psk);
+		ok = hostapd_ctrl_command(&ctrl, command, HOSTAPD_CTRL_TIMEOUT_MS);
+	}
+	/* restarts the BSS with the new settings but leaves the radio alone */
+	if (ok) {
+		ok = hostapd_ctrl_command(&ctrl, "RELOAD", HOSTAPD_CTRL_TIMEOUT_MS);
+	}
+	hostapd_ctrl_close(&ctrl);
+
+	if (!ok) {
+		syslog(LOG_WARNING, "hostapd refused the new settings for %s", ifname);
+	}
+	return ok;
+}
+
+bool wifi_apply_live()
+{
+	int dual_radios = 0;
+
+	if (uci_cache_int(DUAL_RADIO_UCI_PATH, &dual_radios) == UCI_CACHE_ERROR) {
+		return false;
+	}
+	return update_hostapd(0) && (dual_radios != 1 || update_hostapd(1));
+}
+
 void post_wifi(yajl_val top, struct xsrft* token)
 {
 	char errors[BUFSIZ];
@@ -109,152 +173,56 @@ void post_wifi(yajl_val top, struct xsrft* token)
 		}
 	}
 
-	struct uci_context* ctx;
-	struct uci_ptr ptr;
-	int res = 0;
-	char uci_lookup_str[BUFSIZ];
-	ctx = uci_alloc_context();
-
 	if (valid && (strnlen(ssid, BUFSIZ) != 0 || strnlen(psk, BUFSIZ) != 0)) {
-		bool psk_changed = false;
-		bool dual_radios = false;
+		struct uci_txn txn;
+		int dual_radios = 0;
 
-		strcpy(uci_lookup_str, DUAL_RADIO_UCI_PATH);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK) {
+		if (uci_cache_int(DUAL_RADIO_UCI_PATH, &dual_radios) == UCI_CACHE_ERROR) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to retrieve the number of wifi cards effected.\"]}", token->val);
 			return;
-		} else if ((ptr.flags & UCI_LOOKUP_COMPLETE) != 0 && strncmp(ptr.o->v.string, "1", 2) == 0) {
-			dual_radios = true;
-		} else {
-			dual_radios = false;
 		}
 
+		uci_txn_begin(&txn, uci_alloc_context());
 		if (strnlen(ssid, BUFSIZ) != 0) {
-			snprintf(uci_lookup_str, BUFSIZ, SSID_UCI_PATH "=%s", ssid);
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-					|| (res = uci_set(ctx, &ptr)) != UCI_OK
-					|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save ssid to UCI.\"]}", token->val);
-				return;
-			}
-			if (dual_radios) {
-				snprintf(uci_lookup_str, BUFSIZ, DUAL_SSID_UCI_PATH "=%s", ssid);
-				if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-						|| (res = uci_set(ctx, &ptr)) != UCI_OK
-						|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-					printf("Status: 500 Internal Server Error\n");
-					printf("Content-type: application/json\n\n");
-					printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save ssid of second wifi radio to UCI.\"]}", token->val);
-					return;
-				}
+			uci_txn_set(&txn, SSID_UCI_PATH, ssid);
+			if (dual_radios == 1) {
+				uci_txn_set(&txn, DUAL_SSID_UCI_PATH, ssid);
 			}
 		}
 		if (strnlen(psk, BUFSIZ) != 0) {
-			snprintf(uci_lookup_str, BUFSIZ, PSK_UCI_PATH "=%s", psk);
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-					|| (res = uci_set(ctx, &ptr)) != UCI_OK
-					|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save psk to UCI.\"]}", token->val);
-				return;
-			}
-			if (dual_radios) {
-				snprintf(uci_lookup_str, BUFSIZ, DUAL_PSK_UCI_PATH "=%s", psk);
-				if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-						|| (res = uci_set(ctx, &ptr)) != UCI_OK
-						|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-					printf("Status: 500 Internal Server Error\n");
-					printf("Content-type: application/json\n\n");
-					printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save psk of second wifi radio to UCI.\"]}", token->val);
-					return;
-				}
+			uci_txn_set(&txn, PSK_UCI_PATH, psk);
+			if (dual_radios == 1) {
+				uci_txn_set(&txn, DUAL_PSK_UCI_PATH, psk);
 			}
-			psk_changed = true;
+			/* marks WiFi as having been setup */
+			uci_txn_set(&txn, WIFI_CHANGED_UCI_PATH, "1");
 		}
-		strcpy(uci_lookup_str, ENCRYPTION_MODE_UCI_PATH "=" WPA2_ONLY_ENCRYPTION_MODE);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save WPA2 mode to UCI.\"]}", token->val);
-			return;
+		uci_txn_set(&txn, ENCRYPTION_MODE_UCI_PATH, WPA2_ONLY_ENCRYPTION_MODE);
+		uci_txn_delete(&txn, WIFI_DISABLED_UCI_PATH);
+		if (dual_radios == 1) {
+			uci_txn_set(&txn, DUAL_ENCRYPTION_MODE_UCI_PATH, WPA2_ONLY_ENCRYPTION_MODE);
+			uci_txn_delete(&txn, DUAL_WIFI_DISABLED_UCI_PATH);
 		}
-		strcpy(uci_lookup_str, WIFI_DISABLED_UCI_PATH);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| ((ptr.flags & UCI_LOOKUP_COMPLETE) != 0
-					&& ((res = uci_delete(ctx, &ptr)) != UCI_OK
-						|| (res = uci_save(ctx, ptr.p)) != UCI_OK))) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save wifi autostart to UCI.\"]}", token->val);
-			return;
-		}
-		if (dual_radios) {
-			strcpy(uci_lookup_str, DUAL_ENCRYPTION_MODE_UCI_PATH "=" WPA2_ONLY_ENCRYPTION_MODE);
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-					|| (res = uci_set(ctx, &ptr)) != UCI_OK
-					|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save WPA2 mode of second wifi radio to UCI.\"]}", token->val);
-				return;
-			}
-			strcpy(uci_lookup_str, DUAL_WIFI_DISABLED_UCI_PATH);
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-					|| ((ptr.flags & UCI_LOOKUP_COMPLETE) != 0
-						&& ((res = uci_delete(ctx, &ptr)) != UCI_OK
-							|| (res = uci_save(ctx, ptr.p)) != UCI_OK))) {
-				printf("Status: 500 Internal Server Error\n");
-				printf("Content-type: application/json\n\n");
-				printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save wifi autostart of second wifi radio to UCI.\"]}", token->val);
-				return;
-			}
-		}
-		if ((res = uci_commit(ctx, &(ptr.p), false)) != UCI_OK) {
+		if (!uci_txn_commit(&txn)) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to save WiFi to UCI.\"]}", token->val);
 			return;
 		}
-		strcpy(uci_lookup_str, WIFI_CHANGED_UCI_PATH "=1");
-		if (psk_changed
-				&& ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-						|| (res = uci_set(ctx, &ptr)) != UCI_OK
-						|| (res = uci_save(ctx, ptr.p)) != UCI_OK
-						|| (res = uci_commit(ctx, &(ptr.p), false)) != UCI_OK)) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to set WiFi as having been setup.\"]}", token->val);
-			return;
-		}
 	}
 
 	ssid[0] = '\0';
 	psk[0] = '\0';
 
-	strncpy(uci_lookup_str, SSID_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK && (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-		strncpy(ssid, ptr.o->v.string, BUFSIZ);
-	} else if (res == UCI_ERR_NOTFOUND || (ptr.flags & UCI_LOOKUP_DONE)) {
-		/*astpnprintf(&terrors, &errlen, ",\"The ssid has not yet been set in UCI.\"");*/
-	} else {
+	if (uci_cache_string(SSID_UCI_PATH, ssid, BUFSIZ) == UCI_CACHE_ERROR) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to retrieve ssid from UCI.\"]}", token->val);
 		return;
 	}
-	strncpy(uci_lookup_str, PSK_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK && (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-		strncpy(psk, ptr.o->v.string, BUFSIZ);
-	} else if (res == UCI_ERR_NOTFOUND || (ptr.flags & UCI_LOOKUP_DONE)) {
-		/*astpnprintf(&terrors, &errlen, ",\"The psk has not yet been set in UCI.\"");*/
-	} else {
+	if (uci_cache_string(PSK_UCI_PATH, psk, BUFSIZ) == UCI_CACHE_ERROR) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"xsrf\":\"%s\",\"errors\":[\"Unable to retrieve psk from UCI.\"]}", token->val);
@@ -23,9 +23,17 @@
 #ifndef OPENWRT_SUI_WIFI_H
 #define OPENWRT_SUI_WIFI_H
 
+#include <stdbool.h>
 #include <yajl/yajl_tree.h>
 #include "xsrf.h"
 
 void post_wifi(yajl_val top, struct xsrft* token);
 
+/*
+ * Hands the SSID and PSK in UCI to the running hostapd on each radio in use,
+ * so that clients only have to reconnect. Returns false if any radio did not
+ * take them, in which case the whole of wifi has to be reloaded.
+ */
+bool wifi_apply_live();
+
 #endif
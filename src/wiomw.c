@@ -23,15 +23,18 @@
 #include <config.h>
 #include "wiomw.h"
 
+#include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
 #include <uci.h>
 #include <stdlib.h>
 #include <syslog.h>
-#include <curl/curl.h>
 #include <yajl/yajl_tree.h>
 
+#include "http_client.h"
 #include "string_helpers.h"
+#include "uci_cache.h"
+#include "uci_txn.h"
 #include "xsrf.h"
 #include "xsrfc.h"
 
@@ -43,97 +46,75 @@
 #define WIFI_CHANGED_UCI_PATH "sui.changed.wifi"
 
 #define WIOMW_AUTH_URL "https://www.whoisonmywifi.net//api/v100/rest/jss_msauth_router"
-#define CA_FILE "/etc/ssl/certs/f081611a.0"
+#define WIOMW_AUTH_BREAKER "auth"
 
 #define MAX_AUTHTOKEN_LENGTH 1024
 #define MAX_PUBTOKEN_LENGTH 1024
 #define MAX_PRIVTOKEN_LENGTH 4096
 #define MAX_AGENTKEY_LENGTH 1024
+#define MAX_AUTH_RESPONSE_LENGTH 65536
+#define AUTH_TIMEOUT_MS 20000
 
-struct data_holder {
-	size_t offset;
-	char data[];
-};
-
-static size_t get_data_cb(void* buffer, size_t size, size_t nmemb, void* raw_holder)
-{
-	size_t count = 0;
-	struct data_holder* holder;
-
-	if (raw_holder == NULL) {
-		return 0;
-	}
-
-	if (*(void**)raw_holder == NULL) {
-		*(void**)raw_holder = malloc(sizeof(struct data_holder) + (size * nmemb) + 1);
-		(*(struct data_holder**)raw_holder)->offset = 0;
-	} else {
-		*(void**)raw_holder = realloc(*(void**)raw_holder, sizeof(struct data_holder) + (*(struct data_holder**)raw_holder)->offset + (size * nmemb) + 1);
-	}
-	holder = *(struct data_holder**)raw_holder;
-	if (holder == NULL) {
-		return 0;
-	}
-
-	for (count = 0; count < nmemb; count++) {
-		memcpy(holder->data + holder->offset, (char*)buffer + (count * size), size);
-		holder->offset += size;
-	}
-	holder->data[holder->offset] = '\0';
-
-	return count * size;
-}
-
-static struct data_holder*  go_auth(char* const data)
+static char* go_auth(char* const data)
 {
-	CURL* curl_handle = curl_easy_init();
-	struct data_holder* holder = NULL;
-	char error_buffer[BUFSIZ];
-	long http_code = 0;
-
-	curl_easy_setopt(curl_handle, CURLOPT_URL, WIOMW_AUTH_URL);
-	curl_easy_setopt(curl_handle, CURLOPT_CAINFO, CA_FILE);
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, &get_data_cb);
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &holder);
-	curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, data);
-	curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDSIZE, strlen(data));
-	curl_easy_setopt(curl_handle, CURLOPT_ERRORBUFFER, error_buffer);
-
-	if (curl_easy_perform(curl_handle) == 0 && curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &http_code) == 0) {
-		if (holder == NULL) {
-			curl_easy_cleanup(curl_handle);
-			free(holder);
+	struct http_buffer body;
+	struct http_request request;
+	struct http_response response;
+
+	http_buffer_init(&body, MAX_AUTH_RESPONSE_LENGTH);
+	memset(&request, 0x00, sizeof(struct http_request));
+	request.url = WIOMW_AUTH_URL;
+	request.post_data = data;
+	request.post_length = strlen(data);
+	request.timeout_ms = AUTH_TIMEOUT_MS;
+	request.body = &body;
+	request.breaker = WIOMW_AUTH_BREAKER;
+
+	if (http_perform(&request, &response)) {
+		if (body.data == NULL) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"errors\":[\"The router is out of memory and needs to be restarted immediately.\"]}");
 			syslog(LOG_EMERG, "Unable to allocate memory");
 			return NULL;
-		} else if (http_code == 403) {
-			curl_easy_cleanup(curl_handle);
-			free(holder);
-			printf("Status: 403 Forbidden\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"errors\":[\"The provided authtoken was invalid.\"]}");
-			return NULL;
-		} else if (http_code >= 400) {
-			curl_easy_cleanup(curl_handle);
-			free(holder);
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"errors\":[\"Error while contacting authentication server.\"]}");
-			syslog(LOG_WARNING, "Unable to post to authentication API, got HTTP code: %lu", http_code);
-			return NULL;
 		} else {
-			curl_easy_cleanup(curl_handle);
-			return holder;
+			return body.data;
 		}
+	} else if (response.overflowed) {
+		http_buffer_free(&body);
+		printf("Status: 500 Internal Server Error\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"errors\":[\"Received unexpected response from login server.\"]}");
+		syslog(LOG_WARNING, "Authentication response exceeded %d bytes", MAX_AUTH_RESPONSE_LENGTH);
+		return NULL;
+	} else if (response.http_code == 403) {
+		http_buffer_free(&body);
+		printf("Status: 403 Forbidden\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"errors\":[\"The provided authtoken was invalid.\"]}");
+		return NULL;
+	} else if (response.http_code >= 400) {
+		http_buffer_free(&body);
+		printf("Status: 500 Internal Server Error\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"errors\":[\"Error while contacting authentication server.\"]}");
+		syslog(LOG_WARNING, "Unable to post to authentication API, got HTTP code: %lu", response.http_code);
+		return NULL;
+	} else if (response.retry_after_ms != 0) {
+		long retry_after = (response.retry_after_ms + 999) / 1000;
+		http_buffer_free(&body);
+		printf("Status: 503 Service Unavailable\n");
+		printf("Retry-After: %ld\n", retry_after);
+		printf("Content-type: application/json\n\n");
+		printf("{\"errors\":[\"The authentication server is not answering. Please try again in %ld seconds.\"],\"retry_after\":%ld}", retry_after, retry_after);
+		return NULL;
 	} else {
 		/* curl failure (probably network failure) */
+		http_buffer_free(&body);
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"errors\":[\"Error while contacting authentication server.\"]}");
-		syslog(LOG_ERR, "Unable to connect to authentication server: %s", error_buffer);
-		curl_easy_cleanup(curl_handle);
+		syslog(LOG_ERR, "Unable to connect to authentication server: %s", response.error);
 		return NULL;
 	}
 }
@@ -171,11 +152,7 @@ void post_wiomw(yajl_val top)
 		return;
 	}
 
-	struct uci_context* ctx;
-	struct uci_ptr ptr;
-	int res = 0;
-	char uci_lookup_str[BUFSIZ];
-	ctx = uci_alloc_context();
+	enum uci_cache_status status;
 	char agentkey[BUFSIZ];
 	char pubtoken[BUFSIZ];
 	char privtoken[BUFSIZ];
@@ -187,39 +164,23 @@ void post_wiomw(yajl_val top)
 	pin[0] = '\0';
 	token.val[0] = (char)0x00; /* yes i know it's the same... but this searching for xsrf stuff faster */
 
-	strncpy(uci_lookup_str, AGENTKEY_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK
-			&& (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-		strncpy(agentkey, ptr.o->v.string, BUFSIZ);
-	} else if (res == UCI_ERR_NOTFOUND || (ptr.flags & UCI_LOOKUP_DONE)) {
+	if ((status = uci_cache_string(AGENTKEY_UCI_PATH, agentkey, BUFSIZ)) == UCI_CACHE_MISSING) {
 		/* astpnprintf(&terrors, &errlen, ",\"The agentkey has not yet been set in UCI.\""); */
 		strncpy(agentkey, AGENTKEY_PLACEHOLDER, BUFSIZ);
-	} else {
+	} else if (status == UCI_CACHE_ERROR) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"errors\":[\"Unable to retrieve agentkey from UCI.\"]}");
 		return;
 	}
-	strncpy(uci_lookup_str, PUBTOKEN_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK
-			&& (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-		strncpy(pubtoken, ptr.o->v.string, BUFSIZ);
-	} else if (res == UCI_ERR_NOTFOUND || (ptr.flags & UCI_LOOKUP_DONE)) {
-		/* astpnprintf(&terrors, &errlen, ",\"The pubtoken has not yet been set in UCI.\""); */
-	} else {
+	if (uci_cache_string(PUBTOKEN_UCI_PATH, pubtoken, BUFSIZ) == UCI_CACHE_ERROR) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"errors\":[\"Unable to retrieve public token from UCI.\"]}");
 		return;
 	}
 	if (pubtoken[0] != '\0') {
-		strncpy(uci_lookup_str, PRIVTOKEN_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK
-				&& (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-			strncpy(privtoken, ptr.o->v.string, BUFSIZ);
-		} else if (res == UCI_ERR_NOTFOUND || (ptr.flags & UCI_LOOKUP_DONE)) {
-			/* astpnprintf(&terrors, &errlen, ",\"The privtoken has not yet been set in UCI.\""); */
-		} else {
+		if (uci_cache_string(PRIVTOKEN_UCI_PATH, privtoken, BUFSIZ) == UCI_CACHE_ERROR) {
 			printf("Status: 500 Internal Server Error\n");
 			printf("Content-type: application/json\n\n");
 			printf("{\"errors\":[\"Unable to retrieve private token from UCI.\"]}");
@@ -228,14 +189,10 @@ void post_wiomw(yajl_val top)
 
 		if (privtoken[0] == '\0') {
 			int xsrfc_status = -1;
-			strncpy(uci_lookup_str, PIN_UCI_PATH, BUFSIZ);
-			if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) == UCI_OK
-					&& (ptr.flags & UCI_LOOKUP_COMPLETE)) {
-				strncpy(pin, ptr.o->v.string, BUFSIZ);
-			} else if (res == UCI_ERR_NOTFOUND || (ptr.flags & UCI_LOOKUP_DONE)) {
+			if ((status = uci_cache_string(PIN_UCI_PATH, pin, BUFSIZ)) == UCI_CACHE_MISSING) {
 				/* Pin has not been set in UCI??? No good! */
 				syslog(LOG_CRIT, "Pin has not been set in UCI at " PIN_UCI_PATH);
-			} else {
+			} else if (status == UCI_CACHE_ERROR) {
 				printf("Status: 500 Internal Server Error\n");
 				printf("Content-type: application/json\n\n");
 				printf("{\"errors\":[\"Unable to retrieve pin from UCI.\"]}");
@@ -261,16 +218,17 @@ void post_wiomw(yajl_val top)
 		snprintf(data, BUFSIZ, "{\"authtoken\":\"%s\",\"pubtoken\":\"%s\",\"privtoken\":\"%s\",\"agentkey\":\"%s\"}", authtoken, pubtoken, privtoken, agentkey);
 	}
 
-	struct data_holder* holder = NULL;
+	char* auth_response = NULL;
 	
-	if ((holder = go_auth(data)) == NULL) {
+	if ((auth_response = go_auth(data)) == NULL) {
 		return;
 	}
 
 	char error_buffer[BUFSIZ];
-	yajl_val response_yajl = NULL;
+	yajl_val response_yajl = yajl_tree_parse(auth_response, error_buffer, BUFSIZ);
 
-	if ((response_yajl = yajl_tree_parse(holder->data, error_buffer, BUFSIZ)) == NULL || !YAJL_IS_OBJECT(response_yajl)) {
+	free(auth_response);
+	if (response_yajl == NULL || !YAJL_IS_OBJECT(response_yajl)) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"errors\":[\"Received unexpected response from login server.\"");
@@ -293,99 +251,38 @@ void post_wiomw(yajl_val top)
 	char* privtoken_val = YAJL_GET_STRING(privtoken_yajl);
 	char* agentkey_val = YAJL_GET_STRING(agentkey_yajl);
 	char* authtoken_val = YAJL_GET_STRING(authtoken_yajl);
-	bool changed = false;
+	struct uci_txn txn;
 
+	uci_txn_begin(&txn, uci_alloc_context());
 	if (dump_creds_yajl != NULL && YAJL_IS_TRUE(dump_creds_yajl)) {
-		strncpy(uci_lookup_str, PUBTOKEN_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| ((ptr.flags & UCI_LOOKUP_COMPLETE) != UCI_OK
-					&& ((res = uci_delete(ctx, &ptr)) != UCI_OK
-						|| (res = uci_save(ctx, ptr.p)) != UCI_OK))) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"errors\":[\"Unable to remove old pubtoken from UCI.\"]}");
-			return;
-		}
-		strncpy(uci_lookup_str, PRIVTOKEN_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| ((ptr.flags & UCI_LOOKUP_COMPLETE) != UCI_OK
-					&& ((res = uci_delete(ctx, &ptr)) != UCI_OK
-						|| (res = uci_save(ctx, ptr.p)) != UCI_OK))) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"errors\":[\"Unable to remove old privtoken from UCI.\"]}");
-			return;
-		}
-		strncpy(uci_lookup_str, AGENTKEY_UCI_PATH, BUFSIZ);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| ((ptr.flags & UCI_LOOKUP_COMPLETE) != UCI_OK
-					&& ((res = uci_delete(ctx, &ptr)) != UCI_OK
-						|| (res = uci_save(ctx, ptr.p)) != UCI_OK))) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"errors\":[\"Unable to remove old agentkey from UCI.\"]}");
-			return;
-		}
-		changed = true;
+		uci_txn_delete(&txn, PUBTOKEN_UCI_PATH);
+		uci_txn_delete(&txn, PRIVTOKEN_UCI_PATH);
+		uci_txn_delete(&txn, AGENTKEY_UCI_PATH);
 	}
-
 	if (pubtoken_val != NULL && stpncpy(pubtoken, pubtoken_val, BUFSIZ) != pubtoken + BUFSIZ && pubtoken[0] != '\0') {
-		snprintf(uci_lookup_str, BUFSIZ, PUBTOKEN_UCI_PATH "=%s", pubtoken);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"errors\":[\"Unable to save pubtoken to UCI.\"]}");
-			return;
-		} else {
-			changed = true;
-		}
+		uci_txn_set(&txn, PUBTOKEN_UCI_PATH, pubtoken);
 	}
 	if (privtoken_val != NULL && stpncpy(privtoken, privtoken_val, BUFSIZ) != privtoken + BUFSIZ && privtoken[0] != '\0') {
-		snprintf(uci_lookup_str, BUFSIZ, PRIVTOKEN_UCI_PATH "=%s", privtoken);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"errors\":[\"Unable to save privtoken to UCI.\"]}");
-			return;
-		} else {
-			changed = true;
-		}
+		uci_txn_set(&txn, PRIVTOKEN_UCI_PATH, privtoken);
 	}
 	if (agentkey_val != NULL && stpncpy(agentkey, agentkey_val, BUFSIZ) != agentkey + BUFSIZ && agentkey[0] != '\0') {
-		snprintf(uci_lookup_str, BUFSIZ, AGENTKEY_UCI_PATH "=%s", agentkey);
-		if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK
-				|| (res = uci_set(ctx, &ptr)) != UCI_OK
-				|| (res = uci_save(ctx, ptr.p)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"errors\":[\"Unable to save agentkey to UCI.\"]}");
-			return;
-		} else {
-			changed = true;
-		}
+		uci_txn_set(&txn, AGENTKEY_UCI_PATH, agentkey);
 	}
-	if (changed) {
-		if ((res = uci_commit(ctx, &(ptr.p), false)) != UCI_OK) {
-			printf("Status: 500 Internal Server Error\n");
-			printf("Content-type: application/json\n\n");
-			printf("{\"errors\":[\"Unable to save wiomw credentials to UCI.\"]}");
-			return;
-		}
+	if (!uci_txn_commit(&txn)) {
+		printf("Status: 500 Internal Server Error\n");
+		printf("Content-type: application/json\n\n");
+		printf("{\"errors\":[\"Unable to save wiomw credentials to UCI.\"]}");
+		return;
 	}
 
 	bool has_been_setup = false;
 
-	strncpy(uci_lookup_str, WIFI_CHANGED_UCI_PATH, BUFSIZ);
-	if ((res = uci_lookup_ptr(ctx, &ptr, uci_lookup_str, true)) != UCI_OK) {
+	if ((status = uci_cache_exists(WIFI_CHANGED_UCI_PATH)) == UCI_CACHE_ERROR) {
 		printf("Status: 500 Internal Server Error\n");
 		printf("Content-type: application/json\n\n");
 		printf("{\"errors\":[\"Unable to determine setup status.\"]}");
 		return;
-	} else if (ptr.flags & UCI_LOOKUP_COMPLETE) {
+	} else if (status == UCI_CACHE_FOUND) {
 		has_been_setup = true;
 	}
 
@@ -0,0 +1,201 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include <dejagnu.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../../src/breaker.h"
+
+static void endpoint_for(char endpoint[BREAKER_NAME_LENGTH], const char* name)
+{
+	snprintf(endpoint, BREAKER_NAME_LENGTH, "%s-%d", name, (int)getpid());
+}
+
+void test_opens()
+{
+	char endpoint[BREAKER_NAME_LENGTH];
+	long retry_after_ms = 0;
+	int i;
+
+	note("running test_opens");
+	endpoint_for(endpoint, "opens");
+	for (i = 0; i < BREAKER_THRESHOLD - 1; i++) {
+		breaker_record(endpoint, false);
+	}
+	if (!breaker_allow(endpoint, &retry_after_ms)) {
+		fail("opened before %d failures", BREAKER_THRESHOLD);
+	} else {
+		pass("stayed closed below the threshold");
+	}
+	breaker_record(endpoint, false);
+	if (breaker_allow(endpoint, &retry_after_ms)) {
+		fail("still closed after %d failures", BREAKER_THRESHOLD);
+	} else if (retry_after_ms <= 0 || retry_after_ms > BREAKER_COOLDOWN_MS) {
+		fail("retry hint of %ld ms is outside the cooldown", retry_after_ms);
+	} else {
+		pass("failed fast with a retry hint");
+	}
+}
+
+void test_shared()
+{
+	char endpoint[BREAKER_NAME_LENGTH];
+	long retry_after_ms = 0;
+	int status = 0;
+	int i;
+
+	note("running test_shared");
+	endpoint_for(endpoint, "shared");
+	if (fork() == 0) {
+		/* another CGI process finds the server down */
+		for (i = 0; i < BREAKER_THRESHOLD; i++) {
+			breaker_record(endpoint, false);
+		}
+		_exit(0);
+	}
+	wait(&status);
+	if (breaker_allow(endpoint, &retry_after_ms)) {
+		fail("failures in another process were not seen");
+	} else {
+		pass("failures in another process opened the breaker");
+	}
+	/* e.g. a call that was already under way when it opened */
+	breaker_record(endpoint, true);
+	if (!breaker_allow(endpoint, &retry_after_ms) || retry_after_ms != 0) {
+		fail("an answer did not close the breaker");
+	} else {
+		pass("an answer closed the breaker");
+	}
+}
+
+static void trip(const char* endpoint)
+{
+	int i;
+
+	for (i = 0; i < BREAKER_THRESHOLD; i++) {
+		breaker_record(endpoint, false);
+	}
+}
+
+static void sleep_ms(long ms)
+{
+	usleep(ms * 1000);
+}
+
+void test_one_probe()
+{
+	char endpoint[BREAKER_NAME_LENGTH];
+	long retry_after_ms = 0;
+
+	note("running test_one_probe");
+	endpoint_for(endpoint, "probe");
+	trip(endpoint);
+	sleep_ms(BREAKER_COOLDOWN_MS + 50);
+	if (!breaker_allow(endpoint, &retry_after_ms)) {
+		fail("nobody was let through once the cooldown was over");
+	} else if (breaker_allow(endpoint, &retry_after_ms)) {
+		fail("a second caller was let through while the probe was out");
+	} else if (retry_after_ms != BREAKER_PROBE_RETRY_MS) {
+		fail("caller behind the probe was told %ld ms", retry_after_ms);
+	} else {
+		pass("exactly one probe was let through");
+	}
+	breaker_record(endpoint, true);
+	if (!breaker_allow(endpoint, &retry_after_ms) || !breaker_allow(endpoint, &retry_after_ms)) {
+		fail("a successful probe did not close the breaker");
+	} else {
+		pass("a successful probe closed the breaker");
+	}
+}
+
+void test_probe_fails()
+{
+	char endpoint[BREAKER_NAME_LENGTH];
+	long retry_after_ms = 0;
+
+	note("running test_probe_fails");
+	endpoint_for(endpoint, "doubles");
+	trip(endpoint);
+	sleep_ms(BREAKER_COOLDOWN_MS + 50);
+	if (!breaker_allow(endpoint, &retry_after_ms)) {
+		fail("no probe was let through");
+		return;
+	}
+	breaker_record(endpoint, false);
+	if (breaker_allow(endpoint, &retry_after_ms)) {
+		fail("a failed probe did not open the breaker again");
+	} else if (retry_after_ms <= BREAKER_COOLDOWN_MS || retry_after_ms > 2 * BREAKER_COOLDOWN_MS) {
+		fail("retry hint of %ld ms after a failed probe is not the doubled cooldown", retry_after_ms);
+	} else {
+		pass("a failed probe doubled the cooldown");
+	}
+	sleep_ms(BREAKER_COOLDOWN_MS + 50);
+	if (breaker_allow(endpoint, &retry_after_ms)) {
+		fail("a probe was let through after only the first cooldown");
+	} else {
+		pass("still failing fast after the first cooldown");
+	}
+}
+
+void test_stale_probe()
+{
+	char endpoint[BREAKER_NAME_LENGTH];
+	long retry_after_ms = 0;
+
+	note("running test_stale_probe");
+	endpoint_for(endpoint, "stale");
+	trip(endpoint);
+	sleep_ms(BREAKER_COOLDOWN_MS + 50);
+	/* this probe dies without ever reporting back */
+	if (!breaker_allow(endpoint, &retry_after_ms)) {
+		fail("no probe was let through");
+		return;
+	}
+	sleep_ms(BREAKER_PROBE_LEASE_MS + 50);
+	if (!breaker_allow(endpoint, &retry_after_ms)) {
+		fail("the lease of a dead probe was never taken over");
+	} else if (breaker_allow(endpoint, &retry_after_ms)) {
+		fail("more than one caller took over the lease");
+	} else {
+		pass("one caller took over the lease of a dead probe");
+	}
+}
+
+int main()
+{
+	/* a fresh table, so that runs of the test never fill it */
+	unlink(BREAKER_PATH);
+
+	test_opens();
+	test_shared();
+	test_one_probe();
+	test_probe_fails();
+	test_stale_probe();
+
+	unlink(BREAKER_PATH);
+	return 0;
+}
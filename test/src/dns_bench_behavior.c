@@ -0,0 +1,307 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include <dejagnu.h>
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "../../src/dns_bench.h"
+
+#define TEST_TIMEOUT_MS 1000
+#define TEST_SLOW_DELAY_MS 20
+#define TEST_MAX_RESPONDERS 8
+
+enum responder_mode {
+	RESPOND_FAST,
+	RESPOND_SLOW,
+	RESPOND_EVERY_OTHER,
+	RESPOND_REFUSED
+};
+
+static pid_t responder_pids[TEST_MAX_RESPONDERS];
+static size_t responder_count = 0;
+
+static long monotonic_ms()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+/* echoes each query back as an answer, the way mode says to */
+static void respond(int sock, enum responder_mode mode)
+{
+	unsigned char packet[512];
+	struct sockaddr_storage peer;
+	socklen_t peer_len;
+	struct timespec delay;
+	unsigned long seen = 0;
+	ssize_t len;
+
+	delay.tv_sec = 0;
+	delay.tv_nsec = TEST_SLOW_DELAY_MS * 1000000L;
+	while (1) {
+		peer_len = sizeof(struct sockaddr_storage);
+		if ((len = recvfrom(sock, packet, 512, 0, (struct sockaddr*)&peer, &peer_len)) < 12) {
+			continue;
+		}
+		if (mode == RESPOND_EVERY_OTHER && (seen++ % 2) == 1) {
+			continue;
+		} else if (mode == RESPOND_SLOW) {
+			nanosleep(&delay, NULL);
+		}
+		packet[2] |= 0x80;
+		packet[3] = (mode == RESPOND_REFUSED) ? 5 : 0;
+		sendto(sock, packet, len, 0, (struct sockaddr*)&peer, peer_len);
+	}
+}
+
+static int bind_loopback(uint16_t* port)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(struct sockaddr_in);
+	int sock;
+
+	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+		return -1;
+	}
+	memset(&addr, 0x00, sizeof(struct sockaddr_in));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(struct sockaddr_in)) == -1
+			|| getsockname(sock, (struct sockaddr*)&addr, &addr_len) == -1) {
+		close(sock);
+		return -1;
+	}
+	*port = ntohs(addr.sin_port);
+	return sock;
+}
+
+static int start_responder(enum responder_mode mode, const char* group, struct dns_bench_candidate* candidate)
+{
+	pid_t pid;
+	int sock;
+
+	memset(candidate, 0x00, sizeof(struct dns_bench_candidate));
+	strcpy(candidate->address, "127.0.0.1");
+	candidate->group = group;
+	if (responder_count >= TEST_MAX_RESPONDERS || (sock = bind_loopback(&(candidate->port))) == -1) {
+		return -1;
+	}
+	if ((pid = fork()) == 0) {
+		respond(sock, mode);
+		_exit(0);
+	}
+	close(sock);
+	responder_pids[responder_count++] = pid;
+	return pid;
+}
+
+/* a port that nothing listens on, so queries come back port unreachable */
+static int closed_port(const char* group, struct dns_bench_candidate* candidate)
+{
+	int sock;
+
+	memset(candidate, 0x00, sizeof(struct dns_bench_candidate));
+	strcpy(candidate->address, "127.0.0.1");
+	candidate->group = group;
+	if ((sock = bind_loopback(&(candidate->port))) == -1) {
+		return -1;
+	}
+	close(sock);
+	return 0;
+}
+
+static void make_options(struct dns_bench_options* options)
+{
+	memset(options, 0x00, sizeof(struct dns_bench_options));
+	options->rounds = 2;
+	options->timeout_ms = TEST_TIMEOUT_MS;
+}
+
+void test_ranking()
+{
+	struct dns_bench_candidate candidates[2];
+	struct dns_bench_result results[2];
+	struct dns_bench_options options;
+	const char* fastest;
+
+	note("running test_ranking");
+	if (start_responder(RESPOND_SLOW, "slow", &candidates[0]) <= 0
+			|| start_responder(RESPOND_FAST, "fast", &candidates[1]) <= 0) {
+		fail("unable to start stand-in resolvers");
+		return;
+	}
+	make_options(&options);
+	if (!dns_bench_run(candidates, 2, &options, results)) {
+		fail("benchmark did not run");
+		return;
+	}
+	if (results[0].answered != results[0].sent || results[1].answered != results[1].sent || results[1].sent != 12) {
+		fail("expected 12 answers from each, saw %u of %u and %u of %u",
+				results[0].answered, results[0].sent, results[1].answered, results[1].sent);
+	} else {
+		pass("every query was answered");
+	}
+	if (results[0].median_ms < TEST_SLOW_DELAY_MS || results[1].median_ms >= results[0].median_ms
+			|| results[0].p95_ms < results[0].median_ms) {
+		fail("latencies out of order: slow %.2f/%.2f, fast %.2f/%.2f",
+				results[0].median_ms, results[0].p95_ms, results[1].median_ms, results[1].p95_ms);
+	} else {
+		pass("slow resolver measured slower");
+	}
+	if ((fastest = dns_bench_fastest(candidates, results, 2, NULL)) == NULL || strcmp(fastest, "fast") != 0) {
+		fail("expected fast to win, got %s", (fastest == NULL) ? "nothing" : fastest);
+	} else {
+		pass("fastest resolver picked");
+	}
+	if ((fastest = dns_bench_fastest(candidates, results, 2, "fast")) == NULL || strcmp(fastest, "slow") != 0) {
+		fail("skipped group was still picked");
+	} else {
+		pass("skipped group left out");
+	}
+}
+
+void test_failures()
+{
+	struct dns_bench_candidate candidates[3];
+	struct dns_bench_result results[3];
+	struct dns_bench_options options;
+	const char* fastest;
+	long started;
+
+	note("running test_failures");
+	if (start_responder(RESPOND_EVERY_OTHER, "lossy", &candidates[0]) <= 0
+			|| start_responder(RESPOND_REFUSED, "refused", &candidates[1]) <= 0
+			|| closed_port("unreachable", &candidates[2]) != 0) {
+		fail("unable to start stand-in resolvers");
+		return;
+	}
+	make_options(&options);
+	started = monotonic_ms();
+	if (!dns_bench_run(candidates, 3, &options, results)) {
+		fail("benchmark did not run");
+		return;
+	}
+	if (results[0].failure_rate < 0.49 || results[0].failure_rate > 0.51) {
+		fail("lossy resolver failure rate %.2f", results[0].failure_rate);
+	} else {
+		pass("lossy resolver lost half");
+	}
+	if (results[1].failure_rate != 1.0 || results[2].failure_rate != 1.0) {
+		fail("refused %.2f and unreachable %.2f should both fail everything",
+				results[1].failure_rate, results[2].failure_rate);
+	} else {
+		pass("refused and unreachable resolvers failed");
+	}
+	if (monotonic_ms() - started < TEST_TIMEOUT_MS - 100) {
+		fail("the lossy resolver should have kept the benchmark waiting");
+	} else {
+		pass("unanswered queries waited out the timeout");
+	}
+	if ((fastest = dns_bench_fastest(candidates, results, 3, NULL)) != NULL) {
+		fail("an unreliable resolver was picked: %s", fastest);
+	} else {
+		pass("no unreliable resolver picked");
+	}
+}
+
+void test_unreachable_returns_early()
+{
+	struct dns_bench_candidate candidate;
+	struct dns_bench_result result;
+	struct dns_bench_options options;
+	long started;
+
+	note("running test_unreachable_returns_early");
+	if (closed_port("unreachable", &candidate) != 0) {
+		fail("unable to find a closed port");
+		return;
+	}
+	make_options(&options);
+	started = monotonic_ms();
+	if (!dns_bench_run(&candidate, 1, &options, &result)) {
+		fail("benchmark did not run");
+	} else if (monotonic_ms() - started >= TEST_TIMEOUT_MS) {
+		fail("port unreachable should end the wait");
+	} else {
+		pass("port unreachable ended the wait");
+	}
+}
+
+void test_names()
+{
+	const char* good[] = {"example.com", "a-b.example"};
+	const char* bad[] = {"example..com"};
+	struct dns_bench_candidate candidate;
+	struct dns_bench_result result;
+	struct dns_bench_options options;
+
+	note("running test_names");
+	if (start_responder(RESPOND_FAST, "fast", &candidate) <= 0) {
+		fail("unable to start stand-in resolver");
+		return;
+	}
+	make_options(&options);
+	options.names = good;
+	options.name_count = 2;
+	options.rounds = 3;
+	if (!dns_bench_run(&candidate, 1, &options, &result) || result.sent != 6 || result.answered != 6) {
+		fail("custom names were not all answered");
+	} else {
+		pass("custom names answered");
+	}
+	options.names = bad;
+	options.name_count = 1;
+	if (dns_bench_run(&candidate, 1, &options, &result)) {
+		fail("an empty label was accepted");
+	} else {
+		pass("an empty label was rejected");
+	}
+}
+
+int main()
+{
+	size_t i;
+
+	test_ranking();
+	test_failures();
+	test_unreachable_returns_early();
+	test_names();
+
+	for (i = 0; i < responder_count; i++) {
+		kill(responder_pids[i], SIGTERM);
+		waitpid(responder_pids[i], NULL, 0);
+	}
+	return 0;
+}
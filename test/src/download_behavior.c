@@ -0,0 +1,351 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include <dejagnu.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../../src/digest.h"
+#include "../../src/download.h"
+
+#define TEST_FILE "/tmp/download_behavior.bin"
+#define TEST_BODY_LENGTH 200000
+#define TEST_MAX_REQUESTS 64
+
+/* shared with the forked stand-in server */
+struct server_state {
+	size_t drop_after;
+	int honor_range;
+	/* junk sent after the body, with no length announced */
+	size_t extra;
+	int requests;
+	long long range_starts[TEST_MAX_REQUESTS];
+};
+
+static unsigned char body[TEST_BODY_LENGTH];
+static struct server_state* server;
+static pid_t server_pid;
+static char url[BUFSIZ];
+static char expected_md5[DIGEST_MD5_HEX_LENGTH];
+
+/*
+ * A minimal HTTP/1.0 server that honors "Range: bytes=N-" and hangs up
+ * after drop_after bytes of each response, like a flaky DSL line.
+ */
+static void serve(int sock)
+{
+	while (1) {
+		char request[BUFSIZ];
+		char header[BUFSIZ];
+		size_t len = 0;
+		long long start = 0;
+		size_t remaining;
+		size_t sent = 0;
+		const char* range;
+		int tsock;
+
+		if ((tsock = accept(sock, NULL, NULL)) == -1) {
+			continue;
+		}
+		request[0] = '\0';
+		while (len < BUFSIZ - 1 && strstr(request, "\r\n\r\n") == NULL) {
+			ssize_t got = recv(tsock, request + len, BUFSIZ - 1 - len, 0);
+			if (got <= 0) {
+				break;
+			}
+			len += got;
+			request[len] = '\0';
+		}
+
+		if (server->honor_range && (range = strstr(request, "Range: bytes=")) != NULL) {
+			start = atoll(range + strlen("Range: bytes="));
+		}
+		if (server->requests < TEST_MAX_REQUESTS) {
+			server->range_starts[server->requests] = start;
+		}
+		server->requests++;
+
+		if (start > 0) {
+			snprintf(header, BUFSIZ, "HTTP/1.0 206 Partial Content\r\nContent-Length: %lld\r\nContent-Range: bytes %lld-%d/%d\r\n\r\n",
+					TEST_BODY_LENGTH - start, start, TEST_BODY_LENGTH - 1, TEST_BODY_LENGTH);
+		} else if (server->extra != 0) {
+			snprintf(header, BUFSIZ, "HTTP/1.0 200 OK\r\n\r\n");
+		} else {
+			snprintf(header, BUFSIZ, "HTTP/1.0 200 OK\r\nContent-Length: %d\r\n\r\n", TEST_BODY_LENGTH);
+		}
+		send(tsock, header, strlen(header), MSG_NOSIGNAL);
+
+		remaining = TEST_BODY_LENGTH - start;
+		if (server->drop_after != 0 && remaining > server->drop_after) {
+			remaining = server->drop_after;
+		}
+		while (sent < remaining) {
+			ssize_t put = send(tsock, body + start + sent, remaining - sent, MSG_NOSIGNAL);
+			if (put <= 0) {
+				break;
+			}
+			sent += put;
+		}
+		for (sent = 0; sent < server->extra; sent += sizeof(body)) {
+			send(tsock, body, (server->extra - sent < sizeof(body)) ? server->extra - sent : sizeof(body), MSG_NOSIGNAL);
+		}
+		close(tsock);
+	}
+}
+
+static int start_server()
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(struct sockaddr_in);
+	int sock;
+
+	server = mmap(NULL, sizeof(struct server_state), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (server == MAP_FAILED || (sock = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+		return -1;
+	}
+	memset(server, 0x00, sizeof(struct server_state));
+	memset(&addr, 0x00, sizeof(struct sockaddr_in));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(struct sockaddr_in)) == -1
+			|| listen(sock, 5) == -1
+			|| getsockname(sock, (struct sockaddr*)&addr, &addr_len) == -1) {
+		return -1;
+	}
+	snprintf(url, BUFSIZ, "http://127.0.0.1:%d/firmware.bin", ntohs(addr.sin_port));
+
+	if ((server_pid = fork()) == 0) {
+		serve(sock);
+		_exit(0);
+	}
+	close(sock);
+	return server_pid;
+}
+
+static void reset(size_t drop_after, int honor_range)
+{
+	server->drop_after = drop_after;
+	server->honor_range = honor_range;
+	server->extra = 0;
+	server->requests = 0;
+	unlink(TEST_FILE);
+	download_discard(TEST_FILE);
+}
+
+static void make_job(struct download_job* job, unsigned int attempts)
+{
+	memset(job, 0x00, sizeof(struct download_job));
+	job->url = url;
+	job->path = TEST_FILE;
+	job->size = TEST_BODY_LENGTH;
+	job->md5 = expected_md5;
+	job->attempts = attempts;
+	job->timeout_ms = 5000;
+	job->retry_delay_ms = 0;
+}
+
+static void check_complete(const char* name, const char* error, const struct digest_result* result)
+{
+	struct digest_result on_disk;
+
+	if (error != NULL) {
+		fail("%s: download failed: %s", name, error);
+	} else if (!digest_matches(result, expected_md5, NULL)) {
+		fail("%s: streamed digest %s does not match %s", name, result->md5, expected_md5);
+	} else if (!digest_file(TEST_FILE, &on_disk) || !digest_matches(&on_disk, expected_md5, NULL)) {
+		fail("%s: file on disk does not match", name);
+	} else {
+		pass("%s: complete and verified", name);
+	}
+}
+
+void test_resume_within_one_call()
+{
+	struct download_job job;
+	struct digest_result result;
+	const char* error;
+	int i;
+	int resumed = 1;
+
+	note("running test_resume_within_one_call");
+	reset(50000, 1);
+	make_job(&job, 10);
+
+	error = download_fetch(&job, &result);
+	check_complete("dropped connections", error, &result);
+
+	if (server->requests != 4) {
+		fail("expected 4 requests, saw %d", server->requests);
+	} else {
+		for (i = 0; i < server->requests; i++) {
+			if (server->range_starts[i] != i * 50000) {
+				resumed = 0;
+				fail("request %d started at %lld", i, server->range_starts[i]);
+			}
+		}
+		if (resumed) {
+			pass("every request picked up where the last one dropped");
+		}
+	}
+}
+
+void test_resume_across_calls()
+{
+	struct download_job job;
+	struct digest_result result;
+	const char* error;
+
+	note("running test_resume_across_calls");
+	reset(120000, 1);
+	make_job(&job, 1);
+
+	if ((error = download_fetch(&job, &result)) == NULL) {
+		fail("a single dropped attempt should not complete");
+	} else if (!download_resumable(&job)) {
+		fail("partial download was not recorded");
+	} else {
+		pass("partial download recorded: %s", error);
+	}
+
+	server->requests = 0;
+	error = download_fetch(&job, &result);
+	check_complete("second call", error, &result);
+	if (server->requests != 1 || server->range_starts[0] != 120000) {
+		fail("second call should resume at 120000, started at %lld", server->range_starts[0]);
+	} else {
+		pass("second call fetched only the missing bytes");
+	}
+	if (download_resumable(&job)) {
+		fail("progress was not discarded after completion");
+	} else {
+		pass("progress discarded after completion");
+	}
+}
+
+void test_server_without_ranges()
+{
+	struct download_job job;
+	struct digest_result result;
+	const char* error;
+
+	note("running test_server_without_ranges");
+	reset(120000, 1);
+	make_job(&job, 1);
+	download_fetch(&job, &result);
+
+	/* the server now answers every request with the whole body */
+	server->drop_after = 0;
+	server->honor_range = 0;
+	make_job(&job, 3);
+	error = download_fetch(&job, &result);
+	check_complete("ignored range", error, &result);
+}
+
+void test_corrupt_partial()
+{
+	struct download_job job;
+	struct digest_result result;
+	const char* error;
+	FILE* file;
+
+	note("running test_corrupt_partial");
+	reset(120000, 1);
+	make_job(&job, 1);
+	download_fetch(&job, &result);
+
+	/* a file shorter than the recorded prefix cannot be trusted */
+	if ((file = fopen(TEST_FILE, "w")) != NULL) {
+		fclose(file);
+	}
+	server->drop_after = 0;
+	server->requests = 0;
+	make_job(&job, 1);
+	error = download_fetch(&job, &result);
+	check_complete("truncated partial", error, &result);
+	if (server->requests != 1 || server->range_starts[0] != 0) {
+		fail("truncated partial should restart from zero");
+	} else {
+		pass("truncated partial restarted from zero");
+	}
+}
+
+void test_oversized_body()
+{
+	struct download_job job;
+	struct digest_result result;
+	struct stat file_stat;
+
+	note("running test_oversized_body");
+	reset(0, 1);
+	server->extra = 4 * TEST_BODY_LENGTH;
+	make_job(&job, 1);
+	download_fetch(&job, &result);
+	if (stat(TEST_FILE, &file_stat) != 0 || file_stat.st_size > TEST_BODY_LENGTH) {
+		fail("a body past the expected size was written out");
+	} else {
+		pass("nothing past the expected size was written out");
+	}
+}
+
+int main()
+{
+	struct digest digest;
+	struct digest_result expected;
+	size_t i;
+
+	for (i = 0; i < TEST_BODY_LENGTH; i++) {
+		body[i] = (unsigned char)((i * 7919) ^ (i >> 8));
+	}
+	digest_init(&digest);
+	digest_update(&digest, body, TEST_BODY_LENGTH);
+	digest_finish(&digest, &expected);
+	memcpy(expected_md5, expected.md5, DIGEST_MD5_HEX_LENGTH);
+
+	if (start_server() <= 0) {
+		fail("unable to start stand-in HTTP server");
+		return 1;
+	}
+
+	test_resume_within_one_call();
+	test_resume_across_calls();
+	test_server_without_ranges();
+	test_corrupt_partial();
+	test_oversized_body();
+
+	kill(server_pid, SIGTERM);
+	waitpid(server_pid, NULL, 0);
+	unlink(TEST_FILE);
+	download_discard(TEST_FILE);
+
+	return 0;
+}
@@ -0,0 +1,197 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include <dejagnu.h>
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "../../src/hostapd_ctrl.h"
+
+#define TEST_SOCKET_FORMAT "/tmp/sui-test-hostapd-%d"
+#define TEST_TIMEOUT_MS 200
+
+static char server_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static pid_t server_pid = -1;
+
+static long monotonic_ms()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+/* answers the way hostapd does: OK for SET and RELOAD of known fields, FAIL otherwise */
+static void serve(int sock)
+{
+	char command[256];
+	struct sockaddr_un peer;
+	socklen_t peer_len;
+	ssize_t len;
+
+	while (1) {
+		peer_len = sizeof(struct sockaddr_un);
+		if ((len = recvfrom(sock, command, sizeof(command) - 1, 0, (struct sockaddr*)&peer, &peer_len)) <= 0) {
+			continue;
+		}
+		command[len] = '\0';
+		if (strcmp(command, "PING") == 0) {
+			sendto(sock, "PONG\n", 5, 0, (struct sockaddr*)&peer, peer_len);
+		} else if (strcmp(command, "SLOW") == 0) {
+			/* never answered */
+		} else if (strcmp(command, "RELOAD") == 0) {
+			sendto(sock, "<3>AP-DISABLED", 14, 0, (struct sockaddr*)&peer, peer_len);
+			sendto(sock, "OK\n", 3, 0, (struct sockaddr*)&peer, peer_len);
+		} else if (strncmp(command, "SET ssid ", 9) == 0 || strncmp(command, "SET wpa_passphrase ", 19) == 0) {
+			sendto(sock, "OK\n", 3, 0, (struct sockaddr*)&peer, peer_len);
+		} else {
+			sendto(sock, "FAIL\n", 5, 0, (struct sockaddr*)&peer, peer_len);
+		}
+	}
+}
+
+static bool start_server()
+{
+	struct sockaddr_un addr;
+	int sock;
+
+	snprintf(server_path, sizeof(server_path), TEST_SOCKET_FORMAT, (int)getpid());
+	unlink(server_path);
+	memset(&addr, 0x00, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, server_path);
+	if ((sock = socket(AF_UNIX, SOCK_DGRAM, 0)) == -1) {
+		return false;
+	} else if (bind(sock, (struct sockaddr*)&addr, sizeof(struct sockaddr_un)) == -1) {
+		close(sock);
+		return false;
+	}
+	if ((server_pid = fork()) == 0) {
+		serve(sock);
+		_exit(0);
+	}
+	close(sock);
+	return server_pid > 0;
+}
+
+void test_missing_socket()
+{
+	struct hostapd_ctrl ctrl;
+
+	note("running test_missing_socket");
+	if (hostapd_ctrl_open(&ctrl, "/tmp/sui-test-hostapd-missing")) {
+		fail("connected to a socket that is not there");
+		hostapd_ctrl_close(&ctrl);
+	} else {
+		pass("missing socket refused");
+	}
+}
+
+void test_commands()
+{
+	struct hostapd_ctrl ctrl;
+	char reply[HOSTAPD_CTRL_REPLY_LENGTH];
+	char local_path[sizeof(ctrl.local.sun_path)];
+	struct stat st;
+
+	note("running test_commands");
+	if (!hostapd_ctrl_open(&ctrl, server_path)) {
+		fail("unable to connect to the stand-in hostapd");
+		return;
+	}
+	if (!hostapd_ctrl_request(&ctrl, "PING", reply, HOSTAPD_CTRL_REPLY_LENGTH, TEST_TIMEOUT_MS) || strcmp(reply, "PONG\n") != 0) {
+		fail("expected PONG, got \"%s\"", reply);
+	} else {
+		pass("reply read");
+	}
+	if (!hostapd_ctrl_command(&ctrl, "SET ssid My Network", TEST_TIMEOUT_MS)
+			|| !hostapd_ctrl_command(&ctrl, "SET wpa_passphrase a secret", TEST_TIMEOUT_MS)) {
+		fail("SET was not taken");
+	} else {
+		pass("SET taken");
+	}
+	if (hostapd_ctrl_command(&ctrl, "SET no_such_field 1", TEST_TIMEOUT_MS)) {
+		fail("FAIL read as OK");
+	} else {
+		pass("FAIL reported");
+	}
+	if (!hostapd_ctrl_command(&ctrl, "RELOAD", TEST_TIMEOUT_MS)) {
+		fail("an event got in the way of the reply");
+	} else {
+		pass("event skipped");
+	}
+	strcpy(local_path, ctrl.local.sun_path);
+	hostapd_ctrl_close(&ctrl);
+	if (stat(local_path, &st) == 0) {
+		fail("%s left behind", local_path);
+	} else {
+		pass("local socket removed");
+	}
+}
+
+void test_timeout()
+{
+	struct hostapd_ctrl ctrl;
+	long started;
+
+	note("running test_timeout");
+	if (!hostapd_ctrl_open(&ctrl, server_path)) {
+		fail("unable to connect to the stand-in hostapd");
+		return;
+	}
+	started = monotonic_ms();
+	if (hostapd_ctrl_command(&ctrl, "SLOW", TEST_TIMEOUT_MS)) {
+		fail("no reply read as OK");
+	} else if (monotonic_ms() - started < TEST_TIMEOUT_MS - 20 || monotonic_ms() - started > TEST_TIMEOUT_MS * 5) {
+		fail("gave up after %ld ms", monotonic_ms() - started);
+	} else {
+		pass("gave up after the timeout");
+	}
+	hostapd_ctrl_close(&ctrl);
+}
+
+int main()
+{
+	if (!start_server()) {
+		fail("unable to start the stand-in hostapd");
+		return 0;
+	}
+
+	test_missing_socket();
+	test_commands();
+	test_timeout();
+
+	kill(server_pid, SIGTERM);
+	waitpid(server_pid, NULL, 0);
+	unlink(server_path);
+	return 0;
+}
@@ -0,0 +1,203 @@
+/**
+ * Copyright 2014, 2015 Who Is On My WiFi.
+ *
+ * This file is part of Who Is On My WiFi Linux.
+ *
+ * Who Is On My WiFi Linux is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * Who Is On My WiFi Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Who Is On My WiFi Linux.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * More information about Who Is On My WiFi Linux can be found at
+ * <http://www.whoisonmywifi.com/>.
+ */
+
+#include <config.h>
+#include <dejagnu.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../../src/single_flight.h"
+
+#define TEST_CALLERS 6
+#define TEST_WORK_MS 300
+
+/* shared between the callers, which are separate processes as CGI requests are */
+struct tally {
+	volatile int leaders;
+	volatile int followers;
+	volatile int mismatched;
+};
+
+static void key_for(char key[64], const char* name)
+{
+	snprintf(key, 64, "test-%s-%d", name, (int)getpid());
+}
+
+static void remove_key(const char* key)
+{
+	char path[SINGLE_FLIGHT_PATH_LENGTH];
+
+	snprintf(path, SINGLE_FLIGHT_PATH_LENGTH, SINGLE_FLIGHT_DIR "/sui-flight-%s.lock", key);
+	unlink(path);
+	snprintf(path, SINGLE_FLIGHT_PATH_LENGTH, SINGLE_FLIGHT_DIR "/sui-flight-%s.slot", key);
+	unlink(path);
+}
+
+static void caller(const char* key, struct tally* tally, bool publish)
+{
+	struct single_flight flight;
+	struct timespec work;
+	char result[64];
+	size_t length = 0;
+
+	work.tv_sec = 0;
+	work.tv_nsec = TEST_WORK_MS * 1000000L;
+	switch (single_flight_begin(&flight, key, 5000, result, sizeof(result), &length)) {
+	case SINGLE_FLIGHT_LEADER:
+		__sync_fetch_and_add(&(tally->leaders), 1);
+		nanosleep(&work, NULL);
+		if (publish) {
+			single_flight_publish(&flight, "done", 5);
+		} else {
+			single_flight_end(&flight);
+		}
+		break;
+	case SINGLE_FLIGHT_FOLLOWER:
+		__sync_fetch_and_add(&(tally->followers), 1);
+		if (length != 5 || strcmp(result, "done") != 0) {
+			__sync_fetch_and_add(&(tally->mismatched), 1);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void run_callers(const char* key, struct tally* tally, bool publish)
+{
+	pid_t pids[TEST_CALLERS];
+	size_t i;
+
+	memset((void*)tally, 0x00, sizeof(struct tally));
+	for (i = 0; i < TEST_CALLERS; i++) {
+		if ((pids[i] = fork()) == 0) {
+			caller(key, tally, publish);
+			_exit(0);
+		}
+	}
+	for (i = 0; i < TEST_CALLERS; i++) {
+		if (pids[i] > 0) {
+			waitpid(pids[i], NULL, 0);
+		}
+	}
+}
+
+void test_coalesced(struct tally* tally)
+{
+	char key[64];
+
+	note("running test_coalesced");
+	key_for(key, "coalesced");
+	run_callers(key, tally, true);
+	if (tally->leaders != 1 || tally->followers != TEST_CALLERS - 1) {
+		fail("expected 1 leader and %d followers, saw %d and %d", TEST_CALLERS - 1, tally->leaders, tally->followers);
+	} else {
+		pass("one caller did the work for all");
+	}
+	if (tally->mismatched != 0) {
+		fail("%d followers got the wrong result", tally->mismatched);
+	} else {
+		pass("followers got the published result");
+	}
+	remove_key(key);
+}
+
+void test_unpublished(struct tally* tally)
+{
+	char key[64];
+
+	note("running test_unpublished");
+	key_for(key, "unpublished");
+	run_callers(key, tally, false);
+	if (tally->leaders != TEST_CALLERS || tally->followers != 0) {
+		fail("expected every caller to lead in turn, saw %d leaders", tally->leaders);
+	} else {
+		pass("callers took turns when nothing was published");
+	}
+	remove_key(key);
+}
+
+void test_busy_and_stale()
+{
+	struct single_flight leader;
+	struct single_flight other;
+	char key[64];
+	char result[64];
+	size_t length = 0;
+
+	note("running test_busy_and_stale");
+	key_for(key, "busy");
+	if (single_flight_begin(&leader, key, 0, result, sizeof(result), &length) != SINGLE_FLIGHT_LEADER) {
+		fail("first caller did not lead");
+		return;
+	}
+	if (fork() == 0) {
+		/* the lock belongs to the open file, so a child has to ask for itself */
+		_exit(single_flight_begin(&other, key, 100, result, sizeof(result), &length) == SINGLE_FLIGHT_BUSY ? 0 : 1);
+	} else {
+		int status = 0;
+		wait(&status);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fail("a caller that ran out of time was not told so");
+		} else {
+			pass("busy reported after the wait");
+		}
+	}
+	single_flight_publish(&leader, "old", 4);
+	/* published before this caller arrived, so it is not reused */
+	if (single_flight_begin(&other, key, 100, result, sizeof(result), &length) != SINGLE_FLIGHT_LEADER) {
+		fail("an old result was reused");
+	} else {
+		pass("an old result was not reused");
+		single_flight_end(&other);
+	}
+	if (single_flight_begin(&other, "../escape", 100, result, sizeof(result), &length) != SINGLE_FLIGHT_ERROR) {
+		fail("a key with a path in it was accepted");
+	} else {
+		pass("a key with a path in it was refused");
+	}
+	remove_key(key);
+}
+
+int main()
+{
+	struct tally* tally;
+
+	if ((tally = mmap(NULL, sizeof(struct tally), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		fail("unable to share the tally");
+		return 0;
+	}
+
+	test_coalesced(tally);
+	test_unpublished(tally);
+	test_busy_and_stale();
+
+	munmap(tally, sizeof(struct tally));
+	return 0;
+}